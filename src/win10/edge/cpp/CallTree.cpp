@@ -0,0 +1,443 @@
+#include "stdafx.h"
+#include <algorithm>
+
+using namespace std;
+
+//
+// Functions the engine only reports by name get this in place of a script id.
+//
+
+static const UINT32 ByNameScriptId = 0xffffffff;
+
+static ULONGLONG MakeKey(UINT32 scriptId, UINT32 functionId)
+{
+	return ((ULONGLONG) scriptId << 32) | functionId;
+}
+
+CallTree::CallTree(const NameTable *nameTable) :
+	m_nameTable(nameTable),
+	m_sampled(false)
+{
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+	m_ticksPerMillisecond = frequency.QuadPart / 1000.0;
+
+	//
+	// Node 0 is the root. It stands for the host, and so has no function of its own.
+	//
+
+	Node root = {};
+	m_nodes.push_back(root);
+}
+
+void CallTree::SetName(UINT32 scriptId, UINT32 functionId, const wchar_t *name, const wchar_t *hint)
+{
+	//
+	// Anonymous functions have no name, but the engine usually has a hint, such as the
+	// property they were assigned to.
+	//
+
+	if (name != nullptr && name[0] != L'\0')
+	{
+		m_names[MakeKey(scriptId, functionId)] = name;
+	}
+	else if (hint != nullptr && hint[0] != L'\0')
+	{
+		m_names[MakeKey(scriptId, functionId)] = hint;
+	}
+}
+
+ULONGLONG CallTree::GetNameKey(UINT32 nameId)
+{
+	return MakeKey(ByNameScriptId, nameId);
+}
+
+wstring CallTree::GetName(ULONGLONG function)
+{
+	if ((UINT32) (function >> 32) == ByNameScriptId)
+	{
+		return m_nameTable->GetName((UINT32) function);
+	}
+
+	unordered_map<ULONGLONG, wstring>::iterator found = m_names.find(function);
+
+	if (found != m_names.end())
+	{
+		return found->second;
+	}
+
+	wchar_t name[64];
+	swprintf_s(name, L"(anonymous 0x%x:0x%x)", (UINT32) (function >> 32), (UINT32) function);
+	return name;
+}
+
+ULONGLONG CallTree::GetFunctionKey(UINT32 scriptId, UINT32 functionId)
+{
+	return MakeKey(scriptId, functionId);
+}
+
+//
+// Links each node to its children, in the order they were created. Node 0 has no siblings,
+// so 0 also marks the end of a list.
+//
+
+void CallTree::LinkChildren(vector<size_t> &firstChild, vector<size_t> &nextSibling)
+{
+	firstChild.assign(m_nodes.size(), 0);
+	nextSibling.assign(m_nodes.size(), 0);
+
+	for (size_t index = m_nodes.size() - 1; index > 0; index--)
+	{
+		nextSibling[index] = firstChild[m_nodes[index].parent];
+		firstChild[m_nodes[index].parent] = index;
+	}
+}
+
+size_t CallTree::GetChild(size_t parent, ULONGLONG function)
+{
+	ChildKey key = { parent, function };
+	unordered_map<ChildKey, size_t, ChildKeyHash>::iterator found = m_children.find(key);
+
+	if (found != m_children.end())
+	{
+		return found->second;
+	}
+
+	Node child = {};
+	child.function = function;
+	child.parent = parent;
+
+	size_t node = m_nodes.size();
+	m_nodes.push_back(child);
+	m_children[key] = node;
+	return node;
+}
+
+void CallTree::Enter(ULONGLONG function, LONGLONG timestamp)
+{
+	size_t node = GetChild(m_stack.empty() ? 0 : m_stack.back().node, function);
+
+	m_nodes[node].calls++;
+
+	Frame frame = { node, timestamp };
+	m_stack.push_back(frame);
+}
+
+void CallTree::Exit(ULONGLONG function, LONGLONG timestamp)
+{
+	//
+	// Find the call this exit belongs to. Normally it's the innermost one, but if exits
+	// went missing (say, the engine unwound through them), the calls above it are closed
+	// too. An exit with no matching call is ignored.
+	//
+
+	size_t depth = m_stack.size();
+
+	while (depth > 0 && m_nodes[m_stack[depth - 1].node].function != function)
+	{
+		depth--;
+	}
+
+	if (depth == 0)
+	{
+		return;
+	}
+
+	while (m_stack.size() >= depth)
+	{
+		Frame frame = m_stack.back();
+		LONGLONG elapsed = timestamp - frame.start;
+
+		m_stack.pop_back();
+		m_nodes[frame.node].inclusiveTicks += elapsed;
+		m_nodes[m_nodes[frame.node].parent].calleeTicks += elapsed;
+	}
+}
+
+void CallTree::Enter(UINT32 scriptId, UINT32 functionId, LONGLONG timestamp)
+{
+	Enter(MakeKey(scriptId, functionId), timestamp);
+}
+
+void CallTree::Exit(UINT32 scriptId, UINT32 functionId, LONGLONG timestamp)
+{
+	Exit(MakeKey(scriptId, functionId), timestamp);
+}
+
+void CallTree::EnterByName(UINT32 nameId, LONGLONG timestamp)
+{
+	Enter(GetNameKey(nameId), timestamp);
+}
+
+void CallTree::ExitByName(UINT32 nameId, LONGLONG timestamp)
+{
+	Exit(GetNameKey(nameId), timestamp);
+}
+
+void CallTree::AddSample(const ULONGLONG *functions, size_t count, LONGLONG ticks)
+{
+	size_t node = 0;
+
+	m_sampled = true;
+
+	for (size_t index = 0; index < count; index++)
+	{
+		m_nodes[node].calleeTicks += ticks;
+		node = GetChild(node, functions[index]);
+		m_nodes[node].inclusiveTicks += ticks;
+	}
+
+	if (count > 0)
+	{
+		m_nodes[node].calls++;
+	}
+}
+
+void CallTree::Finish(LONGLONG timestamp)
+{
+	if (!m_stack.empty())
+	{
+		Exit(m_nodes[m_stack[0].node].function, timestamp);
+	}
+}
+
+bool CallTree::WriteCollapsedStacks(const wchar_t *fileName)
+{
+	HANDLE file = CreateFileW(fileName, GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+
+	//
+	// Walk the tree depth first, keeping just the path to the current node. Each pending
+	// node remembers how long its parent's path was, so the path can be cut back to it.
+	//
+
+	OutputBuffer output(file);
+	vector<size_t> firstChild;
+	vector<size_t> nextSibling;
+	vector<pair<size_t, size_t>> pending;
+	wstring path;
+	wchar_t value[32];
+
+	LinkChildren(firstChild, nextSibling);
+
+	for (size_t child = firstChild[0]; child != 0; child = nextSibling[child])
+	{
+		pending.push_back(make_pair(child, (size_t) 0));
+	}
+
+	while (!pending.empty())
+	{
+		size_t index = pending.back().first;
+		const Node &node = m_nodes[index];
+		wstring name = GetName(node.function);
+
+		path.resize(pending.back().second);
+		pending.pop_back();
+
+		//
+		// Semicolons separate frames, so they can't appear in names.
+		//
+
+		replace(name.begin(), name.end(), L';', L',');
+
+		if (!path.empty())
+		{
+			path += L';';
+		}
+
+		path += name;
+
+		for (size_t child = firstChild[index]; child != 0; child = nextSibling[child])
+		{
+			pending.push_back(make_pair(child, path.length()));
+		}
+
+		ULONGLONG microseconds = (ULONGLONG) ((node.inclusiveTicks - node.calleeTicks) * 1000 / m_ticksPerMillisecond + 0.5);
+		if (microseconds == 0)
+		{
+			continue;
+		}
+
+		swprintf_s(value, L" %llu\n", microseconds);
+		output.Write(path.c_str(), path.length());
+		output.Write(value);
+	}
+
+	bool succeeded = output.Flush();
+	CloseHandle(file);
+	return succeeded;
+}
+
+bool CallTree::WriteProfile(const wchar_t *fileName)
+{
+	PprofWriter profile;
+	unordered_map<ULONGLONG, ULONGLONG> functionIds;
+	vector<ULONGLONG> stack;
+	double nanosecondsPerTick = 1000000 / m_ticksPerMillisecond;
+	LONGLONG totalTicks = 0;
+
+	profile.AddSampleType(m_sampled ? "samples" : "calls", "count");
+	profile.AddSampleType("wall", "nanoseconds");
+	profile.AddSampleType("inclusive", "nanoseconds");
+	profile.SetDefaultSampleType("wall");
+
+	for (size_t index = 1; index < m_nodes.size(); index++)
+	{
+		const Node &node = m_nodes[index];
+
+		if (node.parent == 0)
+		{
+			totalTicks += node.inclusiveTicks;
+		}
+
+		//
+		// Walk up to the root for the path, adding each function to the profile the first
+		// time it's seen. Functions the engine reports by name have no script.
+		//
+
+		stack.clear();
+
+		for (size_t current = index; current != 0; current = m_nodes[current].parent)
+		{
+			ULONGLONG function = m_nodes[current].function;
+			unordered_map<ULONGLONG, ULONGLONG>::iterator found = functionIds.find(function);
+
+			if (found == functionIds.end())
+			{
+				wchar_t script[32] = L"";
+				UINT32 scriptId = (UINT32) (function >> 32);
+
+				if (scriptId != ByNameScriptId)
+				{
+					swprintf_s(script, L"script 0x%x", scriptId);
+				}
+
+				found = functionIds.insert(make_pair(function, profile.AddFunction(GetName(function), script))).first;
+			}
+
+			stack.push_back(found->second);
+		}
+
+		LONGLONG values[] =
+		{
+			(LONGLONG) node.calls,
+			(LONGLONG) ((node.inclusiveTicks - node.calleeTicks) * nanosecondsPerTick + 0.5),
+			(LONGLONG) (node.inclusiveTicks * nanosecondsPerTick + 0.5)
+		};
+
+		profile.AddSample(&stack[0], stack.size(), values, ARRAYSIZE(values));
+	}
+
+	profile.SetDuration((ULONGLONG) (totalTicks * nanosecondsPerTick + 0.5));
+	return profile.Write(fileName);
+}
+
+//
+// Per-function totals for the report.
+//
+
+struct FunctionTotals
+{
+	ULONGLONG function;
+	ULONGLONG calls;
+	LONGLONG inclusiveTicks;
+	LONGLONG exclusiveTicks;
+};
+
+static bool CompareExclusive(const FunctionTotals &left, const FunctionTotals &right)
+{
+	return left.exclusiveTicks > right.exclusiveTicks;
+}
+
+void CallTree::PrintReport(FILE *stream, size_t count)
+{
+	//
+	// Walk the tree depth first. Walking it that way tells us which calls are nested inside
+	// another call to the same function, so recursive calls don't count their time more
+	// than once.
+	//
+
+	vector<size_t> firstChild;
+	vector<size_t> nextSibling;
+
+	LinkChildren(firstChild, nextSibling);
+
+	unordered_map<ULONGLONG, FunctionTotals> totals;
+	unordered_map<ULONGLONG, unsigned> active;
+	vector<pair<size_t, bool>> pending;
+	LONGLONG totalTicks = 0;
+	ULONGLONG totalCalls = 0;
+
+	for (size_t child = firstChild[0]; child != 0; child = nextSibling[child])
+	{
+		pending.push_back(make_pair(child, true));
+		totalTicks += m_nodes[child].inclusiveTicks;
+	}
+
+	while (!pending.empty())
+	{
+		size_t index = pending.back().first;
+		bool entering = pending.back().second;
+		const Node &node = m_nodes[index];
+
+		pending.pop_back();
+
+		if (!entering)
+		{
+			active[node.function]--;
+			continue;
+		}
+
+		FunctionTotals &function = totals[node.function];
+		function.function = node.function;
+		function.calls += node.calls;
+		function.exclusiveTicks += node.inclusiveTicks - node.calleeTicks;
+
+		if (active[node.function]++ == 0)
+		{
+			function.inclusiveTicks += node.inclusiveTicks;
+		}
+
+		totalCalls += node.calls;
+
+		pending.push_back(make_pair(index, false));
+		for (size_t child = firstChild[index]; child != 0; child = nextSibling[child])
+		{
+			pending.push_back(make_pair(child, true));
+		}
+	}
+
+	vector<FunctionTotals> functions;
+	for (unordered_map<ULONGLONG, FunctionTotals>::iterator entry = totals.begin(); entry != totals.end(); entry++)
+	{
+		functions.push_back(entry->second);
+	}
+
+	sort(functions.begin(), functions.end(), CompareExclusive);
+
+	//
+	// A sampled tree's times are estimates, and its counts are of the samples each function
+	// was running in.
+	//
+
+	const wchar_t *counted = m_sampled ? L"samples" : L"calls";
+
+	fwprintf(stream, L"chakrahost: profile: %u functions, %llu %s, %.3f ms\n",
+		(unsigned) functions.size(), totalCalls, counted, totalTicks / m_ticksPerMillisecond);
+	fwprintf(stream, L"  exclusive ms       %%   inclusive ms %12s  function\n", counted);
+
+	for (size_t index = 0; index < functions.size() && index < count; index++)
+	{
+		const FunctionTotals &function = functions[index];
+
+		fwprintf(stream, L"%14.3f %6.1f%% %14.3f %12llu  %s\n",
+			function.exclusiveTicks / m_ticksPerMillisecond,
+			totalTicks > 0 ? function.exclusiveTicks * 100.0 / totalTicks : 0,
+			function.inclusiveTicks / m_ticksPerMillisecond,
+			function.calls,
+			GetName(function.function).c_str());
+	}
+}
@@ -1,8 +1,27 @@
 #include "stdafx.h"
 #include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <algorithm>
 
 using namespace std;
 
+//
+// How a -jobs worker manages garbage collection between jobs. By default the engine collects
+// whenever it decides to. With the idle policy the runtime defers work to idle time and each
+// worker gives it that time between jobs, when the engine's next-idle tick says it's due. The
+// collect policy forces a full collection after every job.
+//
+
+enum GcPolicy
+{
+	GcPolicyDefault,
+	GcPolicyIdle,
+	GcPolicyCollect,
+	GcPolicyInvalid
+};
+
 //
 // Class to store information about command-line arguments to the host.
 //
@@ -12,21 +31,54 @@ class CommandLineArguments
 public:
 	bool debug;
 	bool profile;
+	bool cache;
+	bool unbuffered;
+	bool stats;
+	bool dumpTrace;
+	wstring cacheDirectory;
+	wstring traceFile;
+	wstring stacksFile;
+	wstring pprofFile;
+	int jobs;
+	int sampleRate;
+	GcPolicy gcPolicy;
 	int argumentsStart;
 
 	CommandLineArguments() :
 		debug(false),
 		profile(false),
+		cache(false),
+		unbuffered(false),
+		stats(false),
+		dumpTrace(false),
+		jobs(0),
+		sampleRate(0),
+		gcPolicy(GcPolicyDefault),
 		argumentsStart(1)
 	{
 	}
 };
 
 //
-// Source context counter.
+// Source context counter. Scripts can run on several threads in -jobs mode, so it's
+// only updated with interlocked operations.
 //
 
-unsigned currentSourceContext = 0;
+volatile long currentSourceContext = 0;
+
+//
+// The thread pool that runs background work for all of the host's runtimes, and the most
+// work items it will hold before declining more.
+//
+
+ThreadPool *threadPool = nullptr;
+const size_t ThreadPoolCapacity = 1024;
+
+//
+// Compile statistics, kept when -stats is given.
+//
+
+CompileStats *compileStats = nullptr;
 
 //
 // Process the host command-line arguments.
@@ -36,6 +88,13 @@ void ProcessArguments(int argc, __in_ecount(argc) wchar_t *argv [], CommandLineA
 {
 	wstring debugFlag = L"debug";
 	wstring profileFlag = L"profile";
+	wstring sampleOption = L"sample:";
+	wstring cacheFlag = L"cache";
+	wstring unbufferedFlag = L"unbuffered";
+	wstring jobsFlag = L"jobs";
+	wstring statsFlag = L"stats";
+	wstring gcFlag = L"gc";
+	wstring dumpTraceFlag = L"dumptrace";
 	int current = 1;
 
 	for (; current < argc; current++)
@@ -53,7 +112,117 @@ void ProcessArguments(int argc, __in_ecount(argc) wchar_t *argv [], CommandLineA
 			}
 			else if (_wcsnicmp(argumentFlag.c_str(), profileFlag.c_str(), profileFlag.length()) == 0)
 			{
+				wstring value = argumentFlag.length() > profileFlag.length() + 1 && argumentFlag[profileFlag.length()] == ':' ?
+					argumentFlag.substr(profileFlag.length() + 1) :
+					L"";
+
 				arguments.profile = true;
+				arguments.sampleRate = 0;
+
+				//
+				// The collapsed stacks and the pprof profile always get written. A full trace is
+				// only recorded if a file for it is given, and then the other files go next to
+				// it. Sampling takes a rate instead, and records no trace. A bad rate, or
+				// anything but a colon after the flag, is reported as a usage error by the
+				// caller.
+				//
+
+				if (argumentFlag.length() > profileFlag.length() && argumentFlag[profileFlag.length()] != ':')
+				{
+					arguments.sampleRate = -1;
+				}
+				else if (_wcsnicmp(value.c_str(), sampleOption.c_str(), sampleOption.length()) == 0)
+				{
+					arguments.sampleRate = _wtoi(value.c_str() + sampleOption.length());
+
+					if (arguments.sampleRate < 1 || arguments.sampleRate > (int) StackSampler::MaximumRate)
+					{
+						arguments.sampleRate = -1;
+					}
+
+					arguments.traceFile.clear();
+					arguments.stacksFile = L"chakrahost.folded";
+					arguments.pprofFile = L"chakrahost.pb.gz";
+				}
+				else if (!value.empty())
+				{
+					arguments.traceFile = value;
+					arguments.stacksFile = arguments.traceFile + L".folded";
+					arguments.pprofFile = arguments.traceFile + L".pb.gz";
+				}
+				else
+				{
+					arguments.traceFile.clear();
+					arguments.stacksFile = L"chakrahost.folded";
+					arguments.pprofFile = L"chakrahost.pb.gz";
+				}
+			}
+			else if (_wcsnicmp(argumentFlag.c_str(), cacheFlag.c_str(), cacheFlag.length()) == 0)
+			{
+				arguments.cache = true;
+
+				if (argumentFlag.length() > cacheFlag.length() + 1 && argumentFlag[cacheFlag.length()] == ':')
+				{
+					arguments.cacheDirectory = argumentFlag.substr(cacheFlag.length() + 1);
+				}
+				else
+				{
+					arguments.cacheDirectory = ScriptCache::GetDefaultDirectory();
+				}
+			}
+			else if (_wcsnicmp(argumentFlag.c_str(), unbufferedFlag.c_str(), unbufferedFlag.length()) == 0)
+			{
+				arguments.unbuffered = true;
+			}
+			else if (_wcsnicmp(argumentFlag.c_str(), dumpTraceFlag.c_str(), dumpTraceFlag.length()) == 0)
+			{
+				arguments.dumpTrace = true;
+			}
+			else if (_wcsnicmp(argumentFlag.c_str(), statsFlag.c_str(), statsFlag.length()) == 0)
+			{
+				arguments.stats = true;
+			}
+			else if (_wcsnicmp(argumentFlag.c_str(), gcFlag.c_str(), gcFlag.length()) == 0)
+			{
+				wstring policy = argumentFlag.length() > gcFlag.length() && argumentFlag[gcFlag.length()] == ':' ?
+					argumentFlag.substr(gcFlag.length() + 1) :
+					L"";
+
+				if (_wcsicmp(policy.c_str(), L"default") == 0)
+				{
+					arguments.gcPolicy = GcPolicyDefault;
+				}
+				else if (_wcsicmp(policy.c_str(), L"idle") == 0)
+				{
+					arguments.gcPolicy = GcPolicyIdle;
+				}
+				else if (_wcsicmp(policy.c_str(), L"collect") == 0)
+				{
+					arguments.gcPolicy = GcPolicyCollect;
+				}
+				else
+				{
+					arguments.gcPolicy = GcPolicyInvalid;
+				}
+			}
+			else if (_wcsnicmp(argumentFlag.c_str(), jobsFlag.c_str(), jobsFlag.length()) == 0)
+			{
+				//
+				// The worker count is the next argument. A missing or bad count is reported
+				// as a usage error by the caller.
+				//
+
+				arguments.jobs = -1;
+
+				if (current + 1 < argc)
+				{
+					arguments.jobs = _wtoi(argv[++current]);
+
+					if (arguments.jobs < 1)
+					{
+						arguments.jobs = -1;
+					}
+				}
 			}
 			else
 			{
@@ -86,66 +255,41 @@ void ThrowException(wstring errorString)
 }
 
 //
-// Helper to load a script from disk.
+// Helper to run a script, going through the bytecode cache if there is one and timing its
+// parse if compile statistics are being kept.
 //
 
-wstring LoadScript(wstring fileName)
+JsErrorCode RunScriptSource(ScriptCache *cache, const wstring &script, const wchar_t *sourceUrl, JsValueRef *result)
 {
-	FILE *file;
-	if (_wfopen_s(&file, fileName.c_str(), L"rb"))
-	{
-		fwprintf(stderr, L"chakrahost: unable to open file: %s.\n", fileName.c_str());
-		return wstring();
-	}
-
-	unsigned int current = ftell(file);
-	fseek(file, 0, SEEK_END);
-	unsigned int end = ftell(file);
-	fseek(file, current, SEEK_SET);
-	unsigned int lengthBytes = end - current;
-	char *rawBytes = (char *) calloc(lengthBytes + 1, sizeof(char) );
-
-	if (rawBytes == nullptr)
-	{
-		fwprintf(stderr, L"chakrahost: fatal error.\n");
-		return wstring();
-	}
-
-	fread((void *) rawBytes, sizeof(char) , lengthBytes, file);
-
-	wchar_t *contents = (wchar_t *) calloc(lengthBytes + 1, sizeof(wchar_t) );
-	if (contents == nullptr)
-	{
-		free(rawBytes);
-		fwprintf(stderr, L"chakrahost: fatal error.\n");
-		return wstring();
-	}
-
-	if (MultiByteToWideChar(CP_UTF8, 0, rawBytes, lengthBytes + 1, contents, lengthBytes + 1) == 0)
+	if (cache != nullptr)
 	{
-        free(rawBytes);
-        free(contents);
-		fwprintf(stderr, L"chakrahost: fatal error.\n");
-		return wstring();
+		return cache->RunScript(script, InterlockedIncrement(&currentSourceContext) - 1, sourceUrl, compileStats, result);
 	}
 
-	wstring result = contents;
-    free(rawBytes);
-    free(contents);
-	return result;
+	return RunScriptTimed(compileStats, script.c_str(), nullptr, ParseSourceText, InterlockedIncrement(&currentSourceContext) - 1, sourceUrl, result);
 }
 
 //
-// Callback to echo something to the command-line.
+// Callback to echo something to the command-line. If the host is buffering its output,
+// the callback state is the output buffer; otherwise, the text goes straight to stdout.
 //
 
 JsValueRef CALLBACK Echo(JsValueRef callee, bool isConstructCall, JsValueRef *arguments, unsigned short argumentCount, void *callbackState)
 {
+	OutputBuffer *output = (OutputBuffer *) callbackState;
+
 	for (unsigned int index = 1; index < argumentCount; index++)
 	{
 		if (index > 1)
 		{
-			wprintf(L" ");
+			if (output != nullptr)
+			{
+				output->Write(L" ", 1);
+			}
+			else
+			{
+				wprintf(L" ");
+			}
 		}
 
 		JsValueRef stringValue;
@@ -155,10 +299,44 @@ JsValueRef CALLBACK Echo(JsValueRef callee, bool isConstructCall, JsValueRef *ar
 		size_t length;
 		IfFailThrow(JsStringToPointer(stringValue, &string, &length), L"invalid argument");
 
-		wprintf(L"%s", string);
+		if (output != nullptr)
+		{
+			output->Write(string, length);
+		}
+		else
+		{
+			wprintf(L"%s", string);
+		}
+	}
+
+	if (output != nullptr)
+	{
+		output->Write(L"\r\n", 2);
+	}
+	else
+	{
+		wprintf(L"\n");
 	}
 
-	wprintf(L"\n");
+	return JS_INVALID_REFERENCE;
+}
+
+//
+// Callback to flush anything echoed so far.
+//
+
+JsValueRef CALLBACK FlushOutput(JsValueRef callee, bool isConstructCall, JsValueRef *arguments, unsigned short argumentCount, void *callbackState)
+{
+	OutputBuffer *output = (OutputBuffer *) callbackState;
+
+	if (output != nullptr)
+	{
+		output->Flush();
+	}
+	else
+	{
+		fflush(stdout);
+	}
 
 	return JS_INVALID_REFERENCE;
 }
@@ -200,7 +378,7 @@ JsValueRef CALLBACK RunScript(JsValueRef callee, bool isConstructCall, JsValueRe
 	// Run the script.
 	//
 
-	IfFailThrow(JsRunScript(script.c_str(), currentSourceContext++, filename, &result), L"failed to run script.");
+	IfFailThrow(RunScriptSource((ScriptCache *) callbackState, script, filename, &result), L"failed to run script.");
 
 	return result;
 }
@@ -238,7 +416,7 @@ JsErrorCode DefineHostCallback(JsValueRef globalObject, const wchar_t *callbackN
 // Creates a host execution context and sets up the host object in it.
 //
 
-JsErrorCode CreateHostContext(JsRuntimeHandle runtime, int argc, wchar_t *argv [], int argumentsStart, JsContextRef *context)
+JsErrorCode CreateHostContext(JsRuntimeHandle runtime, ScriptCache *cache, OutputBuffer *output, int argc, wchar_t *argv [], int argumentsStart, JsContextRef *context)
 {
 	//
 	// Create the context.
@@ -283,8 +461,9 @@ JsErrorCode CreateHostContext(JsRuntimeHandle runtime, int argc, wchar_t *argv [
 	// Now create the host callbacks that we're going to expose to the script.
 	//
 
-	IfFailRet(DefineHostCallback(hostObject, L"echo", Echo, nullptr));
-    IfFailRet(DefineHostCallback(hostObject, L"runScript", RunScript, nullptr));
+	IfFailRet(DefineHostCallback(hostObject, L"echo", Echo, output));
+	IfFailRet(DefineHostCallback(hostObject, L"flush", FlushOutput, output));
+    IfFailRet(DefineHostCallback(hostObject, L"runScript", RunScript, cache));
 
 	//
 	// Create an array for arguments.
@@ -339,10 +518,10 @@ JsErrorCode CreateHostContext(JsRuntimeHandle runtime, int argc, wchar_t *argv [
 }
 
 //
-// Print out a script exception.
+// Get the message of the pending script exception, clearing the exception.
 //
 
-JsErrorCode PrintScriptException()
+JsErrorCode GetScriptExceptionMessage(wstring &message)
 {
 	//
 	// Get script exception.
@@ -361,15 +540,541 @@ JsErrorCode PrintScriptException()
 	JsValueRef messageValue;
 	IfFailRet(JsGetProperty(exception, messageName, &messageValue));
 
-	const wchar_t *message;
+	const wchar_t *messageString;
 	size_t length;
-	IfFailRet(JsStringToPointer(messageValue, &message, &length));
+	IfFailRet(JsStringToPointer(messageValue, &messageString, &length));
 
-	fwprintf(stderr, L"chakrahost: exception: %s\n", message);
+	message.assign(messageString, length);
 
 	return JsNoError;
 }
 
+//
+// Print out a script exception.
+//
+
+JsErrorCode PrintScriptException()
+{
+	wstring message;
+	IfFailRet(GetScriptExceptionMessage(message));
+
+	fwprintf(stderr, L"chakrahost: exception: %s\n", message.c_str());
+
+	return JsNoError;
+}
+
+//
+// Thread service callback that hands the engine's background work to the shared thread
+// pool. If the pool declines the work, the engine does it itself.
+//
+
+bool CALLBACK ThreadService(JsBackgroundWorkItemCallback callback, void *callbackState)
+{
+	return threadPool != nullptr && threadPool->Submit(callback, callbackState);
+}
+
+//
+// Shut down the thread pool once all runtimes are gone, optionally printing its counters.
+//
+
+void ShutdownThreadPool(bool printStatistics)
+{
+	if (threadPool == nullptr)
+	{
+		return;
+	}
+
+	threadPool->Shutdown();
+
+	if (printStatistics)
+	{
+		ThreadPoolStatistics statistics;
+		threadPool->GetStatistics(statistics);
+
+		fwprintf(stderr, L"chakrahost: thread pool: %u threads, %llu items run, %llu declined, %llu steals, queue depth %llu (max %llu), wait avg %.3f ms (max %.3f ms), run avg %.3f ms (max %.3f ms)\n",
+			statistics.threadCount, statistics.executed, statistics.rejected, statistics.steals, statistics.queueDepth, statistics.maximumQueueDepth,
+			statistics.averageWaitMilliseconds, statistics.maximumWaitMilliseconds, statistics.averageRunMilliseconds, statistics.maximumRunMilliseconds);
+	}
+
+	delete threadPool;
+	threadPool = nullptr;
+}
+
+//
+// Print the compile statistics, if any were kept, and free them.
+//
+
+void ShutdownCompileStats(void)
+{
+	if (compileStats == nullptr)
+	{
+		return;
+	}
+
+	compileStats->PrintReport(stderr);
+
+	delete compileStats;
+	compileStats = nullptr;
+}
+
+//
+// Turn on the engine's compile events in the current context, for -stats without -profile.
+// Calls are traced as well, so each function's compile is timed from the last call before
+// it rather than from the last compile.
+//
+
+void StartCompileEvents(void)
+{
+	if (compileStats == nullptr)
+	{
+		return;
+	}
+
+	CompileEvents *events = new CompileEvents(compileStats);
+	JsStartProfiling(events, PROFILER_EVENT_MASK_TRACE_SCRIPT_FUNCTION_CALL, 0);
+	events->Release();
+}
+
+//
+// Helper to create a runtime. Every runtime the host creates goes through here, and all
+// of them share the host's thread pool for background work. Runtimes that the host will
+// give idle time to are created with idle processing enabled, so the engine holds back
+// collection work for JsIdle rather than doing it in the middle of a script.
+//
+
+JsErrorCode CreateRuntime(GcPolicy gcPolicy, JsRuntimeHandle *runtime)
+{
+	JsRuntimeAttributes attributes = JsRuntimeAttributeNone;
+
+	if (gcPolicy == GcPolicyIdle)
+	{
+		attributes = (JsRuntimeAttributes) (attributes | JsRuntimeAttributeEnableIdleProcessing);
+	}
+
+	return JsCreateRuntime(attributes, ThreadService, runtime);
+}
+
+//
+// A script invocation in -jobs mode, along with its results.
+//
+
+struct Job
+{
+	vector<wstring> arguments;
+	int exitCode;
+	wstring error;
+	string output;
+	double milliseconds;
+	bool done;
+
+	Job() :
+		exitCode(EXIT_FAILURE),
+		milliseconds(0),
+		done(false)
+	{
+	}
+};
+
+//
+// The state shared by the workers in -jobs mode.
+//
+
+struct JobPool
+{
+	const CommandLineArguments *arguments;
+	vector<Job> jobs;
+	volatile long nextJob;
+	size_t nextToReport;
+	mutex reportLock;
+	OutputBuffer *output;
+	double ticksPerMillisecond;
+	volatile long idleCalls;
+	volatile long collections;
+
+	JobPool() :
+		arguments(nullptr),
+		nextJob(0),
+		nextToReport(0),
+		output(nullptr),
+		ticksPerMillisecond(1),
+		idleCalls(0),
+		collections(0)
+	{
+	}
+};
+
+//
+// Read the list of script invocations for -jobs mode, one per line, from a file or from
+// stdin. Each line is split into a script name and its arguments the way a command line
+// would be. Blank lines and lines starting with '#' are skipped.
+//
+
+bool ReadJobList(const wchar_t *fileName, vector<Job> &jobs)
+{
+	wstring text;
+
+	if (fileName == nullptr || wcscmp(fileName, L"-") == 0)
+	{
+		HANDLE input = GetStdHandle(STD_INPUT_HANDLE);
+		vector<BYTE> bytes;
+		BYTE chunk[64 * 1024];
+		DWORD read;
+
+		while (ReadFile(input, chunk, sizeof(chunk), &read, nullptr) && read > 0)
+		{
+			bytes.insert(bytes.end(), chunk, chunk + read);
+		}
+
+		if (!bytes.empty())
+		{
+			text = DecodeScript(&bytes[0], bytes.size());
+		}
+	}
+	else
+	{
+		MappedFile file;
+		if (!file.Open(fileName))
+		{
+			fwprintf(stderr, L"chakrahost: unable to open file: %s.\n", fileName);
+			return false;
+		}
+
+		text = DecodeScript(file.Data(), file.Size());
+	}
+
+	size_t lineStart = 0;
+
+	while (lineStart < text.length())
+	{
+		size_t lineEnd = text.find(L'\n', lineStart);
+		if (lineEnd == wstring::npos)
+		{
+			lineEnd = text.length();
+		}
+
+		wstring line = text.substr(lineStart, lineEnd - lineStart);
+		lineStart = lineEnd + 1;
+
+		size_t first = line.find_first_not_of(L" \t\r");
+		if (first == wstring::npos || line[first] == L'#')
+		{
+			continue;
+		}
+
+		int argc;
+		wchar_t **argv = CommandLineToArgvW(line.c_str() + first, &argc);
+		if (argv == nullptr)
+		{
+			continue;
+		}
+
+		Job job;
+		for (int index = 0; index < argc; index++)
+		{
+			job.arguments.push_back(argv[index]);
+		}
+
+		LocalFree(argv);
+		jobs.push_back(job);
+	}
+
+	return true;
+}
+
+//
+// Run a single job in a fresh context on a worker's runtime. The runtime stays warm across
+// jobs; only the context, and so the script's global state, is new each time. The job's
+// context is left current so the worker can give the engine idle time afterwards.
+//
+
+void RunJob(JsRuntimeHandle runtime, ScriptCache *cache, OutputBuffer *output, Job &job)
+{
+	vector<wchar_t *> argv;
+	for (size_t index = 0; index < job.arguments.size(); index++)
+	{
+		argv.push_back(&job.arguments[index][0]);
+	}
+
+	JsContextRef context;
+	if (CreateHostContext(runtime, cache, output, (int) argv.size(), &argv[0], 0, &context) != JsNoError ||
+		JsSetCurrentContext(context) != JsNoError)
+	{
+		job.error = L"failed to create execution context.";
+		return;
+	}
+
+	StartCompileEvents();
+
+	wstring script = LoadScript(job.arguments[0]);
+	if (script.empty())
+	{
+		job.error = L"invalid script.";
+	}
+	else
+	{
+		JsValueRef result;
+		JsErrorCode errorCode = RunScriptSource(cache, script, job.arguments[0].c_str(), &result);
+
+		if (errorCode == JsErrorScriptException)
+		{
+			wstring message;
+			GetScriptExceptionMessage(message);
+			job.error = L"exception: " + message;
+		}
+		else if (errorCode != JsNoError)
+		{
+			job.error = L"failed to run script.";
+		}
+		else
+		{
+			JsValueRef numberResult;
+			double doubleResult;
+
+			if (JsConvertValueToNumber(result, &numberResult) == JsNoError &&
+				JsNumberToDouble(numberResult, &doubleResult) == JsNoError)
+			{
+				job.exitCode = (int) doubleResult;
+			}
+			else
+			{
+				job.error = L"failed to convert return value.";
+			}
+		}
+	}
+}
+
+//
+// Do a worker's garbage collection work between jobs, outside of any job's timing. JsIdle
+// needs a current context, so this runs before the finished job's context is released.
+//
+
+void CollectBetweenJobs(JobPool *pool, JsRuntimeHandle runtime, unsigned int &nextIdleTick)
+{
+	switch (pool->arguments->gcPolicy)
+	{
+	case GcPolicyIdle:
+		//
+		// Only call in when the engine said it would have something to do. The tick count
+		// wraps, so compare the difference rather than the values.
+		//
+
+		if ((int) (GetTickCount() - nextIdleTick) >= 0 && JsIdle(&nextIdleTick) == JsNoError)
+		{
+			InterlockedIncrement(&pool->idleCalls);
+		}
+		break;
+
+	case GcPolicyCollect:
+		if (JsCollectGarbage(runtime) == JsNoError)
+		{
+			InterlockedIncrement(&pool->collections);
+		}
+		break;
+
+	default:
+		break;
+	}
+}
+
+//
+// Write out a finished job: a header line, everything the job echoed and its error, if any.
+//
+
+void ReportJob(JobPool *pool, size_t index)
+{
+	Job &job = pool->jobs[index];
+	wchar_t header[128];
+
+	swprintf_s(header, L"[job %u] exit code %d, %.3f ms: ", (unsigned) index, job.exitCode, job.milliseconds);
+	pool->output->Write(header);
+	pool->output->Write(job.arguments[0].c_str(), job.arguments[0].length());
+	pool->output->Write(L"\r\n", 2);
+	pool->output->WriteUtf8(job.output.c_str(), job.output.length());
+
+	if (!job.error.empty())
+	{
+		pool->output->Write(L"chakrahost: ");
+		pool->output->Write(job.error.c_str(), job.error.length());
+		pool->output->Write(L"\r\n", 2);
+	}
+
+	string().swap(job.output);
+}
+
+//
+// Mark a job as finished and report every job that is now ready, so output stays in the
+// same order as the job list no matter which worker finishes first.
+//
+
+void FinishJob(JobPool *pool, size_t index)
+{
+	lock_guard<mutex> lock(pool->reportLock);
+
+	pool->jobs[index].done = true;
+
+	while (pool->nextToReport < pool->jobs.size() && pool->jobs[pool->nextToReport].done)
+	{
+		ReportJob(pool, pool->nextToReport++);
+	}
+}
+
+//
+// A -jobs mode worker. Each worker owns a runtime (and a bytecode cache, which has to live
+// as long as the runtime) and takes jobs off the shared list until there are none left.
+//
+
+void JobWorker(JobPool *pool)
+{
+	JsRuntimeHandle runtime;
+	ScriptCache *cache = nullptr;
+	OutputBuffer output(nullptr);
+	unsigned int nextIdleTick = GetTickCount();
+
+	if (CreateRuntime(pool->arguments->gcPolicy, &runtime) != JsNoError)
+	{
+		fwprintf(stderr, L"chakrahost: fatal error: failed to create runtime.\n");
+		return;
+	}
+
+	if (pool->arguments->cache)
+	{
+		cache = new ScriptCache(pool->arguments->cacheDirectory.c_str());
+	}
+
+	for (;;)
+	{
+		size_t index = (size_t) (InterlockedIncrement(&pool->nextJob) - 1);
+		if (index >= pool->jobs.size())
+		{
+			break;
+		}
+
+		Job &job = pool->jobs[index];
+		LARGE_INTEGER start;
+		LARGE_INTEGER end;
+
+		QueryPerformanceCounter(&start);
+		RunJob(runtime, cache, &output, job);
+		QueryPerformanceCounter(&end);
+
+		job.milliseconds = (end.QuadPart - start.QuadPart) / pool->ticksPerMillisecond;
+		output.TakeCaptured(job.output);
+
+		FinishJob(pool, index);
+
+		CollectBetweenJobs(pool, runtime, nextIdleTick);
+		JsSetCurrentContext(JS_INVALID_REFERENCE);
+
+		//
+		// The cache can only let go of the scripts it holds once nothing in the runtime could
+		// still be using them, so a worker whose cache is full starts over with a new runtime.
+		//
+
+		if (cache != nullptr && cache->IsFull())
+		{
+			JsDisposeRuntime(runtime);
+			cache->Clear();
+
+			if (CreateRuntime(pool->arguments->gcPolicy, &runtime) != JsNoError)
+			{
+				fwprintf(stderr, L"chakrahost: fatal error: failed to create runtime.\n");
+				delete cache;
+				return;
+			}
+		}
+	}
+
+	JsDisposeRuntime(runtime);
+	delete cache;
+}
+
+//
+// Run every job in the job list on a pool of workers, then print throughput and latency.
+//
+
+int RunJobs(int argc, wchar_t *argv[], const CommandLineArguments &arguments)
+{
+	JobPool pool;
+	LARGE_INTEGER frequency;
+	LARGE_INTEGER start;
+	LARGE_INTEGER end;
+
+	pool.arguments = &arguments;
+
+	if (!ReadJobList(arguments.argumentsStart < argc ? argv[arguments.argumentsStart] : nullptr, pool.jobs))
+	{
+		return EXIT_FAILURE;
+	}
+
+	QueryPerformanceFrequency(&frequency);
+	pool.ticksPerMillisecond = frequency.QuadPart / 1000.0;
+	pool.output = new OutputBuffer(GetStdHandle(STD_OUTPUT_HANDLE));
+
+	QueryPerformanceCounter(&start);
+
+	vector<thread> workers;
+	for (int index = 0; index < arguments.jobs; index++)
+	{
+		workers.push_back(thread(JobWorker, &pool));
+	}
+
+	for (size_t index = 0; index < workers.size(); index++)
+	{
+		workers[index].join();
+	}
+
+	QueryPerformanceCounter(&end);
+
+	//
+	// Jobs that never ran (because no worker could create a runtime) still get reported.
+	//
+
+	for (size_t index = 0; index < pool.jobs.size(); index++)
+	{
+		if (!pool.jobs[index].done)
+		{
+			pool.jobs[index].error = L"job did not run.";
+			FinishJob(&pool, index);
+		}
+	}
+
+	delete pool.output;
+
+	//
+	// Print the summary.
+	//
+
+	vector<double> latencies;
+	unsigned failed = 0;
+
+	for (size_t index = 0; index < pool.jobs.size(); index++)
+	{
+		latencies.push_back(pool.jobs[index].milliseconds);
+
+		if (!pool.jobs[index].error.empty() || pool.jobs[index].exitCode != 0)
+		{
+			failed++;
+		}
+	}
+
+	sort(latencies.begin(), latencies.end());
+
+	double seconds = (end.QuadPart - start.QuadPart) / (pool.ticksPerMillisecond * 1000);
+	double p50 = latencies.empty() ? 0 : latencies[(latencies.size() - 1) * 50 / 100];
+	double p99 = latencies.empty() ? 0 : latencies[(latencies.size() - 1) * 99 / 100];
+	double p999 = latencies.empty() ? 0 : latencies[(latencies.size() - 1) * 999 / 1000];
+
+	fwprintf(stderr, L"chakrahost: %u jobs, %u failed, %d workers, %.3f s, %.1f jobs/sec, latency p50 %.3f ms, p99 %.3f ms, p99.9 %.3f ms\n",
+		(unsigned) pool.jobs.size(), failed, arguments.jobs, seconds, seconds > 0 ? pool.jobs.size() / seconds : 0, p50, p99, p999);
+
+	if (arguments.stats)
+	{
+		fwprintf(stderr, L"chakrahost: gc: %u idle calls, %u forced collections\n", (unsigned) pool.idleCalls, (unsigned) pool.collections);
+	}
+
+	return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
 //
 // The main entry point for the host.
 //
@@ -378,32 +1083,93 @@ int _cdecl wmain(int argc, wchar_t *argv[])
 {
 	int returnValue = EXIT_FAILURE;
 	CommandLineArguments arguments;
+	ScriptCache *cache = nullptr;
+	OutputBuffer *output = nullptr;
+	JsRuntimeHandle runtime = JS_INVALID_RUNTIME_HANDLE;
 
 	ProcessArguments(argc, argv, arguments);
 
-	if (argc - arguments.argumentsStart < 1)
+	if (arguments.jobs != 0)
+	{
+		if (arguments.jobs < 0 || arguments.debug || arguments.profile || arguments.dumpTrace || arguments.gcPolicy == GcPolicyInvalid)
+		{
+			fwprintf(stderr, L"usage: chakrahost [-cache[:<directory>]] [-stats] [-gc:default|idle|collect] -jobs <workers> [<job list>]\n");
+			return returnValue;
+		}
+	}
+	else if (argc - arguments.argumentsStart < 1 || arguments.gcPolicy != GcPolicyDefault || arguments.sampleRate < 0)
 	{
-		fwprintf(stderr, L"usage: chakrahost [-debug] [-profile] <script name> <arguments>\n");
+		fwprintf(stderr, L"usage: chakrahost [-debug] [-profile[:<trace file>|:sample:<hz>]] [-cache[:<directory>]] [-unbuffered] [-stats] <script name> <arguments>\n");
+		fwprintf(stderr, L"       chakrahost [-cache[:<directory>]] [-stats] [-gc:default|idle|collect] -jobs <workers> [<job list>]\n");
+		fwprintf(stderr, L"       chakrahost -dumptrace <trace file>\n");
+		return returnValue;
+	}
+
+	//
+	// Decoding a trace doesn't need a runtime.
+	//
+
+	if (arguments.dumpTrace)
+	{
+		OutputBuffer traceOutput(GetStdHandle(STD_OUTPUT_HANDLE));
+		return DecodeTrace(argv[arguments.argumentsStart], traceOutput) ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	//
+	// Create the thread pool that all of our runtimes share for background work.
+	//
+
+	threadPool = new ThreadPool(thread::hardware_concurrency(), ThreadPoolCapacity);
+
+	if (arguments.stats)
+	{
+		compileStats = new CompileStats();
+	}
+
+	if (arguments.jobs != 0)
+	{
+		returnValue = RunJobs(argc, argv, arguments);
+		ShutdownThreadPool(arguments.stats);
+		ShutdownCompileStats();
 		return returnValue;
 	}
 
 	try
 	{
-		JsRuntimeHandle runtime;
 		JsContextRef context;
 
+		//
+		// Set up the bytecode cache if requested. It has to outlive the runtime, since the
+		// engine keeps using the scripts and serialized buffers it hands out.
+		//
+
+		if (arguments.cache)
+		{
+			cache = new ScriptCache(arguments.cacheDirectory.c_str());
+		}
+
+		//
+		// Buffer the script's output unless asked not to. Interactive consoles are left
+		// unbuffered.
+		//
+
+		if (!arguments.unbuffered && OutputBuffer::ShouldBuffer(GetStdHandle(STD_OUTPUT_HANDLE)))
+		{
+			output = new OutputBuffer(GetStdHandle(STD_OUTPUT_HANDLE));
+		}
+
 		//
 		// Create the runtime. We're only going to use one runtime for this host.
 		//
 
-		IfFailError(JsCreateRuntime(JsRuntimeAttributeNone, nullptr, &runtime), L"failed to create runtime.");
+		IfFailError(CreateRuntime(arguments.gcPolicy, &runtime), L"failed to create runtime.");
 
 		//
 		// Similarly, create a single execution context. Note that we're putting it on the stack here,
 		// so it will stay alive through the entire run.
 		//
 
-		IfFailError(CreateHostContext(runtime, argc, argv, arguments.argumentsStart, &context), L"failed to create execution context.");
+		IfFailError(CreateHostContext(runtime, cache, output, argc, argv, arguments.argumentsStart, &context), L"failed to create execution context.");
 
 		//
 		// Now set the execution context as being the current one on this thread.
@@ -430,7 +1196,7 @@ int _cdecl wmain(int argc, wchar_t *argv[])
 
 		if (arguments.profile)
 		{
-			Profiler *profiler = new Profiler();
+			Profiler *profiler = new Profiler(arguments.traceFile.c_str(), arguments.stacksFile.c_str(), arguments.pprofFile.c_str(), (unsigned) arguments.sampleRate, compileStats);
 			IActiveScriptProfilerCallback *callback;
 
 			profiler->QueryInterface(IID_IActiveScriptProfilerCallback, (void **)&callback);
@@ -439,6 +1205,10 @@ int _cdecl wmain(int argc, wchar_t *argv[])
 			JsStartProfiling(callback, PROFILER_EVENT_MASK_TRACE_ALL, 0);
 			callback->Release();
 		}
+		else
+		{
+			StartCompileEvents();
+		}
 
 		//
 		// Load the script from the disk.
@@ -455,12 +1225,28 @@ int _cdecl wmain(int argc, wchar_t *argv[])
 		//
 
 		JsValueRef result;
-		JsErrorCode errorCode = JsRunScript(script.c_str(), currentSourceContext++, argv[arguments.argumentsStart], &result);
+		JsErrorCode errorCode = RunScriptSource(cache, script, argv[arguments.argumentsStart], &result);
 		
 		if (errorCode == JsErrorScriptException)
 		{
+			if (output != nullptr)
+			{
+				output->Flush();
+			}
+
 			IfFailError(PrintScriptException(), L"failed to print exception");
-			return EXIT_FAILURE;
+
+			//
+			// Stop profiling so the trace is complete.
+			//
+
+			if (arguments.profile || arguments.stats)
+			{
+				JsStopProfiling(0);
+			}
+
+			returnValue = EXIT_FAILURE;
+			goto error;
 		}
 		else
 		{
@@ -481,7 +1267,7 @@ int _cdecl wmain(int argc, wchar_t *argv[])
 		// Stop profiling.
 		//
 
-		if (arguments.profile)
+		if (arguments.profile || arguments.stats)
 		{
 			JsStopProfiling(0);
 		}
@@ -497,6 +1283,7 @@ int _cdecl wmain(int argc, wchar_t *argv[])
 		//
 
 		IfFailError(JsDisposeRuntime(runtime), L"failed to cleanup runtime.");
+		runtime = JS_INVALID_RUNTIME_HANDLE;
 	}
 	catch (...)
 	{
@@ -504,5 +1291,28 @@ int _cdecl wmain(int argc, wchar_t *argv[])
 	}
 
 error:
+	//
+	// A run that failed part way leaves its runtime behind. It has to go before the cache,
+	// whose scripts it may still be using, and before the thread pool its background work
+	// runs on.
+	//
+
+	if (runtime != JS_INVALID_RUNTIME_HANDLE)
+	{
+		JsSetCurrentContext(JS_INVALID_REFERENCE);
+		JsDisposeRuntime(runtime);
+	}
+
+	delete cache;
+
+	//
+	// Flush whatever output is still buffered.
+	//
+
+	delete output;
+
+	ShutdownThreadPool(arguments.stats);
+	ShutdownCompileStats();
+
 	return returnValue;
 }
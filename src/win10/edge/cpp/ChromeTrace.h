@@ -0,0 +1,61 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+//
+// Formats profiler trace events as Chrome trace-event JSON, which chrome://tracing and the
+// Perfetto UI both open. Function calls become begin and end slices, compilation becomes
+// instant events, and each thread that recorded events gets a track of its own. Timestamps
+// are microseconds since the trace was opened.
+//
+// Events are formatted as the trace writer's drain thread hands them over and go to the
+// file through a fixed size buffer, so memory use doesn't grow with the length of the run.
+// Each event is on a line of its own, and the viewers accept a trace whose closing bracket
+// is missing, so a trace cut short by a crash still opens.
+//
+
+class ChromeTraceFormatter sealed
+{
+private:
+	static const size_t BufferCapacity = 256 * 1024;
+
+	OutputBuffer m_output;
+	ULONGLONG m_start;
+	double m_ticksPerMicrosecond;
+	DWORD m_processId;
+	ULONGLONG m_bytesWritten;
+	std::unordered_map<ULONGLONG, std::string> m_functionNames;
+	std::unordered_map<UINT32, std::string> m_names;
+	std::unordered_set<UINT16> m_threads;
+	std::unordered_map<UINT16, std::vector<ULONGLONG>> m_stacks;
+
+	ChromeTraceFormatter(const ChromeTraceFormatter &);
+	ChromeTraceFormatter &operator=(const ChromeTraceFormatter &);
+
+	void Write(const char *text, size_t length);
+	void Write(const char *text) { Write(text, strlen(text)); }
+	void WriteEscaped(const std::string &text);
+	void WriteEventStart(const char *phase, UINT16 thread, ULONGLONG timestamp);
+	void WriteEnds(const TraceEvent &event, ULONGLONG function);
+	void AddThread(UINT16 thread);
+	std::string GetFunctionName(UINT32 scriptId, UINT32 functionId);
+
+public:
+	ChromeTraceFormatter(HANDLE file, ULONGLONG start, ULONGLONG ticksPerSecond);
+
+	void Begin(void);
+
+	//
+	// Takes events that carry names, each followed by its payload, as the trace writer
+	// lays them out. Names are kept for the call events that follow.
+	//
+
+	void WriteNameRecords(const BYTE *records, size_t length);
+	void WriteEvents(const TraceEvent *events, size_t count);
+	bool End(void);
+
+	ULONGLONG BytesWritten(void) const { return m_bytesWritten; }
+};
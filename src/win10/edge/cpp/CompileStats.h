@@ -0,0 +1,189 @@
+#pragma once
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+//
+// A latency histogram in the style of HdrHistogram. Each power of two is split into the same
+// number of buckets, so every value is kept to within a few percent however large it is, and
+// percentiles come out of the counts without keeping the values themselves. Values are
+// performance counter ticks.
+//
+
+class LatencyHistogram sealed
+{
+private:
+	static const unsigned SubBucketBits = 5;
+	static const size_t SubBucketCount = 1 << SubBucketBits;
+
+	std::vector<UINT32> m_counts;
+	ULONGLONG m_count;
+	ULONGLONG m_total;
+	ULONGLONG m_maximum;
+
+	static size_t GetIndex(ULONGLONG value);
+	static ULONGLONG GetHighestValue(size_t index);
+
+public:
+	LatencyHistogram(void);
+
+	void Record(ULONGLONG value);
+
+	//
+	// The highest value the given percentage of recorded values are at or below, to within
+	// the width of its bucket.
+	//
+
+	ULONGLONG ValueAtPercentile(double percentile) const;
+
+	ULONGLONG Count(void) const { return m_count; }
+	ULONGLONG Total(void) const { return m_total; }
+	ULONGLONG Maximum(void) const { return m_maximum; }
+};
+
+//
+// Where a parse got the script from: its source, the script cache, or its source on the way
+// into the script cache, in which case the parse includes serializing it.
+//
+
+enum ParseSource
+{
+	ParseSourceText,
+	ParseSourceCacheHit,
+	ParseSourceCacheMiss
+};
+
+//
+// Compilation statistics for -stats. The host runs each script as usual, and the engine's
+// compile events mark where compiling stops: a script is parsed from the start of the run
+// until the engine reports the script compiled, and that time is recorded against the
+// script's name. Each function compiled is counted against its script, either as part of
+// the parse or as deferred until the function first ran, and the time since the thread's
+// previous profiler event is recorded against the function. That bounds the function's
+// compile from above, since it takes in whatever the script did in between. Scripts can run
+// on any thread, so recording takes a lock.
+//
+
+class CompileStats sealed
+{
+private:
+	struct ScriptStats
+	{
+		LatencyHistogram parses;
+		ULONGLONG parsedFunctions;
+		ULONGLONG deferredFunctions;
+
+		ScriptStats() :
+			parsedFunctions(0),
+			deferredFunctions(0)
+		{
+		}
+	};
+
+	struct Compile
+	{
+		std::wstring script;
+		ULONGLONG ticks;
+		ParseSource source;
+	};
+
+	std::mutex m_lock;
+	std::unordered_map<std::wstring, ScriptStats> m_scripts;
+	std::unordered_map<UINT32, std::wstring> m_scriptIds;
+	std::unordered_map<std::wstring, LatencyHistogram> m_functions;
+	LatencyHistogram m_parses;
+	std::vector<Compile> m_slowest;
+	double m_ticksPerMillisecond;
+
+	CompileStats(const CompileStats &);
+	CompileStats &operator=(const CompileStats &);
+
+	static LONGLONG GetTimestamp(void);
+	static bool CompareScripts(const std::pair<const std::wstring *, const ScriptStats *> &left, const std::pair<const std::wstring *, const ScriptStats *> &right);
+	static bool CompareFunctions(const std::pair<const std::wstring *, const LatencyHistogram *> &left, const std::pair<const std::wstring *, const LatencyHistogram *> &right);
+	static bool CompareSlowest(ULONGLONG ticks, const Compile &compile);
+	void AddSlowest(const wchar_t *script, ULONGLONG ticks, ParseSource source);
+	void PrintHistogram(FILE *stream, const LatencyHistogram &histogram);
+
+public:
+	static const size_t ReportCount = 10;
+
+	//
+	// A run of a script on some thread. Runs nest when a script runs another, so each keeps
+	// the run it interrupted.
+	//
+
+	struct Run
+	{
+		const wchar_t *script;
+		ParseSource source;
+		LONGLONG start;
+		bool parsing;
+		bool running;
+		Run *previous;
+	};
+
+	CompileStats(void);
+
+	//
+	// Brackets a run of a script on the calling thread. A run whose script the engine never
+	// reports compiled, because it failed to parse, isn't recorded.
+	//
+
+	void BeginRun(Run *run, const wchar_t *script, ParseSource source);
+	void EndRun(Run *run);
+
+	//
+	// Fed from the profiler's events. Calls only mark time for the functions compiled after
+	// them.
+	//
+
+	void ScriptCompiled(UINT32 scriptId);
+	void FunctionCompiled(UINT32 scriptId, const wchar_t *name);
+	void FunctionCalled(void);
+
+	//
+	// Prints the parse time percentiles over all scripts and for each script, the most
+	// expensive parses, and the functions that took longest to compile.
+	//
+
+	void PrintReport(FILE *stream);
+};
+
+//
+// Profiler callback that only passes compile events and calls on to compile statistics, for
+// -stats when the host isn't profiling.
+//
+
+class CompileEvents sealed : public IActiveScriptProfilerCallback
+{
+private:
+	long m_refCount;
+	CompileStats *m_stats;
+
+public:
+	CompileEvents(CompileStats *stats);
+
+	// IUnknown
+	HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void **ppvObj);
+	ULONG STDMETHODCALLTYPE AddRef(void);
+	ULONG STDMETHODCALLTYPE Release(void);
+
+	// IActiveScriptProfilerCallback
+	HRESULT STDMETHODCALLTYPE Initialize(DWORD dwContext);
+	HRESULT STDMETHODCALLTYPE Shutdown(HRESULT hrReason);
+	HRESULT STDMETHODCALLTYPE ScriptCompiled(PROFILER_TOKEN scriptId, PROFILER_SCRIPT_TYPE type, IUnknown *pIDebugDocumentContext);
+	HRESULT STDMETHODCALLTYPE FunctionCompiled(PROFILER_TOKEN functionId, PROFILER_TOKEN scriptId, const wchar_t *pwszFunctionName, const wchar_t *pwszFunctionNameHint, IUnknown *pIDebugDocumentContext);
+	HRESULT STDMETHODCALLTYPE OnFunctionEnter(PROFILER_TOKEN scriptId, PROFILER_TOKEN functionId);
+	HRESULT STDMETHODCALLTYPE OnFunctionExit(PROFILER_TOKEN scriptId, PROFILER_TOKEN functionId);
+};
+
+//
+// Runs a script, from its source or from its serialized form if one is given, within a run
+// of the compile statistics if there are any. For a cache miss the caller has already begun
+// the run before serializing the script, and ends it afterward.
+//
+
+JsErrorCode RunScriptTimed(CompileStats *stats, const wchar_t *script, BYTE *serialized, ParseSource source, JsSourceContext sourceContext, const wchar_t *sourceUrl, JsValueRef *result);
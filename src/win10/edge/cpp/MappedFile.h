@@ -0,0 +1,28 @@
+#pragma once
+
+//
+// A read-only view of a file on disk. The file is mapped into memory rather than read
+// into a heap buffer, so large scripts cost no copies until they are transcoded.
+//
+
+class MappedFile sealed
+{
+private:
+	HANDLE m_file;
+	HANDLE m_mapping;
+	const BYTE *m_data;
+	size_t m_size;
+
+	MappedFile(const MappedFile &);
+	MappedFile &operator=(const MappedFile &);
+
+public:
+	MappedFile(void);
+	~MappedFile(void);
+
+	bool Open(const wchar_t *fileName);
+	void Close(void);
+
+	const BYTE *Data(void) const { return m_data; }
+	size_t Size(void) const { return m_size; }
+};
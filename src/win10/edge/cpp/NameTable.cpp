@@ -0,0 +1,168 @@
+#include "stdafx.h"
+
+using namespace std;
+
+//
+// The cache the current thread uses, and the table it belongs to. As with the trace
+// writer's rings, tables get unique ids so a cache left behind by a table that's gone is
+// never mistaken for one of the current table's.
+//
+
+static __declspec(thread) void *currentCache = nullptr;
+static __declspec(thread) unsigned currentCacheTable = 0;
+static volatile long nextTableId = 0;
+
+NameTable::NameTable(void) :
+	m_id((unsigned) InterlockedIncrement(&nextTableId)),
+	m_caches(nullptr)
+{
+}
+
+NameTable::~NameTable(void)
+{
+	Cache *cache = m_caches.load();
+	while (cache != nullptr)
+	{
+		Cache *next = cache->next;
+		delete cache;
+		cache = next;
+	}
+}
+
+//
+// Names are at least two byte aligned, so the low bits of the pointer say little. Fibonacci
+// hashing spreads the rest over the top bits of the product.
+//
+
+size_t NameTable::Hash(const wchar_t *name)
+{
+	return (size_t) (((ULONGLONG) (UINT_PTR) name * 0x9E3779B97F4A7C15ULL) >> 32);
+}
+
+NameTable::Cache *NameTable::GetCache(void)
+{
+	if (currentCacheTable == m_id)
+	{
+		return (Cache *) currentCache;
+	}
+
+	Cache *cache = new Cache();
+	CacheSlot empty = {};
+	cache->slots.assign(InitialCacheCapacity, empty);
+	cache->count = 0;
+
+	cache->next = m_caches.load();
+	while (!m_caches.compare_exchange_weak(cache->next, cache))
+	{
+	}
+
+	currentCache = cache;
+	currentCacheTable = m_id;
+	return cache;
+}
+
+//
+// Caches are kept at most half full, so probes stay short.
+//
+
+void NameTable::Grow(Cache *cache)
+{
+	CacheSlot empty = {};
+	vector<CacheSlot> slots(cache->slots.size() * 2, empty);
+	size_t mask = slots.size() - 1;
+
+	for (size_t index = 0; index < cache->slots.size(); index++)
+	{
+		const CacheSlot &slot = cache->slots[index];
+
+		if (slot.name == nullptr)
+		{
+			continue;
+		}
+
+		size_t probe = Hash(slot.name) & mask;
+		while (slots[probe].name != nullptr)
+		{
+			probe = (probe + 1) & mask;
+		}
+
+		slots[probe] = slot;
+	}
+
+	cache->slots.swap(slots);
+}
+
+UINT32 NameTable::Intern(const wchar_t *name, const wchar_t **interned)
+{
+	lock_guard<mutex> lock(m_lock);
+	unordered_map<wstring, UINT32>::iterator found = m_ids.find(name);
+
+	if (found == m_ids.end())
+	{
+		found = m_ids.insert(make_pair(wstring(name), (UINT32) m_names.size())).first;
+		m_names.push_back(name);
+	}
+
+	//
+	// The deque never moves its strings, so the copy stays put for the caches to compare
+	// against.
+	//
+
+	*interned = m_names[found->second].c_str();
+	return found->second;
+}
+
+UINT32 NameTable::GetId(const wchar_t *name)
+{
+	Cache *cache = GetCache();
+	size_t mask = cache->slots.size() - 1;
+	size_t index = Hash(name) & mask;
+
+	while (cache->slots[index].name != nullptr)
+	{
+		CacheSlot &slot = cache->slots[index];
+
+		if (slot.name == name)
+		{
+			if (slot.interned[0] != name[0])
+			{
+				slot.id = Intern(name, &slot.interned);
+			}
+
+			return slot.id;
+		}
+
+		index = (index + 1) & mask;
+	}
+
+	CacheSlot &slot = cache->slots[index];
+	slot.name = name;
+	slot.id = Intern(name, &slot.interned);
+
+	UINT32 id = slot.id;
+
+	if (++cache->count * 2 > cache->slots.size())
+	{
+		Grow(cache);
+	}
+
+	return id;
+}
+
+wstring NameTable::GetName(UINT32 id) const
+{
+	lock_guard<mutex> lock(m_lock);
+	return id < m_names.size() ? m_names[id] : wstring();
+}
+
+size_t NameTable::GetNames(size_t first, vector<wstring> *names) const
+{
+	lock_guard<mutex> lock(m_lock);
+
+	for (size_t id = first; id < m_names.size(); id++)
+	{
+		names->push_back(m_names[id]);
+	}
+
+	return m_names.size();
+}
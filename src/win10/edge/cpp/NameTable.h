@@ -0,0 +1,68 @@
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+//
+// Interns the names of functions the engine only reports by name, giving each a small id
+// counting up from 0, so the profiler's call tree, sampler and trace only ever see the id.
+//
+// The engine passes the same name pointer each time a function is called, so each
+// thread keeps a flat open-addressed cache from name pointers to ids. A call only hashes the
+// pointer and checks the first character against the table's copy, which catches most
+// buffers the engine reuses for another name without reading the whole name. Names the
+// thread hasn't seen go to a table shared by every thread, under a lock.
+//
+
+class NameTable sealed
+{
+private:
+	static const size_t InitialCacheCapacity = 64;
+
+	struct CacheSlot
+	{
+		const wchar_t *name;
+		const wchar_t *interned;
+		UINT32 id;
+	};
+
+	struct Cache
+	{
+		std::vector<CacheSlot> slots;
+		size_t count;
+		Cache *next;
+	};
+
+	unsigned m_id;
+	std::atomic<Cache *> m_caches;
+
+	mutable std::mutex m_lock;
+	std::unordered_map<std::wstring, UINT32> m_ids;
+	std::deque<std::wstring> m_names;
+
+	NameTable(const NameTable &);
+	NameTable &operator=(const NameTable &);
+
+	static size_t Hash(const wchar_t *name);
+	static void Grow(Cache *cache);
+	Cache *GetCache(void);
+	UINT32 Intern(const wchar_t *name, const wchar_t **interned);
+
+public:
+	NameTable(void);
+	~NameTable(void);
+
+	UINT32 GetId(const wchar_t *name);
+	std::wstring GetName(UINT32 id) const;
+
+	//
+	// Copies the names with ids from first on, for consumers that pass the names along as
+	// they're added. Returns how many names there are in all.
+	//
+
+	size_t GetNames(size_t first, std::vector<std::wstring> *names) const;
+};
@@ -0,0 +1,102 @@
+#include "stdafx.h"
+
+OutputBuffer::OutputBuffer(HANDLE handle, size_t capacity) :
+	m_handle(handle),
+	m_buffer(new BYTE[capacity]),
+	m_size(0),
+	m_capacity(capacity)
+{
+}
+
+OutputBuffer::~OutputBuffer(void)
+{
+	Flush();
+	delete [] m_buffer;
+}
+
+bool OutputBuffer::ShouldBuffer(HANDLE handle)
+{
+	return handle != INVALID_HANDLE_VALUE && handle != nullptr && GetFileType(handle) != FILE_TYPE_CHAR;
+}
+
+bool OutputBuffer::WriteBytes(const BYTE *bytes, size_t length)
+{
+	if (m_handle == nullptr)
+	{
+		m_captured.append((const char *) bytes, length);
+		return true;
+	}
+
+	while (length > 0)
+	{
+		DWORD written;
+		DWORD chunk = length > MAXDWORD ? MAXDWORD : (DWORD) length;
+
+		if (!WriteFile(m_handle, bytes, chunk, &written, nullptr) || written == 0)
+		{
+			return false;
+		}
+
+		bytes += written;
+		length -= written;
+	}
+
+	return true;
+}
+
+void OutputBuffer::Write(const wchar_t *text, size_t length)
+{
+	size_t maximumLength = UTF8_LENGTH_FOR_UTF16(length);
+
+	if (m_size + maximumLength > m_capacity)
+	{
+		Flush();
+
+		//
+		// Text too big for the buffer even when it's empty gets transcoded and written
+		// on its own.
+		//
+
+		if (maximumLength > m_capacity)
+		{
+			BYTE *bytes = new BYTE[maximumLength];
+			size_t byteCount = Utf16ToUtf8((const uint16_t *) text, length, bytes);
+			WriteBytes(bytes, byteCount);
+			delete [] bytes;
+			return;
+		}
+	}
+
+	m_size += Utf16ToUtf8((const uint16_t *) text, length, m_buffer + m_size);
+}
+
+void OutputBuffer::WriteUtf8(const char *bytes, size_t length)
+{
+	if (m_size + length > m_capacity)
+	{
+		Flush();
+
+		if (length > m_capacity)
+		{
+			WriteBytes((const BYTE *) bytes, length);
+			return;
+		}
+	}
+
+	memcpy(m_buffer + m_size, bytes, length);
+	m_size += length;
+}
+
+bool OutputBuffer::Flush(void)
+{
+	bool succeeded = WriteBytes(m_buffer, m_size);
+	m_size = 0;
+	return succeeded;
+}
+
+void OutputBuffer::TakeCaptured(std::string &captured)
+{
+	Flush();
+	captured.clear();
+	captured.swap(m_captured);
+}
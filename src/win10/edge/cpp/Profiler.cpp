@@ -6,11 +6,27 @@
 
 using namespace std;
 
-Profiler::Profiler(void)
+Profiler::Profiler(const wchar_t *traceFileName, const wchar_t *stacksFileName, const wchar_t *pprofFileName, unsigned sampleRate, CompileStats *compileStats) :
+	m_traceFileName(traceFileName),
+	m_stacksFileName(stacksFileName),
+	m_pprofFileName(pprofFileName),
+	m_trace(&m_names),
+	m_tracing(false),
+	m_callTree(&m_names),
+	m_sampleRate(sampleRate),
+	m_sampler(&m_callTree),
+	m_compileStats(compileStats)
 {
 	m_refCount = 1;
 }
 
+LONGLONG Profiler::GetTimestamp(void)
+{
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	return now.QuadPart;
+}
+
 Profiler::~Profiler(void)
 {
 }
@@ -55,50 +71,218 @@ ULONG Profiler::Release()
 	return lw;
 }
 
+//
+// Traces whose file name ends in .json are written as Chrome trace-event JSON, so they can
+// be opened in chrome://tracing or Perfetto. Anything else gets the binary format.
+//
+
+static TraceFormat GetTraceFormat(const wstring &fileName)
+{
+	const wchar_t *extension = wcsrchr(fileName.c_str(), L'.');
+
+	return extension != nullptr && _wcsicmp(extension, L".json") == 0 ? TraceFormatChrome : TraceFormatBinary;
+}
+
 HRESULT Profiler::Initialize(DWORD dwContext)
 {
-	fwprintf(stdout, L"Profiler::Initialize: 0x%lx\n", dwContext);
+	if (m_sampleRate > 0)
+	{
+		m_sampler.Start(m_sampleRate);
+	}
+
+	if (m_traceFileName.empty())
+	{
+		return S_OK;
+	}
+
+	m_tracing = m_trace.Open(m_traceFileName.c_str(), GetTraceFormat(m_traceFileName));
+	if (!m_tracing)
+	{
+		fwprintf(stderr, L"chakrahost: unable to create trace file: %s.\n", m_traceFileName.c_str());
+		return S_OK;
+	}
+
+	m_trace.Record(TraceEventInitialize, dwContext, 0, GetTimestamp());
 	return S_OK;
 }
 
 HRESULT Profiler::Shutdown(HRESULT hrReason)
 {
-	fwprintf(stdout, L"Profiler::Shutdown: 0x%lx\n", hrReason);
+	LONGLONG timestamp = GetTimestamp();
+
+	if (m_tracing)
+	{
+		m_trace.Record(TraceEventShutdown, (UINT32) hrReason, 0, timestamp);
+		m_trace.Close();
+		m_trace.PrintSummary(m_traceFileName.c_str());
+		m_tracing = false;
+	}
+
+	if (m_sampleRate > 0)
+	{
+		m_sampler.Stop();
+		m_sampler.PrintSummary();
+	}
+
+	m_callTree.Finish(timestamp);
+
+	if (!m_callTree.WriteCollapsedStacks(m_stacksFileName.c_str()))
+	{
+		fwprintf(stderr, L"chakrahost: unable to write stacks file: %s.\n", m_stacksFileName.c_str());
+	}
+
+	if (!m_callTree.WriteProfile(m_pprofFileName.c_str()))
+	{
+		fwprintf(stderr, L"chakrahost: unable to write profile file: %s.\n", m_pprofFileName.c_str());
+	}
+
+	m_callTree.PrintReport(stderr, CallTree::DefaultReportCount);
 	return S_OK;
 }
 
 HRESULT Profiler::ScriptCompiled(PROFILER_TOKEN scriptId, PROFILER_SCRIPT_TYPE type, IUnknown *pIDebugDocumentContext)
 {
-	fwprintf(stdout, L"Profiler::ScriptCompiled: 0x%lx, %u\n", scriptId, type);
+	if (m_compileStats != nullptr)
+	{
+		m_compileStats->ScriptCompiled(scriptId);
+	}
+
+	if (m_tracing)
+	{
+		m_trace.Record(TraceEventScriptCompiled, scriptId, type, GetTimestamp());
+	}
+
 	return S_OK;
 }
 
 HRESULT Profiler::FunctionCompiled(PROFILER_TOKEN functionId, PROFILER_TOKEN scriptId, const wchar_t *pwszFunctionName, const wchar_t *pwszFunctionNameHint, IUnknown *pIDebugDocumentContext)
 {
-	fwprintf(stdout, L"Profiler::FunctionCompiled: 0x%lx, 0x%lx, %s, %s\n", scriptId, functionId, pwszFunctionName, pwszFunctionNameHint);
+	if (m_sampleRate > 0)
+	{
+		m_sampler.SetName(scriptId, functionId, pwszFunctionName, pwszFunctionNameHint);
+	}
+	else
+	{
+		m_callTree.SetName(scriptId, functionId, pwszFunctionName, pwszFunctionNameHint);
+	}
+
+	if (m_compileStats != nullptr)
+	{
+		m_compileStats->FunctionCompiled(scriptId, pwszFunctionName);
+	}
+
+	if (m_tracing)
+	{
+		m_trace.RecordFunctionCompiled(scriptId, functionId, pwszFunctionName, pwszFunctionNameHint);
+	}
+
 	return S_OK;
 }
 
 HRESULT Profiler::OnFunctionEnter(PROFILER_TOKEN scriptId, PROFILER_TOKEN functionId)
 {
-	fwprintf(stdout, L"Profiler::OnFunctionEnter: 0x%lx, 0x%lx\n", scriptId, functionId);
+	if (m_compileStats != nullptr)
+	{
+		m_compileStats->FunctionCalled();
+	}
+
+	//
+	// When sampling, calls only go on the shadow stack. The sampling thread does the rest.
+	//
+
+	if (m_sampleRate > 0)
+	{
+		m_sampler.Enter(scriptId, functionId);
+		return S_OK;
+	}
+
+	LONGLONG timestamp = GetTimestamp();
+
+	m_callTree.Enter(scriptId, functionId, timestamp);
+
+	if (m_tracing)
+	{
+		m_trace.Record(TraceEventFunctionEnter, scriptId, functionId, timestamp);
+	}
+
 	return S_OK;
 }
 
 HRESULT Profiler::OnFunctionExit(PROFILER_TOKEN scriptId, PROFILER_TOKEN functionId)
 {
-	fwprintf(stdout, L"Profiler::OnFunctionExit: 0x%lx, 0x%lx\n", scriptId, functionId);
+	if (m_compileStats != nullptr)
+	{
+		m_compileStats->FunctionCalled();
+	}
+
+	if (m_sampleRate > 0)
+	{
+		m_sampler.Exit(scriptId, functionId);
+		return S_OK;
+	}
+
+	LONGLONG timestamp = GetTimestamp();
+
+	m_callTree.Exit(scriptId, functionId, timestamp);
+
+	if (m_tracing)
+	{
+		m_trace.Record(TraceEventFunctionExit, scriptId, functionId, timestamp);
+	}
+
 	return S_OK;
 }
 
 HRESULT Profiler::OnFunctionEnterByName(const wchar_t *pwszFunctionName, PROFILER_SCRIPT_TYPE type)
 {
-	fwprintf(stdout, L"Profiler::OnFunctionEnterByName: %s, %u\n", pwszFunctionName, type);
+	if (m_compileStats != nullptr)
+	{
+		m_compileStats->FunctionCalled();
+	}
+
+	UINT32 nameId = m_names.GetId(pwszFunctionName);
+
+	if (m_sampleRate > 0)
+	{
+		m_sampler.EnterByName(nameId);
+		return S_OK;
+	}
+
+	LONGLONG timestamp = GetTimestamp();
+
+	m_callTree.EnterByName(nameId, timestamp);
+
+	if (m_tracing)
+	{
+		m_trace.RecordByName(TraceEventFunctionEnterByName, nameId, type, timestamp);
+	}
+
 	return S_OK;
 }
 
 HRESULT Profiler::OnFunctionExitByName(const wchar_t *pwszFunctionName, PROFILER_SCRIPT_TYPE type)
 {
-	fwprintf(stdout, L"Profiler::OnFunctionExitByName: %s, %u\n", pwszFunctionName, type);
+	if (m_compileStats != nullptr)
+	{
+		m_compileStats->FunctionCalled();
+	}
+
+	UINT32 nameId = m_names.GetId(pwszFunctionName);
+
+	if (m_sampleRate > 0)
+	{
+		m_sampler.ExitByName(nameId);
+		return S_OK;
+	}
+
+	LONGLONG timestamp = GetTimestamp();
+
+	m_callTree.ExitByName(nameId, timestamp);
+
+	if (m_tracing)
+	{
+		m_trace.RecordByName(TraceEventFunctionExitByName, nameId, type, timestamp);
+	}
+
 	return S_OK;
 }
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <string>
+
+//
+// Decodes the raw bytes of a script into the UTF-16 the engine expects: UTF-16LE when the
+// bytes start with its byte order mark, and UTF-8, with or without one, otherwise.
+//
+
+std::wstring DecodeScript(const BYTE *bytes, size_t lengthBytes);
+
+//
+// Maps a script file and decodes it, reporting any problem and returning an empty string.
+//
+
+std::wstring LoadScript(std::wstring fileName);
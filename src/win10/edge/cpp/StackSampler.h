@@ -0,0 +1,93 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//
+// Samples the script's call stacks at a fixed rate, as a cheaper alternative to timing every
+// call. Enter and exit events only push and pop a function key on their thread's shadow
+// stack, with no timestamp, lookup or I/O. A sampling thread copies each shadow stack on
+// every tick and adds it to a call tree, weighted by the time since the last tick, so the
+// tree's times are estimates of the ones a full trace measures.
+//
+
+class StackSampler sealed
+{
+private:
+	static const size_t MaximumDepth = 1024;
+	static const unsigned MaximumCopyAttempts = 4;
+
+	//
+	// Only a stack's own thread changes it. The version is odd while a change is being
+	// made, so the sampling thread can tell that a copy it took was torn and take another.
+	// Calls deeper than the stack holds are counted but not kept.
+	//
+
+	struct ShadowStack
+	{
+		std::atomic<unsigned> version;
+		size_t depth;
+		ULONGLONG frames[MaximumDepth];
+		ShadowStack *next;
+	};
+
+	CallTree *m_callTree;
+	std::mutex m_treeLock;
+	unsigned m_id;
+	std::atomic<ShadowStack *> m_stacks;
+	std::atomic<unsigned> m_stackCount;
+
+	std::thread m_samplingThread;
+	std::mutex m_stopLock;
+	std::condition_variable m_stop;
+	bool m_stopping;
+	bool m_running;
+
+	unsigned m_rate;
+	ULONGLONG m_ticks;
+	ULONGLONG m_samples;
+	ULONGLONG m_tornCopies;
+	LONGLONG m_elapsedTicks;
+	double m_nanosecondsPerCall;
+
+	StackSampler(const StackSampler &);
+	StackSampler &operator=(const StackSampler &);
+
+	ShadowStack *GetStack(void);
+	static void Push(ShadowStack *stack, ULONGLONG function);
+	static void Pop(ShadowStack *stack, ULONGLONG function);
+	static bool Copy(ShadowStack *stack, std::vector<ULONGLONG> *frames);
+	void Sample(LONGLONG ticks, std::vector<ULONGLONG> *frames);
+	void SamplingThread(void);
+	static double MeasureCallCost(void);
+
+public:
+	static const unsigned MaximumRate = 10000;
+
+	StackSampler(CallTree *callTree);
+	~StackSampler(void);
+
+	void Start(unsigned rate);
+	void Stop(void);
+
+	//
+	// Names go straight into the call tree, under a lock, since they only come with
+	// compilation. Functions entered by name come by their id in the profiler's name table.
+	//
+
+	void SetName(UINT32 scriptId, UINT32 functionId, const wchar_t *name, const wchar_t *hint);
+	void Enter(UINT32 scriptId, UINT32 functionId);
+	void Exit(UINT32 scriptId, UINT32 functionId);
+	void EnterByName(UINT32 nameId);
+	void ExitByName(UINT32 nameId);
+
+	//
+	// Prints how many stacks were sampled, the rate sampling actually ran at and what an
+	// enter and exit cost the script. Only valid once sampling has stopped.
+	//
+
+	void PrintSummary(void);
+};
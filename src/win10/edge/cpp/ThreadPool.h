@@ -0,0 +1,88 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//
+// Counters describing the work a thread pool has done so far.
+//
+
+struct ThreadPoolStatistics
+{
+	unsigned threadCount;
+	ULONGLONG submitted;
+	ULONGLONG rejected;
+	ULONGLONG executed;
+	ULONGLONG steals;
+	ULONGLONG queueDepth;
+	ULONGLONG maximumQueueDepth;
+	double averageWaitMilliseconds;
+	double maximumWaitMilliseconds;
+	double averageRunMilliseconds;
+	double maximumRunMilliseconds;
+};
+
+//
+// A bounded, work-stealing thread pool that runs the engine's background work (JIT and GC)
+// for every runtime the host creates, instead of each runtime spinning up threads of its
+// own. Each pool thread has its own queue: work submitted from a pool thread goes on that
+// thread's queue, and work submitted from anywhere else is spread across the queues. Idle
+// threads steal from the other queues. When the pool is holding as many items as it is
+// allowed to, it declines new work and the engine does that work itself.
+//
+
+class ThreadPool sealed
+{
+private:
+	struct WorkItem
+	{
+		JsBackgroundWorkItemCallback callback;
+		void *callbackState;
+		LONGLONG submitTime;
+	};
+
+	struct WorkQueue
+	{
+		std::mutex lock;
+		std::deque<WorkItem> items;
+	};
+
+	std::vector<WorkQueue *> m_queues;
+	std::vector<std::thread> m_threads;
+	size_t m_capacity;
+	double m_ticksPerMillisecond;
+
+	std::mutex m_sleepLock;
+	std::condition_variable m_wake;
+	std::atomic<size_t> m_pending;
+	std::atomic<unsigned> m_nextQueue;
+	std::atomic<bool> m_shutdown;
+
+	std::atomic<ULONGLONG> m_submitted;
+	std::atomic<ULONGLONG> m_rejected;
+	std::atomic<ULONGLONG> m_executed;
+	std::atomic<ULONGLONG> m_steals;
+	std::atomic<ULONGLONG> m_maximumQueueDepth;
+	std::atomic<ULONGLONG> m_totalWaitTicks;
+	std::atomic<ULONGLONG> m_maximumWaitTicks;
+	std::atomic<ULONGLONG> m_totalRunTicks;
+	std::atomic<ULONGLONG> m_maximumRunTicks;
+
+	ThreadPool(const ThreadPool &);
+	ThreadPool &operator=(const ThreadPool &);
+
+	bool TryTake(unsigned index, WorkItem &item);
+	void Run(unsigned index);
+
+public:
+	ThreadPool(unsigned threadCount, size_t capacity);
+	~ThreadPool(void);
+
+	bool Submit(JsBackgroundWorkItemCallback callback, void *callbackState);
+	void Shutdown(void);
+	void GetStatistics(ThreadPoolStatistics &statistics);
+};
@@ -0,0 +1,557 @@
+#include "stdafx.h"
+#include <algorithm>
+#include <vector>
+
+using namespace std;
+
+//
+// The ring the current thread records into, and the writer it belongs to. Writers get
+// unique ids, so a ring left behind by a writer that's gone is never mistaken for one of
+// the current writer's.
+//
+
+static __declspec(thread) void *currentRing = nullptr;
+static __declspec(thread) unsigned currentRingWriter = 0;
+static volatile long nextWriterId = 0;
+
+TraceWriter::TraceWriter(const NameTable *nameTable) :
+	m_file(INVALID_HANDLE_VALUE),
+	m_chrome(nullptr),
+	m_nameTable(nameTable),
+	m_namesWritten(0),
+	m_id((unsigned) InterlockedIncrement(&nextWriterId)),
+	m_rings(nullptr),
+	m_ringCount(0),
+	m_stopping(false),
+	m_bytesWritten(0),
+	m_nanosecondsPerEvent(0)
+{
+}
+
+TraceWriter::~TraceWriter(void)
+{
+	Close();
+
+	Ring *ring = m_rings.load();
+	while (ring != nullptr)
+	{
+		Ring *next = ring->next;
+		delete ring;
+		ring = next;
+	}
+}
+
+bool TraceWriter::Open(const wchar_t *fileName, TraceFormat format)
+{
+	m_file = CreateFileW(fileName, GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (m_file == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+
+	LARGE_INTEGER frequency;
+	LARGE_INTEGER start;
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&start);
+
+	if (format == TraceFormatChrome)
+	{
+		m_chrome = new ChromeTraceFormatter(m_file, start.QuadPart, frequency.QuadPart);
+		m_chrome->Begin();
+	}
+	else
+	{
+		TraceFileHeader header = {};
+		header.magic = TraceFileMagic;
+		header.version = TraceFileVersion;
+		header.ticksPerSecond = frequency.QuadPart;
+		header.eventSize = sizeof(TraceEvent);
+
+		if (!WriteBytes(&header, sizeof(header)))
+		{
+			CloseHandle(m_file);
+			m_file = INVALID_HANDLE_VALUE;
+			return false;
+		}
+	}
+
+	m_nanosecondsPerEvent = MeasureEventCost();
+	m_stopping = false;
+	m_drainThread = thread(&TraceWriter::DrainThread, this);
+	return true;
+}
+
+void TraceWriter::Close(void)
+{
+	if (m_file == INVALID_HANDLE_VALUE)
+	{
+		return;
+	}
+
+	{
+		lock_guard<mutex> lock(m_stopLock);
+		m_stopping = true;
+	}
+
+	m_stop.notify_one();
+	m_drainThread.join();
+
+	if (m_chrome != nullptr)
+	{
+		m_chrome->End();
+		m_bytesWritten = m_chrome->BytesWritten();
+		delete m_chrome;
+		m_chrome = nullptr;
+	}
+
+	CloseHandle(m_file);
+	m_file = INVALID_HANDLE_VALUE;
+}
+
+TraceWriter::Ring *TraceWriter::GetRing(void)
+{
+	if (currentRingWriter == m_id)
+	{
+		return (Ring *) currentRing;
+	}
+
+	Ring *ring = new Ring();
+	ring->head = 0;
+	ring->tail = 0;
+	ring->thread = (UINT16) m_ringCount++;
+	ring->recorded = 0;
+	ring->stalls = 0;
+
+	//
+	// Rings are only ever added, so the drain thread can walk the list without a lock.
+	//
+
+	ring->next = m_rings.load();
+	while (!m_rings.compare_exchange_weak(ring->next, ring))
+	{
+	}
+
+	currentRing = ring;
+	currentRingWriter = m_id;
+	return ring;
+}
+
+void TraceWriter::Push(Ring *ring, TraceEventKind kind, UINT32 scriptId, UINT32 functionId, ULONGLONG timestamp)
+{
+	size_t head = ring->head.load(memory_order_relaxed);
+
+	if (head - ring->tail.load(memory_order_acquire) >= RingCapacity)
+	{
+		ring->stalls++;
+
+		do
+		{
+			SwitchToThread();
+		} while (head - ring->tail.load(memory_order_acquire) >= RingCapacity);
+	}
+
+	TraceEvent &event = ring->events[head & (RingCapacity - 1)];
+	event.timestamp = timestamp;
+	event.scriptId = scriptId;
+	event.functionId = functionId;
+	event.kind = (UINT16) kind;
+	event.thread = ring->thread;
+	event.length = 0;
+
+	ring->recorded++;
+	ring->head.store(head + 1, memory_order_release);
+}
+
+void TraceWriter::Record(TraceEventKind kind, UINT32 scriptId, UINT32 functionId, ULONGLONG timestamp)
+{
+	Push(GetRing(), kind, scriptId, functionId, timestamp);
+}
+
+void TraceWriter::AppendNameRecord(string &records, TraceEventKind kind, UINT32 scriptId, UINT32 functionId, const wchar_t *name, const wchar_t *hint, UINT16 thread)
+{
+	size_t nameLength = name == nullptr ? 0 : wcslen(name);
+	size_t hintLength = hint == nullptr ? 0 : wcslen(hint);
+	vector<uint8_t> payload(UTF8_LENGTH_FOR_UTF16(nameLength + hintLength) + 1);
+	size_t length = Utf16ToUtf8((const uint16_t *) name, nameLength, &payload[0]);
+
+	if (kind == TraceEventFunctionCompiled)
+	{
+		payload[length++] = 0;
+		length += Utf16ToUtf8((const uint16_t *) hint, hintLength, &payload[length]);
+	}
+
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+
+	TraceEvent event;
+	event.timestamp = now.QuadPart;
+	event.scriptId = scriptId;
+	event.functionId = functionId;
+	event.kind = (UINT16) kind;
+	event.thread = thread;
+	event.length = (UINT32) length;
+
+	records.append((const char *) &event, sizeof(event));
+	records.append((const char *) &payload[0], length);
+}
+
+//
+// Compile events carry names and are rare, so they skip the ring and go straight onto a
+// locked list that the drain thread writes out.
+//
+
+void TraceWriter::RecordFunctionCompiled(UINT32 scriptId, UINT32 functionId, const wchar_t *name, const wchar_t *hint)
+{
+	UINT16 thread = GetRing()->thread;
+
+	lock_guard<mutex> lock(m_nameLock);
+	AppendNameRecord(m_pendingNames, TraceEventFunctionCompiled, scriptId, functionId, name, hint, thread);
+}
+
+void TraceWriter::RecordByName(TraceEventKind kind, UINT32 nameId, UINT32 type, ULONGLONG timestamp)
+{
+	Push(GetRing(), kind, type, nameId, timestamp);
+}
+
+bool TraceWriter::WriteBytes(const void *bytes, size_t length)
+{
+	const BYTE *current = (const BYTE *) bytes;
+
+	while (length > 0)
+	{
+		DWORD written;
+		DWORD chunk = length > MAXDWORD ? MAXDWORD : (DWORD) length;
+
+		if (!WriteFile(m_file, current, chunk, &written, nullptr) || written == 0)
+		{
+			return false;
+		}
+
+		current += written;
+		length -= written;
+		m_bytesWritten += written;
+	}
+
+	return true;
+}
+
+//
+// Write out everything recorded so far. Events are written straight from the rings; a
+// ring's space is only handed back to its thread once its events are on their way to disk.
+//
+// Each ring's head is read before the names are taken, so the names of every function
+// whose events are drained go out with them or before them. A Chrome trace names its
+// slices as it writes them, so it can't wait for a name that comes later. Names from the
+// name table are written as Name events the first time a drain finds them.
+//
+
+void TraceWriter::Drain(void)
+{
+	string names;
+
+	m_drainHeads.clear();
+
+	for (Ring *ring = m_rings.load(memory_order_acquire); ring != nullptr; ring = ring->next)
+	{
+		m_drainHeads.push_back(make_pair(ring, ring->head.load(memory_order_acquire)));
+	}
+
+	{
+		lock_guard<mutex> lock(m_nameLock);
+		names.swap(m_pendingNames);
+	}
+
+	m_newNames.clear();
+	size_t nameCount = m_nameTable->GetNames(m_namesWritten, &m_newNames);
+
+	for (size_t index = 0; index < m_newNames.size(); index++)
+	{
+		AppendNameRecord(names, TraceEventName, 0, (UINT32) (m_namesWritten + index), m_newNames[index].c_str(), nullptr, 0);
+	}
+
+	m_namesWritten = nameCount;
+
+	if (!names.empty())
+	{
+		if (m_chrome != nullptr)
+		{
+			m_chrome->WriteNameRecords((const BYTE *) names.c_str(), names.length());
+		}
+		else
+		{
+			WriteBytes(names.c_str(), names.length());
+		}
+	}
+
+	for (size_t ringIndex = 0; ringIndex < m_drainHeads.size(); ringIndex++)
+	{
+		Ring *ring = m_drainHeads[ringIndex].first;
+		size_t head = m_drainHeads[ringIndex].second;
+		size_t tail = ring->tail.load(memory_order_relaxed);
+
+		while (tail != head)
+		{
+			size_t index = tail & (RingCapacity - 1);
+			size_t count = head - tail;
+
+			if (count > RingCapacity - index)
+			{
+				count = RingCapacity - index;
+			}
+
+			if (m_chrome != nullptr)
+			{
+				m_chrome->WriteEvents(&ring->events[index], count);
+			}
+			else
+			{
+				WriteBytes(&ring->events[index], count * sizeof(TraceEvent));
+			}
+
+			tail += count;
+		}
+
+		ring->tail.store(tail, memory_order_release);
+	}
+}
+
+void TraceWriter::DrainThread(void)
+{
+	unique_lock<mutex> lock(m_stopLock);
+
+	while (!m_stopping)
+	{
+		lock.unlock();
+		Drain();
+		lock.lock();
+
+		m_stop.wait_for(lock, chrono::milliseconds(DrainIntervalMilliseconds));
+	}
+
+	//
+	// The writer is only closed once recording is over, so this gets everything.
+	//
+
+	lock.unlock();
+	Drain();
+}
+
+//
+// Time the recording path on a ring of our own, so the cost reported is what the profiled
+// script pays per event, timestamp included. The first pass just touches the ring's pages.
+//
+
+double TraceWriter::MeasureEventCost(void)
+{
+	const size_t count = RingCapacity / 2;
+	Ring *ring = new Ring();
+	LARGE_INTEGER frequency;
+	LARGE_INTEGER start;
+	LARGE_INTEGER end;
+
+	QueryPerformanceFrequency(&frequency);
+	ring->thread = 0;
+
+	for (int pass = 0; pass < 2; pass++)
+	{
+		ring->head = 0;
+		ring->tail = 0;
+
+		QueryPerformanceCounter(&start);
+
+		for (size_t index = 0; index < count; index++)
+		{
+			LARGE_INTEGER now;
+			QueryPerformanceCounter(&now);
+			Push(ring, TraceEventFunctionEnter, 0, (UINT32) index, now.QuadPart);
+		}
+
+		QueryPerformanceCounter(&end);
+	}
+
+	delete ring;
+	return (end.QuadPart - start.QuadPart) * 1e9 / frequency.QuadPart / count;
+}
+
+void TraceWriter::PrintSummary(const wchar_t *fileName)
+{
+	ULONGLONG recorded = 0;
+	ULONGLONG stalls = 0;
+
+	for (Ring *ring = m_rings.load(); ring != nullptr; ring = ring->next)
+	{
+		recorded += ring->recorded;
+		stalls += ring->stalls;
+	}
+
+	fwprintf(stderr, L"chakrahost: trace: %llu events on %u threads, %llu stalls, %llu bytes written to %s, %.1f ns per event\n",
+		recorded, (unsigned) m_ringCount, stalls, m_bytesWritten, fileName, m_nanosecondsPerEvent);
+}
+
+//
+// Decoding. Events from different threads are interleaved in the file in the order they
+// were drained, so they're put back in timestamp order before printing.
+//
+
+static wstring DecodeName(const BYTE *bytes, size_t length)
+{
+	wstring name;
+
+	if (length > 0)
+	{
+		name.resize(UTF16_LENGTH_FOR_UTF8(length));
+		name.resize(Utf8ToUtf16(bytes, length, (uint16_t *) &name[0]));
+	}
+
+	return name;
+}
+
+static bool CompareEvents(const TraceEvent *left, const TraceEvent *right)
+{
+	return left->timestamp < right->timestamp;
+}
+
+bool DecodeTrace(const wchar_t *fileName, OutputBuffer &output)
+{
+	MappedFile file;
+	if (!file.Open(fileName))
+	{
+		fwprintf(stderr, L"chakrahost: unable to open file: %s.\n", fileName);
+		return false;
+	}
+
+	const BYTE *data = file.Data();
+	size_t size = file.Size();
+	const TraceFileHeader *header = (const TraceFileHeader *) data;
+
+	if (size < sizeof(TraceFileHeader) ||
+		header->magic != TraceFileMagic ||
+		header->version != TraceFileVersion ||
+		header->eventSize != sizeof(TraceEvent))
+	{
+		fwprintf(stderr, L"chakrahost: not a trace file: %s.\n", fileName);
+		return false;
+	}
+
+	//
+	// First pass: find the events and the names that go with them.
+	//
+
+	vector<const TraceEvent *> events;
+	unordered_map<ULONGLONG, wstring> functionNames;
+	unordered_map<UINT32, wstring> names;
+	size_t offset = sizeof(TraceFileHeader);
+
+	while (size - offset >= sizeof(TraceEvent))
+	{
+		const TraceEvent *event = (const TraceEvent *) (data + offset);
+		const BYTE *payload = data + offset + sizeof(TraceEvent);
+
+		if (event->length > size - offset - sizeof(TraceEvent))
+		{
+			fwprintf(stderr, L"chakrahost: trace file is truncated: %s.\n", fileName);
+			break;
+		}
+
+		if (event->kind == TraceEventFunctionCompiled)
+		{
+			const BYTE *separator = (const BYTE *) memchr(payload, 0, event->length);
+			size_t nameLength = separator == nullptr ? event->length : separator - payload;
+
+			functionNames[((ULONGLONG) event->scriptId << 32) | event->functionId] = DecodeName(payload, nameLength);
+		}
+		else if (event->kind == TraceEventName)
+		{
+			names[event->functionId] = DecodeName(payload, event->length);
+		}
+
+		events.push_back(event);
+		offset += sizeof(TraceEvent) + event->length;
+	}
+
+	if (events.empty())
+	{
+		return true;
+	}
+
+	stable_sort(events.begin(), events.end(), CompareEvents);
+
+	//
+	// Second pass: print them. Times are relative to the first event.
+	//
+
+	ULONGLONG start = events[0]->timestamp;
+	double ticksPerMillisecond = header->ticksPerSecond / 1000.0;
+	wchar_t line[256];
+
+	for (size_t index = 0; index < events.size(); index++)
+	{
+		const TraceEvent *event = events[index];
+		const BYTE *payload = (const BYTE *) (event + 1);
+		wstring name;
+
+		swprintf_s(line, L"%12.3f ms [thread %u] ", (event->timestamp - start) / ticksPerMillisecond, event->thread);
+		output.Write(line);
+
+		switch (event->kind)
+		{
+		case TraceEventInitialize:
+			swprintf_s(line, L"Profiler::Initialize: 0x%x", event->scriptId);
+			break;
+
+		case TraceEventShutdown:
+			swprintf_s(line, L"Profiler::Shutdown: 0x%x", event->scriptId);
+			break;
+
+		case TraceEventScriptCompiled:
+			swprintf_s(line, L"Profiler::ScriptCompiled: 0x%x, %u", event->scriptId, event->functionId);
+			break;
+
+		case TraceEventFunctionCompiled:
+		{
+			const BYTE *separator = (const BYTE *) memchr(payload, 0, event->length);
+
+			swprintf_s(line, L"Profiler::FunctionCompiled: 0x%x, 0x%x, ", event->scriptId, event->functionId);
+			name = DecodeName(payload, separator == nullptr ? event->length : separator - payload);
+
+			if (separator != nullptr)
+			{
+				name += L", " + DecodeName(separator + 1, event->length - (separator + 1 - payload));
+			}
+			break;
+		}
+
+		case TraceEventFunctionEnter:
+		case TraceEventFunctionExit:
+			swprintf_s(line, event->kind == TraceEventFunctionEnter ?
+				L"Profiler::OnFunctionEnter: 0x%x, 0x%x " :
+				L"Profiler::OnFunctionExit: 0x%x, 0x%x ",
+				event->scriptId, event->functionId);
+			name = functionNames[((ULONGLONG) event->scriptId << 32) | event->functionId];
+			break;
+
+		case TraceEventFunctionEnterByName:
+		case TraceEventFunctionExitByName:
+			wcscpy_s(line, event->kind == TraceEventFunctionEnterByName ?
+				L"Profiler::OnFunctionEnterByName: " :
+				L"Profiler::OnFunctionExitByName: ");
+			name = names[event->functionId] + L", " + to_wstring(event->scriptId);
+			break;
+
+		case TraceEventName:
+			swprintf_s(line, L"name 0x%x: ", event->functionId);
+			name = names[event->functionId];
+			break;
+
+		default:
+			swprintf_s(line, L"unknown event %u", event->kind);
+			break;
+		}
+
+		output.Write(line);
+		output.Write(name.c_str(), name.length());
+		output.Write(L"\r\n", 2);
+	}
+
+	return true;
+}
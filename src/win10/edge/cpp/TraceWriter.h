@@ -0,0 +1,167 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+//
+// The kinds of events in a profiler trace.
+//
+
+enum TraceEventKind
+{
+	TraceEventInitialize,
+	TraceEventShutdown,
+	TraceEventScriptCompiled,
+	TraceEventFunctionCompiled,
+	TraceEventFunctionEnter,
+	TraceEventFunctionExit,
+	TraceEventFunctionEnterByName,
+	TraceEventFunctionExitByName,
+	TraceEventName
+};
+
+//
+// A single trace event, exactly as it is laid out in a trace file. Events that carry a name
+// (FunctionCompiled and Name) are followed in the file by length bytes of UTF-8. For
+// FunctionCompiled that's the function name, a nul, and the name hint. Functions entered by
+// name are named by a Name event for their id in the profiler's name table, which their
+// enter and exit events carry in place of a function id.
+//
+
+struct TraceEvent
+{
+	ULONGLONG timestamp;
+	UINT32 scriptId;
+	UINT32 functionId;
+	UINT16 kind;
+	UINT16 thread;
+	UINT32 length;
+};
+
+//
+// The header at the start of a trace file. Timestamps are performance counter ticks.
+//
+
+struct TraceFileHeader
+{
+	UINT32 magic;
+	UINT32 version;
+	ULONGLONG ticksPerSecond;
+	UINT32 eventSize;
+	UINT32 reserved;
+};
+
+const UINT32 TraceFileMagic = 'CHTR';
+const UINT32 TraceFileVersion = 1;
+
+//
+// The formats a trace can be written in: the compact binary one above, which -dumptrace
+// decodes, or Chrome trace-event JSON for chrome://tracing and Perfetto.
+//
+
+enum TraceFormat
+{
+	TraceFormatBinary,
+	TraceFormatChrome
+};
+
+class ChromeTraceFormatter;
+
+//
+// Records profiler events into a per-thread ring buffer and writes them to a trace file from
+// a background thread, so the profiled script only pays for a timestamp and a few stores
+// per event. Each ring has a single producer (its thread) and a single consumer (the drain
+// thread), so recording takes no locks. A producer that finds its ring full waits for the
+// drain thread rather than dropping events, so traces are always complete.
+//
+
+class TraceWriter sealed
+{
+private:
+	static const size_t RingCapacity = 256 * 1024;
+	static const DWORD DrainIntervalMilliseconds = 2;
+
+	//
+	// The producer and consumer indexes are kept on separate cache lines so the two threads
+	// don't contend for them.
+	//
+
+	struct Ring
+	{
+		std::atomic<size_t> head;
+		char headPadding[64 - sizeof(size_t)];
+		std::atomic<size_t> tail;
+		char tailPadding[64 - sizeof(size_t)];
+		TraceEvent events[RingCapacity];
+		Ring *next;
+		UINT16 thread;
+		ULONGLONG recorded;
+		ULONGLONG stalls;
+	};
+
+	HANDLE m_file;
+	ChromeTraceFormatter *m_chrome;
+	const NameTable *m_nameTable;
+	size_t m_namesWritten;
+	unsigned m_id;
+	std::atomic<Ring *> m_rings;
+	std::atomic<unsigned> m_ringCount;
+
+	std::mutex m_nameLock;
+	std::string m_pendingNames;
+	std::vector<std::wstring> m_newNames;
+	std::vector<std::pair<Ring *, size_t>> m_drainHeads;
+
+	std::thread m_drainThread;
+	std::mutex m_stopLock;
+	std::condition_variable m_stop;
+	bool m_stopping;
+
+	ULONGLONG m_bytesWritten;
+	double m_nanosecondsPerEvent;
+
+	TraceWriter(const TraceWriter &);
+	TraceWriter &operator=(const TraceWriter &);
+
+	Ring *GetRing(void);
+	static void Push(Ring *ring, TraceEventKind kind, UINT32 scriptId, UINT32 functionId, ULONGLONG timestamp);
+	static void AppendNameRecord(std::string &records, TraceEventKind kind, UINT32 scriptId, UINT32 functionId, const wchar_t *name, const wchar_t *hint, UINT16 thread);
+	bool WriteBytes(const void *bytes, size_t length);
+	void Drain(void);
+	void DrainThread(void);
+	static double MeasureEventCost(void);
+
+public:
+	TraceWriter(const NameTable *nameTable);
+	~TraceWriter(void);
+
+	bool Open(const wchar_t *fileName, TraceFormat format);
+	void Close(void);
+
+	//
+	// Events are stamped with the caller's performance counter reading, so a caller that
+	// also needs the time only reads the counter once.
+	//
+
+	void Record(TraceEventKind kind, UINT32 scriptId, UINT32 functionId, ULONGLONG timestamp);
+	void RecordByName(TraceEventKind kind, UINT32 nameId, UINT32 type, ULONGLONG timestamp);
+	void RecordFunctionCompiled(UINT32 scriptId, UINT32 functionId, const wchar_t *name, const wchar_t *hint);
+
+	//
+	// Prints how many events were recorded, how often a thread had to wait for the drain
+	// thread and what recording an event costs. Only valid once the writer is closed.
+	//
+
+	void PrintSummary(const wchar_t *fileName);
+};
+
+//
+// Decodes a trace file written by TraceWriter into text, one event per line.
+//
+
+bool DecodeTrace(const wchar_t *fileName, OutputBuffer &output);
@@ -0,0 +1,173 @@
+#pragma once
+
+#include <activprof.h>
+#include <deque>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "SnapshotStream.h"
+
+//
+// A compact binary alternative to the snapshot JSON. A snapshot starts with a header and the
+// engine's name table, followed by one record per heap object and an end tag:
+//
+//   header:   magic, version and pointer size, each a little-endian UINT32
+//   names:    varint count, then for each name a varint that is zero if the engine has no
+//             name for that id, and one followed by a varint UTF-8 length and the bytes
+//             if it does
+//   object:   varint tag (1), then varint flags, zigzag varint delta from the previous
+//             object's id, varint type name id plus one (zero when unavailable), varint
+//             size, varint optional info count and each optional info
+//   removed:  varint tag (2), then varint count and each id as a zigzag varint delta from
+//             the one before it, starting from zero
+//   end:      varint tag (0)
+//
+// An optional info is its varint type followed by its payload: an id for a prototype, a
+// string for a function name, a varint for element sizes, a count and ids for scope lists,
+// a relationship for internal properties and a count and relationships for the property,
+// relationship, event and collection lists. A relationship is its varint name id plus
+// one, its varint relationship info and a value: eight raw bytes for numbers, a string for
+// strings, an id for heap objects and a varint for external objects.
+//
+// Ids within an object are zigzag varint deltas from the object's own id. Strings are
+// a varint reference: zero for a new string, which is added to the string table, one for
+// a string written inline and not added to it, or an index into the table plus two. New
+// and inline strings are followed by a varint UTF-8 length and the bytes. The table starts
+// out holding the names from the header, so names used as string values aren't repeated.
+//
+// Only delta snapshots have a removed record. It lists the objects in the previous
+// snapshot that are gone, and comes after all of the objects.
+//
+
+const UINT32 BinarySnapshotMagic = 'CHSB';
+const UINT32 BinarySnapshotVersion = 1;
+
+//
+// Writes a binary snapshot to a stream, buffering output the same way the JSON serializer
+// does.
+//
+
+class BinarySnapshotWriter sealed
+{
+private:
+	static const size_t BufferCapacity = 1024 * 1024;
+
+	//
+	// Strings longer than this are written inline rather than added to the string table.
+	// Long strings are rarely repeated, and the table would keep every one of them alive
+	// until the snapshot is written.
+	//
+
+	static const size_t MaximumInternedLength = 256;
+
+	SnapshotStream *m_stream;
+	uint8_t *m_buffer;
+	size_t m_size;
+	ULONG_PTR m_previousId;
+	std::unordered_map<std::wstring, ULONGLONG> m_strings;
+	ULONGLONG m_stringCount;
+	std::vector<uint8_t> m_scratch;
+
+	BinarySnapshotWriter(const BinarySnapshotWriter &);
+	BinarySnapshotWriter &operator=(const BinarySnapshotWriter &);
+
+	HRESULT Reserve(size_t length);
+	HRESULT WriteBytes(const void *bytes, size_t length);
+	HRESULT WriteUInt32(UINT32 value);
+	HRESULT WriteVarint(ULONGLONG value);
+	HRESULT WriteZigzag(LONGLONG value);
+	HRESULT WriteId(ULONG_PTR id, ULONG_PTR baseId);
+	HRESULT WriteUtf8(const wchar_t *value, size_t length);
+	HRESULT WriteString(const wchar_t *value);
+	HRESULT WriteRelationship(ULONG_PTR objectId, const PROFILER_HEAP_OBJECT_RELATIONSHIP *relationship);
+	HRESULT WriteRelationshipList(ULONG_PTR objectId, const PROFILER_HEAP_OBJECT_RELATIONSHIP_LIST *list);
+
+public:
+	BinarySnapshotWriter(SnapshotStream *stream);
+	~BinarySnapshotWriter(void);
+
+	HRESULT WriteHeader(const wchar_t **nameIdMap, UINT nameCount);
+	HRESULT WriteObject(const PROFILER_HEAP_OBJECT *object, const PROFILER_HEAP_OBJECT_OPTIONAL_INFO *optionalInfo);
+	HRESULT WriteRemovedObjects(const std::vector<ULONG_PTR> &objectIds);
+	HRESULT WriteEnd(void);
+	HRESULT Flush(void);
+};
+
+//
+// Replays a binary snapshot held in memory as a heap enumerator, so it can be fed to the
+// same code that serializes a live heap. The snapshot must stay in memory as long as the
+// reader is in use.
+//
+
+class BinarySnapshotReader sealed : public IActiveScriptProfilerHeapEnum
+{
+private:
+	//
+	// An object handed out by Next, along with everything its optional info points to.
+	//
+
+	struct DecodedObject
+	{
+		PROFILER_HEAP_OBJECT object;
+		std::vector<PROFILER_HEAP_OBJECT_OPTIONAL_INFO> optionalInfo;
+		std::vector<std::unique_ptr<uint8_t[]>> blocks;
+		std::deque<std::wstring> strings;
+	};
+
+	const uint8_t *m_current;
+	const uint8_t *m_end;
+	bool m_finished;
+	ULONG_PTR m_previousId;
+	long m_refCount;
+	std::deque<std::wstring> m_strings;
+	std::vector<const wchar_t *> m_nameIdMap;
+	bool m_delta;
+	std::vector<ULONG_PTR> m_removedObjectIds;
+
+	BinarySnapshotReader(const BinarySnapshotReader &);
+	BinarySnapshotReader &operator=(const BinarySnapshotReader &);
+
+	HRESULT ReadBytes(void *bytes, size_t length);
+	HRESULT ReadUInt32(UINT32 *value);
+	HRESULT ReadVarint(ULONGLONG *value);
+	HRESULT ReadVarint(UINT *value);
+	HRESULT ReadZigzag(LONGLONG *value);
+	HRESULT ReadId(ULONG_PTR baseId, ULONG_PTR *id);
+	HRESULT ReadUtf8(std::wstring *value);
+	HRESULT ReadString(DecodedObject *decoded, const wchar_t **value);
+	HRESULT ReadRelationship(DecodedObject *decoded, ULONG_PTR objectId, PROFILER_HEAP_OBJECT_RELATIONSHIP *relationship);
+	HRESULT ReadRelationshipList(DecodedObject *decoded, ULONG_PTR objectId, PROFILER_HEAP_OBJECT_RELATIONSHIP_LIST **list);
+	HRESULT ReadOptionalInfo(DecodedObject *decoded, ULONG_PTR objectId, PROFILER_HEAP_OBJECT_OPTIONAL_INFO *optionalInfo);
+	HRESULT ReadRemovedObjects(void);
+	HRESULT ReadObject(DecodedObject **decoded);
+
+public:
+	BinarySnapshotReader(const uint8_t *snapshot, size_t length);
+	~BinarySnapshotReader(void);
+
+	//
+	// Reads the header and name table. Must succeed before the enumerator is used.
+	//
+
+	HRESULT Open(void);
+
+	//
+	// Whether the snapshot is a delta, and the objects it removes. Neither is known until
+	// every object has been read.
+	//
+
+	bool IsDelta(void) const { return m_delta; }
+	const std::vector<ULONG_PTR> &RemovedObjectIds(void) const { return m_removedObjectIds; }
+
+	// IUnknown
+	HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void **ppvObj);
+	ULONG STDMETHODCALLTYPE AddRef(void);
+	ULONG STDMETHODCALLTYPE Release(void);
+
+	// IActiveScriptProfilerHeapEnum
+	HRESULT STDMETHODCALLTYPE Next(ULONG celt, PROFILER_HEAP_OBJECT **heapObjects, ULONG *pceltFetched);
+	HRESULT STDMETHODCALLTYPE GetOptionalInfo(PROFILER_HEAP_OBJECT *heapObject, ULONG celt, PROFILER_HEAP_OBJECT_OPTIONAL_INFO *optionalInfo);
+	HRESULT STDMETHODCALLTYPE FreeObjectAndOptionalInfo(ULONG celt, PROFILER_HEAP_OBJECT **heapObjects);
+	HRESULT STDMETHODCALLTYPE GetNameIdMap(LPCWSTR **pNameList, UINT *pcelt);
+};
@@ -0,0 +1,1195 @@
+#include "stdafx.h"
+#include <errno.h>
+#include <stdio.h>
+#include <wctype.h>
+#include <algorithm>
+#include <functional>
+#include <queue>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "DominatorTree.h"
+#include "HeapGraph.h"
+#include "SnapshotDiff.h"
+#include "SnapshotScanner.h"
+#include "SnapshotStream.h"
+#include "Transcode.h"
+#include "ZipReader.h"
+
+using namespace std;
+
+//
+// An offline analyzer for heap snapshots written by the memory profiler. It builds the
+// snapshot's object graph and dominator tree within a memory budget, and reports the
+// objects that retain the most memory, the retained size of each kind of object and the
+// paths from the roots to any objects asked about.
+//
+// Given -diff, it compares a series of snapshots instead, from profiles or files of their
+// own, and reports how each kind of object and each function's objects grew, the objects
+// that survived since the first snapshot, and the largest of those retaining memory.
+//
+
+static const unsigned DefaultTopCount = 20;
+
+struct CommandLineArguments
+{
+	unsigned top;
+	ULONGLONG budget;
+	vector<ULONGLONG> pathIds;
+	bool diff;
+	unsigned survive;
+	wstring jsonFileName;
+	int argumentsStart;
+	bool valid;
+
+	CommandLineArguments() :
+		top(DefaultTopCount),
+		budget(0),
+		diff(false),
+		survive(0),
+		argumentsStart(0),
+		valid(true)
+	{
+	}
+};
+
+//
+// Object ids are given as they appear in the snapshot JSON, in decimal, where snapshots
+// from older versions of a 32-bit process have ids that don't fit in an int as negative
+// numbers. Ids can also be given in hex with a 0x prefix, as addresses usually are. A
+// leading zero is just a zero, not the start of an octal number.
+//
+
+static bool ParseObjectId(const wchar_t *text, ULONGLONG *objectId)
+{
+	bool negative = *text == L'-';
+	const wchar_t *digits = negative ? text + 1 : text;
+	int base = 10;
+	wchar_t *end;
+
+	if (digits[0] == L'0' && (digits[1] == L'x' || digits[1] == L'X'))
+	{
+		digits += 2;
+		base = 16;
+	}
+
+	if (!iswxdigit(*digits))
+	{
+		return false;
+	}
+
+	errno = 0;
+	*objectId = _wcstoui64(digits, &end, base);
+
+	if (end == digits || *end != L'\0' || errno == ERANGE)
+	{
+		return false;
+	}
+
+	if (negative)
+	{
+		*objectId = (UINT32) (0 - *objectId);
+	}
+
+	return true;
+}
+
+//
+// Process the command-line arguments.
+//
+
+void ProcessArguments(int argc, __in_ecount(argc) wchar_t *argv [], CommandLineArguments &arguments)
+{
+	wstring topFlag = L"top:";
+	wstring budgetFlag = L"budget:";
+	wstring pathFlag = L"path:";
+	wstring diffFlag = L"diff";
+	wstring surviveFlag = L"survive:";
+	wstring jsonFlag = L"json:";
+	int current = 1;
+
+	for (; current < argc; current++)
+	{
+		wstring argument = argv[current];
+
+		if (argument.length() > 0 &&
+			(argument[0] == '/' || argument[0] == '-'))
+		{
+			wstring argumentFlag = argument.substr(1);
+
+			if (_wcsnicmp(argumentFlag.c_str(), topFlag.c_str(), topFlag.length()) == 0)
+			{
+				int top = _wtoi(argumentFlag.c_str() + topFlag.length());
+
+				arguments.top = top > 0 ? (unsigned) top : 0;
+				arguments.valid &= top > 0;
+			}
+			else if (_wcsnicmp(argumentFlag.c_str(), budgetFlag.c_str(), budgetFlag.length()) == 0)
+			{
+				ULONGLONG megabytes = _wcstoui64(argumentFlag.c_str() + budgetFlag.length(), nullptr, 10);
+
+				arguments.budget = megabytes * 1024 * 1024;
+				arguments.valid &= megabytes > 0;
+			}
+			else if (_wcsnicmp(argumentFlag.c_str(), pathFlag.c_str(), pathFlag.length()) == 0)
+			{
+				ULONGLONG objectId;
+
+				if (ParseObjectId(argumentFlag.c_str() + pathFlag.length(), &objectId))
+				{
+					arguments.pathIds.push_back(objectId);
+				}
+				else
+				{
+					arguments.valid = false;
+				}
+			}
+			else if (_wcsicmp(argumentFlag.c_str(), diffFlag.c_str()) == 0)
+			{
+				arguments.diff = true;
+			}
+			else if (_wcsnicmp(argumentFlag.c_str(), surviveFlag.c_str(), surviveFlag.length()) == 0)
+			{
+				int survive = _wtoi(argumentFlag.c_str() + surviveFlag.length());
+
+				arguments.survive = survive > 0 ? (unsigned) survive : 0;
+				arguments.valid &= survive > 0;
+			}
+			else if (_wcsnicmp(argumentFlag.c_str(), jsonFlag.c_str(), jsonFlag.length()) == 0)
+			{
+				arguments.jsonFileName = argumentFlag.substr(jsonFlag.length());
+				arguments.valid &= !arguments.jsonFileName.empty();
+			}
+			else
+			{
+				arguments.valid = false;
+				break;
+			}
+		}
+		else
+		{
+			break;
+		}
+	}
+
+	arguments.argumentsStart = current;
+
+	//
+	// Paths are only found in a single snapshot, and the rest only apply to diffs.
+	//
+
+	if (arguments.diff ? !arguments.pathIds.empty() : arguments.survive > 0 || !arguments.jsonFileName.empty())
+	{
+		arguments.valid = false;
+	}
+}
+
+//
+// What's printed about the objects in the report beyond what the graph holds: function
+// names, and the names of the references along the paths to the roots. They're picked up
+// in one more pass over the snapshot.
+//
+
+struct ObjectDetails
+{
+	string functionName;
+	vector<UINT32> pathChildren;
+	vector<string> pathNames;
+};
+
+static HRESULT ReadDetails(SnapshotScanner *scanner, const HeapGraph &graph, unordered_map<UINT32, ObjectDetails> *details)
+{
+	ScannedObject object;
+
+	IfComFailRet(scanner->Rewind());
+
+	try
+	{
+		for (UINT32 index = 0; index < graph.ObjectCount(); index++)
+		{
+			IfComFailRet(scanner->Next(&object));
+
+			unordered_map<UINT32, ObjectDetails>::iterator found = details->find(index);
+			if (found == details->end())
+			{
+				continue;
+			}
+
+			ObjectDetails &objectDetails = found->second;
+
+			objectDetails.functionName.assign(object.functionName.text != nullptr ? object.functionName.text : "", object.functionName.length);
+			objectDetails.pathNames.assign(objectDetails.pathChildren.size(), string());
+
+			for (size_t child = 0; child < objectDetails.pathChildren.size(); child++)
+			{
+				ULONGLONG childId = graph.ObjectId(objectDetails.pathChildren[child]);
+
+				for (size_t reference = 0; reference < object.references.size(); reference++)
+				{
+					if (object.references[reference].objectId == childId)
+					{
+						const ScannedString &name = object.references[reference].name;
+						objectDetails.pathNames[child].assign(name.text != nullptr ? name.text : "", name.length);
+						break;
+					}
+				}
+			}
+		}
+	}
+	catch (...)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	return S_OK;
+}
+
+static void PrintObject(const HeapGraph &graph, UINT32 index, const unordered_map<UINT32, ObjectDetails> &details)
+{
+	const string &kind = graph.KindName(graph.Kind(index));
+	unordered_map<UINT32, ObjectDetails>::const_iterator found = details.find(index);
+
+	printf("%llu %s", graph.ObjectId(index), kind.length() > 0 ? kind.c_str() : "(unknown)");
+
+	if (found != details.end() && found->second.functionName.length() > 0)
+	{
+		printf(" %s", found->second.functionName.c_str());
+	}
+}
+
+static HRESULT Analyze(const MappedFile &snapshot, const CommandLineArguments &arguments, MemoryBudget *budget)
+{
+	SnapshotScanner *scanner = nullptr;
+	HeapGraph graph(budget);
+	DominatorTree tree(budget);
+	vector<UINT32> pathTargets;
+	vector<vector<UINT32>> paths;
+	vector<KindTotals> kindTotals;
+	vector<pair<ULONGLONG, UINT32>> retainers;
+	vector<UINT32> kinds;
+	unordered_map<UINT32, ObjectDetails> details;
+	ULONGLONG unreachableSize = 0;
+	HRESULT hr = S_OK;
+
+	IfComFailError(CreateSnapshotScanner(snapshot.Data(), snapshot.Size(), &scanner));
+	IfComFailError(graph.Build(scanner));
+
+	try
+	{
+		//
+		// Paths have to be found before the dominator tree is built, since that frees the
+		// references.
+		//
+
+		for (size_t path = 0; path < arguments.pathIds.size(); path++)
+		{
+			UINT32 index;
+			pathTargets.push_back(graph.Find(arguments.pathIds[path], &index) ? index : graph.VirtualRoot());
+		}
+
+		if (!pathTargets.empty())
+		{
+			vector<UINT32> found;
+
+			for (size_t path = 0; path < pathTargets.size(); path++)
+			{
+				if (pathTargets[path] != graph.VirtualRoot())
+				{
+					found.push_back(pathTargets[path]);
+				}
+			}
+
+			vector<vector<UINT32>> foundPaths;
+			IfComFailError(graph.FindPaths(found, &foundPaths));
+
+			for (size_t path = 0, next = 0; path < pathTargets.size(); path++)
+			{
+				paths.push_back(pathTargets[path] != graph.VirtualRoot() ? foundPaths[next++] : vector<UINT32>());
+			}
+		}
+
+		printf("Snapshot: %llu objects, %llu bytes, %llu references, %llu roots\n",
+			(ULONGLONG) graph.ObjectCount(), graph.TotalSize(), graph.ReferenceCount(), (ULONGLONG) graph.Roots().size());
+
+		IfComFailError(tree.Build(&graph));
+		IfComFailError(tree.GetKindTotals(&graph, &kindTotals));
+
+		//
+		// Keep the largest retainers in a heap with the smallest on top.
+		//
+
+		priority_queue<pair<ULONGLONG, UINT32>, vector<pair<ULONGLONG, UINT32>>, greater<pair<ULONGLONG, UINT32>>> largest;
+
+		for (UINT32 index = 0; index < graph.ObjectCount(); index++)
+		{
+			if (!tree.IsReachable(index))
+			{
+				unreachableSize += graph.Size(index);
+				continue;
+			}
+
+			if (largest.size() < arguments.top)
+			{
+				largest.push(make_pair(tree.RetainedSize(index), index));
+			}
+			else if (tree.RetainedSize(index) > largest.top().first)
+			{
+				largest.pop();
+				largest.push(make_pair(tree.RetainedSize(index), index));
+			}
+		}
+
+		while (!largest.empty())
+		{
+			retainers.push_back(largest.top());
+			details.insert(make_pair(largest.top().second, ObjectDetails()));
+			largest.pop();
+		}
+
+		reverse(retainers.begin(), retainers.end());
+
+		for (size_t path = 0; path < paths.size(); path++)
+		{
+			for (size_t step = 0; step < paths[path].size(); step++)
+			{
+				ObjectDetails &objectDetails = details[paths[path][step]];
+
+				if (step + 1 < paths[path].size())
+				{
+					objectDetails.pathChildren.push_back(paths[path][step + 1]);
+				}
+			}
+		}
+
+		IfComFailError(ReadDetails(scanner, graph, &details));
+
+		printf("Reachable: %llu objects, %llu bytes\n", (ULONGLONG) tree.ReachableCount(), tree.RetainedSize(graph.VirtualRoot()));
+		printf("Unreachable: %llu objects, %llu bytes\n", (ULONGLONG) (graph.ObjectCount() - tree.ReachableCount()), unreachableSize);
+		printf("Memory: %llu bytes at peak, of a budget of %llu\n", budget->Peak(), budget->Limit());
+
+		printf("\nTop %u retainers:\n", (unsigned) retainers.size());
+		printf("%16s %12s  %s\n", "Retained", "Self", "Object");
+
+		for (size_t retainer = 0; retainer < retainers.size(); retainer++)
+		{
+			printf("%16llu %12llu  ", retainers[retainer].first, graph.Size(retainers[retainer].second));
+			PrintObject(graph, retainers[retainer].second, details);
+			printf("\n");
+		}
+
+		for (UINT32 kind = 0; kind < graph.KindCount(); kind++)
+		{
+			kinds.push_back(kind);
+		}
+
+		sort(kinds.begin(), kinds.end(), [&kindTotals](UINT32 left, UINT32 right)
+		{
+			return kindTotals[left].retainedSize > kindTotals[right].retainedSize;
+		});
+
+		printf("\nRetained size by kind:\n");
+		printf("%12s %16s %16s  %s\n", "Count", "Self", "Retained", "Kind");
+
+		for (size_t kind = 0; kind < kinds.size(); kind++)
+		{
+			const KindTotals &totals = kindTotals[kinds[kind]];
+			const string &name = graph.KindName(kinds[kind]);
+
+			printf("%12llu %16llu %16llu  %s\n", totals.count, totals.size, totals.retainedSize, name.length() > 0 ? name.c_str() : "(unknown)");
+		}
+
+		for (size_t path = 0; path < paths.size(); path++)
+		{
+			printf("\nPath from a root to %llu:\n", arguments.pathIds[path]);
+
+			if (pathTargets[path] == graph.VirtualRoot())
+			{
+				printf("  not in the snapshot\n");
+				continue;
+			}
+
+			if (paths[path].empty())
+			{
+				printf("  not reachable from a root\n");
+				continue;
+			}
+
+			for (size_t step = 0; step < paths[path].size(); step++)
+			{
+				if (step == 0)
+				{
+					printf("  ");
+				}
+				else
+				{
+					const ObjectDetails &parent = details[paths[path][step - 1]];
+					size_t child = find(parent.pathChildren.begin(), parent.pathChildren.end(), paths[path][step]) - parent.pathChildren.begin();
+
+					printf("    -[%s]-> ", parent.pathNames[child].length() > 0 ? parent.pathNames[child].c_str() : "?");
+				}
+
+				PrintObject(graph, paths[path][step], details);
+				printf("\n");
+			}
+		}
+	}
+	catch (...)
+	{
+		hr = E_OUTOFMEMORY;
+	}
+
+error:
+	delete scanner;
+	return hr;
+}
+
+//
+// A snapshot to compare, which is either a file of its own or a part of a profile.
+//
+
+struct DiffSnapshot
+{
+	wstring fileName;
+	ZipReader *package;
+	size_t part;
+	string name;
+};
+
+static string ToUtf8(const wstring &text)
+{
+	string utf8(UTF8_LENGTH_FOR_UTF16(text.length()), '\0');
+
+	utf8.resize(Utf16ToUtf8((const uint16_t *) text.c_str(), text.length(), (uint8_t *) &utf8[0]));
+	return utf8;
+}
+
+//
+// Snapshot parts are named snapshot<number> with the extension of their format. The
+// number gives their order, and every other part, such as a summary, is left out.
+//
+
+static bool GetSnapshotNumber(const string &partName, unsigned *number)
+{
+	static const char prefix[] = "snapshot";
+	size_t end = sizeof(prefix) - 1;
+
+	if (partName.compare(0, end, prefix) != 0)
+	{
+		return false;
+	}
+
+	*number = 0;
+
+	for (; end < partName.length() && partName[end] >= '0' && partName[end] <= '9'; end++)
+	{
+		*number = *number * 10 + (partName[end] - '0');
+	}
+
+	string extension = partName.substr(end);
+
+	return end > sizeof(prefix) - 1 && (extension == ".snapjs" || extension == ".snapbin");
+}
+
+//
+// Lists the snapshots in a file, which is either a profile or a snapshot. Profiles are
+// ZIP files, so they're told apart by the signature they start with.
+//
+
+static HRESULT AddDiffSnapshots(const wchar_t *fileName, vector<ZipReader *> *packages, vector<DiffSnapshot> *snapshots)
+{
+	MappedFile file;
+	bool package;
+	DiffSnapshot snapshot;
+
+	IfComFailRet(file.Open(fileName));
+	package = file.Size() >= 4 && memcmp(file.Data(), "PK\x03\x04", 4) == 0;
+	file.Close();
+
+	snapshot.fileName = fileName;
+	snapshot.package = nullptr;
+	snapshot.part = 0;
+
+	try
+	{
+		if (!package)
+		{
+			snapshot.name = ToUtf8(fileName);
+			snapshots->push_back(snapshot);
+			return S_OK;
+		}
+
+		vector<pair<unsigned, size_t>> parts;
+
+		snapshot.package = new ZipReader();
+		packages->push_back(snapshot.package);
+		IfComFailRet(snapshot.package->Open(fileName));
+
+		for (size_t part = 0; part < snapshot.package->PartCount(); part++)
+		{
+			unsigned number;
+
+			if (GetSnapshotNumber(snapshot.package->PartName(part), &number))
+			{
+				parts.push_back(make_pair(number, part));
+			}
+		}
+
+		sort(parts.begin(), parts.end());
+
+		for (size_t part = 0; part < parts.size(); part++)
+		{
+			snapshot.part = parts[part].second;
+			snapshot.name = snapshot.package->PartName(snapshot.part);
+			snapshots->push_back(snapshot);
+		}
+	}
+	catch (...)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	return S_OK;
+}
+
+//
+// A snapshot mapped into memory to scan. A part of a profile is decompressed to a
+// temporary file first, which is deleted when the snapshot is closed.
+//
+
+class SnapshotFile sealed
+{
+private:
+	MappedFile m_file;
+	wstring m_temporaryFileName;
+
+	SnapshotFile(const SnapshotFile &);
+	SnapshotFile &operator=(const SnapshotFile &);
+
+public:
+	SnapshotFile(void) {}
+	~SnapshotFile(void) { Close(); }
+
+	const MappedFile &File(void) const { return m_file; }
+
+	HRESULT Open(const DiffSnapshot &snapshot)
+	{
+		if (snapshot.package == nullptr)
+		{
+			return m_file.Open(snapshot.fileName.c_str());
+		}
+
+		FileStream stream;
+
+		IfComFailRet(CreateTemporaryFile(&m_temporaryFileName));
+		IfComFailRet(stream.Create(m_temporaryFileName.c_str()));
+		IfComFailRet(snapshot.package->ExtractPart(snapshot.part, &stream));
+		IfComFailRet(stream.Close());
+
+		return m_file.Open(m_temporaryFileName.c_str());
+	}
+
+	void Close(void)
+	{
+		m_file.Close();
+
+		if (!m_temporaryFileName.empty())
+		{
+			DeleteFileW(m_temporaryFileName.c_str());
+			m_temporaryFileName.clear();
+		}
+	}
+};
+
+//
+// A new object retaining memory, which no other new object dominates.
+//
+
+struct NewRetainer
+{
+	ULONGLONG objectId;
+	ULONGLONG size;
+	ULONGLONG retainedSize;
+	UINT32 firstSnapshot;
+	string kind;
+	string functionName;
+};
+
+//
+// Objects are new when they weren't in the first snapshot.
+//
+
+static bool IsNewObject(UINT32 firstSnapshot)
+{
+	return firstSnapshot != 0 && firstSnapshot != ObjectIdTable::NoValue;
+}
+
+//
+// Finds the largest new retainers in the last snapshot. The objects a new retainer
+// dominates are left out, since their memory is already counted toward it.
+//
+
+static HRESULT FindNewRetainers(SnapshotScanner *scanner, const SnapshotDiff &diff, size_t top, MemoryBudget *budget, vector<NewRetainer> *retainers)
+{
+	HeapGraph graph(budget);
+	DominatorTree tree(budget);
+	vector<pair<ULONGLONG, UINT32>> largest;
+	unordered_map<UINT32, ObjectDetails> details;
+
+	IfComFailRet(scanner->Rewind());
+	IfComFailRet(graph.Build(scanner));
+	IfComFailRet(tree.Build(&graph));
+
+	try
+	{
+		for (UINT32 index = 0; index < graph.ObjectCount(); index++)
+		{
+			if (!tree.IsReachable(index) || !IsNewObject(diff.FirstSnapshot(graph.ObjectId(index))))
+			{
+				continue;
+			}
+
+			UINT32 dominator = tree.Dominator(index);
+
+			if (dominator != graph.VirtualRoot() && IsNewObject(diff.FirstSnapshot(graph.ObjectId(dominator))))
+			{
+				continue;
+			}
+
+			if (largest.size() < top)
+			{
+				largest.push_back(make_pair(tree.RetainedSize(index), index));
+				push_heap(largest.begin(), largest.end(), greater<pair<ULONGLONG, UINT32>>());
+			}
+			else if (top > 0 && tree.RetainedSize(index) > largest.front().first)
+			{
+				pop_heap(largest.begin(), largest.end(), greater<pair<ULONGLONG, UINT32>>());
+				largest.back() = make_pair(tree.RetainedSize(index), index);
+				push_heap(largest.begin(), largest.end(), greater<pair<ULONGLONG, UINT32>>());
+			}
+		}
+
+		sort_heap(largest.begin(), largest.end(), greater<pair<ULONGLONG, UINT32>>());
+
+		for (size_t retainer = 0; retainer < largest.size(); retainer++)
+		{
+			details.insert(make_pair(largest[retainer].second, ObjectDetails()));
+		}
+
+		IfComFailRet(ReadDetails(scanner, graph, &details));
+
+		for (size_t retainer = 0; retainer < largest.size(); retainer++)
+		{
+			UINT32 index = largest[retainer].second;
+			NewRetainer newRetainer;
+
+			newRetainer.objectId = graph.ObjectId(index);
+			newRetainer.size = graph.Size(index);
+			newRetainer.retainedSize = largest[retainer].first;
+			newRetainer.firstSnapshot = diff.FirstSnapshot(newRetainer.objectId);
+			newRetainer.kind = graph.KindName(graph.Kind(index));
+			newRetainer.functionName = details[index].functionName;
+			retainers->push_back(newRetainer);
+		}
+	}
+	catch (...)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	return S_OK;
+}
+
+static const char *DisplayName(const string &name)
+{
+	return name.length() > 0 ? name.c_str() : "(unknown)";
+}
+
+//
+// Prints the groups that grew the most between the first snapshot and the last.
+//
+
+static void PrintGrowth(const char *title, const vector<GroupGrowth> &groups, size_t top)
+{
+	vector<size_t> growing;
+
+	for (size_t group = 0; group < groups.size(); group++)
+	{
+		const DiffTotals &first = groups[group].snapshots.front();
+		const DiffTotals &last = groups[group].snapshots.back();
+
+		if (last.size > first.size || last.count > first.count)
+		{
+			growing.push_back(group);
+		}
+	}
+
+	sort(growing.begin(), growing.end(), [&groups](size_t left, size_t right)
+	{
+		return (LONGLONG) (groups[left].snapshots.back().size - groups[left].snapshots.front().size) >
+			(LONGLONG) (groups[right].snapshots.back().size - groups[right].snapshots.front().size);
+	});
+
+	if (growing.size() > top)
+	{
+		growing.resize(top);
+	}
+
+	printf("\n%s:\n", title);
+	printf("%12s %12s %16s %16s  %s\n", "Count", "Change", "Size", "Change", "Name");
+
+	for (size_t group = 0; group < growing.size(); group++)
+	{
+		const GroupGrowth &growth = groups[growing[group]];
+		const DiffTotals &first = growth.snapshots.front();
+		const DiffTotals &last = growth.snapshots.back();
+
+		printf("%12llu %+12lld %16llu %+16lld  %s\n", last.count, (LONGLONG) (last.count - first.count), last.size, (LONGLONG) (last.size - first.size), DisplayName(growth.name));
+	}
+}
+
+static void PrintSurviving(const vector<GroupGrowth> &kinds, size_t top)
+{
+	vector<size_t> surviving;
+
+	for (size_t kind = 0; kind < kinds.size(); kind++)
+	{
+		if (kinds[kind].surviving.count > 0)
+		{
+			surviving.push_back(kind);
+		}
+	}
+
+	sort(surviving.begin(), surviving.end(), [&kinds](size_t left, size_t right)
+	{
+		return kinds[left].surviving.size > kinds[right].surviving.size;
+	});
+
+	if (surviving.size() > top)
+	{
+		surviving.resize(top);
+	}
+
+	printf("%12s %16s  %s\n", "Count", "Size", "Kind");
+
+	for (size_t kind = 0; kind < surviving.size(); kind++)
+	{
+		printf("%12llu %16llu  %s\n", kinds[surviving[kind]].surviving.count, kinds[surviving[kind]].surviving.size, DisplayName(kinds[surviving[kind]].name));
+	}
+}
+
+static void PrintDiff(const vector<DiffSnapshot> &snapshots, const SnapshotDiff &diff, UINT32 surviveCount, size_t top, const vector<NewRetainer> *retainers)
+{
+	const vector<SurvivingObject> &survivors = diff.LargestSurvivors();
+	DiffTotals surviving;
+
+	for (size_t kind = 0; kind < diff.Kinds().size(); kind++)
+	{
+		surviving.count += diff.Kinds()[kind].surviving.count;
+		surviving.size += diff.Kinds()[kind].surviving.size;
+	}
+
+	printf("Snapshots:\n");
+	printf("%12s %16s  %s\n", "Count", "Size", "Snapshot");
+
+	for (UINT32 snapshot = 0; snapshot < diff.SnapshotCount(); snapshot++)
+	{
+		printf("%12llu %16llu  %u %s\n", diff.SnapshotTotals(snapshot).count, diff.SnapshotTotals(snapshot).size, snapshot + 1, snapshots[snapshot].name.c_str());
+	}
+
+	PrintGrowth("Growth by kind, from the first snapshot to the last", diff.Kinds(), top);
+	PrintGrowth("Growth by function name, from the first snapshot to the last", diff.Functions(), top);
+
+	printf("\nSurviving: %llu objects, %llu bytes new since the first snapshot and in the last %u\n", surviving.count, surviving.size, surviveCount);
+	PrintSurviving(diff.Kinds(), top);
+
+	printf("\nLargest surviving objects:\n");
+	printf("%16s %8s  %s\n", "Size", "Since", "Object");
+
+	for (size_t survivor = 0; survivor < survivors.size(); survivor++)
+	{
+		printf("%16llu %8u  %llu %s", survivors[survivor].size, survivors[survivor].firstSnapshot + 1, survivors[survivor].objectId, DisplayName(diff.Kinds()[survivors[survivor].kind].name));
+
+		if (survivors[survivor].functionName.length() > 0)
+		{
+			printf(" %s", survivors[survivor].functionName.c_str());
+		}
+
+		printf("\n");
+	}
+
+	printf("\nLargest new retainers in the last snapshot:\n");
+
+	if (retainers == nullptr)
+	{
+		printf("  not found, since the last snapshot's graph needs more than the memory budget\n");
+		return;
+	}
+
+	printf("%16s %12s %8s  %s\n", "Retained", "Self", "Since", "Object");
+
+	for (size_t retainer = 0; retainer < retainers->size(); retainer++)
+	{
+		const NewRetainer &newRetainer = (*retainers)[retainer];
+
+		printf("%16llu %12llu %8u  %llu %s", newRetainer.retainedSize, newRetainer.size, newRetainer.firstSnapshot + 1, newRetainer.objectId, DisplayName(newRetainer.kind));
+
+		if (newRetainer.functionName.length() > 0)
+		{
+			printf(" %s", newRetainer.functionName.c_str());
+		}
+
+		printf("\n");
+	}
+}
+
+//
+// The names from snapshots are already escaped for JSON; file names aren't. They're UTF-8,
+// so they go back to UTF-16 for the escaper the snapshot writer uses.
+//
+
+static void AppendEscaped(string &json, const string &text)
+{
+	vector<uint16_t> utf16(UTF16_LENGTH_FOR_UTF8(text.length()) + 1);
+	size_t length = Utf8ToUtf16((const uint8_t *) text.data(), text.length(), &utf16[0]);
+	size_t offset = json.length() + 1;
+
+	json += '"';
+	json.resize(offset + JSON_ESCAPED_LENGTH_FOR_UTF16(length));
+	json.resize(offset + EscapeJsonString(&utf16[0], length, (uint8_t *) &json[offset]));
+	json += '"';
+}
+
+static void AppendProperty(string &json, const char *name, const string &escapedValue)
+{
+	json += '"';
+	json += name;
+	json += "\":\"";
+	json += escapedValue;
+	json += "\",";
+}
+
+static void AppendProperty(string &json, const char *name, ULONGLONG value)
+{
+	json += '"';
+	json += name;
+	json += "\":";
+	json += to_string(value);
+	json += ',';
+}
+
+//
+// Ends an object or array, dropping the comma after its last member.
+//
+
+static void AppendEnd(string &json, char end)
+{
+	if (json.back() == ',')
+	{
+		json.back() = end;
+	}
+	else
+	{
+		json += end;
+	}
+
+	json += ',';
+}
+
+static void AppendGroups(string &json, const char *name, const char *groupName, const vector<GroupGrowth> &groups)
+{
+	json += '"';
+	json += name;
+	json += "\":[";
+
+	for (size_t group = 0; group < groups.size(); group++)
+	{
+		json += '{';
+		AppendProperty(json, groupName, groups[group].name);
+
+		json += "\"objectsCount\":[";
+		for (size_t snapshot = 0; snapshot < groups[group].snapshots.size(); snapshot++)
+		{
+			json += to_string(groups[group].snapshots[snapshot].count);
+			json += ',';
+		}
+		AppendEnd(json, ']');
+
+		json += "\"totalObjectSize\":[";
+		for (size_t snapshot = 0; snapshot < groups[group].snapshots.size(); snapshot++)
+		{
+			json += to_string(groups[group].snapshots[snapshot].size);
+			json += ',';
+		}
+		AppendEnd(json, ']');
+
+		AppendProperty(json, "survivingCount", groups[group].surviving.count);
+		AppendProperty(json, "survivingSize", groups[group].surviving.size);
+		AppendEnd(json, '}');
+	}
+
+	AppendEnd(json, ']');
+}
+
+//
+// Writes everything the report summarizes, in full, as UTF-8 JSON. Snapshots are referred
+// to by their index in the list of snapshots.
+//
+
+static HRESULT WriteDiffJson(const wchar_t *fileName, const vector<DiffSnapshot> &snapshots, const SnapshotDiff &diff, UINT32 surviveCount, const vector<NewRetainer> *retainers)
+{
+	const vector<SurvivingObject> &survivors = diff.LargestSurvivors();
+	FileStream stream;
+	string json;
+
+	try
+	{
+		json += "{\"snapshots\":[";
+
+		for (UINT32 snapshot = 0; snapshot < diff.SnapshotCount(); snapshot++)
+		{
+			json += "{\"name\":";
+			AppendEscaped(json, snapshots[snapshot].name);
+			json += ',';
+			AppendProperty(json, "objectsCount", diff.SnapshotTotals(snapshot).count);
+			AppendProperty(json, "totalObjectSize", diff.SnapshotTotals(snapshot).size);
+			AppendEnd(json, '}');
+		}
+
+		AppendEnd(json, ']');
+		AppendProperty(json, "surviveCount", surviveCount);
+		AppendGroups(json, "kinds", "kind", diff.Kinds());
+		AppendGroups(json, "functions", "functionName", diff.Functions());
+
+		json += "\"largestSurvivors\":[";
+
+		for (size_t survivor = 0; survivor < survivors.size(); survivor++)
+		{
+			json += '{';
+			AppendProperty(json, "objectId", survivors[survivor].objectId);
+			AppendProperty(json, "kind", diff.Kinds()[survivors[survivor].kind].name);
+			AppendProperty(json, "functionName", survivors[survivor].functionName);
+			AppendProperty(json, "size", survivors[survivor].size);
+			AppendProperty(json, "firstSnapshot", survivors[survivor].firstSnapshot);
+			AppendEnd(json, '}');
+		}
+
+		AppendEnd(json, ']');
+
+		if (retainers == nullptr)
+		{
+			json += "\"newRetainers\":null,";
+		}
+		else
+		{
+			json += "\"newRetainers\":[";
+
+			for (size_t retainer = 0; retainer < retainers->size(); retainer++)
+			{
+				const NewRetainer &newRetainer = (*retainers)[retainer];
+
+				json += '{';
+				AppendProperty(json, "objectId", newRetainer.objectId);
+				AppendProperty(json, "kind", newRetainer.kind);
+				AppendProperty(json, "functionName", newRetainer.functionName);
+				AppendProperty(json, "size", newRetainer.size);
+				AppendProperty(json, "retainedSize", newRetainer.retainedSize);
+				AppendProperty(json, "firstSnapshot", newRetainer.firstSnapshot);
+				AppendEnd(json, '}');
+			}
+
+			AppendEnd(json, ']');
+		}
+
+		AppendEnd(json, '}');
+		json.back() = '\n';
+	}
+	catch (...)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	IfComFailRet(stream.Create(fileName));
+	IfComFailRet(WriteToStream(&stream, json.data(), json.size()));
+	return stream.Close();
+}
+
+//
+// Compares the snapshots in the files given, which are profiles or snapshots, in order.
+//
+
+static HRESULT Diff(int argc, wchar_t *argv[], const CommandLineArguments &arguments, MemoryBudget *budget)
+{
+	vector<ZipReader *> packages;
+	vector<DiffSnapshot> snapshots;
+	vector<NewRetainer> retainers;
+	SnapshotFile file;
+	SnapshotScanner *scanner = nullptr;
+	UINT32 surviveCount = arguments.survive;
+	bool foundRetainers = true;
+	HRESULT hr = S_OK;
+
+	for (int argument = arguments.argumentsStart; argument < argc; argument++)
+	{
+		hr = AddDiffSnapshots(argv[argument], &packages, &snapshots);
+		if (FAILED(hr))
+		{
+			fwprintf(stderr, L"chakraheapanalyzer: can't read %s (0x%08x).\n", argv[argument], hr);
+			goto error;
+		}
+	}
+
+	if (snapshots.size() < 2)
+	{
+		fwprintf(stderr, L"chakraheapanalyzer: a diff needs at least two snapshots.\n");
+		IfComFailError(E_INVALIDARG);
+	}
+
+	//
+	// By default, objects survive once they've been in two snapshots in a row, which with
+	// only two snapshots means all of the new objects in the second.
+	//
+
+	if (surviveCount == 0)
+	{
+		surviveCount = snapshots.size() > 2 ? 2 : 1;
+	}
+	else if (surviveCount >= snapshots.size())
+	{
+		fwprintf(stderr, L"chakraheapanalyzer: objects can survive at most %u snapshots after the first.\n", (unsigned) snapshots.size() - 1);
+		IfComFailError(E_INVALIDARG);
+	}
+
+	{
+		SnapshotDiff diff(budget, surviveCount, arguments.top);
+
+		for (size_t snapshot = 0; snapshot < snapshots.size(); snapshot++)
+		{
+			delete scanner;
+			scanner = nullptr;
+			file.Close();
+
+			hr = file.Open(snapshots[snapshot]);
+			if (SUCCEEDED(hr))
+			{
+				hr = CreateSnapshotScanner(file.File().Data(), file.File().Size(), &scanner);
+			}
+
+			if (SUCCEEDED(hr))
+			{
+				hr = diff.AddSnapshot(scanner);
+			}
+
+			if (FAILED(hr))
+			{
+				if (hr == DeltaSnapshotError)
+				{
+					fwprintf(stderr, L"chakraheapanalyzer: %S is a delta snapshot; reconstruct the full snapshot first.\n", snapshots[snapshot].name.c_str());
+				}
+				else if (hr != BudgetExceededError)
+				{
+					fwprintf(stderr, L"chakraheapanalyzer: failed to read %S (0x%08x).\n", snapshots[snapshot].name.c_str(), hr);
+				}
+
+				goto error;
+			}
+		}
+
+		//
+		// Finding retainers takes the last snapshot's whole graph, and the rest of the report
+		// is still worth having without them.
+		//
+
+		hr = FindNewRetainers(scanner, diff, arguments.top, budget, &retainers);
+		if (hr == BudgetExceededError)
+		{
+			foundRetainers = false;
+			hr = S_OK;
+		}
+		else if (FAILED(hr))
+		{
+			fwprintf(stderr, L"chakraheapanalyzer: failed to analyze %S (0x%08x).\n", snapshots.back().name.c_str(), hr);
+			goto error;
+		}
+
+		PrintDiff(snapshots, diff, surviveCount, arguments.top, foundRetainers ? &retainers : nullptr);
+		printf("\nMemory: %llu bytes at peak, of a budget of %llu\n", budget->Peak(), budget->Limit());
+
+		if (!arguments.jsonFileName.empty())
+		{
+			hr = WriteDiffJson(arguments.jsonFileName.c_str(), snapshots, diff, surviveCount, foundRetainers ? &retainers : nullptr);
+			if (FAILED(hr))
+			{
+				fwprintf(stderr, L"chakraheapanalyzer: can't write %s (0x%08x).\n", arguments.jsonFileName.c_str(), hr);
+				goto error;
+			}
+		}
+	}
+
+error:
+	delete scanner;
+
+	for (size_t package = 0; package < packages.size(); package++)
+	{
+		delete packages[package];
+	}
+
+	return hr;
+}
+
+//
+// The main entry point for the analyzer.
+//
+
+int _cdecl wmain(int argc, wchar_t *argv[])
+{
+	CommandLineArguments arguments;
+	MappedFile snapshot;
+	HRESULT hr;
+
+	ProcessArguments(argc, argv, arguments);
+
+	if (!arguments.valid || (arguments.diff ? argc == arguments.argumentsStart : argc - arguments.argumentsStart != 1))
+	{
+		fwprintf(stderr, L"usage: chakraheapanalyzer [-top:<count>] [-budget:<megabytes>] [-path:<object id>]... <snapshot file>\n");
+		fwprintf(stderr, L"       chakraheapanalyzer -diff [-top:<count>] [-budget:<megabytes>] [-survive:<count>] [-json:<file>] <profile or snapshot file>...\n");
+		return EXIT_FAILURE;
+	}
+
+	MemoryBudget budget(arguments.budget > 0 ? arguments.budget : MemoryBudget::DefaultLimit);
+
+	if (arguments.diff)
+	{
+		hr = Diff(argc, argv, arguments, &budget);
+
+		if (hr == BudgetExceededError)
+		{
+			fwprintf(stderr, L"chakraheapanalyzer: the snapshots need more than the %llu MB memory budget.\n", budget.Limit() / (1024 * 1024));
+		}
+
+		return SUCCEEDED(hr) ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	hr = snapshot.Open(argv[arguments.argumentsStart]);
+	if (FAILED(hr))
+	{
+		fwprintf(stderr, L"chakraheapanalyzer: can't open %s (0x%08x).\n", argv[arguments.argumentsStart], hr);
+		return EXIT_FAILURE;
+	}
+
+	hr = Analyze(snapshot, arguments, &budget);
+
+	if (hr == BudgetExceededError)
+	{
+		fwprintf(stderr, L"chakraheapanalyzer: the snapshot needs more than the %llu MB memory budget.\n", budget.Limit() / (1024 * 1024));
+	}
+	else if (hr == DeltaSnapshotError)
+	{
+		fwprintf(stderr, L"chakraheapanalyzer: %s is a delta snapshot; reconstruct the full snapshot first.\n", argv[arguments.argumentsStart]);
+	}
+	else if (FAILED(hr))
+	{
+		fwprintf(stderr, L"chakraheapanalyzer: failed to analyze %s (0x%08x).\n", argv[arguments.argumentsStart], hr);
+	}
+
+	return SUCCEEDED(hr) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
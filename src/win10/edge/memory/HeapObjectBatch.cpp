@@ -0,0 +1,206 @@
+#include "stdafx.h"
+#include <stddef.h>
+#include "HeapObjectBatch.h"
+
+using namespace std;
+
+HeapObjectBatch::HeapObjectBatch(void) :
+	m_block(0),
+	m_used(0)
+{
+}
+
+HeapObjectBatch::~HeapObjectBatch(void)
+{
+	Clear();
+
+	for (size_t index = 0; index < m_blocks.size(); index++)
+	{
+		delete [] m_blocks[index];
+	}
+}
+
+void HeapObjectBatch::Clear(void)
+{
+	for (size_t index = 0; index < m_largeBlocks.size(); index++)
+	{
+		delete [] m_largeBlocks[index];
+	}
+
+	m_largeBlocks.clear();
+	m_objects.clear();
+	m_optionalInfo.clear();
+	m_block = 0;
+	m_used = 0;
+}
+
+//
+// Everything copied is made of pointers, integers and doubles, so eight byte alignment
+// covers it all.
+//
+
+void *HeapObjectBatch::Allocate(size_t size)
+{
+	size = (size + 7) & ~(size_t) 7;
+
+	if (size > MaximumBlockAllocation)
+	{
+		uint8_t *block = new uint8_t[size];
+		m_largeBlocks.push_back(block);
+		return block;
+	}
+
+	if (m_block == m_blocks.size() || m_used + size > BlockSize)
+	{
+		if (m_block < m_blocks.size())
+		{
+			m_block++;
+		}
+
+		if (m_block == m_blocks.size())
+		{
+			m_blocks.push_back(new uint8_t[BlockSize]);
+		}
+
+		m_used = 0;
+	}
+
+	void *allocation = m_blocks[m_block] + m_used;
+	m_used += size;
+	return allocation;
+}
+
+const wchar_t *HeapObjectBatch::CopyString(const wchar_t *value)
+{
+	if (value == nullptr)
+	{
+		return nullptr;
+	}
+
+	size_t size = (wcslen(value) + 1) * sizeof(wchar_t);
+	void *copy = Allocate(size);
+	memcpy(copy, value, size);
+	return (const wchar_t *) copy;
+}
+
+void HeapObjectBatch::CopyRelationship(PROFILER_HEAP_OBJECT_RELATIONSHIP *copy, const PROFILER_HEAP_OBJECT_RELATIONSHIP *relationship)
+{
+	*copy = *relationship;
+
+	switch (relationship->relationshipInfo)
+	{
+	case PROFILER_PROPERTY_TYPE_STRING:
+		copy->stringValue = CopyString(relationship->stringValue);
+		break;
+
+	//
+	// BSTRs are only ever read as strings, so they're copied as plain strings.
+	//
+
+	case PROFILER_PROPERTY_TYPE_BSTR:
+		copy->bstrValue = (BSTR) CopyString(relationship->bstrValue);
+		break;
+
+	case PROFILER_PROPERTY_TYPE_NUMBER:
+	case PROFILER_PROPERTY_TYPE_HEAP_OBJECT:
+	case PROFILER_PROPERTY_TYPE_EXTERNAL_OBJECT:
+		break;
+
+	//
+	// Nothing reads any other kind of value, and it can't be copied without knowing what it
+	// points to.
+	//
+
+	default:
+		copy->externalObjectAddress = nullptr;
+		break;
+	}
+}
+
+PROFILER_HEAP_OBJECT_RELATIONSHIP_LIST *HeapObjectBatch::CopyRelationshipList(const PROFILER_HEAP_OBJECT_RELATIONSHIP_LIST *list)
+{
+	size_t size = offsetof(PROFILER_HEAP_OBJECT_RELATIONSHIP_LIST, elements) + list->count * sizeof(PROFILER_HEAP_OBJECT_RELATIONSHIP);
+	if (size < sizeof(PROFILER_HEAP_OBJECT_RELATIONSHIP_LIST))
+	{
+		size = sizeof(PROFILER_HEAP_OBJECT_RELATIONSHIP_LIST);
+	}
+
+	PROFILER_HEAP_OBJECT_RELATIONSHIP_LIST *copy = (PROFILER_HEAP_OBJECT_RELATIONSHIP_LIST *) Allocate(size);
+	copy->count = list->count;
+
+	for (unsigned index = 0; index < list->count; index++)
+	{
+		CopyRelationship(&copy->elements[index], &list->elements[index]);
+	}
+
+	return copy;
+}
+
+HRESULT HeapObjectBatch::Add(const PROFILER_HEAP_OBJECT *object, const PROFILER_HEAP_OBJECT_OPTIONAL_INFO *optionalInfo)
+{
+	try
+	{
+		PROFILER_HEAP_OBJECT *objectCopy = (PROFILER_HEAP_OBJECT *) Allocate(sizeof(PROFILER_HEAP_OBJECT));
+		PROFILER_HEAP_OBJECT_OPTIONAL_INFO *optionalInfoCopy = nullptr;
+
+		*objectCopy = *object;
+
+		if (object->optionalInfoCount > 0)
+		{
+			optionalInfoCopy = (PROFILER_HEAP_OBJECT_OPTIONAL_INFO *) Allocate(object->optionalInfoCount * sizeof(PROFILER_HEAP_OBJECT_OPTIONAL_INFO));
+
+			for (unsigned index = 0; index < object->optionalInfoCount; index++)
+			{
+				const PROFILER_HEAP_OBJECT_OPTIONAL_INFO &info = optionalInfo[index];
+				PROFILER_HEAP_OBJECT_OPTIONAL_INFO &infoCopy = optionalInfoCopy[index];
+
+				infoCopy = info;
+
+				switch (info.infoType)
+				{
+				case PROFILER_HEAP_OBJECT_OPTIONAL_INFO_FUNCTION_NAME:
+					infoCopy.functionName = CopyString(info.functionName);
+					break;
+				case PROFILER_HEAP_OBJECT_OPTIONAL_INFO_SCOPE_LIST:
+				{
+					size_t size = offsetof(PROFILER_HEAP_OBJECT_SCOPE_LIST, scopes) + info.scopeList->count * sizeof(PROFILER_HEAP_OBJECT_ID);
+					if (size < sizeof(PROFILER_HEAP_OBJECT_SCOPE_LIST))
+					{
+						size = sizeof(PROFILER_HEAP_OBJECT_SCOPE_LIST);
+					}
+
+					infoCopy.scopeList = (PROFILER_HEAP_OBJECT_SCOPE_LIST *) Allocate(size);
+					memcpy(infoCopy.scopeList, info.scopeList, size);
+					break;
+				}
+				case PROFILER_HEAP_OBJECT_OPTIONAL_INFO_INTERNAL_PROPERTY:
+					infoCopy.internalProperty = (PROFILER_HEAP_OBJECT_RELATIONSHIP *) Allocate(sizeof(PROFILER_HEAP_OBJECT_RELATIONSHIP));
+					CopyRelationship(infoCopy.internalProperty, info.internalProperty);
+					break;
+				case PROFILER_HEAP_OBJECT_OPTIONAL_INFO_NAME_PROPERTIES:
+				case PROFILER_HEAP_OBJECT_OPTIONAL_INFO_INDEX_PROPERTIES:
+				case PROFILER_HEAP_OBJECT_OPTIONAL_INFO_RELATIONSHIPS:
+				case PROFILER_HEAP_OBJECT_OPTIONAL_INFO_WINRTEVENTS:
+				case PROFILER_HEAP_OBJECT_OPTIONAL_INFO_WEAKMAP_COLLECTION_LIST:
+				case PROFILER_HEAP_OBJECT_OPTIONAL_INFO_MAP_COLLECTION_LIST:
+				case PROFILER_HEAP_OBJECT_OPTIONAL_INFO_SET_COLLECTION_LIST:
+					//
+					// All of the relationship lists share one member of the union.
+					//
+
+					infoCopy.relationshipList = CopyRelationshipList(info.relationshipList);
+					break;
+				}
+			}
+		}
+
+		m_objects.push_back(objectCopy);
+		m_optionalInfo.push_back(optionalInfoCopy);
+	}
+	catch (...)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	return S_OK;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <activprof.h>
+#include <vector>
+
+//
+// Copies of heap objects and their optional info, taken so they can be serialized away
+// from the thread that enumerates the heap. Everything an object's optional info points to
+// is copied along with it, so the originals can go back to the enumerator straight away.
+//
+// Copies are carved out of large blocks, which are kept when the batch is cleared, so a
+// batch that's reused stops allocating once it has grown to the size of its largest fill.
+//
+
+class HeapObjectBatch sealed
+{
+private:
+	static const size_t BlockSize = 64 * 1024;
+
+	//
+	// Anything bigger than this gets a block of its own, which is freed when the batch is
+	// cleared.
+	//
+
+	static const size_t MaximumBlockAllocation = BlockSize / 4;
+
+	std::vector<uint8_t *> m_blocks;
+	size_t m_block;
+	size_t m_used;
+	std::vector<uint8_t *> m_largeBlocks;
+	std::vector<PROFILER_HEAP_OBJECT *> m_objects;
+	std::vector<PROFILER_HEAP_OBJECT_OPTIONAL_INFO *> m_optionalInfo;
+
+	HeapObjectBatch(const HeapObjectBatch &);
+	HeapObjectBatch &operator=(const HeapObjectBatch &);
+
+	void *Allocate(size_t size);
+	const wchar_t *CopyString(const wchar_t *value);
+	void CopyRelationship(PROFILER_HEAP_OBJECT_RELATIONSHIP *copy, const PROFILER_HEAP_OBJECT_RELATIONSHIP *relationship);
+	PROFILER_HEAP_OBJECT_RELATIONSHIP_LIST *CopyRelationshipList(const PROFILER_HEAP_OBJECT_RELATIONSHIP_LIST *list);
+
+public:
+	HeapObjectBatch(void);
+	~HeapObjectBatch(void);
+
+	HRESULT Add(const PROFILER_HEAP_OBJECT *object, const PROFILER_HEAP_OBJECT_OPTIONAL_INFO *optionalInfo);
+	void Clear(void);
+
+	size_t Count(void) const { return m_objects.size(); }
+	PROFILER_HEAP_OBJECT *Object(size_t index) const { return m_objects[index]; }
+	PROFILER_HEAP_OBJECT_OPTIONAL_INFO *OptionalInfo(size_t index) const { return m_optionalInfo[index]; }
+};
@@ -0,0 +1,475 @@
+#include "stdafx.h"
+#include <algorithm>
+#include "Inflate.h"
+#include "DeflateFormat.h"
+
+using namespace std;
+
+static const HRESULT InvalidDeflateData = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+
+Inflater::Inflater(void) :
+	m_input(nullptr),
+	m_inputEnd(nullptr),
+	m_bits(0),
+	m_bitCount(0),
+	m_outputEnd(0),
+	m_flushed(0),
+	m_produced(0),
+	m_stream(nullptr)
+{
+	uint8_t lengths[FixedLiteralLengthCodes];
+
+	for (unsigned code = 0; code < FixedLiteralLengthCodes; code++)
+	{
+		lengths[code] = (uint8_t) GetFixedLiteralLength(code);
+	}
+
+	BuildCode(lengths, FixedLiteralLengthCodes, &m_fixedLiteralLengthCode);
+
+	memset(lengths, 5, DistanceCodes);
+	BuildCode(lengths, DistanceCodes, &m_fixedDistanceCode);
+}
+
+//
+// Builds a code from its code lengths, failing if there are more codes of some length
+// than fit. A code with too few is allowed, as a single distance code is, and running into
+// one of its missing codes fails decoding.
+//
+
+bool Inflater::BuildCode(const uint8_t *lengths, unsigned count, HuffmanCode *code)
+{
+	uint16_t offsets[MaximumCodeLength + 2];
+	unsigned nextCodes[MaximumCodeLength + 1];
+	int left = 1;
+
+	memset(code->fast, 0, sizeof(code->fast));
+	memset(code->counts, 0, sizeof(code->counts));
+
+	for (unsigned symbol = 0; symbol < count; symbol++)
+	{
+		code->counts[lengths[symbol]]++;
+	}
+
+	code->counts[0] = 0;
+
+	for (unsigned length = 1; length <= MaximumCodeLength; length++)
+	{
+		left = (left << 1) - code->counts[length];
+		if (left < 0)
+		{
+			return false;
+		}
+	}
+
+	offsets[1] = 0;
+	nextCodes[1] = 0;
+
+	for (unsigned length = 1; length <= MaximumCodeLength; length++)
+	{
+		offsets[length + 1] = offsets[length] + code->counts[length];
+
+		if (length > 1)
+		{
+			nextCodes[length] = (nextCodes[length - 1] + code->counts[length - 1]) << 1;
+		}
+	}
+
+	for (unsigned symbol = 0; symbol < count; symbol++)
+	{
+		unsigned length = lengths[symbol];
+
+		if (length == 0)
+		{
+			continue;
+		}
+
+		code->symbols[offsets[length]++] = (uint16_t) symbol;
+
+		if (length <= FastBits)
+		{
+			unsigned value = nextCodes[length];
+			unsigned reversed = 0;
+
+			for (unsigned bit = 0; bit < length; bit++)
+			{
+				reversed = (reversed << 1) | ((value >> bit) & 1);
+			}
+
+			for (unsigned index = reversed; index < (1u << FastBits); index += 1 << length)
+			{
+				code->fast[index] = (uint16_t) ((symbol << 4) | length);
+			}
+		}
+
+		nextCodes[length]++;
+	}
+
+	return true;
+}
+
+void Inflater::Refill(void)
+{
+	while (m_bitCount <= 56 && m_input < m_inputEnd)
+	{
+		m_bits |= (uint64_t) *m_input++ << m_bitCount;
+		m_bitCount += 8;
+	}
+}
+
+bool Inflater::NeedBits(unsigned count)
+{
+	if (m_bitCount < count)
+	{
+		Refill();
+	}
+
+	return m_bitCount >= count;
+}
+
+unsigned Inflater::TakeBits(unsigned count)
+{
+	unsigned value = (unsigned) (m_bits & ((1u << count) - 1));
+
+	m_bits >>= count;
+	m_bitCount -= count;
+	return value;
+}
+
+bool Inflater::Decode(const HuffmanCode &code, unsigned *symbol)
+{
+	if (m_bitCount < MaximumCodeLength)
+	{
+		Refill();
+	}
+
+	unsigned entry = code.fast[m_bits & ((1u << FastBits) - 1)];
+
+	if (entry != 0 && (entry & 15) <= m_bitCount)
+	{
+		TakeBits(entry & 15);
+		*symbol = entry >> 4;
+		return true;
+	}
+
+	//
+	// Codes are assigned in order within each length, so going a bit at a time, a code is
+	// found once it's less than the first code of its length plus the number of them.
+	//
+
+	int value = 0;
+	int first = 0;
+	int index = 0;
+
+	for (unsigned length = 1; length <= MaximumCodeLength && length <= m_bitCount; length++)
+	{
+		int count = code.counts[length];
+
+		value |= (int) ((m_bits >> (length - 1)) & 1);
+
+		if (value - count < first)
+		{
+			TakeBits(length);
+			*symbol = code.symbols[index + (value - first)];
+			return true;
+		}
+
+		index += count;
+		first = (first + count) << 1;
+		value <<= 1;
+	}
+
+	return false;
+}
+
+HRESULT Inflater::Flush(void)
+{
+	if (m_outputEnd > m_flushed)
+	{
+		IfComFailRet(WriteToStream(m_stream, m_output.data() + m_flushed, m_outputEnd - m_flushed));
+		m_flushed = m_outputEnd;
+	}
+
+	return S_OK;
+}
+
+//
+// Makes sure there's room for the longest match. When the buffer's full, it's written out
+// and its last 32K moved to the front.
+//
+
+HRESULT Inflater::MakeRoom(void)
+{
+	if (m_outputEnd + MaximumMatch <= m_output.size())
+	{
+		return S_OK;
+	}
+
+	IfComFailRet(Flush());
+
+	memmove(m_output.data(), m_output.data() + m_outputEnd - WindowSize, WindowSize);
+	m_outputEnd = WindowSize;
+	m_flushed = WindowSize;
+	return S_OK;
+}
+
+HRESULT Inflater::InflateStoredBlock(void)
+{
+	TakeBits(m_bitCount & 7);
+
+	if (!NeedBits(32))
+	{
+		return InvalidDeflateData;
+	}
+
+	unsigned length = TakeBits(16);
+
+	if (TakeBits(16) != (~length & 0xFFFF))
+	{
+		return InvalidDeflateData;
+	}
+
+	while (length > 0)
+	{
+		IfComFailRet(MakeRoom());
+
+		size_t count = m_output.size() - m_outputEnd;
+
+		if (count > length)
+		{
+			count = length;
+		}
+
+		//
+		// Whatever the bit buffer has already read comes first.
+		//
+
+		size_t copied = 0;
+
+		while (copied < count && m_bitCount >= 8)
+		{
+			m_output[m_outputEnd + copied++] = (uint8_t) TakeBits(8);
+		}
+
+		if (count - copied > (size_t) (m_inputEnd - m_input))
+		{
+			return InvalidDeflateData;
+		}
+
+		memcpy(m_output.data() + m_outputEnd + copied, m_input, count - copied);
+		m_input += count - copied;
+
+		m_outputEnd += count;
+		m_produced += count;
+		length -= (unsigned) count;
+	}
+
+	return S_OK;
+}
+
+HRESULT Inflater::ReadDynamicCodes(void)
+{
+	uint8_t lengths[LiteralLengthCodes + DistanceCodes];
+	uint8_t codeLengthLengths[CodeLengthCodes] = { 0 };
+	HuffmanCode &codeLengthCode = m_distanceCode;
+
+	if (!NeedBits(14))
+	{
+		return InvalidDeflateData;
+	}
+
+	unsigned literalCount = TakeBits(5) + EndOfBlock + 1;
+	unsigned distanceCount = TakeBits(5) + 1;
+	unsigned codeLengthCount = TakeBits(4) + 4;
+
+	if (literalCount > LiteralLengthCodes || distanceCount > DistanceCodes)
+	{
+		return InvalidDeflateData;
+	}
+
+	for (unsigned index = 0; index < codeLengthCount; index++)
+	{
+		if (!NeedBits(3))
+		{
+			return InvalidDeflateData;
+		}
+
+		codeLengthLengths[codeLengthOrder[index]] = (uint8_t) TakeBits(3);
+	}
+
+	//
+	// The code length code is only needed until the other two are read, so it's built
+	// where the distance code will go.
+	//
+
+	if (!BuildCode(codeLengthLengths, CodeLengthCodes, &codeLengthCode))
+	{
+		return InvalidDeflateData;
+	}
+
+	for (unsigned index = 0; index < literalCount + distanceCount;)
+	{
+		unsigned symbol;
+
+		if (!Decode(codeLengthCode, &symbol))
+		{
+			return InvalidDeflateData;
+		}
+
+		if (symbol < RepeatPrevious)
+		{
+			lengths[index++] = (uint8_t) symbol;
+			continue;
+		}
+
+		unsigned extraBits = GetCodeLengthExtraBits(symbol);
+
+		if ((symbol == RepeatPrevious && index == 0) || !NeedBits(extraBits))
+		{
+			return InvalidDeflateData;
+		}
+
+		uint8_t length = symbol == RepeatPrevious ? lengths[index - 1] : 0;
+		unsigned repeat = TakeBits(extraBits) + (symbol == RepeatPrevious ? 3 : symbol == RepeatZero ? 3 : 11);
+
+		if (index + repeat > literalCount + distanceCount)
+		{
+			return InvalidDeflateData;
+		}
+
+		while (repeat-- > 0)
+		{
+			lengths[index++] = length;
+		}
+	}
+
+	if (lengths[EndOfBlock] == 0 ||
+		!BuildCode(lengths, literalCount, &m_literalLengthCode) ||
+		!BuildCode(lengths + literalCount, distanceCount, &m_distanceCode))
+	{
+		return InvalidDeflateData;
+	}
+
+	return S_OK;
+}
+
+HRESULT Inflater::InflateBlock(const HuffmanCode &literalLengthCode, const HuffmanCode &distanceCode)
+{
+	for (;;)
+	{
+		unsigned symbol;
+
+		IfComFailRet(MakeRoom());
+
+		if (!Decode(literalLengthCode, &symbol))
+		{
+			return InvalidDeflateData;
+		}
+
+		if (symbol < EndOfBlock)
+		{
+			m_output[m_outputEnd++] = (uint8_t) symbol;
+			m_produced++;
+			continue;
+		}
+
+		if (symbol == EndOfBlock)
+		{
+			return S_OK;
+		}
+
+		symbol -= EndOfBlock + 1;
+
+		if (symbol >= LengthCodes || !NeedBits(lengthExtraBits[symbol]))
+		{
+			return InvalidDeflateData;
+		}
+
+		unsigned length = lengthBase[symbol] + TakeBits(lengthExtraBits[symbol]);
+
+		if (!Decode(distanceCode, &symbol) || symbol >= DistanceCodes || !NeedBits(distanceExtraBits[symbol]))
+		{
+			return InvalidDeflateData;
+		}
+
+		unsigned distance = distanceBase[symbol] + TakeBits(distanceExtraBits[symbol]);
+
+		if (distance > m_produced)
+		{
+			return InvalidDeflateData;
+		}
+
+		//
+		// The match can overlap the bytes it's copying, so it's copied a byte at a time.
+		//
+
+		uint8_t *target = m_output.data() + m_outputEnd;
+		const uint8_t *source = target - distance;
+
+		for (unsigned index = 0; index < length; index++)
+		{
+			target[index] = source[index];
+		}
+
+		m_outputEnd += length;
+		m_produced += length;
+	}
+}
+
+HRESULT Inflater::Inflate(const uint8_t *input, size_t length, SnapshotStream *output, ULONGLONG *outputLength)
+{
+	bool final = false;
+
+	*outputLength = 0;
+
+	try
+	{
+		m_output.resize(WindowSize + OutputSize);
+	}
+	catch (...)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	m_input = input;
+	m_inputEnd = input + length;
+	m_bits = 0;
+	m_bitCount = 0;
+	m_outputEnd = 0;
+	m_flushed = 0;
+	m_produced = 0;
+	m_stream = output;
+
+	while (!final)
+	{
+		if (!NeedBits(3))
+		{
+			return InvalidDeflateData;
+		}
+
+		final = TakeBits(1) != 0;
+
+		switch (TakeBits(2))
+		{
+		case 0:
+			IfComFailRet(InflateStoredBlock());
+			break;
+
+		case 1:
+			IfComFailRet(InflateBlock(m_fixedLiteralLengthCode, m_fixedDistanceCode));
+			break;
+
+		case 2:
+			IfComFailRet(ReadDynamicCodes());
+			IfComFailRet(InflateBlock(m_literalLengthCode, m_distanceCode));
+			break;
+
+		default:
+			return InvalidDeflateData;
+		}
+	}
+
+	IfComFailRet(Flush());
+
+	*outputLength = m_produced;
+	return S_OK;
+}
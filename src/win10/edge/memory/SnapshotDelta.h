@@ -0,0 +1,142 @@
+#pragma once
+
+#include <activprof.h>
+#include <unordered_set>
+#include <vector>
+#include "BinarySnapshot.h"
+#include "SnapshotStream.h"
+
+//
+// Incremental snapshots. A profile taking them remembers a fingerprint of every object in
+// its last snapshot, and the next snapshot is a delta that only holds the objects that are
+// new or have changed since, followed by a list of the objects that have gone. A full
+// snapshot is rebuilt by starting from the newest delta and working back to the snapshot
+// it's based on.
+//
+
+struct ObjectFingerprint
+{
+	ULONG_PTR objectId;
+	ULONGLONG hash;
+};
+
+//
+// Hashes everything about an object that's written to a snapshot, other than whether the
+// engine thinks the object is new.
+//
+
+ULONGLONG FingerprintHeapObject(const PROFILER_HEAP_OBJECT *object, const PROFILER_HEAP_OBJECT_OPTIONAL_INFO *optionalInfo);
+
+//
+// The fingerprints of the objects in a snapshot, sorted by id so they take no more memory
+// than the fingerprints themselves. Once built they're only read, so any number of threads
+// can look objects up at once.
+//
+
+class SnapshotFingerprints sealed
+{
+private:
+	std::vector<ObjectFingerprint> m_fingerprints;
+
+	SnapshotFingerprints(const SnapshotFingerprints &);
+	SnapshotFingerprints &operator=(const SnapshotFingerprints &);
+
+public:
+	SnapshotFingerprints(void) {}
+
+	//
+	// Takes the given fingerprints, which can be in any order.
+	//
+
+	HRESULT Build(std::vector<ObjectFingerprint> *fingerprints);
+	void Swap(SnapshotFingerprints *other) { m_fingerprints.swap(other->m_fingerprints); }
+	void Clear(void);
+
+	size_t Count(void) const { return m_fingerprints.size(); }
+	bool Find(ULONG_PTR objectId, ULONGLONG *hash) const;
+
+	//
+	// Lists, in order, the objects here that aren't in a later snapshot.
+	//
+
+	HRESULT GetRemovedObjects(const SnapshotFingerprints &later, std::vector<ULONG_PTR> *objectIds) const;
+};
+
+//
+// Decides which objects go in a delta snapshot. Each serializer has its own, so they never
+// contend, and the fingerprints they gather are put together once the snapshot is done.
+//
+
+class DeltaFilter sealed
+{
+private:
+	const SnapshotFingerprints *m_base;
+	std::vector<ObjectFingerprint> m_fingerprints;
+	ULONGLONG m_includedCount;
+
+	DeltaFilter(const DeltaFilter &);
+	DeltaFilter &operator=(const DeltaFilter &);
+
+public:
+	//
+	// With no base, every object is included and only fingerprinted.
+	//
+
+	DeltaFilter(const SnapshotFingerprints *base);
+
+	HRESULT Filter(const PROFILER_HEAP_OBJECT *object, const PROFILER_HEAP_OBJECT_OPTIONAL_INFO *optionalInfo, bool *include);
+
+	std::vector<ObjectFingerprint> *Fingerprints(void) { return &m_fingerprints; }
+	ULONGLONG IncludedCount(void) const { return m_includedCount; }
+};
+
+//
+// Enumerates the full snapshot described by a binary delta and the snapshots it's based
+// on. Objects come from the newest snapshot first, and an older snapshot's object is only
+// passed on if no newer snapshot has already replaced or removed it, and is marked as not
+// new. The chain ends at the first snapshot that isn't a delta.
+//
+
+class DeltaSnapshotReader sealed : public IActiveScriptProfilerHeapEnum
+{
+private:
+	std::vector<BinarySnapshotReader *> m_snapshots;
+	size_t m_current;
+	std::unordered_set<ULONG_PTR> m_seen;
+	long m_refCount;
+
+	DeltaSnapshotReader(const DeltaSnapshotReader &);
+	DeltaSnapshotReader &operator=(const DeltaSnapshotReader &);
+
+	void FinishSnapshot(void);
+
+public:
+	DeltaSnapshotReader(void);
+	~DeltaSnapshotReader(void);
+
+	//
+	// Adds a snapshot that's already been opened, newest first. The reader takes its own
+	// reference to it.
+	//
+
+	HRESULT Add(BinarySnapshotReader *snapshot);
+
+	// IUnknown
+	HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void **ppvObj);
+	ULONG STDMETHODCALLTYPE AddRef(void);
+	ULONG STDMETHODCALLTYPE Release(void);
+
+	// IActiveScriptProfilerHeapEnum
+	HRESULT STDMETHODCALLTYPE Next(ULONG celt, PROFILER_HEAP_OBJECT **heapObjects, ULONG *pceltFetched);
+	HRESULT STDMETHODCALLTYPE GetOptionalInfo(PROFILER_HEAP_OBJECT *heapObject, ULONG celt, PROFILER_HEAP_OBJECT_OPTIONAL_INFO *optionalInfo);
+	HRESULT STDMETHODCALLTYPE FreeObjectAndOptionalInfo(ULONG celt, PROFILER_HEAP_OBJECT **heapObjects);
+	HRESULT STDMETHODCALLTYPE GetNameIdMap(LPCWSTR **pNameList, UINT *pcelt);
+};
+
+//
+// Does the same for snapshot JSON, newest first. Each object is on a line of its own, so
+// lines are copied to the output as they are, other than to mark objects as not new and
+// to write out interned names, and only the object ids are ever parsed.
+//
+
+HRESULT MergeJsonSnapshots(const std::vector<const MappedFile *> &snapshots, SnapshotStream *output);
@@ -0,0 +1,158 @@
+#include "stdafx.h"
+#include <algorithm>
+#include "SnapshotDiff.h"
+
+using namespace std;
+
+//
+// Orders survivors so that a heap of them has the smallest on top.
+//
+
+static bool IsLarger(const SurvivingObject &left, const SurvivingObject &right)
+{
+	return left.size > right.size;
+}
+
+SnapshotDiff::SnapshotDiff(MemoryBudget *budget, UINT32 surviveCount, size_t topCount) :
+	m_surviveCount(surviveCount),
+	m_topCount(topCount),
+	m_objects(budget),
+	m_nextObjects(budget)
+{
+}
+
+UINT32 SnapshotDiff::AddToGroup(const ScannedString &name, vector<GroupGrowth> *groups, GroupIndices *indices)
+{
+	string groupName(name.text != nullptr ? name.text : "", name.length);
+	GroupIndices::iterator existing = indices->find(groupName);
+
+	if (existing != indices->end())
+	{
+		return existing->second;
+	}
+
+	UINT32 index = (UINT32) groups->size();
+
+	groups->push_back(GroupGrowth());
+	groups->back().name = groupName;
+	groups->back().snapshots.resize(m_snapshots.size());
+	(*indices)[groupName] = index;
+	return index;
+}
+
+void SnapshotDiff::AddSurvivor(const ScannedObject &object, UINT32 firstSnapshot, UINT32 kind)
+{
+	if (m_topCount == 0 || (m_largestSurvivors.size() == m_topCount && object.size <= m_largestSurvivors.front().size))
+	{
+		return;
+	}
+
+	if (m_largestSurvivors.size() == m_topCount)
+	{
+		pop_heap(m_largestSurvivors.begin(), m_largestSurvivors.end(), IsLarger);
+		m_largestSurvivors.pop_back();
+	}
+
+	SurvivingObject survivor;
+
+	survivor.objectId = object.objectId;
+	survivor.size = object.size;
+	survivor.firstSnapshot = firstSnapshot;
+	survivor.kind = kind;
+	survivor.functionName.assign(object.functionName.text != nullptr ? object.functionName.text : "", object.functionName.length);
+
+	m_largestSurvivors.push_back(survivor);
+	push_heap(m_largestSurvivors.begin(), m_largestSurvivors.end(), IsLarger);
+}
+
+HRESULT SnapshotDiff::AddSnapshot(SnapshotScanner *scanner)
+{
+	UINT32 snapshot = SnapshotCount();
+	ScannedObject object;
+	HRESULT hr = S_OK;
+
+	try
+	{
+		m_snapshots.push_back(DiffTotals());
+
+		for (size_t kind = 0; kind < m_kinds.size(); kind++)
+		{
+			m_kinds[kind].snapshots.push_back(DiffTotals());
+			m_kinds[kind].surviving = DiffTotals();
+		}
+
+		for (size_t function = 0; function < m_functions.size(); function++)
+		{
+			m_functions[function].snapshots.push_back(DiffTotals());
+			m_functions[function].surviving = DiffTotals();
+		}
+
+		m_largestSurvivors.clear();
+
+		while ((hr = scanner->Next(&object)) == S_OK)
+		{
+			//
+			// An object that was in the last snapshot carries on its run; any other starts one.
+			//
+
+			UINT32 firstSnapshot = m_objects.Find(object.objectId);
+
+			if (firstSnapshot == ObjectIdTable::NoValue)
+			{
+				firstSnapshot = snapshot;
+			}
+
+			IfComFailError(m_nextObjects.Insert(object.objectId, firstSnapshot));
+
+			bool surviving = firstSnapshot > 0 && snapshot - firstSnapshot + 1 >= m_surviveCount;
+			UINT32 kind = AddToGroup(object.kind, &m_kinds, &m_kindIndices);
+			DiffTotals &kindTotals = m_kinds[kind].snapshots[snapshot];
+
+			m_snapshots[snapshot].count++;
+			m_snapshots[snapshot].size += object.size;
+			kindTotals.count++;
+			kindTotals.size += object.size;
+
+			if (surviving)
+			{
+				m_kinds[kind].surviving.count++;
+				m_kinds[kind].surviving.size += object.size;
+				AddSurvivor(object, firstSnapshot, kind);
+			}
+
+			if (object.functionName.length > 0)
+			{
+				UINT32 function = AddToGroup(object.functionName, &m_functions, &m_functionIndices);
+				DiffTotals &functionTotals = m_functions[function].snapshots[snapshot];
+
+				functionTotals.count++;
+				functionTotals.size += object.size;
+
+				if (surviving)
+				{
+					m_functions[function].surviving.count++;
+					m_functions[function].surviving.size += object.size;
+				}
+			}
+		}
+
+		IfComFailError(hr);
+
+		sort_heap(m_largestSurvivors.begin(), m_largestSurvivors.end(), IsLarger);
+	}
+	catch (...)
+	{
+		IfComFailError(E_OUTOFMEMORY);
+	}
+
+	//
+	// Only this snapshot's objects are needed to join the next one.
+	//
+
+	m_objects.Swap(&m_nextObjects);
+	hr = S_OK;
+
+error:
+	m_nextObjects.Clear();
+	return hr;
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "HeapGraph.h"
+#include "SnapshotScanner.h"
+
+//
+// Compares a series of snapshots of the same heap, oldest first, for finding leaks. Each
+// snapshot is streamed through once and joined to the one before it on object ids, so
+// only the ids of one snapshot's objects are held onto between snapshots, along with the
+// snapshot each of them first appeared in.
+//
+// An object survives when it's new since the first snapshot, which is taken to be the
+// baseline, and has been in at least a given number of snapshots in a row.
+//
+
+struct DiffTotals
+{
+	ULONGLONG count;
+	ULONGLONG size;
+
+	DiffTotals() :
+		count(0),
+		size(0)
+	{
+	}
+};
+
+//
+// The objects of a kind, or of functions with a name, in each snapshot, and those in the
+// latest snapshot that survive.
+//
+
+struct GroupGrowth
+{
+	std::string name;
+	std::vector<DiffTotals> snapshots;
+	DiffTotals surviving;
+};
+
+struct SurvivingObject
+{
+	ULONGLONG objectId;
+	ULONGLONG size;
+	UINT32 firstSnapshot;
+	UINT32 kind;
+	std::string functionName;
+};
+
+class SnapshotDiff sealed
+{
+private:
+	typedef std::unordered_map<std::string, UINT32> GroupIndices;
+
+	UINT32 m_surviveCount;
+	size_t m_topCount;
+	std::vector<DiffTotals> m_snapshots;
+	ObjectIdTable m_objects;
+	ObjectIdTable m_nextObjects;
+	std::vector<GroupGrowth> m_kinds;
+	GroupIndices m_kindIndices;
+	std::vector<GroupGrowth> m_functions;
+	GroupIndices m_functionIndices;
+	std::vector<SurvivingObject> m_largestSurvivors;
+
+	SnapshotDiff(const SnapshotDiff &);
+	SnapshotDiff &operator=(const SnapshotDiff &);
+
+	UINT32 AddToGroup(const ScannedString &name, std::vector<GroupGrowth> *groups, GroupIndices *indices);
+	void AddSurvivor(const ScannedObject &object, UINT32 firstSnapshot, UINT32 kind);
+
+public:
+	//
+	// Objects survive once they've been in surviveCount snapshots in a row, and the largest
+	// topCount of them are kept.
+	//
+
+	SnapshotDiff(MemoryBudget *budget, UINT32 surviveCount, size_t topCount);
+
+	//
+	// Adds the next snapshot.
+	//
+
+	HRESULT AddSnapshot(SnapshotScanner *scanner);
+
+	UINT32 SnapshotCount(void) const { return (UINT32) m_snapshots.size(); }
+	const DiffTotals &SnapshotTotals(UINT32 snapshot) const { return m_snapshots[snapshot]; }
+	const std::vector<GroupGrowth> &Kinds(void) const { return m_kinds; }
+	const std::vector<GroupGrowth> &Functions(void) const { return m_functions; }
+
+	//
+	// The largest objects surviving in the latest snapshot, largest first.
+	//
+
+	const std::vector<SurvivingObject> &LargestSurvivors(void) const { return m_largestSurvivors; }
+
+	//
+	// The first of the snapshots in a row that an object in the latest snapshot has been in,
+	// or ObjectIdTable::NoValue for an object that isn't in the latest snapshot.
+	//
+
+	UINT32 FirstSnapshot(ULONGLONG objectId) const { return m_objects.Find(objectId); }
+};
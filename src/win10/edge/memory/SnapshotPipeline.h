@@ -0,0 +1,93 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "HeapObjectBatch.h"
+#include "SnapshotStream.h"
+
+//
+// Turns batches of heap objects into snapshot bytes. The pipeline gives each of its worker
+// threads a serializer of its own.
+//
+
+class BatchSerializer
+{
+public:
+	virtual ~BatchSerializer(void) {}
+	virtual HRESULT Serialize(const HeapObjectBatch *batch, std::vector<uint8_t> *output) = 0;
+};
+
+//
+// Writes a snapshot in three stages. The thread enumerating the heap fills batches with
+// copies of heap objects, since only it may touch the enumerator. Worker threads serialize
+// the batches, as many at once as there are workers. A writer thread puts their output in
+// the stream in the order the batches were submitted, so whatever the stream does with it,
+// such as compressing it, overlaps with the other stages too.
+//
+// There's a fixed number of batches, and a batch is only reused once it's been written,
+// which keeps the memory the pipeline uses bounded however fast the heap is enumerated.
+//
+
+class SnapshotPipeline sealed
+{
+private:
+	struct Batch
+	{
+		HeapObjectBatch objects;
+		std::vector<uint8_t> output;
+		ULONGLONG sequence;
+	};
+
+	SnapshotStream *m_stream;
+	std::vector<Batch *> m_batches;
+	std::vector<std::thread> m_workers;
+	std::thread m_writer;
+
+	std::mutex m_lock;
+	std::condition_variable m_batchQueued;
+	std::condition_variable m_batchSerialized;
+	std::condition_variable m_batchFree;
+	std::deque<Batch *> m_free;
+	std::deque<Batch *> m_queued;
+	std::map<ULONGLONG, Batch *> m_serialized;
+	ULONGLONG m_nextSequence;
+	ULONGLONG m_nextWrite;
+	bool m_finishing;
+	HRESULT m_status;
+
+	SnapshotPipeline(const SnapshotPipeline &);
+	SnapshotPipeline &operator=(const SnapshotPipeline &);
+
+	void Fail(HRESULT hr);
+	void RunWorker(BatchSerializer *serializer);
+	void RunWriter(void);
+
+public:
+	SnapshotPipeline(SnapshotStream *stream);
+	~SnapshotPipeline(void);
+
+	//
+	// Starts a worker thread for each serializer. Batches are handed to workers in the order
+	// they're submitted, so with a single serializer they're serialized in order.
+	//
+
+	HRESULT Start(const std::vector<BatchSerializer *> &serializers, unsigned batchCount);
+
+	//
+	// Waits for a free batch. Returns null once the pipeline has failed.
+	//
+
+	HeapObjectBatch *Acquire(void);
+	void Submit(HeapObjectBatch *batch);
+
+	//
+	// Waits for every batch submitted to be written and stops the threads. Returns the first
+	// error any stage ran into.
+	//
+
+	HRESULT Finish(void);
+};
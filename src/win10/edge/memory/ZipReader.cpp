@@ -0,0 +1,299 @@
+#include "stdafx.h"
+#include "ZipReader.h"
+
+using namespace std;
+
+static const UINT32 LocalHeaderSignature = 0x04034b50;
+static const UINT32 CentralHeaderSignature = 0x02014b50;
+static const UINT32 Zip64EndSignature = 0x06064b50;
+static const UINT32 Zip64LocatorSignature = 0x07064b50;
+static const UINT32 EndSignature = 0x06054b50;
+
+static const UINT16 StoredMethod = 0;
+static const UINT16 DeflateMethod = 8;
+static const UINT16 Zip64ExtraId = 1;
+static const UINT32 Zip64Marker = 0xFFFFFFFF;
+
+static const size_t LocalHeaderLength = 30;
+static const size_t CentralHeaderLength = 46;
+static const size_t EndLength = 22;
+static const size_t Zip64LocatorLength = 20;
+static const size_t Zip64EndLength = 56;
+static const size_t MaximumCommentLength = 0xFFFF;
+
+static const HRESULT InvalidPackage = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+
+static UINT16 Read16(const uint8_t *bytes)
+{
+	return (UINT16) (bytes[0] | (bytes[1] << 8));
+}
+
+static UINT32 Read32(const uint8_t *bytes)
+{
+	return (UINT32) Read16(bytes) | ((UINT32) Read16(bytes + 2) << 16);
+}
+
+static ULONGLONG Read64(const uint8_t *bytes)
+{
+	return (ULONGLONG) Read32(bytes) | ((ULONGLONG) Read32(bytes + 4) << 32);
+}
+
+//
+// Passes a part on to where it's going, working out its CRC on the way.
+//
+
+class ChecksumStream sealed : public SnapshotStream
+{
+private:
+	SnapshotStream *m_output;
+	const UINT32 *m_crcTable;
+	UINT32 m_crc;
+
+	ChecksumStream(const ChecksumStream &);
+	ChecksumStream &operator=(const ChecksumStream &);
+
+public:
+	ChecksumStream(SnapshotStream *output, const UINT32 *crcTable) :
+		m_output(output),
+		m_crcTable(crcTable),
+		m_crc(0xFFFFFFFF)
+	{
+	}
+
+	UINT32 Crc(void) const { return m_crc ^ 0xFFFFFFFF; }
+
+	HRESULT Write(const void *bytes, ULONG length, ULONG *written)
+	{
+		const uint8_t *current = (const uint8_t *) bytes;
+		UINT32 crc = m_crc;
+
+		for (ULONG index = 0; index < length; index++)
+		{
+			crc = m_crcTable[(crc ^ current[index]) & 0xFF] ^ (crc >> 8);
+		}
+
+		m_crc = crc;
+		*written = length;
+		return WriteToStream(m_output, bytes, length);
+	}
+};
+
+ZipReader::ZipReader(void)
+{
+	for (UINT32 index = 0; index < 256; index++)
+	{
+		UINT32 crc = index;
+
+		for (unsigned bit = 0; bit < 8; bit++)
+		{
+			crc = (crc & 1) ? 0xEDB88320 ^ (crc >> 1) : crc >> 1;
+		}
+
+		m_crcTable[index] = crc;
+	}
+}
+
+HRESULT ZipReader::Open(const wchar_t *fileName)
+{
+	IfComFailRet(m_file.Open(fileName));
+	return ReadCentralDirectory();
+}
+
+//
+// The end of central directory record is at the end of the package, before a comment of
+// up to 64K. When any of its fields don't fit, the Zip64 record just before it holds them.
+//
+
+HRESULT ZipReader::FindCentralDirectory(ULONGLONG *offset, ULONGLONG *size, ULONGLONG *entryCount) const
+{
+	const uint8_t *data = m_file.Data();
+	size_t fileSize = m_file.Size();
+	size_t end;
+
+	if (fileSize < EndLength)
+	{
+		return InvalidPackage;
+	}
+
+	for (end = fileSize - EndLength; ; end--)
+	{
+		if (Read32(data + end) == EndSignature && end + EndLength + Read16(data + end + 20) == fileSize)
+		{
+			break;
+		}
+
+		if (end == 0 || fileSize - EndLength - end >= MaximumCommentLength)
+		{
+			return InvalidPackage;
+		}
+	}
+
+	*entryCount = Read16(data + end + 10);
+	*size = Read32(data + end + 12);
+	*offset = Read32(data + end + 16);
+
+	if (*entryCount != 0xFFFF && *size != Zip64Marker && *offset != Zip64Marker)
+	{
+		return S_OK;
+	}
+
+	if (end < Zip64LocatorLength || Read32(data + end - Zip64LocatorLength) != Zip64LocatorSignature)
+	{
+		return InvalidPackage;
+	}
+
+	ULONGLONG zip64End = Read64(data + end - Zip64LocatorLength + 8);
+
+	if (fileSize < Zip64EndLength || zip64End > fileSize - Zip64EndLength || Read32(data + zip64End) != Zip64EndSignature)
+	{
+		return InvalidPackage;
+	}
+
+	*entryCount = Read64(data + zip64End + 32);
+	*size = Read64(data + zip64End + 40);
+	*offset = Read64(data + zip64End + 48);
+	return S_OK;
+}
+
+HRESULT ZipReader::ReadCentralDirectory(void)
+{
+	const uint8_t *data = m_file.Data();
+	size_t fileSize = m_file.Size();
+	ULONGLONG offset;
+	ULONGLONG size;
+	ULONGLONG entryCount;
+
+	IfComFailRet(FindCentralDirectory(&offset, &size, &entryCount));
+
+	if (offset > fileSize || size > fileSize - offset)
+	{
+		return InvalidPackage;
+	}
+
+	const uint8_t *current = data + offset;
+	const uint8_t *end = current + size;
+
+	try
+	{
+		m_entries.clear();
+
+		for (ULONGLONG index = 0; index < entryCount; index++)
+		{
+			Entry entry;
+
+			if ((size_t) (end - current) < CentralHeaderLength || Read32(current) != CentralHeaderSignature)
+			{
+				return InvalidPackage;
+			}
+
+			UINT16 nameLength = Read16(current + 28);
+			UINT16 extraLength = Read16(current + 30);
+			UINT16 commentLength = Read16(current + 32);
+
+			if ((size_t) (end - current) < CentralHeaderLength + nameLength + extraLength + commentLength)
+			{
+				return InvalidPackage;
+			}
+
+			entry.method = Read16(current + 10);
+			entry.crc = Read32(current + 16);
+			entry.compressedSize = Read32(current + 20);
+			entry.size = Read32(current + 24);
+			entry.offset = Read32(current + 42);
+			entry.name.assign((const char *) current + CentralHeaderLength, nameLength);
+
+			//
+			// The Zip64 extra field only holds the values that didn't fit, in this order.
+			//
+
+			const uint8_t *extra = current + CentralHeaderLength + nameLength;
+			const uint8_t *extraEnd = extra + extraLength;
+
+			while (extraEnd - extra >= 4)
+			{
+				UINT16 id = Read16(extra);
+				UINT16 length = Read16(extra + 2);
+				const uint8_t *field = extra + 4;
+
+				if (extraEnd - field < length)
+				{
+					return InvalidPackage;
+				}
+
+				if (id == Zip64ExtraId)
+				{
+					ULONGLONG *values[] = { &entry.size, &entry.compressedSize, &entry.offset };
+
+					for (size_t value = 0; value < ARRAYSIZE(values); value++)
+					{
+						if (*values[value] != Zip64Marker)
+						{
+							continue;
+						}
+
+						if (field + 8 > extra + 4 + length)
+						{
+							return InvalidPackage;
+						}
+
+						*values[value] = Read64(field);
+						field += 8;
+					}
+				}
+
+				extra += 4 + length;
+			}
+
+			m_entries.push_back(entry);
+			current += CentralHeaderLength + nameLength + extraLength + commentLength;
+		}
+	}
+	catch (...)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	return S_OK;
+}
+
+HRESULT ZipReader::ExtractPart(size_t index, SnapshotStream *output)
+{
+	const Entry &entry = m_entries[index];
+	const uint8_t *data = m_file.Data();
+	size_t fileSize = m_file.Size();
+	ChecksumStream checksum(output, m_crcTable);
+	ULONGLONG size;
+
+	if (entry.offset > fileSize || fileSize - entry.offset < LocalHeaderLength || Read32(data + entry.offset) != LocalHeaderSignature)
+	{
+		return InvalidPackage;
+	}
+
+	ULONGLONG start = entry.offset + LocalHeaderLength + Read16(data + entry.offset + 26) + Read16(data + entry.offset + 28);
+
+	if (start > fileSize || entry.compressedSize > fileSize - start)
+	{
+		return InvalidPackage;
+	}
+
+	if (entry.method == StoredMethod)
+	{
+		IfComFailRet(WriteToStream(&checksum, data + start, (size_t) entry.compressedSize));
+		size = entry.compressedSize;
+	}
+	else if (entry.method == DeflateMethod)
+	{
+		IfComFailRet(m_inflater.Inflate(data + start, (size_t) entry.compressedSize, &checksum, &size));
+	}
+	else
+	{
+		return HRESULT_FROM_WIN32(ERROR_UNSUPPORTED_COMPRESSION);
+	}
+
+	if (size != entry.size || checksum.Crc() != entry.crc)
+	{
+		return HRESULT_FROM_WIN32(ERROR_CRC);
+	}
+
+	return S_OK;
+}
@@ -0,0 +1,264 @@
+#include <windows.h>
+#include <activprof.h>
+#include <stdio.h>
+#include <vector>
+#include "Benchmark.h"
+
+using namespace std;
+
+typedef void *MemoryProfileHandle;
+typedef MemoryProfileHandle (*StartMemoryProfileExFunction)(unsigned format, const wchar_t *fileName);
+typedef bool (*WriteSnapshotFunction)(MemoryProfileHandle memoryProfileHandle, IActiveScriptProfilerHeapEnum *enumerator);
+typedef bool (*EndMemoryProfileFunction)(MemoryProfileHandle memoryProfileHandle, const wchar_t *fileName);
+typedef void (*SetSnapshotBatchSizeFunction)(unsigned batchSize);
+
+static const unsigned SnapshotFormatBinary = 1;
+static const ULONG SnapshotObjectCount = 1024 * 1024;
+
+//
+// Stands in for the engine's heap enumerator, handing out a given number of objects with
+// a few properties each. Calls to Next and FreeObjectAndOptionalInfo can be made to take a
+// fixed time, as the engine's own bookkeeping for each call does, whatever the batch size.
+//
+
+class MockHeapEnumerator sealed : public IActiveScriptProfilerHeapEnum
+{
+private:
+	static const ULONG MaximumBatchSize = 64 * 1024;
+	static const ULONG PropertyCount = 4;
+
+	long m_refCount;
+	ULONG m_objectCount;
+	ULONG m_nextObject;
+	double m_callSeconds;
+	vector<PROFILER_HEAP_OBJECT> m_objects;
+	vector<uint8_t> m_properties;
+
+	MockHeapEnumerator(const MockHeapEnumerator &);
+	MockHeapEnumerator &operator=(const MockHeapEnumerator &);
+
+	void Call(void)
+	{
+		if (m_callSeconds > 0)
+		{
+			double end = GetSeconds() + m_callSeconds;
+
+			while (GetSeconds() < end)
+			{
+			}
+		}
+	}
+
+public:
+	static const wchar_t *names[];
+	static const UINT NameCount = 8;
+
+	MockHeapEnumerator(ULONG objectCount, double callSeconds) :
+		m_refCount(1),
+		m_objectCount(objectCount),
+		m_nextObject(0),
+		m_callSeconds(callSeconds),
+		m_objects(MaximumBatchSize),
+		m_properties(offsetof(PROFILER_HEAP_OBJECT_RELATIONSHIP_LIST, elements) + PropertyCount * sizeof(PROFILER_HEAP_OBJECT_RELATIONSHIP))
+	{
+		PROFILER_HEAP_OBJECT_RELATIONSHIP_LIST *properties = (PROFILER_HEAP_OBJECT_RELATIONSHIP_LIST *) &m_properties[0];
+
+		properties->count = PropertyCount;
+
+		for (ULONG index = 0; index < PropertyCount; index++)
+		{
+			PROFILER_HEAP_OBJECT_RELATIONSHIP *property = &properties->elements[index];
+
+			property->relationshipId = index;
+
+			if (index == PropertyCount - 1)
+			{
+				property->relationshipInfo = PROFILER_PROPERTY_TYPE_NUMBER;
+				property->numberValue = 42;
+			}
+			else
+			{
+				property->relationshipInfo = PROFILER_PROPERTY_TYPE_HEAP_OBJECT;
+				property->objectId = 0x10000000 + index * 32;
+			}
+		}
+	}
+
+	HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void **ppvObj)
+	{
+		if (riid == IID_IUnknown || riid == IID_IActiveScriptProfilerHeapEnum)
+		{
+			*ppvObj = (IActiveScriptProfilerHeapEnum *) this;
+		}
+		else
+		{
+			*ppvObj = NULL;
+			return E_NOINTERFACE;
+		}
+
+		AddRef();
+		return NOERROR;
+	}
+
+	ULONG STDMETHODCALLTYPE AddRef(void)
+	{
+		return InterlockedIncrement(&m_refCount);
+	}
+
+	ULONG STDMETHODCALLTYPE Release(void)
+	{
+		long lw;
+
+		if (0 == (lw = InterlockedDecrement(&m_refCount)))
+		{
+			delete this;
+		}
+		return lw;
+	}
+
+	HRESULT STDMETHODCALLTYPE Next(ULONG celt, PROFILER_HEAP_OBJECT **heapObjects, ULONG *pceltFetched)
+	{
+		Call();
+
+		ULONG count = m_objectCount - m_nextObject;
+		count = count < celt ? count : celt;
+		count = count < MaximumBatchSize ? count : MaximumBatchSize;
+
+		for (ULONG index = 0; index < count; index++)
+		{
+			PROFILER_HEAP_OBJECT *object = &m_objects[index];
+
+			object->size = 32 + m_nextObject % 64;
+			object->objectId = 0x10000000 + (PROFILER_HEAP_OBJECT_ID) m_nextObject * 32;
+			object->typeNameId = m_nextObject % NameCount;
+			object->flags = PROFILER_HEAP_OBJECT_FLAGS_NEW_STATE_UNAVAILABLE;
+			object->unused = 0;
+			object->optionalInfoCount = 1;
+			heapObjects[index] = object;
+			m_nextObject++;
+		}
+
+		*pceltFetched = count;
+		return count < celt ? S_FALSE : S_OK;
+	}
+
+	HRESULT STDMETHODCALLTYPE GetOptionalInfo(PROFILER_HEAP_OBJECT *heapObject, ULONG celt, PROFILER_HEAP_OBJECT_OPTIONAL_INFO *optionalInfo)
+	{
+		if (celt != heapObject->optionalInfoCount)
+		{
+			return E_INVALIDARG;
+		}
+
+		optionalInfo[0].infoType = PROFILER_HEAP_OBJECT_OPTIONAL_INFO_NAME_PROPERTIES;
+		optionalInfo[0].namePropertyList = (PROFILER_HEAP_OBJECT_RELATIONSHIP_LIST *) &m_properties[0];
+		return S_OK;
+	}
+
+	HRESULT STDMETHODCALLTYPE FreeObjectAndOptionalInfo(ULONG celt, PROFILER_HEAP_OBJECT **heapObjects)
+	{
+		Call();
+		return S_OK;
+	}
+
+	HRESULT STDMETHODCALLTYPE GetNameIdMap(LPCWSTR *pNameList[], UINT *pcelt)
+	{
+		*pNameList = (LPCWSTR *) CoTaskMemAlloc(NameCount * sizeof(LPCWSTR));
+
+		if (*pNameList == nullptr)
+		{
+			return E_OUTOFMEMORY;
+		}
+
+		memcpy(*pNameList, names, NameCount * sizeof(LPCWSTR));
+		*pcelt = NameCount;
+		return S_OK;
+	}
+};
+
+const wchar_t *MockHeapEnumerator::names[] =
+{
+	L"Object", L"Array", L"String", L"Function", L"length", L"prototype", L"next", L"value"
+};
+
+//
+// Snapshots a million or so mock objects through ChakraMemoryProfile.dll at a range of batch
+// sizes, a batch size of one being how the heap was walked before batching. Snapshots are
+// written in the binary format, which does the least serializing, so the time is mostly
+// the enumeration's. The DLL has to be somewhere LoadLibrary looks, such as next to the
+// benchmarks.
+//
+
+void BenchmarkHeapEnumeration(void)
+{
+	static const unsigned batchSizes[] = { 1, 16, 64, 256, 1024, 4096 };
+	static const struct
+	{
+		const char *name;
+		double callSeconds;
+	} callCosts[] =
+	{
+		{ "HeapEnumeration", 0 },
+		{ "HeapEnumeration 1us/call", 1e-6 },
+	};
+
+	HMODULE module = LoadLibraryW(L"ChakraMemoryProfile.dll");
+
+	if (module == nullptr)
+	{
+		fwprintf(stderr, L"HeapEnumeration: ChakraMemoryProfile.dll wasn't found\n");
+		return;
+	}
+
+	StartMemoryProfileExFunction startMemoryProfile = (StartMemoryProfileExFunction) GetProcAddress(module, "StartMemoryProfileEx");
+	WriteSnapshotFunction writeSnapshot = (WriteSnapshotFunction) GetProcAddress(module, "WriteSnapshot");
+	EndMemoryProfileFunction endMemoryProfile = (EndMemoryProfileFunction) GetProcAddress(module, "EndMemoryProfile");
+	SetSnapshotBatchSizeFunction setSnapshotBatchSize = (SetSnapshotBatchSizeFunction) GetProcAddress(module, "SetSnapshotBatchSize");
+
+	if (startMemoryProfile == nullptr || writeSnapshot == nullptr || endMemoryProfile == nullptr || setSnapshotBatchSize == nullptr)
+	{
+		fwprintf(stderr, L"HeapEnumeration: ChakraMemoryProfile.dll doesn't export the profile functions\n");
+		FreeLibrary(module);
+		return;
+	}
+
+	for (size_t cost = 0; cost < ARRAYSIZE(callCosts); cost++)
+	{
+		for (size_t size = 0; size < ARRAYSIZE(batchSizes); size++)
+		{
+			bool written = true;
+			char variant[32];
+
+			setSnapshotBatchSize(batchSizes[size]);
+
+			double seconds = TimeBest(3, 1, [&]()
+			{
+				MockHeapEnumerator *enumerator = new MockHeapEnumerator(SnapshotObjectCount, callCosts[cost].callSeconds);
+				MemoryProfileHandle profile = startMemoryProfile(SnapshotFormatBinary, nullptr);
+
+				if (profile != nullptr)
+				{
+					written = writeSnapshot(profile, enumerator) && written;
+					endMemoryProfile(profile, nullptr);
+				}
+				else
+				{
+					written = false;
+				}
+
+				enumerator->Release();
+			});
+
+			if (!written)
+			{
+				fwprintf(stderr, L"HeapEnumeration: the snapshot couldn't be written\n");
+				break;
+			}
+
+			sprintf_s(variant, "batch size %u", batchSizes[size]);
+			Report(callCosts[cost].name, variant, SnapshotObjectCount / seconds / 1e6, "M objects/s");
+		}
+	}
+
+	setSnapshotBatchSize(0);
+	FreeLibrary(module);
+}
@@ -0,0 +1,148 @@
+#include <windows.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include "../memory/Transcode.h"
+#include "Test.h"
+
+using namespace std;
+
+//
+// The snapshot writer's escaping loop from before EscapeJsonString, one code unit at a
+// time, kept as the reference the new escaper has to match.
+//
+
+static string ReferenceEscape(const uint16_t *source, size_t sourceLength)
+{
+	static const char hexDigits[] = "0123456789abcdef";
+	string escaped;
+
+	for (size_t index = 0; index < sourceLength; index++)
+	{
+		uint16_t character = source[index];
+
+		switch (character)
+		{
+		case L'"':
+			escaped += "\\\"";
+			break;
+		case L'/':
+			escaped += "\\/";
+			break;
+		case L'\\':
+			escaped += "\\\\";
+			break;
+		case L'\b':
+			escaped += "\\b";
+			break;
+		case L'\f':
+			escaped += "\\f";
+			break;
+		case L'\n':
+			escaped += "\\n";
+			break;
+		case L'\r':
+			escaped += "\\r";
+			break;
+		case L'\t':
+			escaped += "\\t";
+			break;
+		default:
+			if (character <= 0x001F || character > 0x007F)
+			{
+				escaped += "\\u";
+				escaped += hexDigits[(character >> 12) & 0xF];
+				escaped += hexDigits[(character >> 8) & 0xF];
+				escaped += hexDigits[(character >> 4) & 0xF];
+				escaped += hexDigits[character & 0xF];
+			}
+			else
+			{
+				escaped += (char) character;
+			}
+			break;
+		}
+	}
+
+	return escaped;
+}
+
+static bool EscapesLikeReference(const vector<uint16_t> &source)
+{
+	vector<uint8_t> escaped(JSON_ESCAPED_LENGTH_FOR_UTF16(source.size()) + 1);
+	size_t length = EscapeJsonString(source.empty() ? nullptr : &source[0], source.size(), &escaped[0]);
+
+	return string((const char *) &escaped[0], length) == ReferenceEscape(source.empty() ? nullptr : &source[0], source.size());
+}
+
+//
+// Every code unit on its own, and in the middle of a run of plain ASCII at each offset
+// within a 16 code unit block, so it's found by the vector scan as well as the tail.
+//
+
+bool TestEscapeJsonStringEveryCodeUnit(void)
+{
+	for (unsigned character = 0; character <= 0xFFFF; character++)
+	{
+		vector<uint16_t> source(1, (uint16_t) character);
+		Check(EscapesLikeReference(source));
+
+		for (size_t offset = 0; offset < 16; offset += 5)
+		{
+			source.assign(40, (uint16_t) 'a');
+			source[offset + 16] = (uint16_t) character;
+			Check(EscapesLikeReference(source));
+		}
+	}
+
+	return true;
+}
+
+//
+// Random strings, mostly plain ASCII with escapes and non-ASCII mixed in at different
+// rates, so there are runs of every length for the vector scan to copy. The generator is
+// seeded, so a failure can be reproduced.
+//
+
+bool TestEscapeJsonStringMatchesReference(void)
+{
+	static const uint16_t special[] = { '"', '\\', '/', '\b', '\f', '\n', '\r', '\t', 0, 0x1F, 0x7F, 0x80, 0xE9, 0xD83D, 0xDE00, 0xFFFF };
+	UINT32 seed = 0x2545F491;
+	vector<uint16_t> source;
+
+	for (int iteration = 0; iteration < 200000; iteration++)
+	{
+		seed ^= seed << 13;
+		seed ^= seed >> 17;
+		seed ^= seed << 5;
+
+		size_t length = seed % 80;
+		unsigned rate = 1 + (seed >> 8) % 32;
+
+		source.clear();
+
+		for (size_t index = 0; index < length; index++)
+		{
+			seed ^= seed << 13;
+			seed ^= seed >> 17;
+			seed ^= seed << 5;
+
+			if (seed % rate != 0)
+			{
+				source.push_back((uint16_t) (' ' + (seed >> 8) % 95));
+			}
+			else if ((seed >> 8) % 2 == 0)
+			{
+				source.push_back(special[(seed >> 9) % ARRAYSIZE(special)]);
+			}
+			else
+			{
+				source.push_back((uint16_t) (seed >> 16));
+			}
+		}
+
+		Check(EscapesLikeReference(source));
+	}
+
+	return true;
+}
@@ -0,0 +1,82 @@
+#include "../cpp/stdafx.h"
+#include "Test.h"
+
+using namespace std;
+
+//
+// A profile with every kind of field the host writes, names outside ASCII among them, and
+// enough samples that the deflate stream has matches and dynamic Huffman blocks. The
+// samples come from a fixed linear congruential generator, so the profile never changes.
+//
+
+static void BuildProfile(PprofWriter *profile)
+{
+	static const wchar_t *names[] =
+	{
+		L"main",
+		L"obj.fib",
+		L"Math.sin",
+		L"caf\u00e9",
+		L"\u4e2d\u6587",
+		L"\U0001F600",
+		L"",
+	};
+
+	ULONGLONG functions[ARRAYSIZE(names)];
+	UINT32 seed = 12345;
+
+	profile->AddSampleType("samples", "count");
+	profile->AddSampleType("cpu", "nanoseconds");
+	profile->SetDefaultSampleType("cpu");
+	profile->SetDuration(1500000000);
+
+	for (size_t index = 0; index < ARRAYSIZE(names); index++)
+	{
+		functions[index] = profile->AddFunction(names[index], index % 2 == 0 ? L"test.js" : L"");
+	}
+
+	for (int sample = 0; sample < 400; sample++)
+	{
+		ULONGLONG stack[8];
+		size_t depth;
+
+		seed = seed * 1103515245 + 12345;
+		depth = 1 + (seed >> 16) % ARRAYSIZE(stack);
+
+		for (size_t frame = 0; frame < depth; frame++)
+		{
+			seed = seed * 1103515245 + 12345;
+			stack[frame] = functions[(seed >> 16) % ARRAYSIZE(functions)];
+		}
+
+		LONGLONG values[] = { 1, (LONGLONG) ((seed >> 8) % 100000) * 1000 };
+		profile->AddSample(stack, depth, values, ARRAYSIZE(values));
+	}
+}
+
+//
+// pprof.pb.gz was written by this profile and checked with go tool pprof. The output has to
+// match it byte for byte: the gzip wrapper has no timestamp and the compressor is
+// deterministic, so any difference is a change in the encoding.
+//
+
+bool TestPprofWriterMatchesGolden(void)
+{
+	const wchar_t *outputName = L"ChakraTests.pb.gz";
+	PprofWriter *profile = new PprofWriter();
+	string expected;
+	string actual;
+
+	BuildProfile(profile);
+	bool written = profile->Write(outputName);
+	delete profile;
+
+	Check(written);
+	Check(ReadWholeFile(outputName, &actual));
+	DeleteFileW(outputName);
+
+	Check(ReadWholeFile(GetDataPath(L"pprof.pb.gz").c_str(), &expected));
+	Check(actual.size() == expected.size());
+	Check(actual == expected);
+	return true;
+}
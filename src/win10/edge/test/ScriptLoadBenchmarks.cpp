@@ -0,0 +1,150 @@
+#include "../cpp/stdafx.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include "Benchmark.h"
+
+using namespace std;
+
+static const size_t ScriptLength = 16 * 1024 * 1024;
+
+//
+// How LoadScript read a script before it mapped the file: read into one buffer, transcode
+// into a second, and copy that into the string.
+//
+
+static wstring LoadScriptWithCrt(const wstring &fileName)
+{
+	FILE *file;
+	if (_wfopen_s(&file, fileName.c_str(), L"rb"))
+	{
+		return wstring();
+	}
+
+	unsigned int current = ftell(file);
+	fseek(file, 0, SEEK_END);
+	unsigned int end = ftell(file);
+	fseek(file, current, SEEK_SET);
+	unsigned int lengthBytes = end - current;
+	char *rawBytes = (char *) calloc(lengthBytes + 1, sizeof(char));
+	wchar_t *contents = (wchar_t *) calloc(lengthBytes + 1, sizeof(wchar_t));
+	wstring result;
+
+	if (rawBytes != nullptr && contents != nullptr)
+	{
+		fread((void *) rawBytes, sizeof(char), lengthBytes, file);
+
+		if (MultiByteToWideChar(CP_UTF8, 0, rawBytes, lengthBytes + 1, contents, lengthBytes + 1) != 0)
+		{
+			result = contents;
+		}
+	}
+
+	free(rawBytes);
+	free(contents);
+	fclose(file);
+	return result;
+}
+
+//
+// Opening a file unbuffered makes the system drop what it has cached of the file, so the
+// next load reads it from the disk.
+//
+
+static void DropCachedFile(const wstring &fileName)
+{
+	HANDLE file = CreateFileW(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_NO_BUFFERING, nullptr);
+
+	if (file != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(file);
+	}
+}
+
+static bool WriteScript(const wstring &fileName)
+{
+	static const char line[] = "var message = \"caf\xC3\xA9\"; function add(a, b) { return a + b; }\r\n";
+	string script;
+
+	while (script.size() < ScriptLength)
+	{
+		script.append(line, sizeof(line) - 1);
+	}
+
+	FILE *file;
+	if (_wfopen_s(&file, fileName.c_str(), L"wb"))
+	{
+		return false;
+	}
+
+	bool written = fwrite(script.data(), 1, script.size(), file) == script.size();
+	return fclose(file) == 0 && written;
+}
+
+//
+// Loads a 16 MB UTF-8 script the old way and through LoadScript. Warm loads find the file
+// in the system's cache; cold loads have it dropped from the cache first, and are only as
+// cold as the disk's own cache lets them be. Throughput is in megabytes of script a second.
+//
+
+void BenchmarkScriptLoad(void)
+{
+	wchar_t directory[MAX_PATH];
+	DWORD length = GetTempPathW(ARRAYSIZE(directory), directory);
+
+	if (length == 0 || length >= ARRAYSIZE(directory))
+	{
+		fwprintf(stderr, L"ScriptLoad: there's no temporary directory\n");
+		return;
+	}
+
+	wstring fileName = wstring(directory) + L"ChakraBenchmarks.js";
+
+	if (!WriteScript(fileName))
+	{
+		fwprintf(stderr, L"ScriptLoad: unable to write %s\n", fileName.c_str());
+		DeleteFileW(fileName.c_str());
+		return;
+	}
+
+	double megabytes = ScriptLength / (1024.0 * 1024.0);
+	double coldSeconds[2] = {};
+
+	for (unsigned run = 0; run < 5; run++)
+	{
+		for (unsigned loader = 0; loader < 2; loader++)
+		{
+			DropCachedFile(fileName);
+
+			double start = GetSeconds();
+			wstring script = loader == 0 ? LoadScriptWithCrt(fileName) : LoadScript(fileName);
+			double seconds = GetSeconds() - start;
+
+			benchmarkSink += script.size();
+
+			if (run == 0 || seconds < coldSeconds[loader])
+			{
+				coldSeconds[loader] = seconds;
+			}
+		}
+	}
+
+	double oldSeconds = TimeBest(5, 4, [&]()
+	{
+		benchmarkSink += LoadScriptWithCrt(fileName).size();
+	});
+
+	double newSeconds = TimeBest(5, 4, [&]()
+	{
+		benchmarkSink += LoadScript(fileName).size();
+	});
+
+	Report("ScriptLoad cold", "fread + MultiByteToWideChar", megabytes / coldSeconds[0], "MB/s");
+	Report("ScriptLoad cold", "LoadScript", megabytes / coldSeconds[1], "MB/s");
+	Report("ScriptLoad cold", "speedup", coldSeconds[0] / coldSeconds[1], "x");
+	Report("ScriptLoad warm", "fread + MultiByteToWideChar", megabytes / oldSeconds, "MB/s");
+	Report("ScriptLoad warm", "LoadScript", megabytes / newSeconds, "MB/s");
+	Report("ScriptLoad warm", "speedup", oldSeconds / newSeconds, "x");
+
+	DeleteFileW(fileName.c_str());
+}
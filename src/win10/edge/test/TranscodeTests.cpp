@@ -0,0 +1,183 @@
+#include <windows.h>
+#include <stdio.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "../memory/Transcode.h"
+#include "Test.h"
+
+using namespace std;
+
+//
+// Encodes code points one at a time, the plain way, as the reference for both directions.
+//
+
+static void AppendReference(UINT32 codePoint, vector<uint16_t> *utf16, vector<uint8_t> *utf8)
+{
+	if (codePoint < 0x10000)
+	{
+		utf16->push_back((uint16_t) codePoint);
+	}
+	else
+	{
+		utf16->push_back((uint16_t) (0xD800 + ((codePoint - 0x10000) >> 10)));
+		utf16->push_back((uint16_t) (0xDC00 + ((codePoint - 0x10000) & 0x3FF)));
+	}
+
+	if (codePoint < 0x80)
+	{
+		utf8->push_back((uint8_t) codePoint);
+	}
+	else if (codePoint < 0x800)
+	{
+		utf8->push_back((uint8_t) (0xC0 | (codePoint >> 6)));
+		utf8->push_back((uint8_t) (0x80 | (codePoint & 0x3F)));
+	}
+	else if (codePoint < 0x10000)
+	{
+		utf8->push_back((uint8_t) (0xE0 | (codePoint >> 12)));
+		utf8->push_back((uint8_t) (0x80 | ((codePoint >> 6) & 0x3F)));
+		utf8->push_back((uint8_t) (0x80 | (codePoint & 0x3F)));
+	}
+	else
+	{
+		utf8->push_back((uint8_t) (0xF0 | (codePoint >> 18)));
+		utf8->push_back((uint8_t) (0x80 | ((codePoint >> 12) & 0x3F)));
+		utf8->push_back((uint8_t) (0x80 | ((codePoint >> 6) & 0x3F)));
+		utf8->push_back((uint8_t) (0x80 | (codePoint & 0x3F)));
+	}
+}
+
+//
+// Converts both ways and checks each direction against the reference, so a round trip
+// can't pass by two mistakes cancelling out.
+//
+
+static bool RoundTrips(const vector<uint16_t> &utf16, const vector<uint8_t> &utf8)
+{
+	vector<uint8_t> narrowed(UTF8_LENGTH_FOR_UTF16(utf16.size()) + 1);
+	size_t narrowedLength = Utf16ToUtf8(utf16.empty() ? nullptr : &utf16[0], utf16.size(), &narrowed[0]);
+
+	if (narrowedLength != utf8.size() || !equal(utf8.begin(), utf8.end(), narrowed.begin()))
+	{
+		return false;
+	}
+
+	vector<uint16_t> widened(UTF16_LENGTH_FOR_UTF8(narrowedLength) + 1);
+	size_t widenedLength = Utf8ToUtf16(&narrowed[0], narrowedLength, &widened[0]);
+
+	return widenedLength == utf16.size() && equal(utf16.begin(), utf16.end(), widened.begin());
+}
+
+//
+// ASCII of every length up to a few blocks of the widest vector path, so each path and the
+// tail after it are covered.
+//
+
+bool TestTranscodeRoundTripsAscii(void)
+{
+	for (size_t length = 0; length <= 100; length++)
+	{
+		vector<uint16_t> utf16;
+		vector<uint8_t> utf8;
+
+		for (size_t index = 0; index < length; index++)
+		{
+			AppendReference((UINT32) (index * 7 % 0x80), &utf16, &utf8);
+		}
+
+		Check(RoundTrips(utf16, utf8));
+	}
+
+	return true;
+}
+
+//
+// Every code point in the basic multilingual plane outside the surrogates, and every
+// supplementary code point, as a surrogate pair. Each is put after a run of ASCII at a
+// few offsets, so it also ends a vector block early.
+//
+
+bool TestTranscodeRoundTripsEveryCodePoint(void)
+{
+	for (UINT32 codePoint = 0x80; codePoint <= 0x10FFFF; codePoint++)
+	{
+		if (codePoint >= 0xD800 && codePoint <= 0xDFFF)
+		{
+			continue;
+		}
+
+		for (size_t offset = 0; offset < 40; offset += 13)
+		{
+			vector<uint16_t> utf16;
+			vector<uint8_t> utf8;
+
+			for (size_t index = 0; index < offset; index++)
+			{
+				AppendReference('a', &utf16, &utf8);
+			}
+
+			AppendReference(codePoint, &utf16, &utf8);
+			AppendReference('z', &utf16, &utf8);
+			Check(RoundTrips(utf16, utf8));
+		}
+	}
+
+	return true;
+}
+
+//
+// Seeded random text mixing ASCII runs, BMP characters and surrogate pairs.
+//
+
+bool TestTranscodeRoundTripsMixedText(void)
+{
+	UINT32 seed = 0x9E3779B9;
+
+	for (int iteration = 0; iteration < 100000; iteration++)
+	{
+		vector<uint16_t> utf16;
+		vector<uint8_t> utf8;
+
+		seed ^= seed << 13;
+		seed ^= seed >> 17;
+		seed ^= seed << 5;
+
+		size_t length = seed % 120;
+
+		for (size_t index = 0; index < length; index++)
+		{
+			UINT32 codePoint;
+
+			seed ^= seed << 13;
+			seed ^= seed >> 17;
+			seed ^= seed << 5;
+
+			switch (seed % 8)
+			{
+			case 0:
+				codePoint = 0x80 + (seed >> 8) % 0x780;
+				break;
+			case 1:
+				codePoint = 0x800 + (seed >> 8) % 0xD000;
+				if (codePoint >= 0xD800)
+				{
+					codePoint += 0x800;
+				}
+				break;
+			case 2:
+				codePoint = 0x10000 + (seed >> 8) % 0x100000;
+				break;
+			default:
+				codePoint = (seed >> 8) % 0x80;
+				break;
+			}
+
+			AppendReference(codePoint, &utf16, &utf8);
+		}
+
+		Check(RoundTrips(utf16, utf8));
+	}
+
+	return true;
+}
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+//
+// A live call tree built from the profiler's enter and exit events. Each node is a function
+// reached by a particular path from the root, and keeps its call count, inclusive time and
+// the time spent in its callees. Functions are identified by their (scriptId, functionId)
+// tokens, or, for functions the engine only reports by name, by their id in the profiler's
+// name table.
+//
+// The tree is fed from the thread running script and is not thread safe. It can also be
+// fed sampled stacks instead, in which case it counts samples rather than calls.
+//
+
+class CallTree sealed
+{
+private:
+	struct Node
+	{
+		ULONGLONG function;
+		size_t parent;
+		ULONGLONG calls;
+		LONGLONG inclusiveTicks;
+		LONGLONG calleeTicks;
+	};
+
+	struct Frame
+	{
+		size_t node;
+		LONGLONG start;
+	};
+
+	struct ChildKey
+	{
+		size_t parent;
+		ULONGLONG function;
+
+		bool operator==(const ChildKey &other) const { return parent == other.parent && function == other.function; }
+	};
+
+	struct ChildKeyHash
+	{
+		size_t operator()(const ChildKey &key) const { return std::hash<ULONGLONG>()(key.function * 31 + key.parent); }
+	};
+
+	std::vector<Node> m_nodes;
+	std::vector<Frame> m_stack;
+	std::unordered_map<ChildKey, size_t, ChildKeyHash> m_children;
+	std::unordered_map<ULONGLONG, std::wstring> m_names;
+	const NameTable *m_nameTable;
+	double m_ticksPerMillisecond;
+	bool m_sampled;
+
+	CallTree(const CallTree &);
+	CallTree &operator=(const CallTree &);
+
+	std::wstring GetName(ULONGLONG function);
+	size_t GetChild(size_t parent, ULONGLONG function);
+	void LinkChildren(std::vector<size_t> &firstChild, std::vector<size_t> &nextSibling);
+	void Enter(ULONGLONG function, LONGLONG timestamp);
+	void Exit(ULONGLONG function, LONGLONG timestamp);
+
+public:
+	static const size_t DefaultReportCount = 20;
+
+	CallTree(const NameTable *nameTable);
+
+	void SetName(UINT32 scriptId, UINT32 functionId, const wchar_t *name, const wchar_t *hint);
+	void Enter(UINT32 scriptId, UINT32 functionId, LONGLONG timestamp);
+	void Exit(UINT32 scriptId, UINT32 functionId, LONGLONG timestamp);
+	void EnterByName(UINT32 nameId, LONGLONG timestamp);
+	void ExitByName(UINT32 nameId, LONGLONG timestamp);
+
+	//
+	// The keys functions are identified by.
+	//
+
+	static ULONGLONG GetFunctionKey(UINT32 scriptId, UINT32 functionId);
+	static ULONGLONG GetNameKey(UINT32 nameId);
+
+	//
+	// Adds a sampled stack of function keys, outermost first, that stands for the given
+	// time. The innermost function gets the time as exclusive time and a sample in place of
+	// a call.
+	//
+
+	void AddSample(const ULONGLONG *functions, size_t count, LONGLONG ticks);
+
+	//
+	// Closes any calls still open, as of the given time. Called when profiling stops.
+	//
+
+	void Finish(LONGLONG timestamp);
+
+	//
+	// Writes one line per call path, with the path's frames separated by semicolons and its
+	// exclusive time in microseconds: the collapsed stack format flame graph tools read.
+	//
+
+	bool WriteCollapsedStacks(const wchar_t *fileName);
+
+	//
+	// Writes a gzipped pprof profile with a sample per call path. Its values are the path's
+	// calls (or samples), exclusive time and inclusive time, both in nanoseconds. Functions
+	// are named as in the report, and their file is the script they came from.
+	//
+
+	bool WriteProfile(const wchar_t *fileName);
+
+	//
+	// Prints the functions with the most exclusive time, along with their inclusive time
+	// and call counts. Inclusive time only counts the outermost call of recursive functions.
+	//
+
+	void PrintReport(FILE *stream, size_t count);
+};
@@ -0,0 +1,259 @@
+#include "stdafx.h"
+
+using namespace std;
+
+//
+// By-name functions have ids of their own, so they're kept apart from compiled functions
+// with a script id no script has.
+//
+
+static const UINT32 ByNameScriptId = 0xffffffff;
+
+static ULONGLONG MakeFunctionKey(UINT32 scriptId, UINT32 functionId)
+{
+	return ((ULONGLONG) scriptId << 32) | functionId;
+}
+
+ChromeTraceFormatter::ChromeTraceFormatter(HANDLE file, ULONGLONG start, ULONGLONG ticksPerSecond) :
+	m_output(file, BufferCapacity),
+	m_start(start),
+	m_ticksPerMicrosecond(ticksPerSecond / 1000000.0),
+	m_processId(GetCurrentProcessId()),
+	m_bytesWritten(0)
+{
+}
+
+void ChromeTraceFormatter::Write(const char *text, size_t length)
+{
+	m_output.WriteUtf8(text, length);
+	m_bytesWritten += length;
+}
+
+//
+// Names are already UTF-8, so only quotes, backslashes and control characters need escaping.
+//
+
+void ChromeTraceFormatter::WriteEscaped(const string &text)
+{
+	size_t start = 0;
+
+	for (size_t index = 0; index < text.length(); index++)
+	{
+		unsigned char character = (unsigned char) text[index];
+
+		if (character != '"' && character != '\\' && character >= 0x20)
+		{
+			continue;
+		}
+
+		char escape[8];
+		int length = character == '"' || character == '\\' ?
+			sprintf_s(escape, "\\%c", character) :
+			sprintf_s(escape, "\\u%04x", character);
+
+		Write(text.c_str() + start, index - start);
+		Write(escape, length);
+		start = index + 1;
+	}
+
+	Write(text.c_str() + start, text.length() - start);
+}
+
+void ChromeTraceFormatter::WriteEventStart(const char *phase, UINT16 thread, ULONGLONG timestamp)
+{
+	char text[128];
+	int length = sprintf_s(text, ",\n{\"ph\":\"%s\",\"pid\":%u,\"tid\":%u,\"ts\":%.3f",
+		phase, m_processId, thread, (LONGLONG) (timestamp - m_start) / m_ticksPerMicrosecond);
+
+	Write(text, length);
+}
+
+//
+// Each thread's track is named the first time the thread shows up, so the viewer doesn't
+// just show a bare id.
+//
+
+void ChromeTraceFormatter::AddThread(UINT16 thread)
+{
+	if (!m_threads.insert(thread).second)
+	{
+		return;
+	}
+
+	char text[128];
+	int length = sprintf_s(text, ",\n{\"ph\":\"M\",\"pid\":%u,\"tid\":%u,\"name\":\"thread_name\",\"args\":{\"name\":\"script thread %u\"}}",
+		m_processId, thread, thread);
+
+	Write(text, length);
+}
+
+//
+// An end in a Chrome trace closes the innermost open slice on its thread. So that slices
+// match the call tree, an exit that doesn't match the innermost call also ends the calls
+// above the one it does match, and an exit that matches none is dropped.
+//
+
+void ChromeTraceFormatter::WriteEnds(const TraceEvent &event, ULONGLONG function)
+{
+	vector<ULONGLONG> &stack = m_stacks[event.thread];
+	size_t depth = stack.size();
+
+	while (depth > 0 && stack[depth - 1] != function)
+	{
+		depth--;
+	}
+
+	while (depth > 0 && stack.size() >= depth)
+	{
+		WriteEventStart("E", event.thread, event.timestamp);
+		Write("}");
+		stack.pop_back();
+	}
+}
+
+string ChromeTraceFormatter::GetFunctionName(UINT32 scriptId, UINT32 functionId)
+{
+	unordered_map<ULONGLONG, string>::iterator found = m_functionNames.find(MakeFunctionKey(scriptId, functionId));
+
+	if (found != m_functionNames.end())
+	{
+		return found->second;
+	}
+
+	char name[64];
+	sprintf_s(name, "(anonymous 0x%x:0x%x)", scriptId, functionId);
+	return name;
+}
+
+void ChromeTraceFormatter::Begin(void)
+{
+	char text[128];
+	int length = sprintf_s(text, "[\n{\"ph\":\"M\",\"pid\":%u,\"tid\":0,\"name\":\"process_name\",\"args\":{\"name\":\"chakrahost\"}}",
+		m_processId);
+
+	Write(text, length);
+}
+
+void ChromeTraceFormatter::WriteNameRecords(const BYTE *records, size_t length)
+{
+	size_t offset = 0;
+
+	while (length - offset >= sizeof(TraceEvent))
+	{
+		const TraceEvent *event = (const TraceEvent *) (records + offset);
+		const char *payload = (const char *) (event + 1);
+
+		offset += sizeof(TraceEvent) + event->length;
+
+		if (event->kind == TraceEventName)
+		{
+			m_names[event->functionId].assign(payload, event->length);
+			continue;
+		}
+
+		if (event->kind != TraceEventFunctionCompiled)
+		{
+			continue;
+		}
+
+		//
+		// Anonymous functions are named by their hint, as in the call tree.
+		//
+
+		const char *separator = (const char *) memchr(payload, 0, event->length);
+		string name(payload, separator == nullptr ? event->length : separator - payload);
+		string hint;
+
+		if (separator != nullptr)
+		{
+			hint.assign(separator + 1, event->length - (separator + 1 - payload));
+		}
+
+		if (name.empty() && !hint.empty())
+		{
+			name = hint;
+		}
+
+		if (!name.empty())
+		{
+			m_functionNames[MakeFunctionKey(event->scriptId, event->functionId)] = name;
+		}
+
+		char text[128];
+		int textLength;
+
+		AddThread(event->thread);
+		WriteEventStart("i", event->thread, event->timestamp);
+		Write(",\"s\":\"t\",\"cat\":\"compile\",\"name\":\"");
+		WriteEscaped(GetFunctionName(event->scriptId, event->functionId));
+		textLength = sprintf_s(text, "\",\"args\":{\"scriptId\":%u,\"functionId\":%u,\"hint\":\"", event->scriptId, event->functionId);
+		Write(text, textLength);
+		WriteEscaped(hint);
+		Write("\"}}");
+	}
+}
+
+void ChromeTraceFormatter::WriteEvents(const TraceEvent *events, size_t count)
+{
+	char text[128];
+	int length;
+
+	for (size_t index = 0; index < count; index++)
+	{
+		const TraceEvent &event = events[index];
+
+		AddThread(event.thread);
+
+		switch (event.kind)
+		{
+		case TraceEventInitialize:
+		case TraceEventShutdown:
+			WriteEventStart("i", event.thread, event.timestamp);
+			length = sprintf_s(text, ",\"s\":\"p\",\"name\":\"%s\",\"args\":{\"value\":\"0x%x\"}}",
+				event.kind == TraceEventInitialize ? "Profiler::Initialize" : "Profiler::Shutdown", event.scriptId);
+			Write(text, length);
+			break;
+
+		case TraceEventScriptCompiled:
+			WriteEventStart("i", event.thread, event.timestamp);
+			length = sprintf_s(text, ",\"s\":\"t\",\"cat\":\"compile\",\"name\":\"script 0x%x\",\"args\":{\"type\":%u}}",
+				event.scriptId, event.functionId);
+			Write(text, length);
+			break;
+
+		case TraceEventFunctionEnter:
+			WriteEventStart("B", event.thread, event.timestamp);
+			Write(",\"cat\":\"function\",\"name\":\"");
+			WriteEscaped(GetFunctionName(event.scriptId, event.functionId));
+			Write("\"}");
+			m_stacks[event.thread].push_back(MakeFunctionKey(event.scriptId, event.functionId));
+			break;
+
+		case TraceEventFunctionEnterByName:
+			WriteEventStart("B", event.thread, event.timestamp);
+			Write(",\"cat\":\"function\",\"name\":\"");
+			WriteEscaped(m_names[event.functionId]);
+			length = sprintf_s(text, "\",\"args\":{\"type\":%u}}", event.scriptId);
+			Write(text, length);
+			m_stacks[event.thread].push_back(MakeFunctionKey(ByNameScriptId, event.functionId));
+			break;
+
+		case TraceEventFunctionExit:
+			WriteEnds(event, MakeFunctionKey(event.scriptId, event.functionId));
+			break;
+
+		case TraceEventFunctionExitByName:
+			WriteEnds(event, MakeFunctionKey(ByNameScriptId, event.functionId));
+			break;
+
+		default:
+			break;
+		}
+	}
+}
+
+bool ChromeTraceFormatter::End(void)
+{
+	Write("\n]\n");
+	return m_output.Flush();
+}
@@ -0,0 +1,425 @@
+#include "stdafx.h"
+#include <algorithm>
+
+using namespace std;
+
+LatencyHistogram::LatencyHistogram(void) :
+	m_count(0),
+	m_total(0),
+	m_maximum(0)
+{
+}
+
+//
+// Values below twice the bucket count each get a bucket of their own. Above that, a value
+// is shifted right until it falls in [SubBucketCount, 2 * SubBucketCount), and the shift
+// picks the power of two and the shifted value the bucket within it.
+//
+
+size_t LatencyHistogram::GetIndex(ULONGLONG value)
+{
+	if (value < 2 * SubBucketCount)
+	{
+		return (size_t) value;
+	}
+
+	unsigned shift = 1;
+	while ((value >> shift) >= 2 * SubBucketCount)
+	{
+		shift++;
+	}
+
+	return (shift + 1) * SubBucketCount + (size_t) (value >> shift) - SubBucketCount;
+}
+
+ULONGLONG LatencyHistogram::GetHighestValue(size_t index)
+{
+	if (index < 2 * SubBucketCount)
+	{
+		return index;
+	}
+
+	unsigned shift = (unsigned) (index / SubBucketCount) - 1;
+	ULONGLONG subBucket = index % SubBucketCount + SubBucketCount;
+
+	return ((subBucket + 1) << shift) - 1;
+}
+
+void LatencyHistogram::Record(ULONGLONG value)
+{
+	size_t index = GetIndex(value);
+
+	if (index >= m_counts.size())
+	{
+		m_counts.resize(index + 1, 0);
+	}
+
+	m_counts[index]++;
+	m_count++;
+	m_total += value;
+
+	if (value > m_maximum)
+	{
+		m_maximum = value;
+	}
+}
+
+ULONGLONG LatencyHistogram::ValueAtPercentile(double percentile) const
+{
+	if (m_count == 0)
+	{
+		return 0;
+	}
+
+	ULONGLONG target = (ULONGLONG) (m_count * percentile / 100 + 0.5);
+	ULONGLONG seen = 0;
+
+	if (target < 1)
+	{
+		target = 1;
+	}
+
+	for (size_t index = 0; index < m_counts.size(); index++)
+	{
+		seen += m_counts[index];
+
+		if (seen >= target)
+		{
+			return min(GetHighestValue(index), m_maximum);
+		}
+	}
+
+	return m_maximum;
+}
+
+//
+// The run in progress on this thread, if any, and when the thread last saw a profiler event.
+//
+
+static __declspec(thread) CompileStats::Run *currentRun = nullptr;
+static __declspec(thread) LONGLONG lastEvent = 0;
+
+CompileStats::CompileStats(void)
+{
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+	m_ticksPerMillisecond = frequency.QuadPart / 1000.0;
+}
+
+LONGLONG CompileStats::GetTimestamp(void)
+{
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	return now.QuadPart;
+}
+
+void CompileStats::BeginRun(Run *run, const wchar_t *script, ParseSource source)
+{
+	run->script = script;
+	run->source = source;
+	run->start = GetTimestamp();
+	run->parsing = true;
+	run->running = false;
+	run->previous = currentRun;
+
+	currentRun = run;
+	lastEvent = run->start;
+}
+
+void CompileStats::EndRun(Run *run)
+{
+	currentRun = run->previous;
+}
+
+//
+// Only the slowest parses are kept, in order, so a long job list doesn't keep every one.
+//
+
+bool CompileStats::CompareSlowest(ULONGLONG ticks, const Compile &compile)
+{
+	return ticks > compile.ticks;
+}
+
+void CompileStats::AddSlowest(const wchar_t *script, ULONGLONG ticks, ParseSource source)
+{
+	if (m_slowest.size() == ReportCount && ticks <= m_slowest.back().ticks)
+	{
+		return;
+	}
+
+	Compile compile;
+	compile.script = script;
+	compile.ticks = ticks;
+	compile.source = source;
+
+	m_slowest.insert(upper_bound(m_slowest.begin(), m_slowest.end(), ticks, CompareSlowest), compile);
+
+	if (m_slowest.size() > ReportCount)
+	{
+		m_slowest.pop_back();
+	}
+}
+
+//
+// The first script compiled in a run is the run's own; any after it, such as eval code,
+// are only tied to the run's script so their functions are counted against it. Scripts
+// compiled outside of a run have no name, so their functions aren't counted at all.
+//
+
+void CompileStats::ScriptCompiled(UINT32 scriptId)
+{
+	LONGLONG now = GetTimestamp();
+	Run *run = currentRun;
+
+	lastEvent = now;
+
+	if (run == nullptr)
+	{
+		return;
+	}
+
+	lock_guard<mutex> lock(m_lock);
+	m_scriptIds[scriptId] = run->script;
+
+	if (run->parsing)
+	{
+		ULONGLONG ticks = now - run->start;
+
+		m_scripts[run->script].parses.Record(ticks);
+		m_parses.Record(ticks);
+		AddSlowest(run->script, ticks, run->source);
+		run->parsing = false;
+	}
+}
+
+void CompileStats::FunctionCompiled(UINT32 scriptId, const wchar_t *name)
+{
+	LONGLONG now = GetTimestamp();
+	ULONGLONG ticks = now - lastEvent;
+	Run *run = currentRun;
+
+	lastEvent = now;
+
+	lock_guard<mutex> lock(m_lock);
+
+	unordered_map<UINT32, wstring>::iterator found = m_scriptIds.find(scriptId);
+	if (found == m_scriptIds.end())
+	{
+		return;
+	}
+
+	ScriptStats &script = m_scripts[found->second];
+
+	if (run != nullptr && !run->running)
+	{
+		script.parsedFunctions++;
+	}
+	else
+	{
+		script.deferredFunctions++;
+	}
+
+	m_functions[wstring(name != nullptr && name[0] != L'\0' ? name : L"(anonymous)") + L"  " + found->second].Record(ticks);
+}
+
+void CompileStats::FunctionCalled(void)
+{
+	lastEvent = GetTimestamp();
+
+	if (currentRun != nullptr)
+	{
+		currentRun->running = true;
+	}
+}
+
+bool CompileStats::CompareScripts(const pair<const wstring *, const ScriptStats *> &left, const pair<const wstring *, const ScriptStats *> &right)
+{
+	return left.second->parses.Total() > right.second->parses.Total();
+}
+
+bool CompileStats::CompareFunctions(const pair<const wstring *, const LatencyHistogram *> &left, const pair<const wstring *, const LatencyHistogram *> &right)
+{
+	return left.second->Total() > right.second->Total();
+}
+
+void CompileStats::PrintHistogram(FILE *stream, const LatencyHistogram &histogram)
+{
+	fwprintf(stream, L"%14.3f %12.3f %12.3f %12.3f %12.3f %10llu",
+		histogram.Total() / m_ticksPerMillisecond,
+		histogram.ValueAtPercentile(50) / m_ticksPerMillisecond,
+		histogram.ValueAtPercentile(90) / m_ticksPerMillisecond,
+		histogram.ValueAtPercentile(99) / m_ticksPerMillisecond,
+		histogram.Maximum() / m_ticksPerMillisecond,
+		histogram.Count());
+}
+
+void CompileStats::PrintReport(FILE *stream)
+{
+	lock_guard<mutex> lock(m_lock);
+
+	fwprintf(stream, L"chakrahost: compile: %llu parses of %u scripts, %.3f ms, p50 %.3f ms, p90 %.3f ms, p99 %.3f ms, max %.3f ms\n",
+		m_parses.Count(), (unsigned) m_scripts.size(), m_parses.Total() / m_ticksPerMillisecond,
+		m_parses.ValueAtPercentile(50) / m_ticksPerMillisecond,
+		m_parses.ValueAtPercentile(90) / m_ticksPerMillisecond,
+		m_parses.ValueAtPercentile(99) / m_ticksPerMillisecond,
+		m_parses.Maximum() / m_ticksPerMillisecond);
+
+	if (m_parses.Count() == 0)
+	{
+		return;
+	}
+
+	//
+	// Scripts in order of the total time spent parsing them.
+	//
+
+	vector<pair<const wstring *, const ScriptStats *>> scripts;
+	for (unordered_map<wstring, ScriptStats>::iterator entry = m_scripts.begin(); entry != m_scripts.end(); entry++)
+	{
+		scripts.push_back(make_pair(&entry->first, &entry->second));
+	}
+
+	sort(scripts.begin(), scripts.end(), CompareScripts);
+
+	fwprintf(stream, L"      total ms       p50 ms       p90 ms       p99 ms       max ms     parses    functions     deferred  script\n");
+
+	for (size_t index = 0; index < scripts.size() && index < ReportCount; index++)
+	{
+		const ScriptStats &script = *scripts[index].second;
+
+		PrintHistogram(stream, script.parses);
+		fwprintf(stream, L" %12llu %12llu  %s\n", script.parsedFunctions, script.deferredFunctions, scripts[index].first->c_str());
+	}
+
+	fwprintf(stream, L"chakrahost: compile: slowest parses\n");
+	fwprintf(stream, L"            ms  script\n");
+
+	for (size_t index = 0; index < m_slowest.size(); index++)
+	{
+		fwprintf(stream, L"%14.3f  %s%s\n",
+			m_slowest[index].ticks / m_ticksPerMillisecond,
+			m_slowest[index].script.c_str(),
+			m_slowest[index].source == ParseSourceCacheHit ? L" (cached)" :
+			m_slowest[index].source == ParseSourceCacheMiss ? L" (cache miss)" : L"");
+	}
+
+	//
+	// Functions in order of the total time up to their compiles. Each function is named
+	// along with its script, since names repeat across scripts.
+	//
+
+	vector<pair<const wstring *, const LatencyHistogram *>> functions;
+	for (unordered_map<wstring, LatencyHistogram>::iterator entry = m_functions.begin(); entry != m_functions.end(); entry++)
+	{
+		functions.push_back(make_pair(&entry->first, &entry->second));
+	}
+
+	sort(functions.begin(), functions.end(), CompareFunctions);
+
+	fwprintf(stream, L"chakrahost: compile: slowest functions, as time since the previous event\n");
+	fwprintf(stream, L"      total ms       p50 ms       p90 ms       p99 ms       max ms   compiles  function  script\n");
+
+	for (size_t index = 0; index < functions.size() && index < ReportCount; index++)
+	{
+		PrintHistogram(stream, *functions[index].second);
+		fwprintf(stream, L"  %s\n", functions[index].first->c_str());
+	}
+}
+
+CompileEvents::CompileEvents(CompileStats *stats) :
+	m_refCount(1),
+	m_stats(stats)
+{
+}
+
+HRESULT CompileEvents::QueryInterface(REFIID riid, void **ppvObj)
+{
+	if (riid == IID_IUnknown)
+	{
+		*ppvObj = (IUnknown *) this;
+	}
+	else if (riid == IID_IActiveScriptProfilerCallback)
+	{
+		*ppvObj = (IActiveScriptProfilerCallback *) this;
+	}
+	else
+	{
+		*ppvObj = NULL;
+		return E_NOINTERFACE;
+	}
+
+	AddRef();
+	return NOERROR;
+}
+
+ULONG CompileEvents::AddRef(void)
+{
+	return InterlockedIncrement(&m_refCount);
+}
+
+ULONG CompileEvents::Release(void)
+{
+	long lw;
+
+	if (0 == (lw = InterlockedDecrement(&m_refCount)))
+	{
+		delete this;
+	}
+
+	return lw;
+}
+
+HRESULT CompileEvents::Initialize(DWORD dwContext)
+{
+	return S_OK;
+}
+
+HRESULT CompileEvents::Shutdown(HRESULT hrReason)
+{
+	return S_OK;
+}
+
+HRESULT CompileEvents::ScriptCompiled(PROFILER_TOKEN scriptId, PROFILER_SCRIPT_TYPE type, IUnknown *pIDebugDocumentContext)
+{
+	m_stats->ScriptCompiled(scriptId);
+	return S_OK;
+}
+
+HRESULT CompileEvents::FunctionCompiled(PROFILER_TOKEN functionId, PROFILER_TOKEN scriptId, const wchar_t *pwszFunctionName, const wchar_t *pwszFunctionNameHint, IUnknown *pIDebugDocumentContext)
+{
+	m_stats->FunctionCompiled(scriptId, pwszFunctionName);
+	return S_OK;
+}
+
+HRESULT CompileEvents::OnFunctionEnter(PROFILER_TOKEN scriptId, PROFILER_TOKEN functionId)
+{
+	m_stats->FunctionCalled();
+	return S_OK;
+}
+
+HRESULT CompileEvents::OnFunctionExit(PROFILER_TOKEN scriptId, PROFILER_TOKEN functionId)
+{
+	m_stats->FunctionCalled();
+	return S_OK;
+}
+
+JsErrorCode RunScriptTimed(CompileStats *stats, const wchar_t *script, BYTE *serialized, ParseSource source, JsSourceContext sourceContext, const wchar_t *sourceUrl, JsValueRef *result)
+{
+	CompileStats::Run run;
+
+	if (stats != nullptr && source != ParseSourceCacheMiss)
+	{
+		stats->BeginRun(&run, sourceUrl, source);
+	}
+
+	JsErrorCode errorCode = serialized != nullptr ?
+		JsRunSerializedScript(script, serialized, sourceContext, sourceUrl, result) :
+		JsRunScript(script, sourceContext, sourceUrl, result);
+
+	if (stats != nullptr && source != ParseSourceCacheMiss)
+	{
+		stats->EndRun(&run);
+	}
+
+	return errorCode;
+}
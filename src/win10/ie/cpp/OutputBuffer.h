@@ -0,0 +1,49 @@
+#pragma once
+
+#include <string>
+
+//
+// Buffers host output as UTF-8 and writes it out in large blocks, instead of going through
+// locale-aware stdio for every piece of text. Output is flushed when the buffer fills up,
+// when Flush is called, and when the buffer is destroyed. A buffer created without a handle
+// captures its output in memory instead.
+//
+
+class OutputBuffer sealed
+{
+private:
+	HANDLE m_handle;
+	BYTE *m_buffer;
+	size_t m_size;
+	size_t m_capacity;
+	std::string m_captured;
+
+	OutputBuffer(const OutputBuffer &);
+	OutputBuffer &operator=(const OutputBuffer &);
+
+	bool WriteBytes(const BYTE *bytes, size_t length);
+
+public:
+	static const size_t DefaultCapacity = 64 * 1024;
+
+	OutputBuffer(HANDLE handle, size_t capacity = DefaultCapacity);
+	~OutputBuffer(void);
+
+	void Write(const wchar_t *text, size_t length);
+	void Write(const wchar_t *text) { Write(text, wcslen(text)); }
+	void WriteUtf8(const char *bytes, size_t length);
+	bool Flush(void);
+
+	//
+	// Hands back everything captured since the last call, for buffers without a handle.
+	//
+
+	void TakeCaptured(std::string &captured);
+
+	//
+	// Whether output to this handle should be buffered by default. Consoles are interactive,
+	// so they keep the unbuffered behavior.
+	//
+
+	static bool ShouldBuffer(HANDLE handle);
+};
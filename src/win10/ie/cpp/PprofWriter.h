@@ -0,0 +1,49 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+
+//
+// Builds a profile in pprof's format, a gzipped profile.proto message, for tools that read
+// pprof. The protobuf encoding is done by hand: the profile only needs varints and
+// length-delimited fields, and fields can be written in any order, so each message is
+// encoded as soon as it's added. The string table goes last, once every string has been
+// interned. Each function gets a location of its own with the same id, so a sample's
+// stack is a list of function ids, innermost first.
+//
+
+class PprofWriter sealed
+{
+private:
+	std::string m_profile;
+	std::string m_stringTable;
+	std::unordered_map<std::string, ULONGLONG> m_strings;
+	ULONGLONG m_nextFunctionId;
+
+	PprofWriter(const PprofWriter &);
+	PprofWriter &operator=(const PprofWriter &);
+
+	static void AppendVarint(std::string &message, ULONGLONG value);
+	static void AppendVarintField(std::string &message, unsigned field, ULONGLONG value);
+	static void AppendBytesField(std::string &message, unsigned field, const std::string &bytes);
+	static UINT32 Crc32(const BYTE *bytes, size_t length);
+
+	ULONGLONG GetStringId(const std::string &text);
+	ULONGLONG GetStringId(const std::wstring &text);
+
+public:
+	PprofWriter(void);
+
+	//
+	// Sample types say what each of a sample's values counts, in the order they're added.
+	//
+
+	void AddSampleType(const char *type, const char *unit);
+	void SetDefaultSampleType(const char *type);
+	void SetDuration(ULONGLONG nanoseconds);
+
+	ULONGLONG AddFunction(const std::wstring &name, const std::wstring &fileName);
+	void AddSample(const ULONGLONG *functions, size_t functionCount, const LONGLONG *values, size_t valueCount);
+
+	bool Write(const wchar_t *fileName);
+};
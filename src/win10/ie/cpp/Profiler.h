@@ -1,12 +1,32 @@
 #pragma once
 
+//
+// Profiler callback for -profile. Builds a call tree from the engine's events, either by
+// timing every call or from samples of the call stack, and when profiling stops writes it
+// out as collapsed stacks and a pprof profile and prints the hottest functions. With a
+// trace file, every event is recorded there as well. Compile events and calls are passed
+// on to the host's compile statistics, if it keeps them.
+//
+
 class Profiler sealed : public IActiveScriptProfilerCallback2
 {
 private:
 	long m_refCount;
+	std::wstring m_traceFileName;
+	std::wstring m_stacksFileName;
+	std::wstring m_pprofFileName;
+	NameTable m_names;
+	TraceWriter m_trace;
+	bool m_tracing;
+	CallTree m_callTree;
+	unsigned m_sampleRate;
+	StackSampler m_sampler;
+	CompileStats *m_compileStats;
+
+	static LONGLONG GetTimestamp(void);
 
 public:
-	Profiler(void);
+	Profiler(const wchar_t *traceFileName, const wchar_t *stacksFileName, const wchar_t *pprofFileName, unsigned sampleRate, CompileStats *compileStats);
 	~Profiler(void);
 
 	// IUnknown
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+
+//
+// An on-disk cache of serialized (pre-parsed) scripts. Entries are keyed by a hash of
+// the script source and by the version of the engine that produced them, so a stale
+// entry is simply never found. Each entry also holds the source it was made from, so
+// scripts whose hashes collide are told apart. The engine keeps referencing both the
+// script source and the serialized buffer after the script has run, so the cache owns
+// them until it is cleared or destroyed, neither of which may happen before the runtime
+// that used it has been disposed.
+//
+
+class ScriptCache sealed
+{
+private:
+	struct Entry
+	{
+		std::wstring script;
+		MappedFile file;
+		BYTE *buffer;
+		unsigned long bufferSize;
+
+		Entry() :
+			buffer(nullptr),
+			bufferSize(0)
+		{
+		}
+
+		~Entry()
+		{
+			delete [] buffer;
+		}
+	};
+
+	std::wstring m_directory;
+	std::vector<Entry *> m_entries;
+	std::map<ULONGLONG, Entry *> m_index;
+	size_t m_size;
+	DWORD m_engineTimestamp;
+	DWORD m_engineImageSize;
+	unsigned m_hits;
+	unsigned m_misses;
+
+	ScriptCache(const ScriptCache &);
+	ScriptCache &operator=(const ScriptCache &);
+
+	std::wstring GetEntryPath(ULONGLONG hash);
+	bool LoadEntry(ULONGLONG hash, Entry *entry);
+	bool SerializeEntry(Entry *entry);
+	void StoreEntry(ULONGLONG hash, Entry *entry);
+
+public:
+	ScriptCache(const wchar_t *directory);
+	~ScriptCache(void);
+
+	JsErrorCode RunScript(const std::wstring &script, JsSourceContext sourceContext, const wchar_t *sourceUrl, CompileStats *stats, JsValueRef *result);
+
+	//
+	// How much the cache is holding on to, in source and serialized bytes. Once it's full,
+	// the runtime using it should be disposed and the cache cleared.
+	//
+
+	static const size_t MaximumSize = 64 * 1024 * 1024;
+
+	bool IsFull(void) const { return m_size >= MaximumSize; }
+	void Clear(void);
+
+	unsigned Hits(void) const { return m_hits; }
+	unsigned Misses(void) const { return m_misses; }
+
+	static std::wstring GetDefaultDirectory(void);
+};
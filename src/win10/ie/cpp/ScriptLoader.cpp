@@ -0,0 +1,66 @@
+#include "stdafx.h"
+
+using namespace std;
+
+//
+// Helper to decode the raw bytes of a script into the UTF-16 the engine expects. The
+// bytes are transcoded straight into the result string, so this is the only copy made.
+//
+
+wstring DecodeScript(const BYTE *bytes, size_t lengthBytes)
+{
+	wstring result;
+
+	//
+	// UTF-16LE files are already in the engine's encoding and only need to be copied.
+	//
+
+	if (lengthBytes >= 2 && bytes[0] == 0xFF && bytes[1] == 0xFE)
+	{
+		result.assign((const wchar_t *) (bytes + 2), (lengthBytes - 2) / sizeof(wchar_t));
+		return result;
+	}
+
+	//
+	// Otherwise, the file is UTF-8, with or without a byte order mark.
+	//
+
+	if (lengthBytes >= 3 && bytes[0] == 0xEF && bytes[1] == 0xBB && bytes[2] == 0xBF)
+	{
+		bytes += 3;
+		lengthBytes -= 3;
+	}
+
+	if (lengthBytes == 0)
+	{
+		return result;
+	}
+
+	result.resize(UTF16_LENGTH_FOR_UTF8(lengthBytes));
+
+	size_t length = Utf8ToUtf16((const uint8_t *) bytes, lengthBytes, (uint16_t *) &result[0]);
+	result.resize(length);
+	return result;
+}
+
+//
+// Helper to load a script from disk.
+//
+
+wstring LoadScript(wstring fileName)
+{
+	MappedFile file;
+	if (!file.Open(fileName.c_str()))
+	{
+		fwprintf(stderr, L"chakrahost: unable to open file: %s.\n", fileName.c_str());
+		return wstring();
+	}
+
+	wstring result = DecodeScript(file.Data(), file.Size());
+	if (result.empty() && file.Size() > 0)
+	{
+		fwprintf(stderr, L"chakrahost: fatal error.\n");
+	}
+
+	return result;
+}
@@ -0,0 +1,225 @@
+#include "stdafx.h"
+
+using namespace std;
+
+//
+// The index of the pool thread running on the current thread, if any. Work submitted from
+// a pool thread goes on that thread's own queue.
+//
+
+static __declspec(thread) int currentThreadIndex = -1;
+
+static LONGLONG GetTicks(void)
+{
+	LARGE_INTEGER ticks;
+	QueryPerformanceCounter(&ticks);
+	return ticks.QuadPart;
+}
+
+static void UpdateMaximum(atomic<ULONGLONG> &maximum, ULONGLONG value)
+{
+	ULONGLONG current = maximum.load();
+
+	while (value > current && !maximum.compare_exchange_weak(current, value))
+	{
+	}
+}
+
+ThreadPool::ThreadPool(unsigned threadCount, size_t capacity) :
+	m_capacity(capacity),
+	m_pending(0),
+	m_nextQueue(0),
+	m_shutdown(false),
+	m_submitted(0),
+	m_rejected(0),
+	m_executed(0),
+	m_steals(0),
+	m_maximumQueueDepth(0),
+	m_totalWaitTicks(0),
+	m_maximumWaitTicks(0),
+	m_totalRunTicks(0),
+	m_maximumRunTicks(0)
+{
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+	m_ticksPerMillisecond = frequency.QuadPart / 1000.0;
+
+	if (threadCount == 0)
+	{
+		threadCount = 1;
+	}
+
+	for (unsigned index = 0; index < threadCount; index++)
+	{
+		m_queues.push_back(new WorkQueue());
+	}
+
+	for (unsigned index = 0; index < threadCount; index++)
+	{
+		m_threads.push_back(thread(&ThreadPool::Run, this, index));
+	}
+}
+
+ThreadPool::~ThreadPool(void)
+{
+	Shutdown();
+
+	for (size_t index = 0; index < m_queues.size(); index++)
+	{
+		delete m_queues[index];
+	}
+}
+
+bool ThreadPool::Submit(JsBackgroundWorkItemCallback callback, void *callbackState)
+{
+	//
+	// Reserve a slot first, so the pool never holds more than its capacity.
+	//
+
+	size_t depth = ++m_pending;
+
+	if (depth > m_capacity || m_shutdown)
+	{
+		m_pending--;
+		m_rejected++;
+		return false;
+	}
+
+	UpdateMaximum(m_maximumQueueDepth, depth);
+
+	WorkItem item;
+	item.callback = callback;
+	item.callbackState = callbackState;
+	item.submitTime = GetTicks();
+
+	unsigned index = currentThreadIndex >= 0 ? (unsigned) currentThreadIndex : m_nextQueue++ % m_queues.size();
+	WorkQueue *queue = m_queues[index];
+
+	{
+		lock_guard<mutex> lock(queue->lock);
+		queue->items.push_back(item);
+	}
+
+	m_submitted++;
+
+	{
+		lock_guard<mutex> lock(m_sleepLock);
+		m_wake.notify_one();
+	}
+
+	return true;
+}
+
+//
+// Take an item for the given pool thread: the newest item on its own queue if there is one
+// (it's the most likely to still be in cache), and otherwise the oldest item on another
+// thread's queue.
+//
+
+bool ThreadPool::TryTake(unsigned index, WorkItem &item)
+{
+	{
+		WorkQueue *queue = m_queues[index];
+		lock_guard<mutex> lock(queue->lock);
+
+		if (!queue->items.empty())
+		{
+			item = queue->items.back();
+			queue->items.pop_back();
+			return true;
+		}
+	}
+
+	for (size_t offset = 1; offset < m_queues.size(); offset++)
+	{
+		WorkQueue *queue = m_queues[(index + offset) % m_queues.size()];
+		lock_guard<mutex> lock(queue->lock);
+
+		if (!queue->items.empty())
+		{
+			item = queue->items.front();
+			queue->items.pop_front();
+			m_steals++;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void ThreadPool::Run(unsigned index)
+{
+	currentThreadIndex = (int) index;
+
+	for (;;)
+	{
+		WorkItem item;
+
+		if (TryTake(index, item))
+		{
+			m_pending--;
+
+			LONGLONG start = GetTicks();
+			item.callback(item.callbackState);
+			LONGLONG end = GetTicks();
+
+			m_executed++;
+			m_totalWaitTicks += start - item.submitTime;
+			m_totalRunTicks += end - start;
+			UpdateMaximum(m_maximumWaitTicks, start - item.submitTime);
+			UpdateMaximum(m_maximumRunTicks, end - start);
+			continue;
+		}
+
+		unique_lock<mutex> lock(m_sleepLock);
+
+		while (m_pending == 0 && !m_shutdown)
+		{
+			m_wake.wait(lock);
+		}
+
+		//
+		// Once shut down, keep going until the queues are drained; the engine is waiting on
+		// anything it has handed us.
+		//
+
+		if (m_pending == 0 && m_shutdown)
+		{
+			return;
+		}
+	}
+}
+
+void ThreadPool::Shutdown(void)
+{
+	{
+		lock_guard<mutex> lock(m_sleepLock);
+		m_shutdown = true;
+		m_wake.notify_all();
+	}
+
+	for (size_t index = 0; index < m_threads.size(); index++)
+	{
+		if (m_threads[index].joinable())
+		{
+			m_threads[index].join();
+		}
+	}
+}
+
+void ThreadPool::GetStatistics(ThreadPoolStatistics &statistics)
+{
+	ULONGLONG executed = m_executed;
+
+	statistics.threadCount = (unsigned) m_threads.size();
+	statistics.submitted = m_submitted;
+	statistics.rejected = m_rejected;
+	statistics.executed = executed;
+	statistics.steals = m_steals;
+	statistics.queueDepth = m_pending;
+	statistics.maximumQueueDepth = m_maximumQueueDepth;
+	statistics.averageWaitMilliseconds = executed ? m_totalWaitTicks / m_ticksPerMillisecond / executed : 0;
+	statistics.maximumWaitMilliseconds = m_maximumWaitTicks / m_ticksPerMillisecond;
+	statistics.averageRunMilliseconds = executed ? m_totalRunTicks / m_ticksPerMillisecond / executed : 0;
+	statistics.maximumRunMilliseconds = m_maximumRunTicks / m_ticksPerMillisecond;
+}
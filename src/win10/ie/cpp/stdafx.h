@@ -3,7 +3,21 @@
 #include <sdkddkver.h>
 #include <windows.h>
 #include <jsrt.h>
+#include "Transcode.h"
+#include "MappedFile.h"
+#include "ScriptLoader.h"
+#include "OutputBuffer.h"
+#include "CompileStats.h"
+#include "NameTable.h"
+#include "TraceWriter.h"
+#include "ChromeTrace.h"
+#include "../memory/Deflate.h"
+#include "PprofWriter.h"
+#include "CallTree.h"
+#include "StackSampler.h"
 #include "Profiler.h"
+#include "ThreadPool.h"
+#include "ScriptCache.h"
 
 #define IfFailError(v, e) \
     { \
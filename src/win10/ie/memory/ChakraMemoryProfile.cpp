@@ -1,71 +1,288 @@
 #include "stdafx.h"
 #include <activprof.h>
-#include <msopc.h>
+#include <algorithm>
 #include <string>
 #include <stack>
 #include <queue>
+#include <thread>
+#include "Transcode.h"
+#include "BinarySnapshot.h"
+#include "HeapObjectBatch.h"
+#include "SnapshotDelta.h"
+#include "SnapshotPipeline.h"
+#include "SnapshotStream.h"
+#include "ZipWriter.h"
 
 using namespace std;
 
 typedef void *MemoryProfileHandle;
 
-static IOpcFactory *factory = nullptr;
+//
+// Heap objects are fetched from the enumerator, and freed, this many at a time. Going one
+// object at a time costs two calls into the engine per object, which dominates the time
+// it takes to snapshot a large heap. Past the default, ChakraBenchmarks' HeapEnumeration
+// shows no more gain, while the engine holds more objects at once.
+//
+
+static const ULONG DefaultSnapshotBatchSize = 256;
+static const ULONG MaximumSnapshotBatchSize = 64 * 1024;
+static ULONG snapshotBatchSize = DefaultSnapshotBatchSize;
+
+//
+// Fetched objects are passed down the snapshot pipeline at least this many at a time, so
+// its threads hand work over rarely.
+//
+
+static const size_t PipelineBatchObjectCount = 4096;
+
+//
+// The number of threads serializing snapshot JSON. By default there's one per processor,
+// less the one enumerating the heap, up to a limit.
+//
+
+static const unsigned MaximumDefaultSnapshotThreadCount = 16;
+static const unsigned MaximumSnapshotThreadCount = 64;
+static unsigned snapshotThreadCount = 0;
+
+//
+// The formats snapshots can be written in. Binary snapshots are much smaller and faster to
+// write, and can be converted to JSON afterwards with ConvertSnapshotToJson.
+//
+
+enum SnapshotFormat
+{
+    SnapshotFormatJson = 0,
+    SnapshotFormatBinary = 1
+};
+
+//
+// A profile is written to its file as it goes, one snapshot at a time. When no file is
+// given up front, it goes to a temporary file that EndMemoryProfile moves into place.
+//
+// A profile taking incremental snapshots keeps the fingerprints of the objects in the last
+// snapshot it wrote, which the next one is a delta from.
+//
 
 struct MemoryProfile
 {
-    IOpcPackage *package;
-    IOpcPartSet *partSet;
+    ZipWriter package;
+    std::wstring fileName;
+    bool temporary;
     int snapshotCount;
+    SnapshotFormat format;
+    bool incremental;
+    bool internNames;
+    SnapshotFingerprints fingerprints;
+    std::wstring baseSnapshotName;
 
     MemoryProfile() :
-        package(nullptr),
-        partSet(nullptr),
-        snapshotCount(0)
+        temporary(false),
+        snapshotCount(0),
+        format(SnapshotFormatJson),
+        incremental(false),
+        internNames(false)
+    {
+    }
+};
+
+//
+// What went into a snapshot, in all and for each kind of object. A delta snapshot still
+// counts every object on the heap, along with how many of them it holds and how many
+// objects it removes.
+//
+// Each kind's objects are also counted by size, in powers of two from 16 bytes to 1MB. The
+// first bucket takes everything under 16 bytes and the last everything from 1MB up.
+//
+
+const size_t SnapshotSizeBucketCount = 18;
+
+struct SnapshotSizeBucket
+{
+    ULONGLONG objectsCount;
+    ULONGLONG objectsSize;
+
+    SnapshotSizeBucket() :
+        objectsCount(0),
+        objectsSize(0)
+    {
+    }
+};
+
+struct SnapshotKindTotals
+{
+    std::wstring name;
+    ULONGLONG objectsCount;
+    ULONGLONG objectsSize;
+    SnapshotSizeBucket sizes[SnapshotSizeBucketCount];
+
+    SnapshotKindTotals() :
+        objectsCount(0),
+        objectsSize(0)
+    {
+    }
+};
+
+static size_t GetSizeBucket(ULONGLONG size)
+{
+    size_t bucket = 0;
+
+    while (bucket < SnapshotSizeBucketCount - 1 && size >= (16ULL << bucket))
+    {
+        bucket++;
+    }
+
+    return bucket;
+}
+
+static ULONGLONG GetSizeBucketMinimum(size_t bucket)
+{
+    return bucket == 0 ? 0 : 16ULL << (bucket - 1);
+}
+
+struct SnapshotTotals
+{
+    ULONGLONG objectsCount;
+    ULONGLONG objectsSize;
+    ULONGLONG changedObjectsCount;
+    ULONGLONG removedObjectsCount;
+
+    //
+    // Indexed by type name id while the snapshot is written, with a last entry for objects
+    // whose type name isn't in the name map. Once it's written, only the kinds that have
+    // objects are left, named and largest first.
+    //
+
+    std::vector<SnapshotKindTotals> kinds;
+
+    SnapshotTotals() :
+        objectsCount(0),
+        objectsSize(0),
+        changedObjectsCount(0),
+        removedObjectsCount(0)
     {
     }
 };
 
-#define IfComFailError(v) \
-	{ \
-		hr = (v) ; \
-		if (FAILED(hr)) \
-		{ \
-			goto error; \
-		} \
+//
+// The buffer objects' optional info is fetched into. It's shared by all of the objects in
+// a snapshot and only grows, so it ends up the size of the largest object's optional info
+// instead of being allocated and freed for every object.
+//
+
+struct OptionalInfoBuffer
+{
+	PROFILER_HEAP_OBJECT_OPTIONAL_INFO *items;
+	unsigned capacity;
+
+	OptionalInfoBuffer() :
+		items(nullptr),
+		capacity(0)
+	{
+	}
+
+	~OptionalInfoBuffer()
+	{
+		delete [] items;
 	}
 
-#define IfComFailRet(v) \
-	{ \
-		HRESULT hr = (v) ; \
-		if (FAILED(hr)) \
-		{ \
-			return hr; \
-		} \
+	HRESULT Reserve(unsigned count)
+	{
+		if (count <= capacity)
+		{
+			return S_OK;
+		}
+
+		unsigned newCapacity = count > capacity * 2 ? count : capacity * 2;
+
+		delete [] items;
+		items = new PROFILER_HEAP_OBJECT_OPTIONAL_INFO[newCapacity];
+		capacity = items == nullptr ? 0 : newCapacity;
+
+		return items == nullptr ? E_OUTOFMEMORY : S_OK;
 	}
+};
+
+//
+// Two-digit chunks for formatting integers, so each division by 100 produces two digits.
+//
+
+static const char digitPairs[] =
+	"00010203040506070809101112131415161718192021222324252627282930313233343536373839404142434445464748495051525354555657585960616263646566676869707172737475767778798081828384858687888990919293949596979899";
+
+//
+// Writes the snapshot JSON. Output is built up as UTF-8 in a large buffer, which goes to
+// the stream in big chunks, rather than making a stream call for every token.
+//
 
 class JsonSerializer
 {
 public:
-	JsonSerializer(IStream *stream) :
-		_stream(stream)
+	JsonSerializer(SnapshotStream *stream) :
+		_stream(stream),
+		_buffer(new uint8_t[BufferCapacity]),
+		_size(0),
+		_internNames(false)
+	{
+	}
+
+	//
+	// With interned names, the profile's first line lists the names, and objects and their
+	// relationships give a name's index in it instead of the name itself.
+	//
+
+	bool InternsNames() const
+	{
+		return _internNames;
+	}
+
+	void SetInternNames(bool internNames)
+	{
+		_internNames = internNames;
+	}
+
+	~JsonSerializer()
 	{
+		Flush();
+		delete [] _buffer;
 	}
 
 	HRESULT EndArray()
 	{
-		IfComFailRet(Write(L"]"));
+		IfComFailRet(WriteAscii("]"));
 		_scopeStack.pop();
 		return S_OK;
 	}
 
 	HRESULT EndProfile()
 	{
+		return Flush();
+	}
+
+	HRESULT Flush()
+	{
+		const uint8_t *current = _buffer;
+
+		while (_size > 0)
+		{
+			ULONG written = 0;
+			HRESULT hr = _stream->Write(current, (ULONG) _size, &written);
+
+			if (FAILED(hr) || written == 0)
+			{
+				_size = 0;
+				return FAILED(hr) ? hr : STG_E_CANTSAVE;
+			}
+
+			current += written;
+			_size -= written;
+		}
+
 		return S_OK;
 	}
 
 	HRESULT EndSummary()
 	{
-		return S_OK;
+		return Flush();
 	}
 
 	HRESULT EndProperty()
@@ -84,7 +301,7 @@ public:
 
 	HRESULT EndJsonObject()
 	{
-		IfComFailRet(Write(L"}"));
+		IfComFailRet(WriteAscii("}"));
 		_scopeStack.pop();
 		return S_OK;
 	}
@@ -92,21 +309,59 @@ public:
 	HRESULT StartArray()
 	{
 		IfComFailRet(AppendDelimiterIfNecessary());
-		IfComFailRet(Write(L"["));
+		IfComFailRet(WriteAscii("["));
 		_scopeStack.push(false);
 		return S_OK;
 	}
 
-	HRESULT StartProfile()
+	HRESULT StartProfile(const wchar_t **nameIdMap, UINT nameCount)
 	{
 		IfComFailRet(WriteBOM());
 		IfComFailRet(StartJsonObject());
 		IfComFailRet(WriteVersion());
 		IfComFailRet(WriteTimestamp());
+
+		if (_internNames)
+		{
+			IfComFailRet(StartProperty(L"names"));
+			IfComFailRet(StartArray());
+
+			for (UINT index = 0; index < nameCount; index++)
+			{
+				IfComFailRet(WriteValue(nameIdMap[index] != nullptr ? nameIdMap[index] : L""));
+			}
+
+			IfComFailRet(EndArray());
+			IfComFailRet(EndProperty());
+		}
+
 		IfComFailRet(EndJsonObject());
 		return S_OK;
 	}
 
+	//
+	// A delta snapshot ends with a line listing the objects that have gone since the snapshot
+	// it's based on.
+	//
+
+	HRESULT StartRemovedObjects()
+	{
+		IfComFailRet(WriteNewLine());
+		IfComFailRet(StartJsonObject());
+		IfComFailRet(WriteVersion());
+		IfComFailRet(StartProperty(L"removedObjectIds"));
+		IfComFailRet(StartArray());
+		return S_OK;
+	}
+
+	HRESULT EndRemovedObjects()
+	{
+		IfComFailRet(EndArray());
+		IfComFailRet(EndProperty());
+		IfComFailRet(EndJsonObject());
+		return Flush();
+	}
+
 	HRESULT StartSummary()
 	{
 		IfComFailRet(WriteBOM());
@@ -126,14 +381,14 @@ public:
 
 	HRESULT StartJsonObject()
 	{
-		IfComFailRet(Write(L"{"));
+		IfComFailRet(WriteAscii("{"));
 		return S_OK;
 	}
 
 	HRESULT StartJsonObjectNested()
 	{
 		IfComFailRet(AppendDelimiterIfNecessary());
-		IfComFailRet(Write(L"{"));
+		IfComFailRet(WriteAscii("{"));
 		_scopeStack.push(false);
 		return S_OK;
 	}
@@ -141,7 +396,7 @@ public:
 	HRESULT StartProperty(const wchar_t * name)
 	{
 		IfComFailRet(AppendDelimiterIfNecessary());
-		IfComFailRet(AppendPropertyToData(name));
+		IfComFailRet(AppendPropertyName(name));
 		_scopeStack.push(false);
 		return S_OK;
 	}
@@ -149,117 +404,252 @@ public:
 	HRESULT WriteProperty(const wchar_t * name, const wchar_t * value)
 	{
 		IfComFailRet(AppendDelimiterIfNecessary());
-		IfComFailRet(AppendPropertyAndValueToData(name, EncodeAsJsonString(value).c_str()));
+		IfComFailRet(AppendPropertyName(name));
+		IfComFailRet(AppendString(value));
 		return S_OK;
 	}
 
 	HRESULT WriteProperty(const wchar_t * name, const int value)
 	{
+		char buffer[24];
 		IfComFailRet(AppendDelimiterIfNecessary());
-		wchar_t buffer[11];
-		int iResult = _itow_s(value, buffer, ARRAYSIZE(buffer), 10);
-		if (iResult == 0)
-		{
-			IfComFailRet(AppendPropertyAndValueToDataNoQuotes(name, (const wchar_t *) buffer));
-			return S_OK;
-		}
-
-		return E_FAIL;
+		IfComFailRet(AppendPropertyName(name));
+		IfComFailRet(WriteAscii(buffer, FormatInteger(value, buffer)));
+		return S_OK;
 	}
 
 	HRESULT WriteProperty(const wchar_t * name, const unsigned value)
 	{
+		char buffer[24];
 		IfComFailRet(AppendDelimiterIfNecessary());
-		wchar_t buffer[11];
-		int iResult = _itow_s(value, buffer, ARRAYSIZE(buffer), 10);
-		if (iResult == 0)
-		{
-			IfComFailRet(AppendPropertyAndValueToDataNoQuotes(name, (const wchar_t *) buffer));
-			return S_OK;
-		}
+		IfComFailRet(AppendPropertyName(name));
+		IfComFailRet(WriteAscii(buffer, FormatUnsigned(value, buffer)));
+		return S_OK;
+	}
 
-		return E_FAIL;
+	HRESULT WriteProperty(const wchar_t * name, const ULONGLONG value)
+	{
+		char buffer[24];
+		IfComFailRet(AppendDelimiterIfNecessary());
+		IfComFailRet(AppendPropertyName(name));
+		IfComFailRet(WriteAscii(buffer, FormatUnsigned(value, buffer)));
+		return S_OK;
 	}
 
 	HRESULT WriteProperty(const wchar_t * name, const double value)
 	{
-		IfComFailRet(AppendDelimiterIfNecessary());
-		wchar_t buffer[256];
-		if (swprintf_s(buffer, ARRAYSIZE(buffer), L"%g", value) != -1)
+		char buffer[32];
+		size_t length = FormatDouble(value, buffer, ARRAYSIZE(buffer));
+
+		if (length == 0)
 		{
-			IfComFailRet(AppendPropertyAndValueToDataNoQuotes(name, (const wchar_t *) buffer));
-			return S_OK;
+			return E_FAIL;
 		}
 
-		return E_FAIL;
+		IfComFailRet(AppendDelimiterIfNecessary());
+		IfComFailRet(AppendPropertyName(name));
+		IfComFailRet(WriteAscii(buffer, length));
+		return S_OK;
 	}
 
 	HRESULT WriteProperty(const wchar_t * name, const bool value)
 	{
 		IfComFailRet(AppendDelimiterIfNecessary());
-		IfComFailRet(AppendPropertyAndValueToDataNoQuotes(name, value ? L"true" : L"false"));
+		IfComFailRet(AppendPropertyName(name));
+		IfComFailRet(value ? WriteAscii("true") : WriteAscii("false"));
+		return S_OK;
+	}
+
+	//
+	// Object ids are written as unsigned numbers, however many bits they take.
+	//
+
+	HRESULT WriteIdProperty(const wchar_t * name, ULONG_PTR id)
+	{
+		IfComFailRet(AppendDelimiterIfNecessary());
+		IfComFailRet(AppendPropertyName(name));
+		IfComFailRet(AppendId(id));
 		return S_OK;
 	}
 
 	HRESULT WriteValue(const wchar_t * value)
 	{
 		IfComFailRet(AppendDelimiterIfNecessary());
-		IfComFailRet(AppendValueToData(EncodeAsJsonString(value).c_str()));
+		IfComFailRet(AppendString(value));
 		return S_OK;
 	}
 
 	HRESULT WriteValue(const int value)
 	{
+		char buffer[24];
 		IfComFailRet(AppendDelimiterIfNecessary());
-		wchar_t buffer[11];
-		int iResult = _itow_s(value, buffer, ARRAYSIZE(buffer), 10);
-		if (iResult == 0)
-		{
-			IfComFailRet(AppendValueToDataNoQuotes((const wchar_t *) buffer));
-			return S_OK;
-		}
-
-		return E_FAIL;
+		IfComFailRet(WriteAscii(buffer, FormatInteger(value, buffer)));
+		return S_OK;
 	}
 
-private:
-	HRESULT WriteBOM()
+	HRESULT WriteIdValue(ULONG_PTR id)
 	{
-		ULONG written;
-		const char *BOM = "\xEF\xBB\xBF";
-		IfComFailRet(_stream->Write(BOM, strlen(BOM), &written));
+		IfComFailRet(AppendDelimiterIfNecessary());
+		IfComFailRet(AppendId(id));
 		return S_OK;
 	}
 
-	HRESULT Write(const wchar_t *s)
+private:
+	static const size_t BufferCapacity = 1024 * 1024;
+
+	//
+	// The most UTF-16 code units transcoded in one go. Each turns into at most three bytes
+	// of UTF-8.
+	//
+
+	static const size_t MaximumChunkLength = BufferCapacity / 3;
+
+	//
+	// The most UTF-16 code units escaped in one go. Each turns into at most six bytes.
+	//
+
+	static const size_t MaximumEscapedChunkLength = BufferCapacity / 6;
+
+	//
+	// The most ASCII characters copied in before handing the rest of a string to the
+	// transcoder.
+	//
+
+	static const size_t MaximumCopiedLength = 64;
+
+	static size_t FormatUnsigned(ULONGLONG value, char *buffer)
 	{
-		ULONG written;
-		unsigned characterCount = wcslen(s);
-		char smallBuffer[256];
-		char *buffer;
-		bool freeBuffer = false;
-		HRESULT hr = S_OK;
+		char digits[20];
+		char *end = digits + ARRAYSIZE(digits);
+		char *current = end;
+
+		while (value >= 100)
+		{
+			unsigned pair = (unsigned) (value % 100) * 2;
+			value /= 100;
+			*--current = digitPairs[pair + 1];
+			*--current = digitPairs[pair];
+		}
 
-		if (characterCount * 2 < 256)
+		if (value >= 10)
 		{
-			buffer = smallBuffer;
+			unsigned pair = (unsigned) value * 2;
+			*--current = digitPairs[pair + 1];
+			*--current = digitPairs[pair];
 		}
 		else
 		{
-			buffer = new char[characterCount * 2];
-			freeBuffer = true;
+			*--current = (char) ('0' + value);
+		}
+
+		memcpy(buffer, current, end - current);
+		return end - current;
+	}
+
+	static size_t FormatInteger(LONGLONG value, char *buffer)
+	{
+		if (value < 0)
+		{
+			buffer[0] = '-';
+			return 1 + FormatUnsigned(0 - (ULONGLONG) value, buffer + 1);
+		}
+
+		return FormatUnsigned((ULONGLONG) value, buffer);
+	}
+
+	//
+	// Doubles are written the way "%g" writes them. That prints whole numbers under a million
+	// exactly like integers, which covers most numbers on a heap, so only the rest go
+	// through the CRT.
+	//
+
+	static size_t FormatDouble(double value, char *buffer, size_t bufferLength)
+	{
+		if (value > -1e6 && value < 1e6 && value == (double) (int) value && _fpclass(value) != _FPCLASS_NZ)
+		{
+			return FormatInteger((int) value, buffer);
+		}
+
+		int length = _snprintf_s(buffer, bufferLength, _TRUNCATE, "%g", value);
+		return length < 0 ? 0 : (size_t) length;
+	}
+
+	HRESULT WriteBOM()
+	{
+		return WriteAscii("\xEF\xBB\xBF");
+	}
+
+	//
+	// Make room for length more bytes in the buffer. Nothing written at once is ever more
+	// than a buffer's worth.
+	//
+
+	HRESULT Reserve(size_t length)
+	{
+		if (_size + length > BufferCapacity)
+		{
+			IfComFailRet(Flush());
 		}
 
-		int byteCount = WideCharToMultiByte(CP_UTF8, 0, s, characterCount, buffer, characterCount * 2, nullptr, nullptr);
+		return S_OK;
+	}
+
+	template <size_t length>
+	HRESULT WriteAscii(const char (&text)[length])
+	{
+		return WriteAscii(text, length - 1);
+	}
+
+	HRESULT WriteAscii(const char *text, size_t length)
+	{
+		IfComFailRet(Reserve(length));
+		memcpy(_buffer + _size, text, length);
+		_size += length;
+		return S_OK;
+	}
+
+	//
+	// Most of what's written this way is a short property name in ASCII, which is copied
+	// straight in. The transcoder picks up from the first character that isn't ASCII.
+	//
 
-		if (byteCount)
+	HRESULT Write(const wchar_t *s)
+	{
+		if (_size + MaximumCopiedLength <= BufferCapacity)
 		{
-			hr = _stream->Write(buffer, byteCount, &written);
+			uint8_t *current = _buffer + _size;
+			uint8_t *end = current + MaximumCopiedLength;
+
+			while (current < end && *s != 0 && *s < 0x80)
+			{
+				*current++ = (uint8_t) *s++;
+			}
+
+			_size = current - _buffer;
+
+			if (*s == 0)
+			{
+				return S_OK;
+			}
 		}
 
-		if (freeBuffer)
+		size_t characterCount = wcslen(s);
+
+		while (characterCount > 0)
 		{
-			delete buffer;
+			size_t chunkLength = characterCount > MaximumChunkLength ? MaximumChunkLength : characterCount;
+
+			// Don't split a surrogate pair between chunks.
+			if (chunkLength < characterCount && s[chunkLength - 1] >= 0xD800 && s[chunkLength - 1] <= 0xDBFF)
+			{
+				chunkLength--;
+			}
+
+			IfComFailRet(Reserve(UTF8_LENGTH_FOR_UTF16(chunkLength)));
+			_size += Utf16ToUtf8((const uint16_t *) s, chunkLength, _buffer + _size);
+
+			s += chunkLength;
+			characterCount -= chunkLength;
 		}
 
 		return S_OK;
@@ -272,141 +662,73 @@ private:
 			if (_scopeStack.top())
 			{
 				// Append the delimiter
-				IfComFailRet(Write(L","));
+				IfComFailRet(WriteAscii(","));
 			}
 			else
 			{
 				// Change this scope so the next time
 				// we will append a delimiter.
-				_scopeStack.pop();
-				_scopeStack.push(true);
+				_scopeStack.top() = true;
 			}
 		}
 
 		return S_OK;
 	}
 
-	HRESULT AppendPropertyToData(const wchar_t * name)
-	{
-		IfComFailRet(Write(L"\""));
-		IfComFailRet(Write(name));
-		IfComFailRet(Write(L"\":"));
-		return S_OK;
-	}
-
-	HRESULT AppendPropertyAndValueToData(const wchar_t * name, const wchar_t * value)
+	HRESULT AppendPropertyName(const wchar_t * name)
 	{
-		IfComFailRet(Write(L"\""));
+		IfComFailRet(WriteAscii("\""));
 		IfComFailRet(Write(name));
-		IfComFailRet(Write(L"\":\""));
-		IfComFailRet(Write(value));
-		IfComFailRet(Write(L"\""));
+		IfComFailRet(WriteAscii("\":"));
 		return S_OK;
 	}
 
-	HRESULT AppendPropertyAndValueToDataNoQuotes(const wchar_t * name, const wchar_t * value)
+	HRESULT AppendString(const wchar_t * value)
 	{
-		IfComFailRet(Write(L"\""));
-		IfComFailRet(Write(name));
-		IfComFailRet(Write(L"\":"));
-		IfComFailRet(Write(value));
+		IfComFailRet(WriteAscii("\""));
+		IfComFailRet(WriteEscaped(value));
+		IfComFailRet(WriteAscii("\""));
 		return S_OK;
 	}
 
-	HRESULT AppendValueToData(const wchar_t * value)
+	HRESULT AppendId(ULONG_PTR id)
 	{
-		IfComFailRet(Write(L"\""));
-		IfComFailRet(Write(value));
-		IfComFailRet(Write(L"\""));
-		return S_OK;
+		char buffer[24];
+		return WriteAscii(buffer, FormatUnsigned(id, buffer));
 	}
 
-	HRESULT AppendValueToDataNoQuotes(const wchar_t * value)
-	{
-		IfComFailRet(Write(value));
-		return S_OK;
-	}
+	//
+	// Write a string with JSON escaping. Every character that isn't printable ASCII is
+	// escaped, so the escaped string is written straight into the buffer as bytes.
+	//
 
-	wstring EncodeAsJsonString(const wchar_t * value)
+	HRESULT WriteEscaped(const wchar_t * value)
 	{
-		wstring escapedValue = L"";
+		size_t characterCount = wcslen(value);
 
-		while (*value != L'\0')
+		while (characterCount > 0)
 		{
-			switch (*value)
-			{
-			case L'"':
-				escapedValue.append(L"\\\"");
-				break;
-			case L'/':
-				escapedValue.append(L"\\/");
-				break;
-			case L'\\':
-				escapedValue.append(L"\\\\");
-				break;
-			case L'\b':
-				escapedValue.append(L"\\b");
-				break;
-			case L'\f':
-				escapedValue.append(L"\\f");
-				break;
-			case L'\n':
-				escapedValue.append(L"\\n");
-				break;
-			case L'\r':
-				escapedValue.append(L"\\r");
-				break;
-			case L'\t':
-				escapedValue.append(L"\\t");
-				break;
-			default:
-				// Based on the JSON specification (RFC 4627) any character can
-				// be escaped, but only the above characters and control
-				// characters (U+0000 through U+001F) must be escaped.  However,
-				// we will also escape extended characters (U+007F-) to be safe.
-				// Example:  the unescaped EOF character 0xFFFF cannot be parsed.
-				if (((*value) >= 0x0000 && (*value) <= 0x001F) || (*value) > 0x007F)
-				{
-					escapedValue.append(L"\\u");
-
-					// Go from the int value to the hex value
-					int intValue = (int) (*value);
-					wchar_t buffer[11];
-					int iResult = _itow_s(intValue, buffer, ARRAYSIZE(buffer), 16);
-					if (iResult == 0)
-					{
-						long zerosToAppend = 4 - wcslen((const wchar_t *) buffer);
-						if (zerosToAppend >= 0)
-						{
-							for (int index = 0; index < zerosToAppend; index++)
-							{
-								escapedValue.append(L"0", wcslen(L"0"));
-							}
-							escapedValue.append((const wchar_t *) buffer);
-						}
-					}
-				}
-				else
-				{
-					escapedValue.append(value, 1);
-				}
-				break;
-			}
-			++value;
+			size_t chunkLength = characterCount > MaximumEscapedChunkLength ? MaximumEscapedChunkLength : characterCount;
+
+			IfComFailRet(Reserve(JSON_ESCAPED_LENGTH_FOR_UTF16(chunkLength)));
+			_size += EscapeJsonString((const uint16_t *) value, chunkLength, _buffer + _size);
+
+			value += chunkLength;
+			characterCount -= chunkLength;
 		}
 
-		return escapedValue;
+		return S_OK;
 	}
 
 	HRESULT WriteNewLine()
 	{
-		IfComFailRet(Write(L"\r\n"));
+		IfComFailRet(WriteAscii("\r\n"));
 		return S_OK;
 	}
 
 	HRESULT WriteVersion()
 	{
-		IfComFailRet(Write(L"\"version\":\"1.0\""));
+		IfComFailRet(WriteAscii("\"version\":\"1.0\""));
 		_scopeStack.push(true);
 		return S_OK;
 	}
@@ -418,19 +740,18 @@ private:
 		LARGE_INTEGER time;
 		QueryPerformanceCounter(&time);
 
-		LONGLONG longTime = time.QuadPart;
-		wchar_t buffer[20];
-		int iResult = _i64tow_s(longTime, buffer, ARRAYSIZE(buffer), 10);
-		if (iResult == 0)
-		{
-			IfComFailRet(AppendPropertyAndValueToData(L"timestamp", (const wchar_t *) buffer));
-			return S_OK;
-		}
-
-		return E_FAIL;
+		char buffer[24];
+		IfComFailRet(AppendPropertyName(L"timestamp"));
+		IfComFailRet(WriteAscii("\""));
+		IfComFailRet(WriteAscii(buffer, FormatInteger(time.QuadPart, buffer)));
+		IfComFailRet(WriteAscii("\""));
+		return S_OK;
 	}
 
-	IStream *_stream;
+	SnapshotStream *_stream;
+	uint8_t *_buffer;
+	size_t _size;
+	bool _internNames;
 
 	// If the current scope == true, then we append a delimiter.
 	stack<bool> _scopeStack;
@@ -464,31 +785,59 @@ const wchar_t * GetTypeName(const wchar_t **nameIdMap, UINT nameCount, ULONG ulI
 	return name;
 }
 
-unsigned AddSizes(unsigned uSizeToAdd, unsigned uSize)
+//
+// Whether a name id has a name to intern. Ids without one are written the way they are
+// without interning.
+//
+
+bool HasInternedName(const wchar_t **nameIdMap, UINT nameCount, ULONG ulId)
 {
-	if ((uSize + uSizeToAdd) < uSizeToAdd)
-	{
-		return UINT_MAX;
-	}
-	return uSize + uSizeToAdd;
+	return ulId < nameCount && nameIdMap[ulId] != nullptr && nameIdMap[ulId][0] != L'\0';
 }
 
-HRESULT SerializeIdProperty(JsonSerializer *snapshotSerializer, const wchar_t * name, ULONG_PTR ulId)
+//
+// An object's size, plus the size of the property and collection slots its optional info
+// lists. It's kept in 64 bits, which none of the parts can overflow.
+//
+
+ULONGLONG GetHeapObjectSize(PROFILER_HEAP_OBJECT *profilerHeapObject, PROFILER_HEAP_OBJECT_OPTIONAL_INFO *optionalInfo)
 {
-#ifdef _WIN64
-	if (ulId > MAXINT32)
-	{
-		wchar_t szId[21] = L""; // Maximum decimal in UINT64 is 20
-		_ui64tow_s(ulId, szId, ARRAYSIZE(szId), 10);
-		IfComFailRet(snapshotSerializer->WriteProperty(name, szId));
-	}
-	else
-#endif
+	ULONGLONG size = profilerHeapObject->size;
+
+	for (unsigned index = 0; index < profilerHeapObject->optionalInfoCount; index++)
 	{
-		IfComFailRet(snapshotSerializer->WriteProperty(name, (int) ulId));
+		switch (optionalInfo[index].infoType)
+		{
+		case PROFILER_HEAP_OBJECT_OPTIONAL_INFO_NAME_PROPERTIES:
+			size += (ULONGLONG) optionalInfo[index].namePropertyList->count * sizeof(void*);
+			break;
+		case PROFILER_HEAP_OBJECT_OPTIONAL_INFO_INDEX_PROPERTIES:
+			size += (ULONGLONG) optionalInfo[index].indexPropertyList->count * sizeof(void*);
+			break;
+		case PROFILER_HEAP_OBJECT_OPTIONAL_INFO_ELEMENT_ATTRIBUTES_SIZE:
+			size += optionalInfo[index].elementAttributesSize;
+			break;
+		case PROFILER_HEAP_OBJECT_OPTIONAL_INFO_ELEMENT_TEXT_CHILDREN_SIZE:
+			size += optionalInfo[index].elementTextChildrenSize;
+			break;
+		case PROFILER_HEAP_OBJECT_OPTIONAL_INFO_WEAKMAP_COLLECTION_LIST:
+			size += (ULONGLONG) optionalInfo[index].weakMapCollectionList->count * sizeof(void*);
+			break;
+		case PROFILER_HEAP_OBJECT_OPTIONAL_INFO_MAP_COLLECTION_LIST:
+			size += (ULONGLONG) optionalInfo[index].mapCollectionList->count * sizeof(void*);
+			break;
+		case PROFILER_HEAP_OBJECT_OPTIONAL_INFO_SET_COLLECTION_LIST:
+			size += (ULONGLONG) optionalInfo[index].setCollectionList->count * sizeof(void*);
+			break;
+		}
 	}
 
-	return S_OK;
+	return size;
+}
+
+HRESULT SerializeIdProperty(JsonSerializer *snapshotSerializer, const wchar_t * name, ULONG_PTR ulId)
+{
+	return snapshotSerializer->WriteIdProperty(name, ulId);
 }
 
 HRESULT SerializeProperty(JsonSerializer *snapshotSerializer, const wchar_t **nameIdMap, UINT nameCount, PROFILER_HEAP_OBJECT_RELATIONSHIP *profilerHeapObjectProperty, bool indexList)
@@ -508,6 +857,10 @@ HRESULT SerializeProperty(JsonSerializer *snapshotSerializer, const wchar_t **na
 			wcsncat_s(indexName, L"]", _TRUNCATE);
 			name = indexName;
 		}
+		else if (snapshotSerializer->InternsNames() && HasInternedName(nameIdMap, nameCount, profilerHeapObjectProperty->relationshipId))
+		{
+			IfComFailRet(snapshotSerializer->WriteProperty(L"nameId", (unsigned) profilerHeapObjectProperty->relationshipId));
+		}
 		else
 		{
 			name = GetTypeName(nameIdMap, nameCount, profilerHeapObjectProperty->relationshipId);
@@ -640,21 +993,7 @@ HRESULT SerializePropertyList(JsonSerializer *snapshotSerializer, const wchar_t
 
 HRESULT SerializeIdValue(JsonSerializer *snapshotSerializer, ULONG_PTR ulId)
 {
-	HRESULT hr = S_OK;
-#ifdef _WIN64
-	if (ulId > MAXINT32)
-	{
-		wchar_t id[21] = L""; // Maximum decimal in UINT64 is 20
-		_ui64tow_s(ulId, id, ARRAYSIZE(id), 10);
-		IfComFailRet(snapshotSerializer->WriteValue(id);)
-	}
-	else
-#endif
-	{
-		IfComFailRet(snapshotSerializer->WriteValue((int) ulId));
-	}
-
-	return S_OK;
+	return snapshotSerializer->WriteIdValue(ulId);
 }
 
 HRESULT SerializeKeyValuePropertyList(JsonSerializer *snapshotSerializer, const wchar_t **nameIdMap, UINT nameCount, const wchar_t * propertyListName, PROFILER_HEAP_OBJECT_RELATIONSHIP_LIST *propertyList)
@@ -679,34 +1018,24 @@ HRESULT SerializeKeyValuePropertyList(JsonSerializer *snapshotSerializer, const
 	return S_OK;
 }
 
-HRESULT SerializeHeapObjectOptionalInfo(IActiveScriptProfilerHeapEnum *enumerator, JsonSerializer *snapshotSerializer, const wchar_t **nameIdMap, UINT nameCount, PROFILER_HEAP_OBJECT *profilerHeapObject, unsigned *size)
+HRESULT SerializeHeapObjectOptionalInfo(JsonSerializer *snapshotSerializer, const wchar_t **nameIdMap, UINT nameCount, PROFILER_HEAP_OBJECT *profilerHeapObject, PROFILER_HEAP_OBJECT_OPTIONAL_INFO *optionalInfo, ULONGLONG *size)
 {
 	*size = profilerHeapObject->size;
 	if (profilerHeapObject->optionalInfoCount > 0)
 	{
 		HRESULT hr = S_OK;
 		unsigned optionalInfoCount = profilerHeapObject->optionalInfoCount;
-		PROFILER_HEAP_OBJECT_OPTIONAL_INFO *optionalInfo = new PROFILER_HEAP_OBJECT_OPTIONAL_INFO[optionalInfoCount];
 		queue<unsigned> internalProperties;
 
-		if (optionalInfo == nullptr)
-		{
-			return E_FAIL;
-		}
-
-		IfComFailError(enumerator->GetOptionalInfo(profilerHeapObject, optionalInfoCount, optionalInfo));
-
-		for (unsigned index = 0; index < optionalInfoCount; index++)
+		for (unsigned index = 0; index < optionalInfoCount; index++)
 		{
 			switch (optionalInfo[index].infoType)
 			{
 			case PROFILER_HEAP_OBJECT_OPTIONAL_INFO_NAME_PROPERTIES:
 				IfComFailError(SerializePropertyList(snapshotSerializer, nameIdMap, nameCount, L"properties", optionalInfo[index].namePropertyList, false));
-				*size = AddSizes((unsigned) (optionalInfo[index].namePropertyList)->count * sizeof(void*) , *size);
 				break;
 			case PROFILER_HEAP_OBJECT_OPTIONAL_INFO_INDEX_PROPERTIES:
 				IfComFailError(SerializePropertyList(snapshotSerializer, nameIdMap, nameCount, L"indices", optionalInfo[index].indexPropertyList, true));
-				*size = AddSizes((unsigned) (optionalInfo[index].indexPropertyList)->count * sizeof(void*) , *size);
 				break;
 			case PROFILER_HEAP_OBJECT_OPTIONAL_INFO_RELATIONSHIPS:
 				IfComFailError(SerializePropertyList(snapshotSerializer, nameIdMap, nameCount, L"relationships", optionalInfo[index].relationshipList, false));
@@ -736,27 +1065,24 @@ HRESULT SerializeHeapObjectOptionalInfo(IActiveScriptProfilerHeapEnum *enumerato
 				break;
 			case PROFILER_HEAP_OBJECT_OPTIONAL_INFO_ELEMENT_ATTRIBUTES_SIZE:
 				IfComFailError(snapshotSerializer->WriteProperty(L"elementAttributesSize", optionalInfo[index].elementAttributesSize));
-				*size = AddSizes((unsigned) optionalInfo[index].elementAttributesSize, *size);
 				break;
 			case PROFILER_HEAP_OBJECT_OPTIONAL_INFO_ELEMENT_TEXT_CHILDREN_SIZE:
 				IfComFailError(snapshotSerializer->WriteProperty(L"elementTextChildrenSize", optionalInfo[index].elementTextChildrenSize));
-				*size = AddSizes((unsigned) optionalInfo[index].elementTextChildrenSize, *size);
 				break;
 			case PROFILER_HEAP_OBJECT_OPTIONAL_INFO_WEAKMAP_COLLECTION_LIST:
 				IfComFailError(SerializeKeyValuePropertyList(snapshotSerializer, nameIdMap, nameCount, L"map", optionalInfo[index].weakMapCollectionList));
-				*size = AddSizes((unsigned) (optionalInfo[index].weakMapCollectionList)->count * sizeof(void*) , *size);
 				break;
 			case PROFILER_HEAP_OBJECT_OPTIONAL_INFO_MAP_COLLECTION_LIST:
 				IfComFailError(SerializeKeyValuePropertyList(snapshotSerializer, nameIdMap, nameCount, L"map", optionalInfo[index].mapCollectionList));
-				*size = AddSizes((unsigned) (optionalInfo[index].mapCollectionList)->count * sizeof(void*) , *size);
 				break;
 			case PROFILER_HEAP_OBJECT_OPTIONAL_INFO_SET_COLLECTION_LIST:
 				IfComFailError(SerializePropertyList(snapshotSerializer, nameIdMap, nameCount, L"set", optionalInfo[index].setCollectionList, false));
-				*size = AddSizes((unsigned) (optionalInfo[index].setCollectionList)->count * sizeof(void*) , *size);
 				break;
 			}
 		}
 
+		*size = GetHeapObjectSize(profilerHeapObject, optionalInfo);
+
 		if (internalProperties.size() > 0)
 		{
 			IfComFailError(snapshotSerializer->StartProperty(L"internalProperties"));
@@ -771,14 +1097,17 @@ HRESULT SerializeHeapObjectOptionalInfo(IActiveScriptProfilerHeapEnum *enumerato
 			IfComFailError(snapshotSerializer->EndProperty());
 		}
 	error:
-		delete [] optionalInfo;
+		if (FAILED(hr))
+		{
+			return hr;
+		}
 	}
 
 	IfComFailRet(snapshotSerializer->WriteProperty(L"size", *size));
 	return S_OK;
 }
 
-HRESULT SerializeObject(IActiveScriptProfilerHeapEnum *enumerator, JsonSerializer *snapshotSerializer, const wchar_t **nameIdMap, UINT nameCount, PROFILER_HEAP_OBJECT *profilerHeapObject, unsigned *size)
+HRESULT SerializeObject(JsonSerializer *snapshotSerializer, const wchar_t **nameIdMap, UINT nameCount, PROFILER_HEAP_OBJECT *profilerHeapObject, PROFILER_HEAP_OBJECT_OPTIONAL_INFO *optionalInfo, ULONGLONG *size)
 {
 	IfComFailRet(snapshotSerializer->StartHeapObject());
 	IfComFailRet(SerializeIdProperty(snapshotSerializer, L"objectId", profilerHeapObject->objectId));
@@ -794,7 +1123,11 @@ HRESULT SerializeObject(IActiveScriptProfilerHeapEnum *enumerator, JsonSerialize
 	}
 
 	// typeNameId
-	if (profilerHeapObject->typeNameId != PROFILER_HEAP_OBJECT_NAME_ID_UNAVAILABLE)
+	if (snapshotSerializer->InternsNames() && HasInternedName(nameIdMap, nameCount, profilerHeapObject->typeNameId))
+	{
+		IfComFailRet(snapshotSerializer->WriteProperty(L"kindId", (unsigned) profilerHeapObject->typeNameId));
+	}
+	else if (profilerHeapObject->typeNameId != PROFILER_HEAP_OBJECT_NAME_ID_UNAVAILABLE)
 	{
 		const wchar_t * pszTypeName = GetTypeName(nameIdMap, nameCount, profilerHeapObject->typeNameId);
 
@@ -805,68 +1138,476 @@ HRESULT SerializeObject(IActiveScriptProfilerHeapEnum *enumerator, JsonSerialize
 	}
 
 	IfComFailRet(SerializeHeapObjectFlags(snapshotSerializer, profilerHeapObject));
-	IfComFailRet(SerializeHeapObjectOptionalInfo(enumerator, snapshotSerializer, nameIdMap, nameCount, profilerHeapObject, size));
+	IfComFailRet(SerializeHeapObjectOptionalInfo(snapshotSerializer, nameIdMap, nameCount, profilerHeapObject, optionalInfo, size));
 	IfComFailRet(snapshotSerializer->EndHeapObject());
 
 	return S_OK;
 }
 
-HRESULT GetNextHeapObject(IActiveScriptProfilerHeapEnum *enumerator, JsonSerializer *snapshotSerializer, const wchar_t **nameIdMap, UINT nameCount, bool *moreObjects, unsigned *size)
+//
+// Serializes batches as snapshot JSON. Each heap object's JSON stands on its own, so any
+// number of these can run at once. With a filter, only the objects it lets through are
+// written.
+//
+
+class JsonBatchSerializer sealed : public BatchSerializer
 {
-	PROFILER_HEAP_OBJECT *profilerHeapObject[1];
-	ULONG fetchedObjectCount = 0;
+public:
+	JsonBatchSerializer(const wchar_t **nameIdMap, UINT nameCount, bool internNames, DeltaFilter *filter) :
+		m_serializer(&m_stream),
+		m_nameIdMap(nameIdMap),
+		m_nameCount(nameCount),
+		m_filter(filter)
+	{
+		m_serializer.SetInternNames(internNames);
+	}
+
+	HRESULT Serialize(const HeapObjectBatch *batch, vector<uint8_t> *output)
+	{
+		HRESULT hr = S_OK;
+
+		m_stream.SetBuffer(output);
+
+		for (size_t index = 0; index < batch->Count(); index++)
+		{
+			PROFILER_HEAP_OBJECT *profilerHeapObject = batch->Object(index);
+			PROFILER_HEAP_OBJECT_OPTIONAL_INFO *optionalInfo = batch->OptionalInfo(index);
+			bool include = true;
+			ULONGLONG size;
 
-	IfComFailRet(enumerator->Next(1, profilerHeapObject, &fetchedObjectCount));
+			if (m_filter != nullptr)
+			{
+				IfComFailError(m_filter->Filter(profilerHeapObject, optionalInfo, &include));
+			}
+
+			if (include)
+			{
+				IfComFailError(SerializeObject(&m_serializer, m_nameIdMap, m_nameCount, profilerHeapObject, optionalInfo, &size));
+			}
+		}
 
-	if (fetchedObjectCount == 0)
+		IfComFailError(m_serializer.Flush());
+
+	error:
+		m_stream.SetBuffer(nullptr);
+		return hr;
+	}
+
+private:
+	MemoryStream m_stream;
+	JsonSerializer m_serializer;
+	const wchar_t **m_nameIdMap;
+	UINT m_nameCount;
+	DeltaFilter *m_filter;
+};
+
+//
+// Serializes batches as a binary snapshot. Objects are written relative to the ones before
+// them, so only one of these can run, and it has to see the batches in order.
+//
+
+class BinaryBatchSerializer sealed : public BatchSerializer
+{
+public:
+	BinaryBatchSerializer(DeltaFilter *filter) :
+		m_writer(&m_stream),
+		m_filter(filter)
 	{
-		*moreObjects = false;
-		return S_OK;
 	}
-	else
+
+	HRESULT WriteHeader(const wchar_t **nameIdMap, UINT nameCount, vector<uint8_t> *output)
+	{
+		HRESULT hr = S_OK;
+
+		m_stream.SetBuffer(output);
+		IfComFailError(m_writer.WriteHeader(nameIdMap, nameCount));
+		IfComFailError(m_writer.Flush());
+
+	error:
+		m_stream.SetBuffer(nullptr);
+		return hr;
+	}
+
+	HRESULT Serialize(const HeapObjectBatch *batch, vector<uint8_t> *output)
+	{
+		HRESULT hr = S_OK;
+
+		m_stream.SetBuffer(output);
+
+		for (size_t index = 0; index < batch->Count(); index++)
+		{
+			PROFILER_HEAP_OBJECT *profilerHeapObject = batch->Object(index);
+			PROFILER_HEAP_OBJECT_OPTIONAL_INFO *optionalInfo = batch->OptionalInfo(index);
+			bool include = true;
+
+			if (m_filter != nullptr)
+			{
+				IfComFailError(m_filter->Filter(profilerHeapObject, optionalInfo, &include));
+			}
+
+			if (include)
+			{
+				IfComFailError(m_writer.WriteObject(profilerHeapObject, optionalInfo));
+			}
+		}
+
+		IfComFailError(m_writer.Flush());
+
+	error:
+		m_stream.SetBuffer(nullptr);
+		return hr;
+	}
+
+	//
+	// Ends the snapshot, listing the objects it removes first if it's a delta.
+	//
+
+	HRESULT WriteEnd(const vector<ULONG_PTR> *removedObjectIds, vector<uint8_t> *output)
 	{
-		*moreObjects = true;
-		IfComFailRet(SerializeObject(enumerator, snapshotSerializer, nameIdMap, nameCount, profilerHeapObject[0], size));
-		return enumerator->FreeObjectAndOptionalInfo(fetchedObjectCount, profilerHeapObject);
+		HRESULT hr = S_OK;
+
+		m_stream.SetBuffer(output);
+
+		if (removedObjectIds != nullptr)
+		{
+			IfComFailError(m_writer.WriteRemovedObjects(*removedObjectIds));
+		}
+
+		IfComFailError(m_writer.WriteEnd());
+
+	error:
+		m_stream.SetBuffer(nullptr);
+		return hr;
 	}
+
+private:
+	MemoryStream m_stream;
+	BinarySnapshotWriter m_writer;
+	DeltaFilter *m_filter;
+};
+
+static unsigned GetSnapshotThreadCount(void)
+{
+	if (snapshotThreadCount != 0)
+	{
+		return snapshotThreadCount;
+	}
+
+	unsigned processorCount = thread::hardware_concurrency();
+	unsigned threadCount = processorCount > 1 ? processorCount - 1 : 1;
+
+	return threadCount > MaximumDefaultSnapshotThreadCount ? MaximumDefaultSnapshotThreadCount : threadCount;
 }
 
-HRESULT WriteSnapshot(IActiveScriptProfilerHeapEnum *enumerator, IStream *snapshotPartStream, unsigned *objectsCount, unsigned *objectsSize)
+//
+// Fetches the next heap objects and their optional info from the enumerator, and copies
+// them into a batch, counting them toward the totals on the way. The objects go back to
+// the enumerator before this returns, even if copying them failed part way through.
+//
+
+HRESULT FetchHeapObjects(IActiveScriptProfilerHeapEnum *enumerator, HeapObjectBatch *batch, OptionalInfoBuffer *optionalInfoBuffer, PROFILER_HEAP_OBJECT **profilerHeapObjects, ULONG batchSize, ULONG *fetchedObjectCount, SnapshotTotals *totals)
 {
-	bool moreObjects = true;
+	HRESULT hr = S_OK;
+
+	*fetchedObjectCount = 0;
+	IfComFailRet(enumerator->Next(batchSize, profilerHeapObjects, fetchedObjectCount));
+
+	for (ULONG index = 0; index < *fetchedObjectCount; index++)
+	{
+		PROFILER_HEAP_OBJECT *profilerHeapObject = profilerHeapObjects[index];
+		PROFILER_HEAP_OBJECT_OPTIONAL_INFO *optionalInfo = nullptr;
+
+		if (profilerHeapObject->optionalInfoCount > 0)
+		{
+			IfComFailError(optionalInfoBuffer->Reserve(profilerHeapObject->optionalInfoCount));
+
+			optionalInfo = optionalInfoBuffer->items;
+
+			IfComFailError(enumerator->GetOptionalInfo(profilerHeapObject, profilerHeapObject->optionalInfoCount, optionalInfo));
+		}
+
+		ULONGLONG size = GetHeapObjectSize(profilerHeapObject, optionalInfo);
+		size_t unnamedKind = totals->kinds.size() - 1;
+		SnapshotKindTotals *kind = &totals->kinds[profilerHeapObject->typeNameId < unnamedKind ? profilerHeapObject->typeNameId : unnamedKind];
+		SnapshotSizeBucket *sizes = &kind->sizes[GetSizeBucket(size)];
+
+		totals->objectsCount++;
+		totals->objectsSize += size;
+		kind->objectsCount++;
+		kind->objectsSize += size;
+		sizes->objectsCount++;
+		sizes->objectsSize += size;
+
+		IfComFailError(batch->Add(profilerHeapObject, optionalInfo));
+	}
+
+error:
+	if (*fetchedObjectCount > 0)
+	{
+		HRESULT freeHr = enumerator->FreeObjectAndOptionalInfo(*fetchedObjectCount, profilerHeapObjects);
+
+		if (SUCCEEDED(hr))
+		{
+			hr = freeHr;
+		}
+	}
+
+	return hr;
+}
+
+//
+// Puts together the fingerprints every filter gathered, and works out which objects in the
+// base snapshot are gone.
+//
+
+HRESULT FinishDelta(const vector<DeltaFilter *> &filters, const SnapshotFingerprints *base, SnapshotFingerprints *fingerprints, vector<ULONG_PTR> *removedObjectIds, SnapshotTotals *totals)
+{
+	vector<ObjectFingerprint> gathered;
+
+	try
+	{
+		size_t count = 0;
+
+		for (size_t index = 0; index < filters.size(); index++)
+		{
+			count += filters[index]->Fingerprints()->size();
+		}
+
+		gathered.swap(*filters[0]->Fingerprints());
+		gathered.reserve(count);
+
+		for (size_t index = 1; index < filters.size(); index++)
+		{
+			vector<ObjectFingerprint> *filterFingerprints = filters[index]->Fingerprints();
+
+			gathered.insert(gathered.end(), filterFingerprints->begin(), filterFingerprints->end());
+			vector<ObjectFingerprint>().swap(*filterFingerprints);
+		}
+	}
+	catch (...)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	IfComFailRet(fingerprints->Build(&gathered));
+
+	for (size_t index = 0; index < filters.size(); index++)
+	{
+		totals->changedObjectsCount += filters[index]->IncludedCount();
+	}
+
+	if (base != nullptr)
+	{
+		IfComFailRet(base->GetRemovedObjects(*fingerprints, removedObjectIds));
+		totals->removedObjectsCount = removedObjectIds->size();
+	}
+
+	return S_OK;
+}
+
+static bool IsLargerKind(const SnapshotKindTotals &left, const SnapshotKindTotals &right)
+{
+	return left.objectsSize > right.objectsSize;
+}
+
+//
+// Names the kinds a snapshot's objects were of, and drops the ones it had none of.
+//
+
+HRESULT FinishKindTotals(const wchar_t **nameIdMap, UINT nameCount, SnapshotTotals *totals)
+{
+	vector<SnapshotKindTotals> kinds;
+
+	try
+	{
+		for (size_t index = 0; index < totals->kinds.size(); index++)
+		{
+			if (totals->kinds[index].objectsCount > 0)
+			{
+				kinds.push_back(totals->kinds[index]);
+				kinds.back().name = GetTypeName(nameIdMap, nameCount, (ULONG) index);
+			}
+		}
+	}
+	catch (...)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	stable_sort(kinds.begin(), kinds.end(), IsLargerKind);
+	totals->kinds.swap(kinds);
+	return S_OK;
+}
+
+//
+// Writes a snapshot through a SnapshotPipeline. This thread only enumerates the heap and
+// copies what it finds, which is all the enumerator allows other threads to be spared.
+// Serializing, and whatever the stream does with the output, happen on the pipeline's
+// threads.
+//
+// Given somewhere to put the fingerprints of the objects written, the snapshot is a delta
+// from the base snapshot, or a full snapshot if there's no base.
+//
+
+HRESULT WriteSnapshot(IActiveScriptProfilerHeapEnum *enumerator, SnapshotStream *snapshotPartStream, SnapshotFormat format, bool internNames, const SnapshotFingerprints *base, SnapshotFingerprints *fingerprints, SnapshotTotals *totals)
+{
+	ULONG fetchedObjectCount = 0;
+	ULONG batchSize = snapshotBatchSize;
+	PROFILER_HEAP_OBJECT **profilerHeapObjects = nullptr;
+	OptionalInfoBuffer optionalInfoBuffer;
 	const wchar_t **nameIdMap = nullptr;
 	UINT nameCount;
-	JsonSerializer snapshotSerializer(snapshotPartStream);
+	vector<BatchSerializer *> serializers;
+	vector<DeltaFilter *> filters;
+	BinaryBatchSerializer *binarySerializer = nullptr;
+	vector<uint8_t> output;
+	vector<ULONG_PTR> removedObjectIds;
+	SnapshotPipeline pipeline(snapshotPartStream);
+	HeapObjectBatch *batch = nullptr;
 	HRESULT hr = S_OK;
 
+	profilerHeapObjects = new PROFILER_HEAP_OBJECT *[batchSize];
+	if (profilerHeapObjects == nullptr)
+	{
+		return E_OUTOFMEMORY;
+	}
+
 	IfComFailError(enumerator->GetNameIdMap(&nameIdMap, &nameCount));
-	IfComFailError(snapshotSerializer.StartProfile());
 
-	while (moreObjects)
+	try
+	{
+		unsigned threadCount = format == SnapshotFormatBinary ? 1 : GetSnapshotThreadCount();
+
+		totals->kinds.assign((size_t) nameCount + 1, SnapshotKindTotals());
+
+		for (unsigned index = 0; index < threadCount; index++)
+		{
+			DeltaFilter *filter = nullptr;
+
+			if (fingerprints != nullptr)
+			{
+				filters.push_back(new DeltaFilter(base));
+				filter = filters.back();
+			}
+
+			if (format == SnapshotFormatBinary)
+			{
+				binarySerializer = new BinaryBatchSerializer(filter);
+				serializers.push_back(binarySerializer);
+			}
+			else
+			{
+				serializers.push_back(new JsonBatchSerializer(nameIdMap, nameCount, internNames, filter));
+			}
+		}
+	}
+	catch (...)
+	{
+		hr = E_OUTOFMEMORY;
+		goto error;
+	}
+
+	if (binarySerializer != nullptr)
 	{
-		unsigned size;
-		(*objectsCount)++;
-		IfComFailError(GetNextHeapObject(enumerator, &snapshotSerializer, nameIdMap, nameCount, &moreObjects, &size));
+		IfComFailError(binarySerializer->WriteHeader(nameIdMap, nameCount, &output));
+		IfComFailError(WriteToStream(snapshotPartStream, output.data(), output.size()));
+	}
+	else
+	{
+		JsonSerializer snapshotSerializer(snapshotPartStream);
+		snapshotSerializer.SetInternNames(internNames);
+		IfComFailError(snapshotSerializer.StartProfile(nameIdMap, nameCount));
+		IfComFailError(snapshotSerializer.EndProfile());
+	}
 
-		if (moreObjects)
+	//
+	// Two batches per worker keeps every worker busy while the writer catches up.
+	//
+
+	IfComFailError(pipeline.Start(serializers, (unsigned) serializers.size() * 2 + 2));
+
+	do
+	{
+		batch = pipeline.Acquire();
+		if (batch == nullptr)
 		{
-			*objectsSize += size;
+			break;
 		}
+
+		do
+		{
+			IfComFailError(FetchHeapObjects(enumerator, batch, &optionalInfoBuffer, profilerHeapObjects, batchSize, &fetchedObjectCount, totals));
+		} while (fetchedObjectCount > 0 && batch->Count() < PipelineBatchObjectCount);
+
+		pipeline.Submit(batch);
+	} while (fetchedObjectCount > 0);
+
+	IfComFailError(pipeline.Finish());
+	IfComFailError(FinishKindTotals(nameIdMap, nameCount, totals));
+
+	if (fingerprints != nullptr)
+	{
+		IfComFailError(FinishDelta(filters, base, fingerprints, &removedObjectIds, totals));
+	}
+	else
+	{
+		totals->changedObjectsCount = totals->objectsCount;
 	}
 
-	IfComFailError(snapshotSerializer.EndProfile());
+	if (binarySerializer != nullptr)
+	{
+		output.clear();
+		IfComFailError(binarySerializer->WriteEnd(base != nullptr ? &removedObjectIds : nullptr, &output));
+		IfComFailError(WriteToStream(snapshotPartStream, output.data(), output.size()));
+	}
+	else if (base != nullptr)
+	{
+		JsonSerializer snapshotSerializer(snapshotPartStream);
+		IfComFailError(snapshotSerializer.StartRemovedObjects());
+
+		for (size_t index = 0; index < removedObjectIds.size(); index++)
+		{
+			IfComFailError(snapshotSerializer.WriteIdValue(removedObjectIds[index]));
+		}
+
+		IfComFailError(snapshotSerializer.EndRemovedObjects());
+	}
 
 error:
+	//
+	// The serializers can't go until the pipeline's threads are done with them.
+	//
+
+	pipeline.Finish();
+
+	for (size_t index = 0; index < serializers.size(); index++)
+	{
+		delete serializers[index];
+	}
+
+	for (size_t index = 0; index < filters.size(); index++)
+	{
+		delete filters[index];
+	}
+
 	if (nameIdMap != nullptr)
 	{
 		CoTaskMemFree(nameIdMap);
 		nameIdMap = nullptr;
 	}
 
+	delete [] profilerHeapObjects;
+
 	return hr;
 }
 
-HRESULT WriteSummary(IStream *summaryPartStream, std::wstring snapshotName, unsigned id, unsigned objectsCount, unsigned objectsSize)
+//
+// A delta snapshot's summary names the snapshot it's based on. Its totals are still the
+// whole heap's. The totals for each kind come largest first, each followed by the size
+// buckets that kind has objects in, smallest first.
+//
+
+HRESULT WriteSummary(SnapshotStream *summaryPartStream, std::wstring snapshotName, unsigned id, const SnapshotTotals &totals, const wchar_t *baseSnapshotName)
 {
 	JsonSerializer summarySerializer(summaryPartStream);
 
@@ -879,37 +1620,108 @@ HRESULT WriteSummary(IStream *summaryPartStream, std::wstring snapshotName, unsi
 	IfComFailRet(summarySerializer.EndJsonObject());
 	IfComFailRet(summarySerializer.EndProperty());
 
-	IfComFailRet(summarySerializer.WriteProperty(L"totalObjectSize", objectsSize));
-	IfComFailRet(summarySerializer.WriteProperty(L"objectsCount", objectsCount));
+	if (baseSnapshotName != nullptr)
+	{
+		IfComFailRet(summarySerializer.StartProperty(L"baseSnapshotFile"));
+		IfComFailRet(summarySerializer.StartJsonObjectNested());
+		IfComFailRet(summarySerializer.WriteProperty(L"relativePath", baseSnapshotName));
+		IfComFailRet(summarySerializer.EndJsonObject());
+		IfComFailRet(summarySerializer.EndProperty());
+
+		IfComFailRet(summarySerializer.WriteProperty(L"changedObjectsCount", totals.changedObjectsCount));
+		IfComFailRet(summarySerializer.WriteProperty(L"removedObjectsCount", totals.removedObjectsCount));
+	}
+
+	IfComFailRet(summarySerializer.WriteProperty(L"totalObjectSize", totals.objectsSize));
+	IfComFailRet(summarySerializer.WriteProperty(L"objectsCount", totals.objectsCount));
 
     IfComFailRet(summarySerializer.WriteProperty(L"id", id));
 
+	IfComFailRet(summarySerializer.StartProperty(L"kinds"));
+	IfComFailRet(summarySerializer.StartArray());
+
+	for (size_t index = 0; index < totals.kinds.size(); index++)
+	{
+		IfComFailRet(summarySerializer.StartJsonObjectNested());
+		IfComFailRet(summarySerializer.WriteProperty(L"kind", totals.kinds[index].name.c_str()));
+		IfComFailRet(summarySerializer.WriteProperty(L"totalObjectSize", totals.kinds[index].objectsSize));
+		IfComFailRet(summarySerializer.WriteProperty(L"objectsCount", totals.kinds[index].objectsCount));
+
+		IfComFailRet(summarySerializer.StartProperty(L"sizes"));
+		IfComFailRet(summarySerializer.StartArray());
+
+		for (size_t bucket = 0; bucket < SnapshotSizeBucketCount; bucket++)
+		{
+			const SnapshotSizeBucket &sizes = totals.kinds[index].sizes[bucket];
+
+			if (sizes.objectsCount == 0)
+			{
+				continue;
+			}
+
+			IfComFailRet(summarySerializer.StartJsonObjectNested());
+			IfComFailRet(summarySerializer.WriteProperty(L"minimumSize", GetSizeBucketMinimum(bucket)));
+			IfComFailRet(summarySerializer.WriteProperty(L"totalObjectSize", sizes.objectsSize));
+			IfComFailRet(summarySerializer.WriteProperty(L"objectsCount", sizes.objectsCount));
+			IfComFailRet(summarySerializer.EndJsonObject());
+		}
+
+		IfComFailRet(summarySerializer.EndArray());
+		IfComFailRet(summarySerializer.EndProperty());
+
+		IfComFailRet(summarySerializer.EndJsonObject());
+	}
+
+	IfComFailRet(summarySerializer.EndArray());
+	IfComFailRet(summarySerializer.EndProperty());
+
 	IfComFailRet(summarySerializer.EndJsonObject());
 	IfComFailRet(summarySerializer.EndSummary());
 
 	return S_OK;
 }
 
+//
+// Profiles are written without the OPC factory, so there's nothing to set up or tear down.
+// These are kept for existing callers.
+//
+
 extern "C" __declspec(dllexport) bool InitializeMemoryProfileWriter()
 {
-    HRESULT hr = S_OK;
-    IfComFailError(CoInitializeEx(nullptr, COINIT_APARTMENTTHREADED));
-    IfComFailError(CoCreateInstance(__uuidof(OpcFactory), NULL, CLSCTX_INPROC_SERVER, __uuidof(IOpcFactory), (LPVOID*) &factory));
-
-error:
-    return SUCCEEDED(hr);
+    return true;
 }
 
-extern "C" __declspec(dllexport) MemoryProfileHandle StartMemoryProfile()
+//
+// Starts a profile written in the given format. When fileName isn't null, the profile
+// goes straight to that file and the name passed to EndMemoryProfile may be null.
+//
+
+extern "C" __declspec(dllexport) MemoryProfileHandle StartMemoryProfileEx(unsigned format, const wchar_t *fileName)
 {
     HRESULT hr = S_OK;
     MemoryProfile *memoryProfile = nullptr;
 
+    if (format != SnapshotFormatJson && format != SnapshotFormatBinary)
+    {
+        return nullptr;
+    }
+
     try
     {
         memoryProfile = new MemoryProfile();
-        IfComFailError(factory->CreatePackage(&memoryProfile->package));
-        IfComFailError(memoryProfile->package->GetPartSet(&memoryProfile->partSet));
+        memoryProfile->format = (SnapshotFormat) format;
+
+        if (fileName == nullptr)
+        {
+            IfComFailError(CreateTemporaryFile(&memoryProfile->fileName));
+            memoryProfile->temporary = true;
+        }
+        else
+        {
+            memoryProfile->fileName = fileName;
+        }
+
+        IfComFailError(memoryProfile->package.Create(memoryProfile->fileName.c_str()));
         return (MemoryProfileHandle) memoryProfile;
     }
     catch (...)
@@ -919,9 +1731,9 @@ extern "C" __declspec(dllexport) MemoryProfileHandle StartMemoryProfile()
 error:
     if (memoryProfile)
     {
-        if (memoryProfile->package)
+        if (memoryProfile->temporary)
         {
-            memoryProfile->package->Release();
+            DeleteFileW(memoryProfile->fileName.c_str());
         }
 
         delete memoryProfile;
@@ -930,111 +1742,295 @@ error:
     return nullptr;
 }
 
+extern "C" __declspec(dllexport) MemoryProfileHandle StartMemoryProfile()
+{
+    return StartMemoryProfileEx(SnapshotFormatJson, nullptr);
+}
+
 extern "C" __declspec(dllexport) bool WriteSnapshot(MemoryProfileHandle memoryProfileHandle, IActiveScriptProfilerHeapEnum *enumerator)
 {
     HRESULT hr = S_OK;
     MemoryProfile *memoryProfile = (MemoryProfile *) memoryProfileHandle;
+    ZipWriter *package = &memoryProfile->package;
 
-    IOpcPartUri *summaryPartUri = nullptr;
-    IOpcPart *summaryPart = nullptr;
-    IStream *summaryPartStream = nullptr;
+    bool binary = memoryProfile->format == SnapshotFormatBinary;
+    const wchar_t *snapshotContentType = binary ? L"application/octet-stream" : L"application/json";
+    std::wstring snapshotName = L"snapshot" + to_wstring(++(memoryProfile->snapshotCount)) + (binary ? L".snapbin" : L".snapjs");
 
-    IOpcPartUri *snapshotPartUri = nullptr;
-    IOpcPart *snapshotPart = nullptr;
-    IStream *snapshotPartStream = nullptr;
+    SnapshotTotals totals;
+    SnapshotFingerprints fingerprints;
+    const SnapshotFingerprints *base = nullptr;
 
-    std::wstring snapshotName = L"snapshot" + to_wstring(++(memoryProfile->snapshotCount)) + L".snapjs";
+    if (memoryProfile->incremental && !memoryProfile->baseSnapshotName.empty())
+    {
+        base = &memoryProfile->fingerprints;
+    }
 
-    IfComFailError(factory->CreatePartUri((snapshotName + L".snapshotsummary").c_str(), &summaryPartUri));
-    IfComFailError(memoryProfile->partSet->CreatePart(summaryPartUri, L"application/json", OPC_COMPRESSION_NORMAL, &summaryPart));
-    IfComFailError(summaryPart->GetContentStream(&summaryPartStream));
+    IfComFailError(package->StartPart(snapshotName.c_str(), snapshotContentType));
 
-    IfComFailError(factory->CreatePartUri(snapshotName.c_str(), &snapshotPartUri));
-    IfComFailError(memoryProfile->partSet->CreatePart(snapshotPartUri, L"application/json", OPC_COMPRESSION_NORMAL, &snapshotPart));
-    IfComFailError(snapshotPart->GetContentStream(&snapshotPartStream));
+    IfComFailError(WriteSnapshot(enumerator, package, memoryProfile->format, memoryProfile->internNames, base, memoryProfile->incremental ? &fingerprints : nullptr, &totals));
+    IfComFailError(package->EndPart());
 
-    unsigned objectsCount = 0;
-    unsigned objectsSize = 0;
-    IfComFailError(WriteSnapshot(enumerator, snapshotPartStream, &objectsCount, &objectsSize))
+    //
+    // The summary needs the snapshot's totals, so it's written after the snapshot.
+    //
 
-    IfComFailError(WriteSummary(summaryPartStream, snapshotName.c_str(), memoryProfile->snapshotCount, objectsCount, objectsSize));
+    IfComFailError(package->StartPart((snapshotName + L".snapshotsummary").c_str(), L"application/json"));
+    IfComFailError(WriteSummary(package, snapshotName.c_str(), memoryProfile->snapshotCount, totals, base != nullptr ? memoryProfile->baseSnapshotName.c_str() : nullptr));
+    IfComFailError(package->EndPart());
 
-    summaryPartStream->Release();
-    summaryPartStream = nullptr;
+    //
+    // Only a snapshot that made it into the profile can be the next one's base.
+    //
 
-    snapshotPartStream->Release();
-    snapshotPartStream = nullptr;
+    if (memoryProfile->incremental)
+    {
+        memoryProfile->fingerprints.Swap(&fingerprints);
+        memoryProfile->baseSnapshotName = snapshotName;
+    }
 
 error:
-    if (snapshotPartStream)
+    if (FAILED(hr))
     {
-        snapshotPartStream->Release();
+        package->AbandonPart();
     }
 
-    if (snapshotPart)
+    return SUCCEEDED(hr);
+}
+
+extern "C" __declspec(dllexport) bool EndMemoryProfile(MemoryProfileHandle memoryProfileHandle, const wchar_t *filename)
+{
+    HRESULT hr = S_OK;
+
+    MemoryProfile *memoryProfile = (MemoryProfile *) memoryProfileHandle;
+
+    IfComFailError(memoryProfile->package.Close());
+
+    if (filename != nullptr && memoryProfile->fileName != filename)
     {
-        snapshotPart->Release();
-    }
+        if (!MoveFileExW(memoryProfile->fileName.c_str(), filename, MOVEFILE_REPLACE_EXISTING | MOVEFILE_COPY_ALLOWED))
+        {
+            hr = HRESULT_FROM_WIN32(GetLastError());
+            goto error;
+        }
 
-    if (snapshotPartUri)
+        memoryProfile->temporary = false;
+    }
+    else if (memoryProfile->temporary)
     {
-        snapshotPartUri->Release();
+        hr = E_INVALIDARG;
     }
 
-    if (summaryPartStream)
+error:
+    if (memoryProfile->temporary)
     {
-        summaryPartStream->Release();
+        DeleteFileW(memoryProfile->fileName.c_str());
     }
 
-    if (summaryPart)
+    delete memoryProfile;
+
+    return SUCCEEDED(hr);
+}
+
+//
+// Converts a binary snapshot part, extracted from a profile, to the JSON a .snapjs part
+// holds, for tools that only read JSON. The output matches what writing the snapshot as
+// JSON in the first place would have produced, except for its timestamp.
+//
+
+extern "C" __declspec(dllexport) bool ConvertSnapshotToJson(const wchar_t *snapshotFileName, const wchar_t *jsonFileName)
+{
+    HRESULT hr = S_OK;
+    MappedFile snapshot;
+    BinarySnapshotReader *reader = nullptr;
+    FileStream jsonStream;
+    SnapshotTotals totals;
+
+    IfComFailError(snapshot.Open(snapshotFileName));
+
+    try
     {
-        summaryPart->Release();
+        reader = new BinarySnapshotReader(snapshot.Data(), snapshot.Size());
+        IfComFailError(reader->Open());
+        IfComFailError(jsonStream.Create(jsonFileName));
+        IfComFailError(WriteSnapshot(reader, &jsonStream, SnapshotFormatJson, false, nullptr, nullptr, &totals));
+        IfComFailError(jsonStream.Close());
+    }
+    catch (...)
+    {
+        hr = E_OUTOFMEMORY;
     }
 
-    if (summaryPartUri)
+error:
+    if (reader)
     {
-        summaryPartUri->Release();
+        reader->Release();
     }
 
     return SUCCEEDED(hr);
 }
 
-extern "C" __declspec(dllexport) bool EndMemoryProfile(MemoryProfileHandle memoryProfileHandle, const wchar_t *filename)
+//
+// Rebuilds the full snapshot a delta snapshot describes, and writes it as JSON. The delta
+// and the snapshots before it are parts extracted from a profile, given oldest first, and
+// all in the same format. Snapshots older than the newest full snapshot aren't needed, and
+// are ignored if given. Objects come out newest first rather than in the order the heap
+// was enumerated in.
+//
+
+extern "C" __declspec(dllexport) bool ReconstructSnapshot(const wchar_t **snapshotFileNames, unsigned snapshotCount, const wchar_t *jsonFileName)
 {
     HRESULT hr = S_OK;
-    IStream *packageStream = nullptr;
+    MappedFile *snapshots = nullptr;
+    vector<const MappedFile *> newestFirst;
+    DeltaSnapshotReader *reader = nullptr;
+    FileStream jsonStream;
+    SnapshotTotals totals;
+    bool binary = false;
+
+    if (snapshotCount == 0)
+    {
+        return false;
+    }
 
-    MemoryProfile *memoryProfile = (MemoryProfile *) memoryProfileHandle;
+    try
+    {
+        snapshots = new MappedFile[snapshotCount];
 
-    IfComFailError(factory->CreateStreamOnFile(filename, OPC_STREAM_IO_WRITE, nullptr, 0, &packageStream));
-    IfComFailError(factory->WritePackageToStream(memoryProfile->package, OPC_WRITE_DEFAULT, packageStream));
+        for (unsigned index = snapshotCount; index-- > 0;)
+        {
+            UINT32 magic = 0;
+
+            IfComFailError(snapshots[index].Open(snapshotFileNames[index]));
+
+            if (snapshots[index].Size() >= sizeof(magic))
+            {
+                memcpy(&magic, snapshots[index].Data(), sizeof(magic));
+            }
+
+            if (index == snapshotCount - 1)
+            {
+                binary = magic == BinarySnapshotMagic;
+            }
+            else if (binary != (magic == BinarySnapshotMagic))
+            {
+                hr = E_INVALIDARG;
+                goto error;
+            }
+
+            newestFirst.push_back(&snapshots[index]);
+        }
+
+        IfComFailError(jsonStream.Create(jsonFileName));
+
+        if (binary)
+        {
+            reader = new DeltaSnapshotReader();
+
+            for (size_t index = 0; index < newestFirst.size(); index++)
+            {
+                BinarySnapshotReader *snapshotReader = new BinarySnapshotReader(newestFirst[index]->Data(), newestFirst[index]->Size());
+
+                hr = snapshotReader->Open();
+                if (SUCCEEDED(hr))
+                {
+                    hr = reader->Add(snapshotReader);
+                }
+
+                snapshotReader->Release();
+                IfComFailError(hr);
+            }
+
+            IfComFailError(WriteSnapshot(reader, &jsonStream, SnapshotFormatJson, false, nullptr, nullptr, &totals));
+        }
+        else
+        {
+            IfComFailError(MergeJsonSnapshots(newestFirst, &jsonStream));
+        }
+
+        IfComFailError(jsonStream.Close());
+    }
+    catch (...)
+    {
+        hr = E_OUTOFMEMORY;
+    }
 
 error:
-    if (packageStream)
+    if (reader)
     {
-        packageStream->Release();
+        reader->Release();
     }
 
-    if (memoryProfile->partSet)
+    delete [] snapshots;
+
+    return SUCCEEDED(hr);
+}
+
+extern "C" __declspec(dllexport) void SetSnapshotBatchSize(unsigned batchSize)
+{
+    if (batchSize == 0)
+    {
+        batchSize = DefaultSnapshotBatchSize;
+    }
+    else if (batchSize > MaximumSnapshotBatchSize)
     {
-        memoryProfile->partSet->Release();
+        batchSize = MaximumSnapshotBatchSize;
     }
 
-    if (memoryProfile->package)
+    snapshotBatchSize = batchSize;
+}
+
+//
+// Sets how many threads serialize snapshot JSON, with zero going back to the default.
+// Binary snapshots are always serialized by a single thread.
+//
+
+extern "C" __declspec(dllexport) void SetSnapshotThreadCount(unsigned threadCount)
+{
+    if (threadCount > MaximumSnapshotThreadCount)
     {
-        memoryProfile->package->Release();
+        threadCount = MaximumSnapshotThreadCount;
     }
 
-    delete memoryProfile;
+    snapshotThreadCount = threadCount;
+}
 
-    return SUCCEEDED(hr);
+//
+// Makes each snapshot after the next a delta from the one before it. Turning it off makes
+// snapshots full again.
+//
+
+extern "C" __declspec(dllexport) void SetIncrementalSnapshots(MemoryProfileHandle memoryProfileHandle, bool incremental)
+{
+    MemoryProfile *memoryProfile = (MemoryProfile *) memoryProfileHandle;
+
+    memoryProfile->incremental = incremental;
+
+    if (!incremental)
+    {
+        memoryProfile->fingerprints.Clear();
+        memoryProfile->baseSnapshotName.clear();
+    }
 }
 
-extern "C" __declspec(dllexport) void ReleaseMemoryProfileWriter()
+//
+// Makes JSON snapshots list their names once, in their first line, and refer to them by
+// index. Binary snapshots always do. A change takes effect with the next full snapshot,
+// so an incremental profile starts a new one.
+//
+
+extern "C" __declspec(dllexport) void SetInternedNames(MemoryProfileHandle memoryProfileHandle, bool internNames)
 {
-    if (factory)
+    MemoryProfile *memoryProfile = (MemoryProfile *) memoryProfileHandle;
+
+    if (memoryProfile->internNames != internNames)
     {
-        factory->Release();
-        factory = nullptr;
+        memoryProfile->internNames = internNames;
+        memoryProfile->fingerprints.Clear();
+        memoryProfile->baseSnapshotName.clear();
     }
 }
+
+extern "C" __declspec(dllexport) void ReleaseMemoryProfileWriter()
+{
+}
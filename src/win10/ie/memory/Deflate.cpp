@@ -0,0 +1,671 @@
+#include <string.h>
+#include <algorithm>
+#include "Deflate.h"
+#include "DeflateFormat.h"
+
+using namespace std;
+
+Deflater::Deflater(void)
+{
+	for (unsigned code = 0; code < LengthCodes; code++)
+	{
+		unsigned end = code + 1 < LengthCodes ? lengthBase[code + 1] : MaximumMatch + 1;
+
+		for (unsigned length = lengthBase[code]; length < end; length++)
+		{
+			m_lengthCodes[length] = (uint8_t) code;
+		}
+	}
+
+	for (unsigned code = 0; code < DistanceCodes; code++)
+	{
+		unsigned end = distanceBase[code] + (1 << distanceExtraBits[code]);
+
+		for (unsigned distance = distanceBase[code]; distance < end; distance++)
+		{
+			unsigned index = distance - 1;
+			m_distanceCodes[index < 256 ? index : 256 + (index >> 7)] = (uint8_t) code;
+		}
+	}
+
+	Reset();
+}
+
+void Deflater::Reset(void)
+{
+	m_windowEnd = 0;
+	m_position = 0;
+	m_blockStart = 0;
+	m_symbolCount = 0;
+	m_bits = 0;
+	m_bitCount = 0;
+	memset(m_head, 0, sizeof(m_head));
+	memset(m_previous, 0, sizeof(m_previous));
+	m_output.clear();
+}
+
+void Deflater::Write(const uint8_t *bytes, size_t length)
+{
+	while (length > 0)
+	{
+		if (m_windowEnd == sizeof(m_window))
+		{
+			Slide();
+		}
+
+		size_t count = sizeof(m_window) - m_windowEnd;
+
+		if (count > length)
+		{
+			count = length;
+		}
+
+		memcpy(m_window + m_windowEnd, bytes, count);
+		m_windowEnd += (unsigned) count;
+		bytes += count;
+		length -= count;
+
+		Compress(false);
+	}
+}
+
+void Deflater::Finish(void)
+{
+	Compress(true);
+	WriteBlock(true);
+	AlignToByte();
+}
+
+unsigned Deflater::Hash(const uint8_t *bytes)
+{
+	return ((bytes[0] << 10) ^ (bytes[1] << 5) ^ bytes[2]) & (HashSize - 1);
+}
+
+unsigned Deflater::GetDistanceCode(unsigned distance) const
+{
+	unsigned index = distance - 1;
+	return m_distanceCodes[index < 256 ? index : 256 + (index >> 7)];
+}
+
+//
+// Adds a position to the hash chains. Position zero can't be told apart from the end of a
+// chain, so it's never matched against, which costs next to nothing.
+//
+
+void Deflater::Insert(unsigned position)
+{
+	unsigned hash = Hash(m_window + position);
+	m_previous[position & WindowMask] = m_head[hash];
+	m_head[hash] = (uint16_t) position;
+}
+
+unsigned Deflater::FindMatch(unsigned available, unsigned *distance)
+{
+	const uint8_t *current = m_window + m_position;
+	unsigned maximumLength = available < MaximumMatch ? available : MaximumMatch;
+	unsigned bestLength = MinimumMatch - 1;
+	unsigned candidate = m_previous[m_position & WindowMask];
+
+	for (unsigned chain = 0; candidate > 0 && chain < MaximumChain; chain++)
+	{
+		unsigned candidateDistance = m_position - candidate;
+
+		if (candidateDistance > MaximumDistance)
+		{
+			break;
+		}
+
+		const uint8_t *match = m_window + candidate;
+
+		if (match[bestLength] == current[bestLength] && match[0] == current[0] && match[1] == current[1])
+		{
+			unsigned length = 2;
+
+			while (length < maximumLength && match[length] == current[length])
+			{
+				length++;
+			}
+
+			if (length > bestLength)
+			{
+				bestLength = length;
+				*distance = candidateDistance;
+
+				if (length >= maximumLength || length >= GoodMatch)
+				{
+					break;
+				}
+			}
+		}
+
+		candidate = m_previous[candidate & WindowMask];
+	}
+
+	return bestLength >= MinimumMatch ? bestLength : 0;
+}
+
+//
+// Turns the input in the window into literals and matches. Unless the input is being
+// flushed, it stops short of the end of the window so there's always room to look for the
+// longest match.
+//
+
+void Deflater::Compress(bool flush)
+{
+	for (;;)
+	{
+		unsigned available = m_windowEnd - m_position;
+
+		if (available == 0 || (available < Lookahead && !flush))
+		{
+			break;
+		}
+
+		unsigned length = 0;
+		unsigned distance = 0;
+
+		if (available >= MinimumMatch)
+		{
+			Insert(m_position);
+			length = FindMatch(available, &distance);
+		}
+
+		if (length > 0)
+		{
+			m_literalLengths[m_symbolCount] = (uint16_t) length;
+			m_distances[m_symbolCount] = (uint16_t) distance;
+
+			for (unsigned index = 1; index < length && m_position + index + MinimumMatch <= m_windowEnd; index++)
+			{
+				Insert(m_position + index);
+			}
+
+			m_position += length;
+		}
+		else
+		{
+			m_literalLengths[m_symbolCount] = m_window[m_position];
+			m_distances[m_symbolCount] = 0;
+			m_position++;
+		}
+
+		if (++m_symbolCount == BlockSymbols)
+		{
+			WriteBlock(false);
+		}
+	}
+}
+
+//
+// Drops the older half of a full window. The current block is written first, since a
+// block written without compression needs all of its input still in the window.
+//
+
+void Deflater::Slide(void)
+{
+	if (m_position > m_blockStart)
+	{
+		WriteBlock(false);
+	}
+
+	memmove(m_window, m_window + WindowSize, WindowSize);
+	m_windowEnd -= WindowSize;
+	m_position -= WindowSize;
+	m_blockStart -= WindowSize;
+
+	for (unsigned index = 0; index < HashSize; index++)
+	{
+		m_head[index] = (uint16_t) (m_head[index] >= WindowSize ? m_head[index] - WindowSize : 0);
+	}
+
+	for (unsigned index = 0; index < WindowSize; index++)
+	{
+		m_previous[index] = (uint16_t) (m_previous[index] >= WindowSize ? m_previous[index] - WindowSize : 0);
+	}
+}
+
+void Deflater::PutBits(uint32_t value, unsigned count)
+{
+	m_bits |= (uint64_t) value << m_bitCount;
+	m_bitCount += count;
+
+	while (m_bitCount >= 8)
+	{
+		m_output.push_back((uint8_t) m_bits);
+		m_bits >>= 8;
+		m_bitCount -= 8;
+	}
+}
+
+void Deflater::AlignToByte(void)
+{
+	if (m_bitCount > 0)
+	{
+		PutBits(0, 8 - m_bitCount);
+	}
+}
+
+//
+// Builds Huffman code lengths for the given symbol frequencies, no longer than
+// maximumLength bits. Codes that come out too long are shortened to the limit, and then
+// codes are lengthened, starting with the longest codes under the limit, until the code is
+// complete again.
+//
+
+void Deflater::BuildLengths(const unsigned *frequencies, unsigned count, unsigned maximumLength, uint8_t *lengths)
+{
+	unsigned symbols[LiteralLengthCodes];
+	unsigned weights[2 * LiteralLengthCodes];
+	unsigned parents[2 * LiteralLengthCodes];
+	unsigned lengthCounts[MaximumCodeLength + 2] = { 0 };
+	unsigned used = 0;
+
+	memset(lengths, 0, count);
+
+	for (unsigned symbol = 0; symbol < count; symbol++)
+	{
+		if (frequencies[symbol] > 0)
+		{
+			symbols[used++] = symbol;
+		}
+	}
+
+	//
+	// A code needs at least two symbols to be complete, so pad it out with unused ones.
+	//
+
+	if (used < 2)
+	{
+		lengths[0] = 1;
+		lengths[1] = 1;
+
+		if (used == 1 && symbols[0] > 1)
+		{
+			lengths[1] = 0;
+			lengths[symbols[0]] = 1;
+		}
+
+		return;
+	}
+
+	sort(symbols, symbols + used, [frequencies](unsigned left, unsigned right)
+	{
+		return frequencies[left] < frequencies[right] || (frequencies[left] == frequencies[right] && left < right);
+	});
+
+	//
+	// Leaves are in order of weight, and the nodes joining them are made in order of weight,
+	// so the two lightest are always at the front of one list or the other.
+	//
+
+	for (unsigned index = 0; index < used; index++)
+	{
+		weights[index] = frequencies[symbols[index]];
+	}
+
+	unsigned nextLeaf = 0;
+	unsigned nextNode = used;
+
+	for (unsigned node = used; node < 2 * used - 1; node++)
+	{
+		unsigned children[2];
+
+		for (unsigned child = 0; child < 2; child++)
+		{
+			if (nextLeaf < used && (nextNode >= node || weights[nextLeaf] <= weights[nextNode]))
+			{
+				children[child] = nextLeaf++;
+			}
+			else
+			{
+				children[child] = nextNode++;
+			}
+		}
+
+		weights[node] = weights[children[0]] + weights[children[1]];
+		parents[children[0]] = node;
+		parents[children[1]] = node;
+	}
+
+	unsigned *depths = weights;
+	depths[2 * used - 2] = 0;
+
+	for (unsigned index = 2 * used - 2; index-- > 0;)
+	{
+		depths[index] = depths[parents[index]] + 1;
+	}
+
+	for (unsigned index = 0; index < used; index++)
+	{
+		lengthCounts[depths[index] < maximumLength ? depths[index] : maximumLength]++;
+	}
+
+	unsigned total = 0;
+
+	for (unsigned length = 1; length <= maximumLength; length++)
+	{
+		total += lengthCounts[length] << (maximumLength - length);
+	}
+
+	while (total != 1u << maximumLength)
+	{
+		lengthCounts[maximumLength]--;
+
+		for (unsigned length = maximumLength - 1; length > 0; length--)
+		{
+			if (lengthCounts[length] > 0)
+			{
+				lengthCounts[length]--;
+				lengthCounts[length + 1] += 2;
+				break;
+			}
+		}
+
+		total--;
+	}
+
+	//
+	// The rarest symbols get the longest codes.
+	//
+
+	unsigned index = 0;
+
+	for (unsigned length = maximumLength; length > 0; length--)
+	{
+		for (unsigned symbolCount = 0; symbolCount < lengthCounts[length]; symbolCount++)
+		{
+			lengths[symbols[index++]] = (uint8_t) length;
+		}
+	}
+}
+
+//
+// Assigns canonical codes for the given lengths, bit reversed since deflate writes Huffman
+// codes starting from their most significant bit.
+//
+
+void Deflater::BuildCodes(const uint8_t *lengths, unsigned count, uint16_t *codes)
+{
+	unsigned lengthCounts[MaximumCodeLength + 1] = { 0 };
+	unsigned nextCodes[MaximumCodeLength + 1];
+	unsigned code = 0;
+
+	for (unsigned symbol = 0; symbol < count; symbol++)
+	{
+		lengthCounts[lengths[symbol]]++;
+	}
+
+	lengthCounts[0] = 0;
+
+	for (unsigned length = 1; length <= MaximumCodeLength; length++)
+	{
+		code = (code + lengthCounts[length - 1]) << 1;
+		nextCodes[length] = code;
+	}
+
+	for (unsigned symbol = 0; symbol < count; symbol++)
+	{
+		unsigned length = lengths[symbol];
+		unsigned value = length > 0 ? nextCodes[length]++ : 0;
+		unsigned reversed = 0;
+
+		for (unsigned bit = 0; bit < length; bit++)
+		{
+			reversed = (reversed << 1) | ((value >> bit) & 1);
+		}
+
+		codes[symbol] = (uint16_t) reversed;
+	}
+}
+
+void Deflater::WriteSymbols(const uint8_t *literalLengths, const uint16_t *literalCodes, const uint8_t *distanceLengths, const uint16_t *distanceCodes)
+{
+	for (unsigned index = 0; index < m_symbolCount; index++)
+	{
+		unsigned literalLength = m_literalLengths[index];
+		unsigned distance = m_distances[index];
+
+		if (distance == 0)
+		{
+			PutBits(literalCodes[literalLength], literalLengths[literalLength]);
+			continue;
+		}
+
+		unsigned lengthCode = m_lengthCodes[literalLength];
+		unsigned symbol = EndOfBlock + 1 + lengthCode;
+		PutBits(literalCodes[symbol], literalLengths[symbol]);
+		PutBits(literalLength - lengthBase[lengthCode], lengthExtraBits[lengthCode]);
+
+		unsigned distanceCode = GetDistanceCode(distance);
+		PutBits(distanceCodes[distanceCode], distanceLengths[distanceCode]);
+		PutBits(distance - distanceBase[distanceCode], distanceExtraBits[distanceCode]);
+	}
+
+	PutBits(literalCodes[EndOfBlock], literalLengths[EndOfBlock]);
+}
+
+void Deflater::WriteStoredBlock(bool final)
+{
+	const uint8_t *data = m_window + m_blockStart;
+	unsigned remaining = m_position - m_blockStart;
+
+	do
+	{
+		unsigned length = remaining > 0xFFFF ? 0xFFFF : remaining;
+		remaining -= length;
+
+		PutBits(final && remaining == 0 ? 1 : 0, 1);
+		PutBits(0, 2);
+		AlignToByte();
+		PutBits(length, 16);
+		PutBits(~length & 0xFFFF, 16);
+
+		m_output.insert(m_output.end(), data, data + length);
+		data += length;
+	} while (remaining > 0);
+}
+
+//
+// Writes the symbols collected so far as a block, with dynamic codes, fixed codes or no
+// compression, whichever is smallest.
+//
+
+void Deflater::WriteBlock(bool final)
+{
+	unsigned literalFrequencies[LiteralLengthCodes] = { 0 };
+	unsigned distanceFrequencies[DistanceCodes] = { 0 };
+	uint8_t literalLengths[FixedLiteralLengthCodes];
+	uint8_t distanceLengths[DistanceCodes];
+	uint16_t literalCodes[FixedLiteralLengthCodes];
+	uint16_t distanceCodes[DistanceCodes];
+
+	for (unsigned index = 0; index < m_symbolCount; index++)
+	{
+		if (m_distances[index] == 0)
+		{
+			literalFrequencies[m_literalLengths[index]]++;
+		}
+		else
+		{
+			literalFrequencies[EndOfBlock + 1 + m_lengthCodes[m_literalLengths[index]]]++;
+			distanceFrequencies[GetDistanceCode(m_distances[index])]++;
+		}
+	}
+
+	literalFrequencies[EndOfBlock] = 1;
+
+	BuildLengths(literalFrequencies, LiteralLengthCodes, MaximumCodeLength, literalLengths);
+	BuildLengths(distanceFrequencies, DistanceCodes, MaximumCodeLength, distanceLengths);
+
+	unsigned literalCount = LiteralLengthCodes;
+	unsigned distanceCount = DistanceCodes;
+
+	while (literalCount > EndOfBlock + 1 && literalLengths[literalCount - 1] == 0)
+	{
+		literalCount--;
+	}
+
+	while (distanceCount > 1 && distanceLengths[distanceCount - 1] == 0)
+	{
+		distanceCount--;
+	}
+
+	//
+	// The code lengths of both codes are written as one run-length encoded sequence.
+	//
+
+	uint8_t lengths[LiteralLengthCodes + DistanceCodes];
+	uint8_t runSymbols[LiteralLengthCodes + DistanceCodes];
+	uint8_t runExtras[LiteralLengthCodes + DistanceCodes];
+	unsigned runCount = 0;
+	unsigned lengthCount = literalCount + distanceCount;
+	unsigned codeLengthFrequencies[CodeLengthCodes] = { 0 };
+
+	memcpy(lengths, literalLengths, literalCount);
+	memcpy(lengths + literalCount, distanceLengths, distanceCount);
+
+	for (unsigned index = 0; index < lengthCount;)
+	{
+		uint8_t length = lengths[index];
+		unsigned run = 1;
+
+		while (index + run < lengthCount && lengths[index + run] == length)
+		{
+			run++;
+		}
+
+		index += run;
+
+		if (length == 0)
+		{
+			while (run >= 11)
+			{
+				unsigned repeat = run < 138 ? run : 138;
+				runSymbols[runCount] = RepeatZeroLong;
+				runExtras[runCount++] = (uint8_t) (repeat - 11);
+				run -= repeat;
+			}
+
+			if (run >= 3)
+			{
+				runSymbols[runCount] = RepeatZero;
+				runExtras[runCount++] = (uint8_t) (run - 3);
+				run = 0;
+			}
+		}
+		else
+		{
+			runSymbols[runCount] = length;
+			runExtras[runCount++] = 0;
+			run--;
+
+			while (run >= 3)
+			{
+				unsigned repeat = run < 6 ? run : 6;
+				runSymbols[runCount] = RepeatPrevious;
+				runExtras[runCount++] = (uint8_t) (repeat - 3);
+				run -= repeat;
+			}
+		}
+
+		for (; run > 0; run--)
+		{
+			runSymbols[runCount] = length;
+			runExtras[runCount++] = 0;
+		}
+	}
+
+	for (unsigned index = 0; index < runCount; index++)
+	{
+		codeLengthFrequencies[runSymbols[index]]++;
+	}
+
+	uint8_t codeLengthLengths[CodeLengthCodes];
+	uint16_t codeLengthCodes[CodeLengthCodes];
+	unsigned codeLengthCount = CodeLengthCodes;
+
+	BuildLengths(codeLengthFrequencies, CodeLengthCodes, MaximumCodeLengthCodeLength, codeLengthLengths);
+
+	while (codeLengthCount > 4 && codeLengthLengths[codeLengthOrder[codeLengthCount - 1]] == 0)
+	{
+		codeLengthCount--;
+	}
+
+	//
+	// Work out what each kind of block would cost.
+	//
+
+	uint64_t dynamicBits = 3 + 5 + 5 + 4 + 3 * codeLengthCount;
+	uint64_t fixedBits = 3;
+
+	for (unsigned index = 0; index < runCount; index++)
+	{
+		dynamicBits += codeLengthLengths[runSymbols[index]] + GetCodeLengthExtraBits(runSymbols[index]);
+	}
+
+	for (unsigned code = 0; code < LiteralLengthCodes; code++)
+	{
+		uint64_t extraBits = code > EndOfBlock ? lengthExtraBits[code - EndOfBlock - 1] : 0;
+		dynamicBits += (uint64_t) literalFrequencies[code] * (literalLengths[code] + extraBits);
+		fixedBits += (uint64_t) literalFrequencies[code] * (GetFixedLiteralLength(code) + extraBits);
+	}
+
+	for (unsigned code = 0; code < DistanceCodes; code++)
+	{
+		dynamicBits += (uint64_t) distanceFrequencies[code] * (distanceLengths[code] + distanceExtraBits[code]);
+		fixedBits += (uint64_t) distanceFrequencies[code] * (5 + distanceExtraBits[code]);
+	}
+
+	uint64_t storedLength = m_position - m_blockStart;
+	uint64_t storedBlocks = storedLength == 0 ? 1 : (storedLength + 0xFFFE) / 0xFFFF;
+	uint64_t storedBits = (storedLength + 4 * storedBlocks) * 8 + 10 * storedBlocks;
+
+	if (storedBits < dynamicBits && storedBits < fixedBits)
+	{
+		WriteStoredBlock(final);
+	}
+	else if (fixedBits <= dynamicBits)
+	{
+		for (unsigned code = 0; code < FixedLiteralLengthCodes; code++)
+		{
+			literalLengths[code] = (uint8_t) GetFixedLiteralLength(code);
+		}
+
+		memset(distanceLengths, 5, sizeof(distanceLengths));
+		BuildCodes(literalLengths, FixedLiteralLengthCodes, literalCodes);
+		BuildCodes(distanceLengths, DistanceCodes, distanceCodes);
+
+		PutBits(final ? 1 : 0, 1);
+		PutBits(1, 2);
+		WriteSymbols(literalLengths, literalCodes, distanceLengths, distanceCodes);
+	}
+	else
+	{
+		BuildCodes(literalLengths, LiteralLengthCodes, literalCodes);
+		BuildCodes(distanceLengths, DistanceCodes, distanceCodes);
+		BuildCodes(codeLengthLengths, CodeLengthCodes, codeLengthCodes);
+
+		PutBits(final ? 1 : 0, 1);
+		PutBits(2, 2);
+		PutBits(literalCount - EndOfBlock - 1, 5);
+		PutBits(distanceCount - 1, 5);
+		PutBits(codeLengthCount - 4, 4);
+
+		for (unsigned index = 0; index < codeLengthCount; index++)
+		{
+			PutBits(codeLengthLengths[codeLengthOrder[index]], 3);
+		}
+
+		for (unsigned index = 0; index < runCount; index++)
+		{
+			unsigned symbol = runSymbols[index];
+			PutBits(codeLengthCodes[symbol], codeLengthLengths[symbol]);
+			PutBits(runExtras[index], GetCodeLengthExtraBits(symbol));
+		}
+
+		WriteSymbols(literalLengths, literalCodes, distanceLengths, distanceCodes);
+	}
+
+	m_symbolCount = 0;
+	m_blockStart = m_position;
+}
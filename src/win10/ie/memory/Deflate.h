@@ -0,0 +1,104 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+//
+// A streaming raw deflate (RFC 1951) compressor: LZ77 matching over a 32K window with hash
+// chains, and each block written with whichever of dynamic Huffman codes, the fixed codes
+// or no compression comes out smallest. Compression is a little below zlib's default
+// level, in exchange for bounded chain searches.
+//
+// Input is fed in with Write and ended with Finish. Compressed bytes collect in Output
+// until the caller takes them with ClearOutput.
+//
+// The compressor needs nothing from Windows and builds without the precompiled header, so
+// the host compiles this same source for its pprof profiles.
+//
+
+class Deflater sealed
+{
+private:
+	static const unsigned WindowSize = 32768;
+	static const unsigned WindowMask = WindowSize - 1;
+	static const unsigned MinimumMatch = 3;
+	static const unsigned MaximumMatch = 258;
+
+	//
+	// Matching needs this much input after the current position, so that the longest match
+	// can be found without running off the end of the window.
+	//
+
+	static const unsigned Lookahead = MaximumMatch + MinimumMatch + 1;
+	static const unsigned MaximumDistance = WindowSize - Lookahead;
+
+	static const unsigned HashBits = 15;
+	static const unsigned HashSize = 1 << HashBits;
+	static const unsigned MaximumChain = 32;
+	static const unsigned GoodMatch = 64;
+
+	static const unsigned BlockSymbols = 16 * 1024;
+	static const unsigned LiteralLengthCodes = 286;
+
+	//
+	// The fixed code covers two literal/length codes that are never used, and they take part
+	// in assigning it.
+	//
+
+	static const unsigned FixedLiteralLengthCodes = 288;
+	static const unsigned DistanceCodes = 30;
+	static const unsigned CodeLengthCodes = 19;
+	static const unsigned MaximumCodeLength = 15;
+	static const unsigned MaximumCodeLengthCodeLength = 7;
+	static const unsigned EndOfBlock = 256;
+
+	uint8_t m_window[2 * WindowSize];
+	unsigned m_windowEnd;
+	unsigned m_position;
+	unsigned m_blockStart;
+	uint16_t m_head[HashSize];
+	uint16_t m_previous[WindowSize];
+
+	//
+	// The current block, as literals (distance zero) and matches.
+	//
+
+	uint16_t m_literalLengths[BlockSymbols];
+	uint16_t m_distances[BlockSymbols];
+	unsigned m_symbolCount;
+
+	uint8_t m_lengthCodes[MaximumMatch + 1];
+	uint8_t m_distanceCodes[512];
+
+	uint64_t m_bits;
+	unsigned m_bitCount;
+	std::vector<uint8_t> m_output;
+
+	Deflater(const Deflater &);
+	Deflater &operator=(const Deflater &);
+
+	static unsigned Hash(const uint8_t *bytes);
+	unsigned GetDistanceCode(unsigned distance) const;
+	unsigned FindMatch(unsigned available, unsigned *distance);
+	void Insert(unsigned position);
+	void Compress(bool flush);
+	void Slide(void);
+
+	void PutBits(uint32_t value, unsigned count);
+	void AlignToByte(void);
+	static void BuildLengths(const unsigned *frequencies, unsigned count, unsigned maximumLength, uint8_t *lengths);
+	static void BuildCodes(const uint8_t *lengths, unsigned count, uint16_t *codes);
+	void WriteSymbols(const uint8_t *literalLengths, const uint16_t *literalCodes, const uint8_t *distanceLengths, const uint16_t *distanceCodes);
+	void WriteStoredBlock(bool final);
+	void WriteBlock(bool final);
+
+public:
+	Deflater(void);
+
+	void Reset(void);
+	void Write(const uint8_t *bytes, size_t length);
+	void Finish(void);
+
+	const std::vector<uint8_t> &Output(void) const { return m_output; }
+	void ClearOutput(void) { m_output.clear(); }
+};
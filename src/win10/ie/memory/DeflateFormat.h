@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdint.h>
+
+//
+// The parts of the deflate (RFC 1951) format the compressor and decompressor share: the
+// base values and extra bits of the length and distance codes, and how code lengths are
+// themselves coded.
+//
+
+static const uint16_t lengthBase[] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const uint8_t lengthExtraBits[] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const uint16_t distanceBase[] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+static const uint8_t distanceExtraBits[] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+static const unsigned LengthCodes = sizeof(lengthBase) / sizeof(lengthBase[0]);
+
+//
+// The order code length code lengths are written in, from the most to the least likely to
+// be used.
+//
+
+static const uint8_t codeLengthOrder[] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+static const unsigned RepeatPrevious = 16;
+static const unsigned RepeatZero = 17;
+static const unsigned RepeatZeroLong = 18;
+
+static unsigned GetFixedLiteralLength(unsigned code)
+{
+	return code < 144 ? 8 : code < 256 ? 9 : code < 280 ? 7 : 8;
+}
+
+static unsigned GetCodeLengthExtraBits(unsigned symbol)
+{
+	return symbol == RepeatPrevious ? 2 : symbol == RepeatZero ? 3 : symbol == RepeatZeroLong ? 7 : 0;
+}
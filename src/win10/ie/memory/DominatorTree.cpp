@@ -0,0 +1,468 @@
+#include "stdafx.h"
+#include <algorithm>
+#include "DominatorTree.h"
+
+using namespace std;
+
+const UINT32 DominatorTree::Unreachable;
+
+DominatorTree::DominatorTree(MemoryBudget *budget) :
+	m_reachableCount(0),
+	m_budget(budget)
+{
+}
+
+DominatorTree::~DominatorTree(void)
+{
+	m_budget->Free(&m_dominators);
+	m_budget->Free(&m_retainedSizes);
+}
+
+//
+// Objects are numbered in the order a depth first search reaches them, from one, and the
+// algorithm works on those numbers. The search takes five arrays, reversing the references
+// takes three and the reversed references, and finding the dominators takes the reversed
+// references and ten arrays, by which time the graph's own references have been freed.
+//
+
+ULONGLONG DominatorTree::EstimateMemory(const HeapGraph *graph)
+{
+	ULONGLONG arrayBytes = ((ULONGLONG) graph->ObjectCount() + 2) * sizeof(UINT32);
+	ULONGLONG reversedBytes = (graph->ReferenceCount() + graph->Roots().size()) * sizeof(UINT32) + arrayBytes;
+	ULONGLONG search = 5 * arrayBytes;
+	ULONGLONG reverse = 3 * arrayBytes + reversedBytes;
+	ULONGLONG dominators = 10 * arrayBytes + reversedBytes - graph->ReferenceCount() * sizeof(UINT32);
+	ULONGLONG estimate = search > reverse ? search : reverse;
+
+	return estimate > dominators ? estimate : dominators;
+}
+
+//
+// Evaluate and Link keep the forest of the objects processed so far, as in the
+// sophisticated version of Lengauer and Tarjan's algorithm. Link balances the trees by
+// size, so a path in the forest has O(log n) vertices even before it's compressed, and
+// the two together take O(m alpha(m, n)) time. Number zero stands for no vertex, with a
+// semidominator and a size of zero.
+//
+// Evaluate finds the vertex with the smallest semidominator on the path from a vertex up
+// to the root of its tree, compressing the path as it goes.
+//
+
+static UINT32 Evaluate(UINT32 vertex, vector<UINT32> &ancestors, vector<UINT32> &labels, const vector<UINT32> &semidominators, vector<UINT32> &path)
+{
+	if (ancestors[vertex] == 0)
+	{
+		return labels[vertex];
+	}
+
+	UINT32 current = vertex;
+
+	path.clear();
+	while (ancestors[ancestors[current]] != 0)
+	{
+		path.push_back(current);
+		current = ancestors[current];
+	}
+
+	while (!path.empty())
+	{
+		current = path.back();
+		path.pop_back();
+
+		UINT32 ancestor = ancestors[current];
+
+		if (semidominators[labels[ancestor]] < semidominators[labels[current]])
+		{
+			labels[current] = labels[ancestor];
+		}
+
+		ancestors[current] = ancestors[ancestor];
+	}
+
+	UINT32 ancestor = ancestors[vertex];
+	return semidominators[labels[ancestor]] < semidominators[labels[vertex]] ? labels[ancestor] : labels[vertex];
+}
+
+//
+// Adds a vertex's tree to its parent's. Rather than hanging it straight off the parent,
+// the vertex's label is pushed down the chain of the parent's subtrees, combining subtrees
+// that are small next to the next one along, and the smaller of the two trees goes under
+// the root of the larger.
+//
+
+static void Link(UINT32 parent, UINT32 vertex, vector<UINT32> &ancestors, vector<UINT32> &labels, const vector<UINT32> &semidominators, vector<UINT32> &sizes, vector<UINT32> &children)
+{
+	UINT32 subtree = vertex;
+
+	while (semidominators[labels[vertex]] < semidominators[labels[children[subtree]]])
+	{
+		UINT32 child = children[subtree];
+
+		if ((ULONGLONG) sizes[subtree] + sizes[children[child]] >= 2 * (ULONGLONG) sizes[child])
+		{
+			ancestors[child] = subtree;
+			children[subtree] = children[child];
+		}
+		else
+		{
+			sizes[child] = sizes[subtree];
+			ancestors[subtree] = child;
+			subtree = child;
+		}
+	}
+
+	labels[subtree] = labels[vertex];
+	sizes[parent] += sizes[vertex];
+
+	if (sizes[parent] < 2 * (ULONGLONG) sizes[vertex])
+	{
+		swap(subtree, children[parent]);
+	}
+
+	while (subtree != 0)
+	{
+		ancestors[subtree] = parent;
+		subtree = children[subtree];
+	}
+}
+
+HRESULT DominatorTree::Build(HeapGraph *graph)
+{
+	UINT32 root = graph->VirtualRoot();
+	size_t objectCount = (size_t) root + 1;
+	vector<UINT32> numbers;
+	vector<UINT32> vertices;
+	vector<UINT32> parents;
+	vector<UINT32> stack;
+	vector<UINT32> cursors;
+	vector<UINT32> predecessorOffsets;
+	vector<UINT32> predecessors;
+	vector<UINT32> semidominators;
+	vector<UINT32> labels;
+	vector<UINT32> ancestors;
+	vector<UINT32> sizes;
+	vector<UINT32> children;
+	vector<UINT32> bucketHeads;
+	vector<UINT32> bucketNext;
+	vector<UINT32> dominators;
+	vector<UINT32> path;
+	ULONGLONG predecessorCount = 0;
+	UINT32 count = 0;
+	size_t depth = 0;
+	HRESULT hr = S_OK;
+
+	if (EstimateMemory(graph) > m_budget->Limit() - m_budget->Used())
+	{
+		return BudgetExceededError;
+	}
+
+	//
+	// Number the objects reachable from the virtual root in depth first order, remembering
+	// each one's parent in the search.
+	//
+
+	IfComFailError(m_budget->Allocate(&numbers, objectCount));
+	IfComFailError(m_budget->Allocate(&vertices, objectCount + 1));
+	IfComFailError(m_budget->Allocate(&parents, objectCount + 1));
+	IfComFailError(m_budget->Allocate(&stack, objectCount));
+	IfComFailError(m_budget->Allocate(&cursors, objectCount + 1));
+
+	numbers[root] = ++count;
+	vertices[count] = root;
+	stack[depth++] = root;
+
+	while (depth > 0)
+	{
+		UINT32 current = stack[depth - 1];
+		UINT32 number = numbers[current];
+		UINT32 referenceCount;
+		const UINT32 *references = graph->References(current, &referenceCount);
+
+		if (cursors[number] == referenceCount)
+		{
+			depth--;
+			continue;
+		}
+
+		UINT32 next = references[cursors[number]++];
+
+		if (numbers[next] == 0)
+		{
+			numbers[next] = ++count;
+			vertices[count] = next;
+			parents[count] = number;
+			stack[depth++] = next;
+		}
+	}
+
+	m_budget->Free(&stack);
+	m_budget->Free(&cursors);
+
+	//
+	// Reverse the references between reachable objects, by number. Each object's count goes
+	// in the offset after its own, so that summing them leaves each offset at its object's
+	// start, and adding the references moves each offset on to the next object's start.
+	//
+
+	IfComFailError(m_budget->Allocate(&predecessorOffsets, (size_t) count + 2));
+
+	for (UINT32 number = 1; number <= count; number++)
+	{
+		UINT32 referenceCount;
+		const UINT32 *references = graph->References(vertices[number], &referenceCount);
+
+		for (UINT32 reference = 0; reference < referenceCount; reference++)
+		{
+			predecessorOffsets[numbers[references[reference]] + 1]++;
+		}
+
+		predecessorCount += referenceCount;
+	}
+
+	if (predecessorCount > 0xFFFFFFFF)
+	{
+		IfComFailError(HRESULT_FROM_WIN32(ERROR_ARITHMETIC_OVERFLOW));
+	}
+
+	for (UINT32 number = 1; number <= count; number++)
+	{
+		predecessorOffsets[number + 1] += predecessorOffsets[number];
+	}
+
+	IfComFailError(m_budget->Allocate(&predecessors, (size_t) predecessorCount));
+
+	for (UINT32 number = 1; number <= count; number++)
+	{
+		UINT32 referenceCount;
+		const UINT32 *references = graph->References(vertices[number], &referenceCount);
+
+		for (UINT32 reference = 0; reference < referenceCount; reference++)
+		{
+			predecessors[predecessorOffsets[numbers[references[reference]]]++] = number;
+		}
+	}
+
+	for (UINT32 number = count; number > 0; number--)
+	{
+		predecessorOffsets[number] = predecessorOffsets[number - 1];
+	}
+
+	m_budget->Free(&numbers);
+	graph->FreeReferences();
+
+	//
+	// Find each object's semidominator, working back from the last object numbered, and
+	// from those the dominators.
+	//
+
+	IfComFailError(m_budget->Allocate(&semidominators, (size_t) count + 1));
+	IfComFailError(m_budget->Allocate(&labels, (size_t) count + 1));
+	IfComFailError(m_budget->Allocate(&ancestors, (size_t) count + 1));
+	IfComFailError(m_budget->Allocate(&sizes, (size_t) count + 1));
+	IfComFailError(m_budget->Allocate(&children, (size_t) count + 1));
+	IfComFailError(m_budget->Allocate(&bucketHeads, (size_t) count + 1));
+	IfComFailError(m_budget->Allocate(&bucketNext, (size_t) count + 1));
+	IfComFailError(m_budget->Allocate(&dominators, (size_t) count + 1));
+
+	for (UINT32 number = 1; number <= count; number++)
+	{
+		semidominators[number] = number;
+		labels[number] = number;
+		sizes[number] = 1;
+	}
+
+	try
+	{
+		for (UINT32 number = count; number > 1; number--)
+		{
+			UINT32 parent = parents[number];
+
+			for (UINT32 predecessor = predecessorOffsets[number]; predecessor < predecessorOffsets[number + 1]; predecessor++)
+			{
+				UINT32 lowest = Evaluate(predecessors[predecessor], ancestors, labels, semidominators, path);
+
+				if (semidominators[lowest] < semidominators[number])
+				{
+					semidominators[number] = semidominators[lowest];
+				}
+			}
+
+			bucketNext[number] = bucketHeads[semidominators[number]];
+			bucketHeads[semidominators[number]] = number;
+			Link(parent, number, ancestors, labels, semidominators, sizes, children);
+
+			for (UINT32 vertex = bucketHeads[parent]; vertex != 0; vertex = bucketNext[vertex])
+			{
+				UINT32 lowest = Evaluate(vertex, ancestors, labels, semidominators, path);
+				dominators[vertex] = semidominators[lowest] < semidominators[vertex] ? lowest : parent;
+			}
+
+			bucketHeads[parent] = 0;
+		}
+	}
+	catch (...)
+	{
+		IfComFailError(E_OUTOFMEMORY);
+	}
+
+	for (UINT32 number = 2; number <= count; number++)
+	{
+		if (dominators[number] != semidominators[number])
+		{
+			dominators[number] = dominators[dominators[number]];
+		}
+	}
+
+	m_budget->Free(&semidominators);
+	m_budget->Free(&labels);
+	m_budget->Free(&ancestors);
+	m_budget->Free(&sizes);
+	m_budget->Free(&children);
+	m_budget->Free(&bucketHeads);
+	m_budget->Free(&bucketNext);
+	m_budget->Free(&predecessorOffsets);
+	m_budget->Free(&predecessors);
+	m_budget->Free(&parents);
+
+	//
+	// A dominator is always numbered before the objects it dominates, so working back up
+	// the numbers adds each object's retained size into its dominator's after everything
+	// it retains has been added into its own.
+	//
+
+	IfComFailError(m_budget->Allocate(&m_dominators, objectCount));
+	IfComFailError(m_budget->Allocate(&m_retainedSizes, objectCount));
+
+	fill(m_dominators.begin(), m_dominators.end(), Unreachable);
+	m_dominators[root] = root;
+
+	for (UINT32 number = 2; number <= count; number++)
+	{
+		m_retainedSizes[vertices[number]] = graph->Size(vertices[number]);
+	}
+
+	for (UINT32 number = count; number > 1; number--)
+	{
+		UINT32 dominator = vertices[dominators[number]];
+
+		m_dominators[vertices[number]] = dominator;
+		m_retainedSizes[dominator] += m_retainedSizes[vertices[number]];
+	}
+
+	m_reachableCount = count - 1;
+
+error:
+	m_budget->Free(&numbers);
+	m_budget->Free(&vertices);
+	m_budget->Free(&parents);
+	m_budget->Free(&stack);
+	m_budget->Free(&cursors);
+	m_budget->Free(&predecessorOffsets);
+	m_budget->Free(&predecessors);
+	m_budget->Free(&semidominators);
+	m_budget->Free(&labels);
+	m_budget->Free(&ancestors);
+	m_budget->Free(&sizes);
+	m_budget->Free(&children);
+	m_budget->Free(&bucketHeads);
+	m_budget->Free(&bucketNext);
+	m_budget->Free(&dominators);
+	return hr;
+}
+
+HRESULT DominatorTree::GetKindTotals(const HeapGraph *graph, vector<KindTotals> *totals) const
+{
+	UINT32 root = graph->VirtualRoot();
+	size_t objectCount = (size_t) root + 1;
+	vector<UINT32> childOffsets;
+	vector<UINT32> children;
+	vector<UINT32> stack;
+	vector<UINT32> cursors;
+	vector<UINT32> active;
+	size_t depth = 0;
+	HRESULT hr = S_OK;
+
+	try
+	{
+		KindTotals empty = { 0, 0, 0 };
+		totals->assign(graph->KindCount(), empty);
+		active.assign(graph->KindCount(), 0);
+	}
+	catch (...)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	for (UINT32 index = 0; index < root; index++)
+	{
+		(*totals)[graph->Kind(index)].count++;
+		(*totals)[graph->Kind(index)].size += graph->Size(index);
+	}
+
+	//
+	// List each object's children in the tree, the same way the references are listed,
+	// then walk it keeping count of how many objects of each kind are on the way down.
+	//
+
+	IfComFailError(m_budget->Allocate(&childOffsets, objectCount + 1));
+	IfComFailError(m_budget->Allocate(&children, objectCount));
+	IfComFailError(m_budget->Allocate(&stack, objectCount));
+	IfComFailError(m_budget->Allocate(&cursors, objectCount));
+
+	for (UINT32 index = 0; index < root; index++)
+	{
+		if (IsReachable(index))
+		{
+			childOffsets[m_dominators[index] + 1]++;
+		}
+	}
+
+	for (size_t index = 0; index < objectCount; index++)
+	{
+		childOffsets[index + 1] += childOffsets[index];
+	}
+
+	for (UINT32 index = 0; index < root; index++)
+	{
+		if (IsReachable(index))
+		{
+			children[childOffsets[m_dominators[index]] + cursors[m_dominators[index]]++] = index;
+		}
+	}
+
+	fill(cursors.begin(), cursors.end(), 0);
+	stack[depth++] = root;
+
+	while (depth > 0)
+	{
+		UINT32 current = stack[depth - 1];
+
+		if (childOffsets[current] + cursors[current] == childOffsets[current + 1])
+		{
+			if (current != root)
+			{
+				active[graph->Kind(current)]--;
+			}
+
+			depth--;
+			continue;
+		}
+
+		UINT32 child = children[childOffsets[current] + cursors[current]++];
+		UINT32 kind = graph->Kind(child);
+
+		if (active[kind]++ == 0)
+		{
+			(*totals)[kind].retainedSize += m_retainedSizes[child];
+		}
+
+		stack[depth++] = child;
+	}
+
+error:
+	m_budget->Free(&childOffsets);
+	m_budget->Free(&children);
+	m_budget->Free(&stack);
+	m_budget->Free(&cursors);
+	return hr;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <vector>
+#include "HeapGraph.h"
+
+//
+// The dominator tree of a heap graph, and the size each object retains. An object
+// dominates another when every chain of references from the roots to the other goes
+// through it, so the objects it dominates are the ones that would be freed along with it,
+// and its retained size is their total size and its own. The graph's virtual root
+// dominates every object a root can reach.
+//
+// Dominators are found with the Lengauer-Tarjan algorithm, with its balanced forest, which
+// takes O(m alpha(m, n)) time for n objects and m references, where alpha is the inverse
+// of Ackermann's function: linear in the size of the graph for any graph that fits in
+// memory. Nothing recurses, since heaps have chains of references far deeper than a
+// thread's stack, and the working arrays are freed as soon as they're done with.
+//
+
+struct KindTotals
+{
+	ULONGLONG count;
+	ULONGLONG size;
+	ULONGLONG retainedSize;
+};
+
+class DominatorTree sealed
+{
+private:
+	std::vector<UINT32> m_dominators;
+	std::vector<ULONGLONG> m_retainedSizes;
+	UINT32 m_reachableCount;
+	MemoryBudget *m_budget;
+
+	DominatorTree(const DominatorTree &);
+	DominatorTree &operator=(const DominatorTree &);
+
+public:
+	static const UINT32 Unreachable = 0xFFFFFFFF;
+
+	DominatorTree(MemoryBudget *budget);
+	~DominatorTree(void);
+
+	//
+	// The most memory building the tree for a graph takes, on top of what the graph holds.
+	//
+
+	static ULONGLONG EstimateMemory(const HeapGraph *graph);
+
+	//
+	// Builds the tree. The graph's references are freed along the way, since by then the
+	// tree has its own reversed copy of them, and together they'd take the most memory.
+	//
+
+	HRESULT Build(HeapGraph *graph);
+
+	//
+	// An object's immediate dominator, which is the virtual root for objects only the virtual
+	// root dominates, and Unreachable for objects no root can reach.
+	//
+
+	UINT32 Dominator(UINT32 index) const { return m_dominators[index]; }
+	bool IsReachable(UINT32 index) const { return m_dominators[index] != Unreachable; }
+	ULONGLONG RetainedSize(UINT32 index) const { return m_retainedSizes[index]; }
+	UINT32 ReachableCount(void) const { return m_reachableCount; }
+
+	//
+	// The count, size and retained size of the objects of each kind. An object's retained
+	// size is only counted toward its kind when none of its dominators is of the same kind,
+	// so nothing is counted twice.
+	//
+
+	HRESULT GetKindTotals(const HeapGraph *graph, std::vector<KindTotals> *totals) const;
+};
@@ -0,0 +1,478 @@
+#include "stdafx.h"
+#include <algorithm>
+#include "HeapGraph.h"
+
+using namespace std;
+
+static const HRESULT InvalidSnapshot = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+static const UINT32 NoObject = 0xFFFFFFFF;
+
+const ULONGLONG MemoryBudget::DefaultLimit;
+
+MemoryBudget::MemoryBudget(ULONGLONG limit) :
+	m_limit(limit),
+	m_used(0),
+	m_peak(0)
+{
+}
+
+HRESULT MemoryBudget::Reserve(ULONGLONG bytes)
+{
+	if (bytes > m_limit - m_used)
+	{
+		return BudgetExceededError;
+	}
+
+	m_used += bytes;
+	if (m_used > m_peak)
+	{
+		m_peak = m_used;
+	}
+
+	return S_OK;
+}
+
+void MemoryBudget::Release(ULONGLONG bytes)
+{
+	m_used = bytes > m_used ? 0 : m_used - bytes;
+}
+
+//
+// Object ids are addresses, so their low bits are mostly the same. Multiplying by a large
+// odd constant mixes the rest into the top bits, which are the ones used.
+//
+
+static size_t HashObjectId(ULONGLONG objectId, unsigned bits)
+{
+	return (size_t) ((objectId * 0x9E3779B97F4A7C15ULL) >> (64 - bits));
+}
+
+ObjectIdTable::ObjectIdTable(MemoryBudget *budget) :
+	m_bits(0),
+	m_count(0),
+	m_budget(budget)
+{
+}
+
+ObjectIdTable::~ObjectIdTable(void)
+{
+	Clear();
+}
+
+HRESULT ObjectIdTable::Resize(unsigned bits)
+{
+	vector<Slot> slots;
+	size_t slotCount = (size_t) 1 << bits;
+
+	IfComFailRet(m_budget->Allocate(&slots, slotCount));
+
+	for (size_t slot = 0; slot < slotCount; slot++)
+	{
+		slots[slot].value = NoValue;
+	}
+
+	for (size_t old = 0; old < m_slots.size(); old++)
+	{
+		if (m_slots[old].value == NoValue)
+		{
+			continue;
+		}
+
+		size_t slot = HashObjectId(m_slots[old].objectId, bits);
+
+		while (slots[slot].value != NoValue)
+		{
+			slot = (slot + 1) & (slotCount - 1);
+		}
+
+		slots[slot] = m_slots[old];
+	}
+
+	m_budget->Free(&m_slots);
+	m_slots.swap(slots);
+	m_bits = bits;
+	return S_OK;
+}
+
+HRESULT ObjectIdTable::Insert(ULONGLONG objectId, UINT32 value)
+{
+	if (value == NoValue)
+	{
+		return E_INVALIDARG;
+	}
+
+	if ((m_count + 1) * 2 > m_slots.size())
+	{
+		IfComFailRet(Resize(m_slots.empty() ? 16 : m_bits + 1));
+	}
+
+	size_t mask = m_slots.size() - 1;
+	size_t slot = HashObjectId(objectId, m_bits);
+
+	while (m_slots[slot].value != NoValue)
+	{
+		if (m_slots[slot].objectId == objectId)
+		{
+			return S_OK;
+		}
+
+		slot = (slot + 1) & mask;
+	}
+
+	m_slots[slot].objectId = objectId;
+	m_slots[slot].value = value;
+	m_count++;
+	return S_OK;
+}
+
+UINT32 ObjectIdTable::Find(ULONGLONG objectId) const
+{
+	if (m_slots.empty())
+	{
+		return NoValue;
+	}
+
+	size_t mask = m_slots.size() - 1;
+	size_t slot = HashObjectId(objectId, m_bits);
+
+	while (m_slots[slot].value != NoValue)
+	{
+		if (m_slots[slot].objectId == objectId)
+		{
+			return m_slots[slot].value;
+		}
+
+		slot = (slot + 1) & mask;
+	}
+
+	return NoValue;
+}
+
+void ObjectIdTable::Swap(ObjectIdTable *other)
+{
+	m_slots.swap(other->m_slots);
+	swap(m_bits, other->m_bits);
+	swap(m_count, other->m_count);
+}
+
+void ObjectIdTable::Clear(void)
+{
+	m_budget->Free(&m_slots);
+	m_bits = 0;
+	m_count = 0;
+}
+
+HeapGraph::HeapGraph(MemoryBudget *budget) :
+	m_totalSize(0),
+	m_budget(budget)
+{
+}
+
+HeapGraph::~HeapGraph(void)
+{
+	m_budget->Free(&m_objectIds);
+	m_budget->Free(&m_sizes);
+	m_budget->Free(&m_kinds);
+	m_budget->Free(&m_offsets);
+	m_budget->Free(&m_roots);
+	FreeReferences();
+}
+
+HRESULT HeapGraph::AddKind(const ScannedString &kind, UINT32 *index)
+{
+	try
+	{
+		string name(kind.text != nullptr ? kind.text : "", kind.length);
+		unordered_map<string, UINT32>::iterator existing = m_kindIndices.find(name);
+
+		if (existing != m_kindIndices.end())
+		{
+			*index = existing->second;
+			return S_OK;
+		}
+
+		*index = (UINT32) m_kindNames.size();
+		m_kindNames.push_back(name);
+		m_kindIndices[name] = *index;
+	}
+	catch (...)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	return S_OK;
+}
+
+HRESULT HeapGraph::ReadObjects(SnapshotScanner *scanner, ULONGLONG *referenceCount)
+{
+	ScannedObject object;
+	HRESULT hr;
+
+	*referenceCount = 0;
+
+	while ((hr = scanner->Next(&object)) == S_OK)
+	{
+		UINT32 index = ObjectCount();
+		UINT32 kind;
+
+		if (index >= MaximumObjectCount)
+		{
+			return HRESULT_FROM_WIN32(ERROR_ARITHMETIC_OVERFLOW);
+		}
+
+		IfComFailRet(AddKind(object.kind, &kind));
+		IfComFailRet(m_budget->Grow(&m_objectIds));
+		IfComFailRet(m_budget->Grow(&m_sizes));
+		IfComFailRet(m_budget->Grow(&m_kinds));
+		IfComFailRet(m_budget->Grow(&m_offsets));
+
+		m_objectIds.push_back(object.objectId);
+		m_sizes.push_back(object.size);
+		m_kinds.push_back(kind);
+		m_totalSize += object.size;
+
+		//
+		// Offsets only fit 32 bits' worth of references, which is far more than a snapshot
+		// that fits in memory has.
+		//
+
+		*referenceCount += object.references.size();
+		if (*referenceCount > 0xFFFFFFFF)
+		{
+			return HRESULT_FROM_WIN32(ERROR_ARITHMETIC_OVERFLOW);
+		}
+
+		m_offsets.push_back((UINT32) object.references.size());
+
+		if (object.isRoot)
+		{
+			IfComFailRet(m_budget->Grow(&m_roots));
+			m_roots.push_back(index);
+		}
+	}
+
+	if (FAILED(hr))
+	{
+		return hr;
+	}
+
+	IfComFailRet(m_budget->Grow(&m_offsets));
+	m_offsets.push_back((UINT32) *referenceCount);
+	return S_OK;
+}
+
+//
+// References are looked up in an open addressing table of object numbers, hashed by id,
+// which is freed once they've all been found.
+//
+
+HRESULT HeapGraph::ReadReferences(SnapshotScanner *scanner)
+{
+	vector<UINT32> table;
+	ULONGLONG referenceCount = m_offsets.back();
+	unsigned bits = 16;
+	ScannedObject object;
+	UINT32 written = 0;
+	HRESULT hr = S_OK;
+
+	while (((size_t) 1 << bits) < (size_t) ObjectCount() * 2)
+	{
+		bits++;
+	}
+
+	IfComFailError(m_budget->Allocate(&table, (size_t) 1 << bits));
+	IfComFailError(m_budget->Allocate(&m_references, (size_t) referenceCount));
+
+	fill(table.begin(), table.end(), NoObject);
+
+	for (UINT32 index = 0; index < ObjectCount(); index++)
+	{
+		size_t slot = HashObjectId(m_objectIds[index], bits);
+
+		while (table[slot] != NoObject && m_objectIds[table[slot]] != m_objectIds[index])
+		{
+			slot = (slot + 1) & (table.size() - 1);
+		}
+
+		if (table[slot] == NoObject)
+		{
+			table[slot] = index;
+		}
+	}
+
+	//
+	// The first pass left each object's reference count in its offset, and the last offset
+	// holding the total. The references found are written over them.
+	//
+
+	for (UINT32 index = 0; index < ObjectCount(); index++)
+	{
+		hr = scanner->Next(&object);
+		if (hr != S_OK || object.objectId != m_objectIds[index] || object.references.size() > m_offsets[index])
+		{
+			IfComFailError(FAILED(hr) ? hr : InvalidSnapshot);
+		}
+
+		m_offsets[index] = written;
+
+		for (size_t reference = 0; reference < object.references.size(); reference++)
+		{
+			size_t slot = HashObjectId(object.references[reference].objectId, bits);
+
+			while (table[slot] != NoObject && m_objectIds[table[slot]] != object.references[reference].objectId)
+			{
+				slot = (slot + 1) & (table.size() - 1);
+			}
+
+			if (table[slot] != NoObject)
+			{
+				m_references[written++] = table[slot];
+			}
+		}
+	}
+
+	m_offsets[ObjectCount()] = written;
+	m_references.resize(written);
+
+error:
+	m_budget->Free(&table);
+	return hr;
+}
+
+HRESULT HeapGraph::Build(SnapshotScanner *scanner)
+{
+	ULONGLONG referenceCount;
+
+	IfComFailRet(ReadObjects(scanner, &referenceCount));
+	IfComFailRet(scanner->Rewind());
+	IfComFailRet(ReadReferences(scanner));
+
+	if (m_roots.empty())
+	{
+		vector<bool> referenced;
+
+		try
+		{
+			referenced.assign(ObjectCount(), false);
+		}
+		catch (...)
+		{
+			return E_OUTOFMEMORY;
+		}
+
+		for (size_t reference = 0; reference < m_references.size(); reference++)
+		{
+			referenced[m_references[reference]] = true;
+		}
+
+		for (UINT32 index = 0; index < ObjectCount(); index++)
+		{
+			if (!referenced[index])
+			{
+				IfComFailRet(m_budget->Grow(&m_roots));
+				m_roots.push_back(index);
+			}
+		}
+	}
+
+	return S_OK;
+}
+
+const UINT32 *HeapGraph::References(UINT32 index, UINT32 *count) const
+{
+	if (index == VirtualRoot())
+	{
+		*count = (UINT32) m_roots.size();
+		return m_roots.data();
+	}
+
+	*count = m_offsets[index + 1] - m_offsets[index];
+	return m_references.data() + m_offsets[index];
+}
+
+bool HeapGraph::Find(ULONGLONG objectId, UINT32 *index) const
+{
+	for (UINT32 current = 0; current < ObjectCount(); current++)
+	{
+		if (m_objectIds[current] == objectId)
+		{
+			*index = current;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+HRESULT HeapGraph::FindPaths(const vector<UINT32> &targets, vector<vector<UINT32>> *paths) const
+{
+	vector<UINT32> parents;
+	vector<UINT32> queue;
+	size_t head = 0;
+	size_t tail = 0;
+	HRESULT hr = S_OK;
+
+	IfComFailError(m_budget->Allocate(&parents, ObjectCount()));
+	IfComFailError(m_budget->Allocate(&queue, ObjectCount()));
+
+	fill(parents.begin(), parents.end(), NoObject);
+
+	for (size_t root = 0; root < m_roots.size(); root++)
+	{
+		if (parents[m_roots[root]] == NoObject)
+		{
+			parents[m_roots[root]] = VirtualRoot();
+			queue[tail++] = m_roots[root];
+		}
+	}
+
+	while (head < tail)
+	{
+		UINT32 current = queue[head++];
+		UINT32 count;
+		const UINT32 *references = References(current, &count);
+
+		for (UINT32 reference = 0; reference < count; reference++)
+		{
+			if (parents[references[reference]] == NoObject)
+			{
+				parents[references[reference]] = current;
+				queue[tail++] = references[reference];
+			}
+		}
+	}
+
+	try
+	{
+		paths->assign(targets.size(), vector<UINT32>());
+
+		for (size_t target = 0; target < targets.size(); target++)
+		{
+			if (parents[targets[target]] == NoObject)
+			{
+				continue;
+			}
+
+			for (UINT32 current = targets[target]; current != VirtualRoot(); current = parents[current])
+			{
+				(*paths)[target].push_back(current);
+			}
+
+			reverse((*paths)[target].begin(), (*paths)[target].end());
+		}
+	}
+	catch (...)
+	{
+		hr = E_OUTOFMEMORY;
+	}
+
+error:
+	m_budget->Free(&parents);
+	m_budget->Free(&queue);
+	return hr;
+}
+
+void HeapGraph::FreeReferences(void)
+{
+	m_budget->Free(&m_references);
+}
@@ -0,0 +1,250 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "SnapshotScanner.h"
+
+//
+// Keeps track of the memory the offline tools use for their largest structures, so they
+// fail cleanly when a snapshot needs more than they're allowed rather than paging the
+// machine to a halt.
+//
+
+class MemoryBudget sealed
+{
+private:
+	ULONGLONG m_limit;
+	ULONGLONG m_used;
+	ULONGLONG m_peak;
+
+	MemoryBudget(const MemoryBudget &);
+	MemoryBudget &operator=(const MemoryBudget &);
+
+public:
+	MemoryBudget(ULONGLONG limit);
+
+	//
+	// The budget when none is given. It's fixed, rather than taken from the memory that's
+	// free, so the same snapshot gets the same result on any machine: 4 GB, or 1 GB for
+	// a 32-bit analyzer, which has little more address space than that to give.
+	//
+
+	static const ULONGLONG DefaultLimit = sizeof(void *) > 4 ? 4096ULL * 1024 * 1024 : 1024ULL * 1024 * 1024;
+
+	HRESULT Reserve(ULONGLONG bytes);
+	void Release(ULONGLONG bytes);
+
+	ULONGLONG Limit(void) const { return m_limit; }
+	ULONGLONG Used(void) const { return m_used; }
+	ULONGLONG Peak(void) const { return m_peak; }
+
+	//
+	// Sizes a vector to the given count, charging its memory to the budget.
+	//
+
+	template <typename T>
+	HRESULT Allocate(std::vector<T> *items, size_t count)
+	{
+		if (count > ((size_t) -1) / sizeof(T))
+		{
+			return E_OUTOFMEMORY;
+		}
+
+		IfComFailRet(Reserve((ULONGLONG) count * sizeof(T)));
+
+		try
+		{
+			std::vector<T>(count).swap(*items);
+		}
+		catch (...)
+		{
+			Release((ULONGLONG) count * sizeof(T));
+			return E_OUTOFMEMORY;
+		}
+
+		return S_OK;
+	}
+
+	//
+	// Makes room for at least one more item in a vector that's filled a piece at a time.
+	//
+
+	template <typename T>
+	HRESULT Grow(std::vector<T> *items)
+	{
+		size_t capacity = items->capacity();
+		size_t newCapacity = capacity < 4096 ? 4096 : capacity + capacity / 2;
+
+		if (items->size() < capacity)
+		{
+			return S_OK;
+		}
+
+		if (newCapacity > ((size_t) -1) / sizeof(T))
+		{
+			return E_OUTOFMEMORY;
+		}
+
+		IfComFailRet(Reserve((ULONGLONG) newCapacity * sizeof(T)));
+
+		try
+		{
+			items->reserve(newCapacity);
+		}
+		catch (...)
+		{
+			Release((ULONGLONG) newCapacity * sizeof(T));
+			return E_OUTOFMEMORY;
+		}
+
+		Release((ULONGLONG) capacity * sizeof(T));
+		return S_OK;
+	}
+
+	template <typename T>
+	void Free(std::vector<T> *items)
+	{
+		Release((ULONGLONG) items->capacity() * sizeof(T));
+		std::vector<T>().swap(*items);
+	}
+};
+
+//
+// The error a budget gives when there isn't enough of it left.
+//
+
+const HRESULT BudgetExceededError = HRESULT_FROM_WIN32(ERROR_NOT_ENOUGH_QUOTA);
+
+//
+// A hash table from object ids to a 32-bit value, for joining snapshots on their objects.
+// It's open addressing, with the slots in one budgeted array, and doubles when it's half
+// full.
+//
+
+class ObjectIdTable sealed
+{
+private:
+	struct Slot
+	{
+		ULONGLONG objectId;
+		UINT32 value;
+	};
+
+	std::vector<Slot> m_slots;
+	unsigned m_bits;
+	size_t m_count;
+	MemoryBudget *m_budget;
+
+	ObjectIdTable(const ObjectIdTable &);
+	ObjectIdTable &operator=(const ObjectIdTable &);
+
+	HRESULT Resize(unsigned bits);
+
+public:
+	static const UINT32 NoValue = 0xFFFFFFFF;
+
+	ObjectIdTable(MemoryBudget *budget);
+	~ObjectIdTable(void);
+
+	//
+	// Adds an object, unless it's already there, in which case its value is left alone.
+	// NoValue can't be added.
+	//
+
+	HRESULT Insert(ULONGLONG objectId, UINT32 value);
+	UINT32 Find(ULONGLONG objectId) const;
+
+	size_t Count(void) const { return m_count; }
+	void Swap(ObjectIdTable *other);
+	void Clear(void);
+};
+
+//
+// A snapshot's object graph, held as compactly as it can be: objects are numbered in the
+// order the snapshot lists them, and the references are kept in compressed sparse row
+// form, as one array of object numbers with each object's own references stored together.
+// An object takes 24 bytes and a reference 4, so graphs of tens of millions of objects
+// fit in memory.
+//
+// References to objects that aren't in the snapshot, such as external objects, are left
+// out. If the snapshot doesn't mark any objects as roots, the objects that nothing
+// references are taken to be the roots.
+//
+
+class HeapGraph sealed
+{
+private:
+	std::vector<ULONGLONG> m_objectIds;
+	std::vector<ULONGLONG> m_sizes;
+	std::vector<UINT32> m_kinds;
+	std::vector<UINT32> m_offsets;
+	std::vector<UINT32> m_references;
+	std::vector<UINT32> m_roots;
+	std::vector<std::string> m_kindNames;
+	std::unordered_map<std::string, UINT32> m_kindIndices;
+	ULONGLONG m_totalSize;
+	MemoryBudget *m_budget;
+
+	HeapGraph(const HeapGraph &);
+	HeapGraph &operator=(const HeapGraph &);
+
+	HRESULT AddKind(const ScannedString &kind, UINT32 *index);
+	HRESULT ReadObjects(SnapshotScanner *scanner, ULONGLONG *referenceCount);
+	HRESULT ReadReferences(SnapshotScanner *scanner);
+
+public:
+	//
+	// Objects are numbered with 32-bit indices, and the one after the last object is the
+	// virtual root that references all of the real roots.
+	//
+
+	static const UINT32 MaximumObjectCount = 0xFFFFFFF0;
+
+	HeapGraph(MemoryBudget *budget);
+	~HeapGraph(void);
+
+	//
+	// Builds the graph in two passes over the snapshot: the first reads the objects, and
+	// the second their references, once every object has its number.
+	//
+
+	HRESULT Build(SnapshotScanner *scanner);
+
+	UINT32 ObjectCount(void) const { return (UINT32) m_objectIds.size(); }
+	UINT32 VirtualRoot(void) const { return ObjectCount(); }
+	ULONGLONG ReferenceCount(void) const { return m_references.size(); }
+	ULONGLONG TotalSize(void) const { return m_totalSize; }
+	ULONGLONG ObjectId(UINT32 index) const { return m_objectIds[index]; }
+	ULONGLONG Size(UINT32 index) const { return m_sizes[index]; }
+	UINT32 Kind(UINT32 index) const { return m_kinds[index]; }
+	UINT32 KindCount(void) const { return (UINT32) m_kindNames.size(); }
+	const std::string &KindName(UINT32 kind) const { return m_kindNames[kind]; }
+	const std::vector<UINT32> &Roots(void) const { return m_roots; }
+
+	//
+	// The objects an object references. The virtual root references the roots.
+	//
+
+	const UINT32 *References(UINT32 index, UINT32 *count) const;
+
+	//
+	// Finds an object by id, looking through every object.
+	//
+
+	bool Find(ULONGLONG objectId, UINT32 *index) const;
+
+	//
+	// Finds the shortest chain of references from a root to each of the given objects. A
+	// path lists objects from the root down, and is empty for an object that no root
+	// reaches.
+	//
+
+	HRESULT FindPaths(const std::vector<UINT32> &targets, std::vector<std::vector<UINT32>> *paths) const;
+
+	//
+	// Frees the references once nothing needs them.
+	//
+
+	void FreeReferences(void);
+};
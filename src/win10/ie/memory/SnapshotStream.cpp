@@ -0,0 +1,254 @@
+#include "stdafx.h"
+#include "SnapshotStream.h"
+
+using namespace std;
+
+HRESULT WriteToStream(SnapshotStream *stream, const void *bytes, size_t length)
+{
+	const uint8_t *current = (const uint8_t *) bytes;
+
+	while (length > 0)
+	{
+		ULONG chunkLength = length > 0x40000000 ? 0x40000000 : (ULONG) length;
+		ULONG written = 0;
+		HRESULT hr = stream->Write(current, chunkLength, &written);
+
+		if (FAILED(hr) || written == 0)
+		{
+			return FAILED(hr) ? hr : STG_E_CANTSAVE;
+		}
+
+		current += written;
+		length -= written;
+	}
+
+	return S_OK;
+}
+
+FileStream::FileStream(void) :
+	m_file(INVALID_HANDLE_VALUE)
+{
+}
+
+FileStream::~FileStream(void)
+{
+	Close();
+}
+
+HRESULT FileStream::Create(const wchar_t *fileName)
+{
+	if (m_file != INVALID_HANDLE_VALUE)
+	{
+		return E_UNEXPECTED;
+	}
+
+	m_file = CreateFileW(fileName, GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+
+	if (m_file == INVALID_HANDLE_VALUE)
+	{
+		return HRESULT_FROM_WIN32(GetLastError());
+	}
+
+	return S_OK;
+}
+
+HRESULT FileStream::Write(const void *bytes, ULONG length, ULONG *written)
+{
+	DWORD bytesWritten = 0;
+
+	*written = 0;
+
+	if (m_file == INVALID_HANDLE_VALUE)
+	{
+		return E_UNEXPECTED;
+	}
+
+	if (!WriteFile(m_file, bytes, length, &bytesWritten, nullptr))
+	{
+		return HRESULT_FROM_WIN32(GetLastError());
+	}
+
+	*written = bytesWritten;
+	return S_OK;
+}
+
+HRESULT FileStream::Patch(ULONGLONG offset, const void *bytes, ULONG length)
+{
+	LARGE_INTEGER position;
+	LARGE_INTEGER end;
+	DWORD bytesWritten = 0;
+	HRESULT hr = S_OK;
+
+	if (m_file == INVALID_HANDLE_VALUE)
+	{
+		return E_UNEXPECTED;
+	}
+
+	position.QuadPart = (LONGLONG) offset;
+	end.QuadPart = 0;
+
+	if (!SetFilePointerEx(m_file, position, nullptr, FILE_BEGIN))
+	{
+		return HRESULT_FROM_WIN32(GetLastError());
+	}
+
+	if (!WriteFile(m_file, bytes, length, &bytesWritten, nullptr))
+	{
+		hr = HRESULT_FROM_WIN32(GetLastError());
+	}
+	else if (bytesWritten != length)
+	{
+		hr = STG_E_CANTSAVE;
+	}
+
+	if (!SetFilePointerEx(m_file, end, nullptr, FILE_END) && SUCCEEDED(hr))
+	{
+		hr = HRESULT_FROM_WIN32(GetLastError());
+	}
+
+	return hr;
+}
+
+HRESULT FileStream::Close(void)
+{
+	if (m_file == INVALID_HANDLE_VALUE)
+	{
+		return S_OK;
+	}
+
+	HRESULT hr = CloseHandle(m_file) ? S_OK : HRESULT_FROM_WIN32(GetLastError());
+	m_file = INVALID_HANDLE_VALUE;
+	return hr;
+}
+
+MemoryStream::MemoryStream(void) :
+	m_buffer(nullptr)
+{
+}
+
+HRESULT MemoryStream::Write(const void *bytes, ULONG length, ULONG *written)
+{
+	*written = 0;
+
+	if (m_buffer == nullptr)
+	{
+		return E_UNEXPECTED;
+	}
+
+	try
+	{
+		m_buffer->insert(m_buffer->end(), (const uint8_t *) bytes, (const uint8_t *) bytes + length);
+	}
+	catch (...)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	*written = length;
+	return S_OK;
+}
+
+HRESULT CreateTemporaryFile(wstring *fileName)
+{
+	wchar_t directory[MAX_PATH + 1];
+	wchar_t name[MAX_PATH + 1];
+	DWORD length = GetTempPathW(ARRAYSIZE(directory), directory);
+
+	if (length == 0 || length > ARRAYSIZE(directory))
+	{
+		return length == 0 ? HRESULT_FROM_WIN32(GetLastError()) : HRESULT_FROM_WIN32(ERROR_BUFFER_OVERFLOW);
+	}
+
+	if (GetTempFileNameW(directory, L"snp", 0, name) == 0)
+	{
+		return HRESULT_FROM_WIN32(GetLastError());
+	}
+
+	*fileName = name;
+	return S_OK;
+}
+
+MappedFile::MappedFile(void) :
+	m_file(INVALID_HANDLE_VALUE),
+	m_mapping(nullptr),
+	m_data(nullptr),
+	m_size(0)
+{
+}
+
+MappedFile::~MappedFile(void)
+{
+	Close();
+}
+
+HRESULT MappedFile::Open(const wchar_t *fileName)
+{
+	LARGE_INTEGER size;
+
+	if (m_file != INVALID_HANDLE_VALUE)
+	{
+		return E_UNEXPECTED;
+	}
+
+	m_file = CreateFileW(fileName, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (m_file == INVALID_HANDLE_VALUE || !GetFileSizeEx(m_file, &size))
+	{
+		HRESULT hr = HRESULT_FROM_WIN32(GetLastError());
+		Close();
+		return hr;
+	}
+
+	if ((ULONGLONG) size.QuadPart > (SIZE_T) -1)
+	{
+		Close();
+		return HRESULT_FROM_WIN32(ERROR_FILE_TOO_LARGE);
+	}
+
+	//
+	// Empty files can't be mapped, and there's nothing in them to read anyway.
+	//
+
+	if (size.QuadPart == 0)
+	{
+		return S_OK;
+	}
+
+	m_mapping = CreateFileMappingW(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (m_mapping != nullptr)
+	{
+		m_data = (const uint8_t *) MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+	}
+
+	if (m_data == nullptr)
+	{
+		HRESULT hr = HRESULT_FROM_WIN32(GetLastError());
+		Close();
+		return hr;
+	}
+
+	m_size = (size_t) size.QuadPart;
+	return S_OK;
+}
+
+void MappedFile::Close(void)
+{
+	if (m_data != nullptr)
+	{
+		UnmapViewOfFile(m_data);
+		m_data = nullptr;
+	}
+
+	if (m_mapping != nullptr)
+	{
+		CloseHandle(m_mapping);
+		m_mapping = nullptr;
+	}
+
+	if (m_file != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(m_file);
+		m_file = INVALID_HANDLE_VALUE;
+	}
+
+	m_size = 0;
+}
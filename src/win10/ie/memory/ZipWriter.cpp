@@ -0,0 +1,394 @@
+#include "stdafx.h"
+#include "ZipWriter.h"
+
+using namespace std;
+
+static const UINT32 LocalHeaderSignature = 0x04034b50;
+static const UINT32 CentralHeaderSignature = 0x02014b50;
+static const UINT32 Zip64EndSignature = 0x06064b50;
+static const UINT32 Zip64LocatorSignature = 0x07064b50;
+static const UINT32 EndSignature = 0x06054b50;
+
+//
+// Zip64 needs version 4.5 to extract.
+//
+
+static const UINT16 ZipVersion = 45;
+static const UINT16 DeflateMethod = 8;
+static const UINT16 Zip64ExtraId = 1;
+static const UINT16 LocalExtraLength = 4 + 2 * 8;
+static const UINT16 CentralExtraLength = 4 + 3 * 8;
+static const UINT32 Zip64Marker = 0xFFFFFFFF;
+
+static const wchar_t ContentTypesPartName[] = L"[Content_Types].xml";
+
+static void Append16(vector<uint8_t> &bytes, UINT16 value)
+{
+	bytes.push_back((uint8_t) value);
+	bytes.push_back((uint8_t) (value >> 8));
+}
+
+static void Append32(vector<uint8_t> &bytes, UINT32 value)
+{
+	Append16(bytes, (UINT16) value);
+	Append16(bytes, (UINT16) (value >> 16));
+}
+
+static void Append64(vector<uint8_t> &bytes, ULONGLONG value)
+{
+	Append32(bytes, (UINT32) value);
+	Append32(bytes, (UINT32) (value >> 32));
+}
+
+static void Append(vector<uint8_t> &bytes, const string &value)
+{
+	bytes.insert(bytes.end(), value.begin(), value.end());
+}
+
+ZipWriter::ZipWriter(void) :
+	m_offset(0),
+	m_status(S_OK),
+	m_time(0),
+	m_date(0),
+	m_inPart(false)
+{
+	for (UINT32 index = 0; index < 256; index++)
+	{
+		UINT32 crc = index;
+
+		for (unsigned bit = 0; bit < 8; bit++)
+		{
+			crc = (crc & 1) ? 0xEDB88320 ^ (crc >> 1) : crc >> 1;
+		}
+
+		m_crcTable[index] = crc;
+	}
+}
+
+HRESULT ZipWriter::Create(const wchar_t *fileName)
+{
+	SYSTEMTIME time;
+
+	IfComFailRet(m_file.Create(fileName));
+
+	//
+	// Every entry gets the time the package was started, in the MS-DOS format ZIP uses.
+	//
+
+	GetLocalTime(&time);
+	m_time = (UINT16) ((time.wHour << 11) | (time.wMinute << 5) | (time.wSecond / 2));
+	m_date = (UINT16) (((time.wYear - 1980) << 9) | (time.wMonth << 5) | time.wDay);
+
+	return S_OK;
+}
+
+HRESULT ZipWriter::ToAscii(const wchar_t *value, string *ascii)
+{
+	ascii->clear();
+
+	for (; *value != L'\0'; value++)
+	{
+		if (*value > 0x7F)
+		{
+			return E_INVALIDARG;
+		}
+
+		ascii->push_back((char) *value);
+	}
+
+	return S_OK;
+}
+
+HRESULT ZipWriter::WriteBytes(const void *bytes, size_t length)
+{
+	const uint8_t *current = (const uint8_t *) bytes;
+
+	IfComFailRet(m_status);
+
+	while (length > 0)
+	{
+		ULONG chunkLength = length > 0x40000000 ? 0x40000000 : (ULONG) length;
+		ULONG written = 0;
+		HRESULT hr = m_file.Write(current, chunkLength, &written);
+
+		if (FAILED(hr) || written == 0)
+		{
+			m_status = FAILED(hr) ? hr : STG_E_CANTSAVE;
+			return m_status;
+		}
+
+		current += written;
+		length -= written;
+		m_offset += written;
+	}
+
+	return S_OK;
+}
+
+HRESULT ZipWriter::WriteCompressed(void)
+{
+	const vector<uint8_t> &output = m_deflater.Output();
+
+	if (output.empty())
+	{
+		return S_OK;
+	}
+
+	HRESULT hr = WriteBytes(output.data(), output.size());
+	m_part.compressedSize += output.size();
+	m_deflater.ClearOutput();
+	return hr;
+}
+
+void ZipWriter::BuildLocalHeader(const Entry &entry)
+{
+	m_header.clear();
+	Append32(m_header, LocalHeaderSignature);
+	Append16(m_header, ZipVersion);
+	Append16(m_header, 0);
+	Append16(m_header, DeflateMethod);
+	Append16(m_header, m_time);
+	Append16(m_header, m_date);
+	Append32(m_header, entry.crc);
+	Append32(m_header, Zip64Marker);
+	Append32(m_header, Zip64Marker);
+	Append16(m_header, (UINT16) entry.name.size());
+	Append16(m_header, LocalExtraLength);
+	Append(m_header, entry.name);
+	Append16(m_header, Zip64ExtraId);
+	Append16(m_header, LocalExtraLength - 4);
+	Append64(m_header, entry.size);
+	Append64(m_header, entry.compressedSize);
+}
+
+HRESULT ZipWriter::StartPart(const wchar_t *name, const wchar_t *contentType)
+{
+	IfComFailRet(m_status);
+
+	if (m_inPart)
+	{
+		return E_UNEXPECTED;
+	}
+
+	IfComFailRet(ToAscii(name, &m_part.name));
+
+	if (m_part.name.empty() || m_part.name.size() > 0xFFFF)
+	{
+		return E_INVALIDARG;
+	}
+
+	m_part.contentType.clear();
+
+	if (contentType != nullptr)
+	{
+		IfComFailRet(ToAscii(contentType, &m_part.contentType));
+	}
+
+	m_part.crc = 0;
+	m_part.compressedSize = 0;
+	m_part.size = 0;
+	m_part.offset = m_offset;
+
+	BuildLocalHeader(m_part);
+	IfComFailRet(WriteBytes(m_header.data(), m_header.size()));
+
+	m_deflater.Reset();
+	m_part.crc = 0xFFFFFFFF;
+	m_inPart = true;
+
+	return S_OK;
+}
+
+HRESULT ZipWriter::Write(const void *bytes, ULONG length, ULONG *written)
+{
+	const uint8_t *current = (const uint8_t *) bytes;
+	UINT32 crc = m_part.crc;
+
+	*written = 0;
+
+	IfComFailRet(m_status);
+
+	if (!m_inPart)
+	{
+		return E_UNEXPECTED;
+	}
+
+	for (ULONG index = 0; index < length; index++)
+	{
+		crc = m_crcTable[(crc ^ current[index]) & 0xFF] ^ (crc >> 8);
+	}
+
+	m_part.crc = crc;
+	m_part.size += length;
+
+	m_deflater.Write(current, length);
+	IfComFailRet(WriteCompressed());
+
+	*written = length;
+	return S_OK;
+}
+
+HRESULT ZipWriter::EndPart(void)
+{
+	IfComFailRet(m_status);
+
+	if (!m_inPart)
+	{
+		return E_UNEXPECTED;
+	}
+
+	m_deflater.Finish();
+	IfComFailRet(WriteCompressed());
+
+	m_part.crc ^= 0xFFFFFFFF;
+	m_inPart = false;
+
+	BuildLocalHeader(m_part);
+
+	HRESULT hr = m_file.Patch(m_part.offset, m_header.data(), (ULONG) m_header.size());
+
+	if (FAILED(hr))
+	{
+		m_status = hr;
+		return hr;
+	}
+
+	m_entries.push_back(m_part);
+	return S_OK;
+}
+
+void ZipWriter::AbandonPart(void)
+{
+	if (m_inPart)
+	{
+		m_deflater.Reset();
+		m_inPart = false;
+	}
+}
+
+HRESULT ZipWriter::WriteContentTypes(void)
+{
+	string contentTypes =
+		"<?xml version=\"1.0\" encoding=\"UTF-8\" standalone=\"yes\"?>\r\n"
+		"<Types xmlns=\"http://schemas.openxmlformats.org/package/2006/content-types\">";
+
+	for (size_t index = 0; index < m_entries.size(); index++)
+	{
+		if (m_entries[index].contentType.empty())
+		{
+			continue;
+		}
+
+		contentTypes += "<Override PartName=\"/";
+		contentTypes += m_entries[index].name;
+		contentTypes += "\" ContentType=\"";
+		contentTypes += m_entries[index].contentType;
+		contentTypes += "\"/>";
+	}
+
+	contentTypes += "</Types>";
+
+	ULONG written;
+
+	IfComFailRet(StartPart(ContentTypesPartName, nullptr));
+	IfComFailRet(Write(contentTypes.data(), (ULONG) contentTypes.size(), &written));
+	IfComFailRet(EndPart());
+
+	return S_OK;
+}
+
+HRESULT ZipWriter::WriteCentralDirectory(void)
+{
+	ULONGLONG directoryOffset = m_offset;
+
+	for (size_t index = 0; index < m_entries.size(); index++)
+	{
+		const Entry &entry = m_entries[index];
+
+		m_header.clear();
+		Append32(m_header, CentralHeaderSignature);
+		Append16(m_header, ZipVersion);
+		Append16(m_header, ZipVersion);
+		Append16(m_header, 0);
+		Append16(m_header, DeflateMethod);
+		Append16(m_header, m_time);
+		Append16(m_header, m_date);
+		Append32(m_header, entry.crc);
+		Append32(m_header, Zip64Marker);
+		Append32(m_header, Zip64Marker);
+		Append16(m_header, (UINT16) entry.name.size());
+		Append16(m_header, CentralExtraLength);
+		Append16(m_header, 0);
+		Append16(m_header, 0);
+		Append16(m_header, 0);
+		Append32(m_header, 0);
+		Append32(m_header, Zip64Marker);
+		Append(m_header, entry.name);
+		Append16(m_header, Zip64ExtraId);
+		Append16(m_header, CentralExtraLength - 4);
+		Append64(m_header, entry.size);
+		Append64(m_header, entry.compressedSize);
+		Append64(m_header, entry.offset);
+
+		IfComFailRet(WriteBytes(m_header.data(), m_header.size()));
+	}
+
+	ULONGLONG directorySize = m_offset - directoryOffset;
+	ULONGLONG entryCount = m_entries.size();
+	bool zip64 = entryCount >= 0xFFFF || directoryOffset >= Zip64Marker || directorySize >= Zip64Marker;
+
+	m_header.clear();
+
+	if (zip64)
+	{
+		ULONGLONG zip64EndOffset = m_offset;
+
+		Append32(m_header, Zip64EndSignature);
+		Append64(m_header, 44);
+		Append16(m_header, ZipVersion);
+		Append16(m_header, ZipVersion);
+		Append32(m_header, 0);
+		Append32(m_header, 0);
+		Append64(m_header, entryCount);
+		Append64(m_header, entryCount);
+		Append64(m_header, directorySize);
+		Append64(m_header, directoryOffset);
+
+		Append32(m_header, Zip64LocatorSignature);
+		Append32(m_header, 0);
+		Append64(m_header, zip64EndOffset);
+		Append32(m_header, 1);
+	}
+
+	Append32(m_header, EndSignature);
+	Append16(m_header, 0);
+	Append16(m_header, 0);
+	Append16(m_header, (UINT16) (zip64 ? 0xFFFF : entryCount));
+	Append16(m_header, (UINT16) (zip64 ? 0xFFFF : entryCount));
+	Append32(m_header, zip64 ? Zip64Marker : (UINT32) directorySize);
+	Append32(m_header, zip64 ? Zip64Marker : (UINT32) directoryOffset);
+	Append16(m_header, 0);
+
+	return WriteBytes(m_header.data(), m_header.size());
+}
+
+HRESULT ZipWriter::Close(void)
+{
+	HRESULT hr = S_OK;
+
+	AbandonPart();
+
+	IfComFailError(WriteContentTypes());
+	IfComFailError(WriteCentralDirectory());
+
+error:
+	HRESULT closeHr = m_file.Close();
+
+	if (SUCCEEDED(hr))
+	{
+		hr = closeHr;
+	}
+
+	m_status = E_UNEXPECTED;
+	return hr;
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "Deflate.h"
+#include "SnapshotStream.h"
+
+//
+// Writes an OPC package, which is a ZIP file, straight to disk a part at a time. A part is
+// compressed as it's written, so only the compressor's window of it is ever in memory. The
+// parts' content types go in [Content_Types].xml, which is written after them when the
+// package is closed, followed by the central directory.
+//
+// A part's size and CRC aren't known until it's finished, so its local header is written
+// with placeholders and patched afterwards. Every entry records its sizes in a Zip64
+// extra field, so the local header is the same size whether or not the part turns out to
+// be bigger than 4GB. The end of central directory record only uses Zip64 when it has to.
+//
+
+class ZipWriter sealed : public SnapshotStream
+{
+private:
+	struct Entry
+	{
+		std::string name;
+		std::string contentType;
+		UINT32 crc;
+		ULONGLONG compressedSize;
+		ULONGLONG size;
+		ULONGLONG offset;
+	};
+
+	FileStream m_file;
+	ULONGLONG m_offset;
+	HRESULT m_status;
+	UINT16 m_time;
+	UINT16 m_date;
+	std::vector<Entry> m_entries;
+	Entry m_part;
+	bool m_inPart;
+	Deflater m_deflater;
+	UINT32 m_crcTable[256];
+	std::vector<uint8_t> m_header;
+
+	ZipWriter(const ZipWriter &);
+	ZipWriter &operator=(const ZipWriter &);
+
+	static HRESULT ToAscii(const wchar_t *value, std::string *ascii);
+	HRESULT WriteBytes(const void *bytes, size_t length);
+	HRESULT WriteCompressed(void);
+	void BuildLocalHeader(const Entry &entry);
+	HRESULT WriteContentTypes(void);
+	HRESULT WriteCentralDirectory(void);
+
+public:
+	ZipWriter(void);
+
+	HRESULT Create(const wchar_t *fileName);
+
+	//
+	// Starts a part. Part names are ASCII, without the leading slash of the part URI. Parts
+	// without a content type are left out of [Content_Types].xml.
+	//
+
+	HRESULT StartPart(const wchar_t *name, const wchar_t *contentType);
+	HRESULT Write(const void *bytes, ULONG length, ULONG *written);
+	HRESULT EndPart(void);
+
+	//
+	// Drops the part being written, if there is one. What was written of it stays in the
+	// file, but nothing refers to it, so the package is still valid.
+	//
+
+	void AbandonPart(void);
+
+	//
+	// Writes [Content_Types].xml and the central directory, and closes the file. The file is
+	// closed even if that fails.
+	//
+
+	HRESULT Close(void);
+};
@@ -2,3 +2,21 @@
 #include <SDKDDKVer.h>
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
+
+#define IfComFailError(v) \
+	{ \
+		hr = (v) ; \
+		if (FAILED(hr)) \
+		{ \
+			goto error; \
+		} \
+	}
+
+#define IfComFailRet(v) \
+	{ \
+		HRESULT hr = (v) ; \
+		if (FAILED(hr)) \
+		{ \
+			return hr; \
+		} \
+	}
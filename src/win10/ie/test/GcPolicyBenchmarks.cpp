@@ -0,0 +1,179 @@
+#include <windows.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "Benchmark.h"
+
+using namespace std;
+
+static const unsigned JobCount = 5000;
+static const unsigned WorkerCount = 4;
+
+//
+// Each job builds enough garbage that collections come around every few jobs.
+//
+
+static const char jobScript[] =
+	"var list = [];\r\n"
+	"for (var index = 0; index < 20000; index++) {\r\n"
+	"    list.push({ index: index, text: 'item ' + index });\r\n"
+	"}\r\n";
+
+static bool WriteFileContents(const wstring &fileName, const void *contents, size_t length)
+{
+	FILE *file;
+	if (_wfopen_s(&file, fileName.c_str(), L"wb"))
+	{
+		return false;
+	}
+
+	bool written = fwrite(contents, 1, length, file) == length;
+	return fclose(file) == 0 && written;
+}
+
+//
+// Runs the host with the given arguments, its output thrown away, and collects what it
+// writes to stderr.
+//
+
+static bool RunHost(const wstring &host, const wstring &arguments, string *errors)
+{
+	SECURITY_ATTRIBUTES attributes = { sizeof(attributes), nullptr, TRUE };
+	HANDLE readPipe;
+	HANDLE writePipe;
+
+	if (!CreatePipe(&readPipe, &writePipe, &attributes, 0))
+	{
+		return false;
+	}
+
+	SetHandleInformation(readPipe, HANDLE_FLAG_INHERIT, 0);
+
+	HANDLE nul = CreateFileW(L"NUL", GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, &attributes, OPEN_EXISTING, 0, nullptr);
+	STARTUPINFOW startup = { sizeof(startup) };
+	PROCESS_INFORMATION process;
+
+	startup.dwFlags = STARTF_USESTDHANDLES;
+	startup.hStdInput = nul;
+	startup.hStdOutput = nul;
+	startup.hStdError = writePipe;
+
+	wstring commandLine = L"\"" + host + L"\" " + arguments;
+	vector<wchar_t> commandLineBuffer(commandLine.begin(), commandLine.end());
+	commandLineBuffer.push_back(L'\0');
+
+	BOOL created = CreateProcessW(host.c_str(), &commandLineBuffer[0], nullptr, nullptr, TRUE, 0, nullptr, nullptr, &startup, &process);
+
+	CloseHandle(writePipe);
+
+	if (nul != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(nul);
+	}
+
+	if (created)
+	{
+		char chunk[4096];
+		DWORD read;
+
+		while (ReadFile(readPipe, chunk, sizeof(chunk), &read, nullptr) && read > 0)
+		{
+			errors->append(chunk, read);
+		}
+
+		WaitForSingleObject(process.hProcess, INFINITE);
+		CloseHandle(process.hThread);
+		CloseHandle(process.hProcess);
+	}
+
+	CloseHandle(readPipe);
+	return created != FALSE;
+}
+
+//
+// Runs the same job list through ChakraHost.exe -jobs under each -gc policy, and reports
+// the throughput and job latencies from the host's summary line. ChakraHost.exe has to be
+// somewhere SearchPath looks, such as next to the benchmarks.
+//
+
+void BenchmarkGcPolicy(void)
+{
+	static const struct
+	{
+		const wchar_t *argument;
+		const char *name;
+	} policies[] =
+	{
+		{ L"-gc:default", "default" },
+		{ L"-gc:idle", "idle" },
+		{ L"-gc:collect", "collect" },
+	};
+
+	wchar_t host[MAX_PATH];
+	wchar_t directory[MAX_PATH];
+	DWORD length = SearchPathW(nullptr, L"ChakraHost.exe", nullptr, ARRAYSIZE(host), host, nullptr);
+
+	if (length == 0 || length >= ARRAYSIZE(host))
+	{
+		fwprintf(stderr, L"GcPolicy: ChakraHost.exe wasn't found\n");
+		return;
+	}
+
+	length = GetTempPathW(ARRAYSIZE(directory), directory);
+
+	if (length == 0 || length >= ARRAYSIZE(directory))
+	{
+		fwprintf(stderr, L"GcPolicy: there's no temporary directory\n");
+		return;
+	}
+
+	wstring scriptFileName = wstring(directory) + L"ChakraBenchmarksJob.js";
+	wstring jobListFileName = wstring(directory) + L"ChakraBenchmarksJobs.txt";
+
+	//
+	// The job list is written as UTF-16LE, with its byte order mark, so any path will do.
+	//
+
+	wstring jobList = L"\xFEFF";
+
+	for (unsigned index = 0; index < JobCount; index++)
+	{
+		jobList += L"\"" + scriptFileName + L"\"\n";
+	}
+
+	if (!WriteFileContents(scriptFileName, jobScript, sizeof(jobScript) - 1) ||
+		!WriteFileContents(jobListFileName, jobList.data(), jobList.size() * sizeof(wchar_t)))
+	{
+		fwprintf(stderr, L"GcPolicy: unable to write the job list\n");
+	}
+	else
+	{
+		for (size_t index = 0; index < ARRAYSIZE(policies); index++)
+		{
+			wstring arguments = wstring(policies[index].argument) + L" -jobs " + to_wstring(WorkerCount) + L" \"" + jobListFileName + L"\"";
+			string errors;
+			const char *summary;
+			double jobsPerSecond;
+			double p50;
+			double p99;
+			double p999;
+
+			if (!RunHost(host, arguments, &errors) ||
+				(summary = strstr(errors.c_str(), " s, ")) == nullptr ||
+				sscanf_s(summary, " s, %lf jobs/sec, latency p50 %lf ms, p99 %lf ms, p99.9 %lf ms", &jobsPerSecond, &p50, &p99, &p999) != 4)
+			{
+				fwprintf(stderr, L"GcPolicy: ChakraHost.exe %s didn't finish\n", arguments.c_str());
+				continue;
+			}
+
+			Report("GcPolicy jobs/sec", policies[index].name, jobsPerSecond, "jobs/s");
+			Report("GcPolicy p50", policies[index].name, p50, "ms");
+			Report("GcPolicy p99", policies[index].name, p99, "ms");
+			Report("GcPolicy p99.9", policies[index].name, p999, "ms");
+		}
+	}
+
+	DeleteFileW(scriptFileName.c_str());
+	DeleteFileW(jobListFileName.c_str());
+}
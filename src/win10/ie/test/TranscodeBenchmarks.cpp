@@ -0,0 +1,113 @@
+#include <windows.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include "../memory/Transcode.h"
+#include "Benchmark.h"
+
+using namespace std;
+
+static const size_t TextLength = 1024 * 1024;
+
+//
+// A megabyte of UTF-16 text of one kind: script source, which is nearly all ASCII, prose
+// with an accented letter every ten characters or so, CJK text, and text with an emoji
+// (a surrogate pair) among every few words.
+//
+
+static void MakeText(const char *kind, vector<uint16_t> *text)
+{
+	static const char source[] = "function fib(n) { return n < 2 ? n : fib(n - 1) + fib(n - 2); }\r\n";
+	UINT32 seed = 1;
+
+	text->clear();
+
+	while (text->size() < TextLength)
+	{
+		seed = seed * 1103515245 + 12345;
+		uint16_t random = (uint16_t) (seed >> 16);
+
+		if (strcmp(kind, "script") == 0)
+		{
+			text->push_back(source[text->size() % (sizeof(source) - 1)]);
+		}
+		else if (strcmp(kind, "accented") == 0)
+		{
+			text->push_back(random % 10 == 0 ? (uint16_t) (0xC0 + random % 0x40) : (uint16_t) ('a' + random % 26));
+		}
+		else if (strcmp(kind, "cjk") == 0)
+		{
+			text->push_back((uint16_t) (0x4E00 + random % 0x5000));
+		}
+		else if (random % 8 == 0)
+		{
+			text->push_back(0xD83D);
+			text->push_back((uint16_t) (0xDE00 + random % 0x50));
+		}
+		else
+		{
+			text->push_back(random % 6 == 0 ? ' ' : (uint16_t) ('a' + random % 26));
+		}
+	}
+}
+
+//
+// UTF-8 to UTF-16, as LoadScript does, and back, as the snapshot writer does, with the
+// code page functions the transcoder replaced and with the transcoder. Throughput is in
+// megabytes of input a second.
+//
+
+void BenchmarkTranscode(void)
+{
+	static const char *kinds[] = { "script", "accented", "cjk", "emoji" };
+	vector<uint16_t> utf16;
+	vector<uint8_t> utf8;
+	vector<uint16_t> widened;
+	vector<uint8_t> narrowed;
+
+	for (size_t kind = 0; kind < ARRAYSIZE(kinds); kind++)
+	{
+		MakeText(kinds[kind], &utf16);
+
+		utf8.resize(UTF8_LENGTH_FOR_UTF16(utf16.size()));
+		utf8.resize(Utf16ToUtf8(&utf16[0], utf16.size(), &utf8[0]));
+		widened.resize(UTF16_LENGTH_FOR_UTF8(utf8.size()));
+		narrowed.resize(UTF8_LENGTH_FOR_UTF16(utf16.size()));
+
+		double utf8Megabytes = utf8.size() / (1024.0 * 1024.0);
+		double utf16Megabytes = utf16.size() * sizeof(uint16_t) / (1024.0 * 1024.0);
+		char name[64];
+
+		sprintf_s(name, "Utf8ToUtf16 %s", kinds[kind]);
+
+		double oldSeconds = TimeBest(5, 20, [&]()
+		{
+			benchmarkSink += MultiByteToWideChar(CP_UTF8, 0, (const char *) &utf8[0], (int) utf8.size(), (wchar_t *) &widened[0], (int) widened.size());
+		});
+
+		double newSeconds = TimeBest(5, 20, [&]()
+		{
+			benchmarkSink += Utf8ToUtf16(&utf8[0], utf8.size(), &widened[0]);
+		});
+
+		Report(name, "MultiByteToWideChar", utf8Megabytes / oldSeconds, "MB/s");
+		Report(name, "Utf8ToUtf16", utf8Megabytes / newSeconds, "MB/s");
+		Report(name, "speedup", oldSeconds / newSeconds, "x");
+
+		sprintf_s(name, "Utf16ToUtf8 %s", kinds[kind]);
+
+		oldSeconds = TimeBest(5, 20, [&]()
+		{
+			benchmarkSink += WideCharToMultiByte(CP_UTF8, 0, (const wchar_t *) &utf16[0], (int) utf16.size(), (char *) &narrowed[0], (int) narrowed.size(), nullptr, nullptr);
+		});
+
+		newSeconds = TimeBest(5, 20, [&]()
+		{
+			benchmarkSink += Utf16ToUtf8(&utf16[0], utf16.size(), &narrowed[0]);
+		});
+
+		Report(name, "WideCharToMultiByte", utf16Megabytes / oldSeconds, "MB/s");
+		Report(name, "Utf16ToUtf8", utf16Megabytes / newSeconds, "MB/s");
+		Report(name, "speedup", oldSeconds / newSeconds, "x");
+	}
+}
@@ -0,0 +1,266 @@
+#include "stdafx.h"
+
+using namespace std;
+
+//
+// Field numbers from pprof's profile.proto.
+//
+
+enum ProfileField
+{
+	ProfileSampleType = 1,
+	ProfileSample = 2,
+	ProfileLocation = 4,
+	ProfileFunction = 5,
+	ProfileStringTable = 6,
+	ProfileDurationNanos = 10,
+	ProfileDefaultSampleType = 14
+};
+
+enum ValueTypeField
+{
+	ValueTypeType = 1,
+	ValueTypeUnit = 2
+};
+
+enum SampleField
+{
+	SampleLocationId = 1,
+	SampleValue = 2
+};
+
+enum LocationField
+{
+	LocationId = 1,
+	LocationLine = 4
+};
+
+enum LineField
+{
+	LineFunctionId = 1
+};
+
+enum FunctionField
+{
+	FunctionId = 1,
+	FunctionName = 2,
+	FunctionSystemName = 3,
+	FunctionFileName = 4
+};
+
+static const unsigned WireVarint = 0;
+static const unsigned WireLengthDelimited = 2;
+
+PprofWriter::PprofWriter(void) :
+	m_nextFunctionId(1)
+{
+	//
+	// The string table has to start with the empty string.
+	//
+
+	GetStringId(string());
+}
+
+void PprofWriter::AppendVarint(string &message, ULONGLONG value)
+{
+	while (value >= 0x80)
+	{
+		message += (char) (value | 0x80);
+		value >>= 7;
+	}
+
+	message += (char) value;
+}
+
+void PprofWriter::AppendVarintField(string &message, unsigned field, ULONGLONG value)
+{
+	AppendVarint(message, (field << 3) | WireVarint);
+	AppendVarint(message, value);
+}
+
+void PprofWriter::AppendBytesField(string &message, unsigned field, const string &bytes)
+{
+	AppendVarint(message, (field << 3) | WireLengthDelimited);
+	AppendVarint(message, bytes.length());
+	message += bytes;
+}
+
+ULONGLONG PprofWriter::GetStringId(const string &text)
+{
+	unordered_map<string, ULONGLONG>::iterator found = m_strings.find(text);
+
+	if (found != m_strings.end())
+	{
+		return found->second;
+	}
+
+	ULONGLONG id = m_strings.size();
+	m_strings[text] = id;
+	AppendBytesField(m_stringTable, ProfileStringTable, text);
+	return id;
+}
+
+ULONGLONG PprofWriter::GetStringId(const wstring &text)
+{
+	string utf8;
+
+	if (!text.empty())
+	{
+		utf8.resize(UTF8_LENGTH_FOR_UTF16(text.length()));
+		utf8.resize(Utf16ToUtf8((const uint16_t *) text.c_str(), text.length(), (uint8_t *) &utf8[0]));
+	}
+
+	return GetStringId(utf8);
+}
+
+void PprofWriter::AddSampleType(const char *type, const char *unit)
+{
+	string valueType;
+
+	AppendVarintField(valueType, ValueTypeType, GetStringId(string(type)));
+	AppendVarintField(valueType, ValueTypeUnit, GetStringId(string(unit)));
+	AppendBytesField(m_profile, ProfileSampleType, valueType);
+}
+
+void PprofWriter::SetDefaultSampleType(const char *type)
+{
+	AppendVarintField(m_profile, ProfileDefaultSampleType, GetStringId(string(type)));
+}
+
+void PprofWriter::SetDuration(ULONGLONG nanoseconds)
+{
+	AppendVarintField(m_profile, ProfileDurationNanos, nanoseconds);
+}
+
+ULONGLONG PprofWriter::AddFunction(const wstring &name, const wstring &fileName)
+{
+	ULONGLONG id = m_nextFunctionId++;
+	ULONGLONG nameId = GetStringId(name);
+	string function;
+	string line;
+	string location;
+
+	AppendVarintField(function, FunctionId, id);
+	AppendVarintField(function, FunctionName, nameId);
+	AppendVarintField(function, FunctionSystemName, nameId);
+	AppendVarintField(function, FunctionFileName, GetStringId(fileName));
+	AppendBytesField(m_profile, ProfileFunction, function);
+
+	AppendVarintField(line, LineFunctionId, id);
+	AppendVarintField(location, LocationId, id);
+	AppendBytesField(location, LocationLine, line);
+	AppendBytesField(m_profile, ProfileLocation, location);
+
+	return id;
+}
+
+//
+// Repeated numbers are written packed: one length-delimited field holding all the varints.
+// Values are never negative, so they don't need the ten byte form of a negative int64.
+//
+
+void PprofWriter::AddSample(const ULONGLONG *functions, size_t functionCount, const LONGLONG *values, size_t valueCount)
+{
+	string sample;
+	string packed;
+
+	for (size_t index = 0; index < functionCount; index++)
+	{
+		AppendVarint(packed, functions[index]);
+	}
+
+	AppendBytesField(sample, SampleLocationId, packed);
+	packed.clear();
+
+	for (size_t index = 0; index < valueCount; index++)
+	{
+		AppendVarint(packed, (ULONGLONG) values[index]);
+	}
+
+	AppendBytesField(sample, SampleValue, packed);
+	AppendBytesField(m_profile, ProfileSample, sample);
+}
+
+UINT32 PprofWriter::Crc32(const BYTE *bytes, size_t length)
+{
+	UINT32 table[256];
+
+	for (UINT32 index = 0; index < 256; index++)
+	{
+		UINT32 crc = index;
+
+		for (int bit = 0; bit < 8; bit++)
+		{
+			crc = (crc & 1) ? 0xEDB88320 ^ (crc >> 1) : crc >> 1;
+		}
+
+		table[index] = crc;
+	}
+
+	UINT32 crc = 0xFFFFFFFF;
+
+	for (size_t index = 0; index < length; index++)
+	{
+		crc = table[(crc ^ bytes[index]) & 0xFF] ^ (crc >> 8);
+	}
+
+	return crc ^ 0xFFFFFFFF;
+}
+
+//
+// The gzip wrapper (RFC 1952) is a fixed header with no name or timestamp, so the same
+// profile always gives the same file, then the deflate stream, its CRC and its length.
+//
+
+bool PprofWriter::Write(const wchar_t *fileName)
+{
+	string profile = m_profile + m_stringTable;
+	Deflater *deflater = new Deflater();
+
+	deflater->Write((const uint8_t *) profile.data(), profile.length());
+	deflater->Finish();
+
+	const BYTE header[] = { 0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 0xff };
+	UINT32 crc = Crc32((const BYTE *) profile.data(), profile.length());
+	UINT32 length = (UINT32) profile.length();
+	string gzip((const char *) header, sizeof(header));
+
+	gzip.append((const char *) &deflater->Output()[0], deflater->Output().size());
+	delete deflater;
+
+	for (int shift = 0; shift < 32; shift += 8)
+	{
+		gzip += (char) (crc >> shift);
+	}
+
+	for (int shift = 0; shift < 32; shift += 8)
+	{
+		gzip += (char) (length >> shift);
+	}
+
+	HANDLE file = CreateFileW(fileName, GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+
+	const char *current = gzip.data();
+	size_t remaining = gzip.length();
+
+	while (remaining > 0)
+	{
+		DWORD written;
+		DWORD chunk = remaining > MAXDWORD ? MAXDWORD : (DWORD) remaining;
+
+		if (!WriteFile(file, current, chunk, &written, nullptr) || written == 0)
+		{
+			break;
+		}
+
+		current += written;
+		remaining -= written;
+	}
+
+	CloseHandle(file);
+	return remaining == 0;
+}
@@ -0,0 +1,344 @@
+#include "stdafx.h"
+
+using namespace std;
+
+//
+// The engine module that produces the serialized buffers. Its build identity is part of
+// every cache key, since serialized scripts are only valid for the exact engine that
+// created them.
+//
+
+#ifdef USE_EDGEMODE_JSRT
+#define ENGINE_MODULE_NAME L"chakra.dll"
+#else
+#define ENGINE_MODULE_NAME L"jscript9.dll"
+#endif
+
+#define CACHE_FILE_MAGIC 0x4342534A // 'JSBC'
+#define CACHE_FILE_VERSION 2
+
+//
+// The header at the start of every cache file. The script source follows it, padded to
+// eight bytes so the serialized buffer after it stays aligned.
+//
+
+struct ScriptCacheHeader
+{
+	DWORD magic;
+	DWORD version;
+	DWORD engineTimestamp;
+	DWORD engineImageSize;
+	DWORD pointerSize;
+	DWORD bufferSize;
+	ULONGLONG sourceHash;
+	ULONGLONG sourceLength;
+};
+
+//
+// 64-bit FNV-1a hash of the script source.
+//
+
+static ULONGLONG HashScript(const wstring &script)
+{
+	const BYTE *current = (const BYTE *) script.c_str();
+	const BYTE *end = current + script.length() * sizeof(wchar_t);
+	ULONGLONG hash = 14695981039346656037ULL;
+
+	while (current < end)
+	{
+		hash ^= *current++;
+		hash *= 1099511628211ULL;
+	}
+
+	return hash;
+}
+
+static size_t GetBufferOffset(size_t sourceLength)
+{
+	return sizeof(ScriptCacheHeader) + ((sourceLength * sizeof(wchar_t) + 7) & ~(size_t) 7);
+}
+
+static void GetEngineVersion(DWORD *timestamp, DWORD *imageSize)
+{
+	*timestamp = 0;
+	*imageSize = 0;
+
+	HMODULE engine = GetModuleHandleW(ENGINE_MODULE_NAME);
+	if (engine == nullptr)
+	{
+		return;
+	}
+
+	const IMAGE_DOS_HEADER *dosHeader = (const IMAGE_DOS_HEADER *) engine;
+	if (dosHeader->e_magic != IMAGE_DOS_SIGNATURE)
+	{
+		return;
+	}
+
+	const IMAGE_NT_HEADERS *ntHeaders = (const IMAGE_NT_HEADERS *) ((const BYTE *) engine + dosHeader->e_lfanew);
+	if (ntHeaders->Signature != IMAGE_NT_SIGNATURE)
+	{
+		return;
+	}
+
+	*timestamp = ntHeaders->FileHeader.TimeDateStamp;
+	*imageSize = ntHeaders->OptionalHeader.SizeOfImage;
+}
+
+ScriptCache::ScriptCache(const wchar_t *directory) :
+	m_directory(directory),
+	m_size(0),
+	m_hits(0),
+	m_misses(0)
+{
+	if (!m_directory.empty() && m_directory.back() != L'\\' && m_directory.back() != L'/')
+	{
+		m_directory += L'\\';
+	}
+
+	CreateDirectoryW(m_directory.c_str(), nullptr);
+	GetEngineVersion(&m_engineTimestamp, &m_engineImageSize);
+}
+
+ScriptCache::~ScriptCache(void)
+{
+	Clear();
+}
+
+void ScriptCache::Clear(void)
+{
+	for (size_t index = 0; index < m_entries.size(); index++)
+	{
+		delete m_entries[index];
+	}
+
+	m_entries.clear();
+	m_index.clear();
+	m_size = 0;
+}
+
+wstring ScriptCache::GetDefaultDirectory(void)
+{
+	wchar_t path[MAX_PATH];
+	DWORD length = GetTempPathW(ARRAYSIZE(path), path);
+
+	if (length == 0 || length >= ARRAYSIZE(path))
+	{
+		return L".\\chakrahost\\";
+	}
+
+	return wstring(path, length) + L"chakrahost\\";
+}
+
+wstring ScriptCache::GetEntryPath(ULONGLONG hash)
+{
+	wchar_t name[32];
+	swprintf_s(name, L"%016llx.jsbc", hash);
+	return m_directory + name;
+}
+
+//
+// Map an existing cache file and check that it was produced from this exact source by
+// this exact engine.
+//
+
+bool ScriptCache::LoadEntry(ULONGLONG hash, Entry *entry)
+{
+	if (m_engineTimestamp == 0 || !entry->file.Open(GetEntryPath(hash).c_str()))
+	{
+		return false;
+	}
+
+	const ScriptCacheHeader *header = (const ScriptCacheHeader *) entry->file.Data();
+	size_t bufferOffset = GetBufferOffset(entry->script.length());
+
+	if (entry->file.Size() < sizeof(ScriptCacheHeader) ||
+		header->magic != CACHE_FILE_MAGIC ||
+		header->version != CACHE_FILE_VERSION ||
+		header->engineTimestamp != m_engineTimestamp ||
+		header->engineImageSize != m_engineImageSize ||
+		header->pointerSize != sizeof(void *) ||
+		header->sourceHash != hash ||
+		header->sourceLength != entry->script.length() ||
+		entry->file.Size() < bufferOffset ||
+		header->bufferSize != entry->file.Size() - bufferOffset ||
+		memcmp(header + 1, entry->script.c_str(), entry->script.length() * sizeof(wchar_t)) != 0)
+	{
+		entry->file.Close();
+		return false;
+	}
+
+	entry->bufferSize = header->bufferSize;
+	return true;
+}
+
+bool ScriptCache::SerializeEntry(Entry *entry)
+{
+	unsigned long bufferSize = 0;
+
+	if (JsSerializeScript(entry->script.c_str(), nullptr, &bufferSize) != JsNoError)
+	{
+		return false;
+	}
+
+	entry->buffer = new BYTE[bufferSize];
+	entry->bufferSize = bufferSize;
+
+	if (JsSerializeScript(entry->script.c_str(), entry->buffer, &entry->bufferSize) != JsNoError)
+	{
+		delete [] entry->buffer;
+		entry->buffer = nullptr;
+		entry->bufferSize = 0;
+		return false;
+	}
+
+	return true;
+}
+
+//
+// Write a freshly serialized entry to disk. The file is written under a temporary name
+// and then renamed into place, so concurrent hosts never see a partially written entry.
+//
+
+void ScriptCache::StoreEntry(ULONGLONG hash, Entry *entry)
+{
+	if (m_engineTimestamp == 0)
+	{
+		return;
+	}
+
+	wstring path = GetEntryPath(hash);
+	wstring temporaryPath = path + L"." + to_wstring(GetCurrentProcessId()) + L"." + to_wstring(GetCurrentThreadId()) + L".tmp";
+
+	HANDLE file = CreateFileW(temporaryPath.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_TEMPORARY, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		return;
+	}
+
+	ScriptCacheHeader header;
+	header.magic = CACHE_FILE_MAGIC;
+	header.version = CACHE_FILE_VERSION;
+	header.engineTimestamp = m_engineTimestamp;
+	header.engineImageSize = m_engineImageSize;
+	header.pointerSize = sizeof(void *);
+	header.bufferSize = entry->bufferSize;
+	header.sourceHash = hash;
+	header.sourceLength = entry->script.length();
+
+	DWORD sourceSize = (DWORD) (entry->script.length() * sizeof(wchar_t));
+	DWORD paddingSize = (DWORD) (GetBufferOffset(entry->script.length()) - sizeof(header) - sourceSize);
+	const BYTE padding[8] = {};
+
+	DWORD written;
+	bool succeeded =
+		WriteFile(file, &header, sizeof(header), &written, nullptr) && written == sizeof(header) &&
+		WriteFile(file, entry->script.c_str(), sourceSize, &written, nullptr) && written == sourceSize &&
+		WriteFile(file, padding, paddingSize, &written, nullptr) && written == paddingSize &&
+		WriteFile(file, entry->buffer, entry->bufferSize, &written, nullptr) && written == entry->bufferSize;
+
+	CloseHandle(file);
+
+	if (!succeeded || !MoveFileExW(temporaryPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING))
+	{
+		DeleteFileW(temporaryPath.c_str());
+	}
+}
+
+//
+// Run a script, using the serialized form from the cache if there is one and adding it
+// to the cache if there isn't.
+//
+
+JsErrorCode ScriptCache::RunScript(const wstring &script, JsSourceContext sourceContext, const wchar_t *sourceUrl, CompileStats *stats, JsValueRef *result)
+{
+	ULONGLONG hash = HashScript(script);
+	Entry *entry = nullptr;
+	ParseSource source = ParseSourceCacheHit;
+	CompileStats::Run run;
+
+	map<ULONGLONG, Entry *>::iterator existing = m_index.find(hash);
+	if (existing != m_index.end() && existing->second->script == script)
+	{
+		entry = existing->second;
+		m_hits++;
+	}
+	else
+	{
+		entry = new Entry();
+		entry->script = script;
+
+		if (LoadEntry(hash, entry))
+		{
+			m_hits++;
+		}
+		else
+		{
+			//
+			// Serializing the script compiles it, so on a miss the run is begun here and
+			// takes in the serialize as well as the run from the fresh buffer below.
+			//
+
+			if (stats != nullptr)
+			{
+				stats->BeginRun(&run, sourceUrl, ParseSourceCacheMiss);
+			}
+
+			if (!SerializeEntry(entry))
+			{
+				//
+				// The script couldn't be serialized, most likely because it has a syntax
+				// error. Run it from source so the error is reported the usual way.
+				//
+
+				if (stats != nullptr)
+				{
+					stats->EndRun(&run);
+				}
+
+				delete entry;
+
+				JsValueRef exception;
+				JsGetAndClearException(&exception);
+				return RunScriptTimed(stats, script.c_str(), nullptr, ParseSourceText, sourceContext, sourceUrl, result);
+			}
+
+			m_misses++;
+			source = ParseSourceCacheMiss;
+			StoreEntry(hash, entry);
+		}
+
+		//
+		// If another script with the same hash was already loaded, it stays alive (the
+		// engine may still be using it) but is no longer found by lookups.
+		//
+
+		m_entries.push_back(entry);
+		m_index[hash] = entry;
+		m_size += entry->script.length() * sizeof(wchar_t) + entry->bufferSize;
+	}
+
+	BYTE *buffer = entry->buffer != nullptr ? entry->buffer : (BYTE *) (entry->file.Data() + GetBufferOffset(entry->script.length()));
+	JsErrorCode errorCode = RunScriptTimed(stats, entry->script.c_str(), buffer, source, sourceContext, sourceUrl, result);
+
+	if (stats != nullptr && source == ParseSourceCacheMiss)
+	{
+		stats->EndRun(&run);
+	}
+
+	if (errorCode == JsErrorBadSerializedScript)
+	{
+		//
+		// The entry stays in m_entries in case the engine still refers to it, but it no
+		// longer counts toward the cache's size.
+		//
+
+		m_size -= entry->script.length() * sizeof(wchar_t) + entry->bufferSize;
+		entry->file.Close();
+		m_index.erase(hash);
+		DeleteFileW(GetEntryPath(hash).c_str());
+		return RunScriptTimed(stats, script.c_str(), nullptr, ParseSourceText, sourceContext, sourceUrl, result);
+	}
+
+	return errorCode;
+}
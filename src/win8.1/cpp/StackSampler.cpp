@@ -0,0 +1,341 @@
+#include "stdafx.h"
+#include <mmsystem.h>
+
+using namespace std;
+
+//
+// The shadow stack the current thread pushes onto, and the sampler it belongs to. As with
+// trace rings, samplers get unique ids so a stack left behind by one that's gone is never
+// mistaken for the current sampler's.
+//
+
+static __declspec(thread) void *currentStack = nullptr;
+static __declspec(thread) unsigned currentStackSampler = 0;
+static volatile long nextSamplerId = 0;
+
+//
+// Waits shorter than the system's default timer resolution need a finer one for as long
+// as sampling runs.
+//
+
+static const unsigned FineTimerRate = 64;
+
+StackSampler::StackSampler(CallTree *callTree) :
+	m_callTree(callTree),
+	m_id((unsigned) InterlockedIncrement(&nextSamplerId)),
+	m_stacks(nullptr),
+	m_stackCount(0),
+	m_stopping(false),
+	m_running(false),
+	m_rate(0),
+	m_ticks(0),
+	m_samples(0),
+	m_tornCopies(0),
+	m_elapsedTicks(0),
+	m_nanosecondsPerCall(0)
+{
+}
+
+StackSampler::~StackSampler(void)
+{
+	Stop();
+
+	ShadowStack *stack = m_stacks.load();
+	while (stack != nullptr)
+	{
+		ShadowStack *next = stack->next;
+		delete stack;
+		stack = next;
+	}
+}
+
+void StackSampler::Start(unsigned rate)
+{
+	m_rate = rate;
+	m_nanosecondsPerCall = MeasureCallCost();
+
+	if (m_rate > FineTimerRate)
+	{
+		timeBeginPeriod(1);
+	}
+
+	m_stopping = false;
+	m_running = true;
+	m_samplingThread = thread(&StackSampler::SamplingThread, this);
+}
+
+void StackSampler::Stop(void)
+{
+	if (!m_running)
+	{
+		return;
+	}
+
+	{
+		lock_guard<mutex> lock(m_stopLock);
+		m_stopping = true;
+	}
+
+	m_stop.notify_one();
+	m_samplingThread.join();
+	m_running = false;
+
+	if (m_rate > FineTimerRate)
+	{
+		timeEndPeriod(1);
+	}
+}
+
+StackSampler::ShadowStack *StackSampler::GetStack(void)
+{
+	if (currentStackSampler == m_id)
+	{
+		return (ShadowStack *) currentStack;
+	}
+
+	ShadowStack *stack = new ShadowStack();
+	stack->version = 0;
+	stack->depth = 0;
+
+	//
+	// Stacks are only ever added, so the sampling thread can walk the list without a lock.
+	//
+
+	stack->next = m_stacks.load();
+	while (!m_stacks.compare_exchange_weak(stack->next, stack))
+	{
+	}
+
+	m_stackCount++;
+	currentStack = stack;
+	currentStackSampler = m_id;
+	return stack;
+}
+
+void StackSampler::Push(ShadowStack *stack, ULONGLONG function)
+{
+	unsigned version = stack->version.load(memory_order_relaxed);
+
+	stack->version.store(version + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+
+	if (stack->depth < MaximumDepth)
+	{
+		stack->frames[stack->depth] = function;
+	}
+
+	stack->depth++;
+	stack->version.store(version + 2, memory_order_release);
+}
+
+void StackSampler::Pop(ShadowStack *stack, ULONGLONG function)
+{
+	//
+	// As in the call tree, an exit that doesn't match the innermost call also closes the
+	// calls above the one it does match, and an exit that matches none is ignored. Calls
+	// deeper than the stack holds can't be matched, so their exits are taken as they come.
+	//
+
+	size_t depth = stack->depth;
+
+	if (depth > MaximumDepth)
+	{
+		depth--;
+	}
+	else
+	{
+		while (depth > 0 && stack->frames[depth - 1] != function)
+		{
+			depth--;
+		}
+
+		if (depth == 0)
+		{
+			return;
+		}
+
+		depth--;
+	}
+
+	unsigned version = stack->version.load(memory_order_relaxed);
+
+	stack->version.store(version + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	stack->depth = depth;
+	stack->version.store(version + 2, memory_order_release);
+}
+
+bool StackSampler::Copy(ShadowStack *stack, vector<ULONGLONG> *frames)
+{
+	unsigned version = stack->version.load(memory_order_acquire);
+
+	if ((version & 1) != 0)
+	{
+		return false;
+	}
+
+	size_t depth = stack->depth;
+	if (depth > MaximumDepth)
+	{
+		depth = MaximumDepth;
+	}
+
+	frames->assign(stack->frames, stack->frames + depth);
+
+	atomic_thread_fence(memory_order_acquire);
+	return stack->version.load(memory_order_relaxed) == version;
+}
+
+void StackSampler::SetName(UINT32 scriptId, UINT32 functionId, const wchar_t *name, const wchar_t *hint)
+{
+	lock_guard<mutex> lock(m_treeLock);
+	m_callTree->SetName(scriptId, functionId, name, hint);
+}
+
+void StackSampler::Enter(UINT32 scriptId, UINT32 functionId)
+{
+	Push(GetStack(), CallTree::GetFunctionKey(scriptId, functionId));
+}
+
+void StackSampler::Exit(UINT32 scriptId, UINT32 functionId)
+{
+	Pop(GetStack(), CallTree::GetFunctionKey(scriptId, functionId));
+}
+
+void StackSampler::EnterByName(UINT32 nameId)
+{
+	Push(GetStack(), CallTree::GetNameKey(nameId));
+}
+
+void StackSampler::ExitByName(UINT32 nameId)
+{
+	Pop(GetStack(), CallTree::GetNameKey(nameId));
+}
+
+//
+// Take a sample of every thread's stack. A thread with nothing on its stack isn't running
+// script, so there's nothing to add for it.
+//
+
+void StackSampler::Sample(LONGLONG ticks, vector<ULONGLONG> *frames)
+{
+	for (ShadowStack *stack = m_stacks.load(memory_order_acquire); stack != nullptr; stack = stack->next)
+	{
+		bool copied = false;
+
+		for (unsigned attempt = 0; attempt < MaximumCopyAttempts && !copied; attempt++)
+		{
+			copied = Copy(stack, frames);
+
+			//
+			// A stack that's mid change belongs to a thread that may have been preempted in
+			// the middle of it, so let it run before trying again.
+			//
+
+			if (!copied)
+			{
+				m_tornCopies++;
+				SwitchToThread();
+			}
+		}
+
+		if (!copied || frames->empty())
+		{
+			continue;
+		}
+
+		lock_guard<mutex> lock(m_treeLock);
+		m_callTree->AddSample(frames->data(), frames->size(), ticks);
+		m_samples++;
+	}
+
+	m_ticks++;
+}
+
+void StackSampler::SamplingThread(void)
+{
+	vector<ULONGLONG> frames;
+	LARGE_INTEGER last;
+	LARGE_INTEGER now;
+
+	frames.reserve(MaximumDepth);
+	QueryPerformanceCounter(&last);
+
+	unique_lock<mutex> lock(m_stopLock);
+
+	while (!m_stopping)
+	{
+		m_stop.wait_for(lock, chrono::microseconds(1000000 / m_rate));
+
+		if (m_stopping)
+		{
+			break;
+		}
+
+		lock.unlock();
+
+		//
+		// Ticks come late as often as not, so each sample stands for the time since the
+		// last one rather than the interval asked for.
+		//
+
+		QueryPerformanceCounter(&now);
+		Sample(now.QuadPart - last.QuadPart, &frames);
+		m_elapsedTicks += now.QuadPart - last.QuadPart;
+		last = now;
+
+		lock.lock();
+	}
+}
+
+//
+// Time entering and leaving calls on a stack of our own, so the cost reported is what the
+// profiled script pays per call. The first pass just touches the stack's pages.
+//
+
+double StackSampler::MeasureCallCost(void)
+{
+	const size_t count = 256 * 1024;
+	ShadowStack *stack = new ShadowStack();
+	LARGE_INTEGER frequency;
+	LARGE_INTEGER start;
+	LARGE_INTEGER end;
+
+	QueryPerformanceFrequency(&frequency);
+	stack->version = 0;
+	stack->depth = 0;
+
+	for (int pass = 0; pass < 2; pass++)
+	{
+		QueryPerformanceCounter(&start);
+
+		for (size_t index = 0; index < count; index++)
+		{
+			Push(stack, index % MaximumDepth);
+
+			if (index % MaximumDepth == MaximumDepth - 1)
+			{
+				for (size_t frame = MaximumDepth; frame > 0; frame--)
+				{
+					Pop(stack, frame - 1);
+				}
+			}
+		}
+
+		QueryPerformanceCounter(&end);
+	}
+
+	delete stack;
+	return (end.QuadPart - start.QuadPart) * 1e9 / frequency.QuadPart / count;
+}
+
+void StackSampler::PrintSummary(void)
+{
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+
+	double seconds = (double) m_elapsedTicks / frequency.QuadPart;
+
+	fwprintf(stderr, L"chakrahost: sampling: %llu stacks from %u threads in %llu ticks at %u Hz (%.1f Hz achieved), %llu torn copies, %.1f ns per call\n",
+		m_samples, (unsigned) m_stackCount, m_ticks, m_rate, seconds > 0 ? m_ticks / seconds : 0, m_tornCopies, m_nanosecondsPerCall);
+}
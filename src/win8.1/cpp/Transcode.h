@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+//
+// Portable UTF-8 <-> UTF-16 transcoding. Runs of ASCII are converted 16 or 32 code units
+// at a time with SSE2/AVX2 when the compiler targets them, and 8 at a time otherwise;
+// everything else goes through a scalar path. Malformed input is replaced with U+FFFD,
+// as the Win32 code page functions do without MB_ERR_INVALID_CHARS.
+//
+
+//
+// A UTF-16 code unit never needs more than three bytes of UTF-8 (a surrogate pair needs
+// four bytes for two code units), and a byte of UTF-8 never produces more than one UTF-16
+// code unit.
+//
+
+#define UTF8_LENGTH_FOR_UTF16(length) ((length) * 3)
+#define UTF16_LENGTH_FOR_UTF8(length) (length)
+
+//
+// Transcode UTF-8 into UTF-16. The destination must have room for
+// UTF16_LENGTH_FOR_UTF8(sourceLength) code units. Returns the number of code units written.
+//
+
+size_t Utf8ToUtf16(const uint8_t *source, size_t sourceLength, uint16_t *destination);
+
+//
+// Transcode UTF-16 into UTF-8. The destination must have room for
+// UTF8_LENGTH_FOR_UTF16(sourceLength) bytes. Returns the number of bytes written.
+//
+
+size_t Utf16ToUtf8(const uint16_t *source, size_t sourceLength, uint8_t *destination);
@@ -0,0 +1,935 @@
+#include "stdafx.h"
+#include "BinarySnapshot.h"
+#include "Transcode.h"
+
+using namespace std;
+
+static const ULONGLONG TagEnd = 0;
+static const ULONGLONG TagObject = 1;
+static const ULONGLONG TagRemovedObjects = 2;
+
+static const ULONGLONG StringNew = 0;
+static const ULONGLONG StringInline = 1;
+static const ULONGLONG StringReferenceBase = 2;
+
+static const HRESULT InvalidSnapshot = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+
+BinarySnapshotWriter::BinarySnapshotWriter(SnapshotStream *stream) :
+	m_stream(stream),
+	m_buffer(new uint8_t[BufferCapacity]),
+	m_size(0),
+	m_previousId(0),
+	m_stringCount(0)
+{
+}
+
+BinarySnapshotWriter::~BinarySnapshotWriter(void)
+{
+	Flush();
+	delete [] m_buffer;
+}
+
+HRESULT BinarySnapshotWriter::Flush(void)
+{
+	const uint8_t *current = m_buffer;
+
+	while (m_size > 0)
+	{
+		ULONG written = 0;
+		HRESULT hr = m_stream->Write(current, (ULONG) m_size, &written);
+
+		if (FAILED(hr) || written == 0)
+		{
+			m_size = 0;
+			return FAILED(hr) ? hr : STG_E_CANTSAVE;
+		}
+
+		current += written;
+		m_size -= written;
+	}
+
+	return S_OK;
+}
+
+HRESULT BinarySnapshotWriter::Reserve(size_t length)
+{
+	if (m_size + length > BufferCapacity)
+	{
+		IfComFailRet(Flush());
+	}
+
+	return S_OK;
+}
+
+HRESULT BinarySnapshotWriter::WriteBytes(const void *bytes, size_t length)
+{
+	const uint8_t *current = (const uint8_t *) bytes;
+
+	while (length > 0)
+	{
+		if (m_size == BufferCapacity)
+		{
+			IfComFailRet(Flush());
+		}
+
+		size_t chunkLength = BufferCapacity - m_size;
+		if (chunkLength > length)
+		{
+			chunkLength = length;
+		}
+
+		memcpy(m_buffer + m_size, current, chunkLength);
+		m_size += chunkLength;
+		current += chunkLength;
+		length -= chunkLength;
+	}
+
+	return S_OK;
+}
+
+HRESULT BinarySnapshotWriter::WriteUInt32(UINT32 value)
+{
+	uint8_t bytes[] = { (uint8_t) value, (uint8_t) (value >> 8), (uint8_t) (value >> 16), (uint8_t) (value >> 24) };
+	return WriteBytes(bytes, sizeof(bytes));
+}
+
+HRESULT BinarySnapshotWriter::WriteVarint(ULONGLONG value)
+{
+	const size_t maximumVarintLength = 10;
+
+	IfComFailRet(Reserve(maximumVarintLength));
+
+	uint8_t *current = m_buffer + m_size;
+
+	while (value >= 0x80)
+	{
+		*current++ = (uint8_t) (value | 0x80);
+		value >>= 7;
+	}
+
+	*current++ = (uint8_t) value;
+	m_size = current - m_buffer;
+	return S_OK;
+}
+
+//
+// Zigzag encoding interleaves negative and positive values (0, -1, 1, -2, ...), so small
+// deltas in either direction make short varints.
+//
+
+HRESULT BinarySnapshotWriter::WriteZigzag(LONGLONG value)
+{
+	return WriteVarint(((ULONGLONG) value << 1) ^ (ULONGLONG) (value >> 63));
+}
+
+HRESULT BinarySnapshotWriter::WriteId(ULONG_PTR id, ULONG_PTR baseId)
+{
+	return WriteZigzag((LONGLONG) ((ULONGLONG) id - (ULONGLONG) baseId));
+}
+
+HRESULT BinarySnapshotWriter::WriteUtf8(const wchar_t *value, size_t length)
+{
+	size_t byteCount = 0;
+
+	if (length > 0)
+	{
+		if (m_scratch.size() < UTF8_LENGTH_FOR_UTF16(length))
+		{
+			m_scratch.resize(UTF8_LENGTH_FOR_UTF16(length));
+		}
+
+		byteCount = Utf16ToUtf8((const uint16_t *) value, length, m_scratch.data());
+	}
+
+	IfComFailRet(WriteVarint(byteCount));
+	return WriteBytes(m_scratch.data(), byteCount);
+}
+
+HRESULT BinarySnapshotWriter::WriteString(const wchar_t *value)
+{
+	if (value == nullptr)
+	{
+		value = L"";
+	}
+
+	size_t length = wcslen(value);
+
+	if (length > MaximumInternedLength)
+	{
+		IfComFailRet(WriteVarint(StringInline));
+		return WriteUtf8(value, length);
+	}
+
+	pair<unordered_map<wstring, ULONGLONG>::iterator, bool> inserted = m_strings.insert(make_pair(wstring(value, length), m_stringCount));
+
+	if (!inserted.second)
+	{
+		return WriteVarint(inserted.first->second + StringReferenceBase);
+	}
+
+	m_stringCount++;
+	IfComFailRet(WriteVarint(StringNew));
+	return WriteUtf8(value, length);
+}
+
+HRESULT BinarySnapshotWriter::WriteRelationship(ULONG_PTR objectId, const PROFILER_HEAP_OBJECT_RELATIONSHIP *relationship)
+{
+	IfComFailRet(WriteVarint((UINT32) (relationship->relationshipId + 1)));
+	IfComFailRet(WriteVarint((UINT32) relationship->relationshipInfo));
+
+	switch (relationship->relationshipInfo)
+	{
+	case PROFILER_PROPERTY_TYPE_NUMBER:
+		return WriteBytes(&relationship->numberValue, sizeof(relationship->numberValue));
+
+	case PROFILER_PROPERTY_TYPE_STRING:
+		return WriteString(relationship->stringValue);
+
+	case PROFILER_PROPERTY_TYPE_HEAP_OBJECT:
+		return WriteId(relationship->objectId, objectId);
+
+	case PROFILER_PROPERTY_TYPE_EXTERNAL_OBJECT:
+		return WriteVarint((ULONG_PTR) relationship->externalObjectAddress);
+
+	case PROFILER_PROPERTY_TYPE_BSTR:
+		return WriteString(relationship->bstrValue);
+
+	default:
+		return S_OK;
+	}
+}
+
+HRESULT BinarySnapshotWriter::WriteRelationshipList(ULONG_PTR objectId, const PROFILER_HEAP_OBJECT_RELATIONSHIP_LIST *list)
+{
+	IfComFailRet(WriteVarint(list->count));
+
+	for (unsigned index = 0; index < list->count; index++)
+	{
+		IfComFailRet(WriteRelationship(objectId, &list->elements[index]));
+	}
+
+	return S_OK;
+}
+
+HRESULT BinarySnapshotWriter::WriteHeader(const wchar_t **nameIdMap, UINT nameCount)
+{
+	IfComFailRet(WriteUInt32(BinarySnapshotMagic));
+	IfComFailRet(WriteUInt32(BinarySnapshotVersion));
+	IfComFailRet(WriteUInt32(sizeof(ULONG_PTR)));
+	IfComFailRet(WriteVarint(nameCount));
+
+	for (UINT index = 0; index < nameCount; index++)
+	{
+		const wchar_t *name = nameIdMap[index];
+
+		if (name == nullptr)
+		{
+			IfComFailRet(WriteVarint(0));
+			continue;
+		}
+
+		size_t length = wcslen(name);
+
+		IfComFailRet(WriteVarint(1));
+		IfComFailRet(WriteUtf8(name, length));
+
+		m_strings.insert(make_pair(wstring(name, length), (ULONGLONG) index));
+	}
+
+	m_stringCount = nameCount;
+	return S_OK;
+}
+
+HRESULT BinarySnapshotWriter::WriteObject(const PROFILER_HEAP_OBJECT *object, const PROFILER_HEAP_OBJECT_OPTIONAL_INFO *optionalInfo)
+{
+	ULONG_PTR objectId = object->objectId;
+
+	IfComFailRet(WriteVarint(TagObject));
+	IfComFailRet(WriteVarint(object->flags));
+	IfComFailRet(WriteId(objectId, m_previousId));
+	IfComFailRet(WriteVarint((UINT32) (object->typeNameId + 1)));
+	IfComFailRet(WriteVarint(object->size));
+	IfComFailRet(WriteVarint(object->optionalInfoCount));
+
+	m_previousId = objectId;
+
+	for (unsigned index = 0; index < object->optionalInfoCount; index++)
+	{
+		const PROFILER_HEAP_OBJECT_OPTIONAL_INFO &info = optionalInfo[index];
+
+		IfComFailRet(WriteVarint((UINT32) info.infoType));
+
+		switch (info.infoType)
+		{
+		case PROFILER_HEAP_OBJECT_OPTIONAL_INFO_PROTOTYPE:
+			IfComFailRet(WriteId(info.prototype, objectId));
+			break;
+		case PROFILER_HEAP_OBJECT_OPTIONAL_INFO_FUNCTION_NAME:
+			IfComFailRet(WriteString(info.functionName));
+			break;
+		case PROFILER_HEAP_OBJECT_OPTIONAL_INFO_ELEMENT_ATTRIBUTES_SIZE:
+			IfComFailRet(WriteVarint(info.elementAttributesSize));
+			break;
+		case PROFILER_HEAP_OBJECT_OPTIONAL_INFO_ELEMENT_TEXT_CHILDREN_SIZE:
+			IfComFailRet(WriteVarint(info.elementTextChildrenSize));
+			break;
+		case PROFILER_HEAP_OBJECT_OPTIONAL_INFO_SCOPE_LIST:
+			IfComFailRet(WriteVarint(info.scopeList->count));
+			for (unsigned scopeIndex = 0; scopeIndex < info.scopeList->count; scopeIndex++)
+			{
+				IfComFailRet(WriteId(info.scopeList->scopes[scopeIndex], objectId));
+			}
+			break;
+		case PROFILER_HEAP_OBJECT_OPTIONAL_INFO_INTERNAL_PROPERTY:
+			IfComFailRet(WriteRelationship(objectId, info.internalProperty));
+			break;
+		case PROFILER_HEAP_OBJECT_OPTIONAL_INFO_NAME_PROPERTIES:
+			IfComFailRet(WriteRelationshipList(objectId, info.namePropertyList));
+			break;
+		case PROFILER_HEAP_OBJECT_OPTIONAL_INFO_INDEX_PROPERTIES:
+			IfComFailRet(WriteRelationshipList(objectId, info.indexPropertyList));
+			break;
+		case PROFILER_HEAP_OBJECT_OPTIONAL_INFO_RELATIONSHIPS:
+			IfComFailRet(WriteRelationshipList(objectId, info.relationshipList));
+			break;
+		case PROFILER_HEAP_OBJECT_OPTIONAL_INFO_WINRTEVENTS:
+			IfComFailRet(WriteRelationshipList(objectId, info.eventList));
+			break;
+		case PROFILER_HEAP_OBJECT_OPTIONAL_INFO_WEAKMAP_COLLECTION_LIST:
+			IfComFailRet(WriteRelationshipList(objectId, info.weakMapCollectionList));
+			break;
+		case PROFILER_HEAP_OBJECT_OPTIONAL_INFO_MAP_COLLECTION_LIST:
+			IfComFailRet(WriteRelationshipList(objectId, info.mapCollectionList));
+			break;
+		case PROFILER_HEAP_OBJECT_OPTIONAL_INFO_SET_COLLECTION_LIST:
+			IfComFailRet(WriteRelationshipList(objectId, info.setCollectionList));
+			break;
+		}
+	}
+
+	return S_OK;
+}
+
+HRESULT BinarySnapshotWriter::WriteRemovedObjects(const vector<ULONG_PTR> &objectIds)
+{
+	ULONG_PTR previousId = 0;
+
+	IfComFailRet(WriteVarint(TagRemovedObjects));
+	IfComFailRet(WriteVarint(objectIds.size()));
+
+	for (size_t index = 0; index < objectIds.size(); index++)
+	{
+		IfComFailRet(WriteId(objectIds[index], previousId));
+		previousId = objectIds[index];
+	}
+
+	return S_OK;
+}
+
+HRESULT BinarySnapshotWriter::WriteEnd(void)
+{
+	IfComFailRet(WriteVarint(TagEnd));
+	return Flush();
+}
+
+BinarySnapshotReader::BinarySnapshotReader(const uint8_t *snapshot, size_t length) :
+	m_current(snapshot),
+	m_end(snapshot + length),
+	m_finished(false),
+	m_previousId(0),
+	m_refCount(1),
+	m_delta(false)
+{
+}
+
+BinarySnapshotReader::~BinarySnapshotReader(void)
+{
+}
+
+HRESULT BinarySnapshotReader::ReadBytes(void *bytes, size_t length)
+{
+	if ((size_t) (m_end - m_current) < length)
+	{
+		return InvalidSnapshot;
+	}
+
+	memcpy(bytes, m_current, length);
+	m_current += length;
+	return S_OK;
+}
+
+HRESULT BinarySnapshotReader::ReadUInt32(UINT32 *value)
+{
+	uint8_t bytes[4];
+
+	IfComFailRet(ReadBytes(bytes, sizeof(bytes)));
+	*value = bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((UINT32) bytes[3] << 24);
+	return S_OK;
+}
+
+HRESULT BinarySnapshotReader::ReadVarint(ULONGLONG *value)
+{
+	ULONGLONG result = 0;
+
+	for (unsigned shift = 0; shift < 64 && m_current < m_end; shift += 7)
+	{
+		uint8_t byte = *m_current++;
+		result |= (ULONGLONG) (byte & 0x7f) << shift;
+
+		if ((byte & 0x80) == 0)
+		{
+			*value = result;
+			return S_OK;
+		}
+	}
+
+	return InvalidSnapshot;
+}
+
+HRESULT BinarySnapshotReader::ReadVarint(UINT *value)
+{
+	ULONGLONG result;
+
+	IfComFailRet(ReadVarint(&result));
+
+	if (result > UINT_MAX)
+	{
+		return InvalidSnapshot;
+	}
+
+	*value = (UINT) result;
+	return S_OK;
+}
+
+HRESULT BinarySnapshotReader::ReadZigzag(LONGLONG *value)
+{
+	ULONGLONG result;
+
+	IfComFailRet(ReadVarint(&result));
+	*value = (LONGLONG) (result >> 1) ^ -(LONGLONG) (result & 1);
+	return S_OK;
+}
+
+HRESULT BinarySnapshotReader::ReadId(ULONG_PTR baseId, ULONG_PTR *id)
+{
+	LONGLONG delta;
+
+	IfComFailRet(ReadZigzag(&delta));
+	*id = (ULONG_PTR) ((ULONGLONG) baseId + (ULONGLONG) delta);
+	return S_OK;
+}
+
+HRESULT BinarySnapshotReader::ReadUtf8(wstring *value)
+{
+	ULONGLONG byteCount;
+
+	IfComFailRet(ReadVarint(&byteCount));
+
+	if ((ULONGLONG) (m_end - m_current) < byteCount)
+	{
+		return InvalidSnapshot;
+	}
+
+	value->clear();
+
+	if (byteCount > 0)
+	{
+		value->resize(UTF16_LENGTH_FOR_UTF8((size_t) byteCount));
+		value->resize(Utf8ToUtf16(m_current, (size_t) byteCount, (uint16_t *) &(*value)[0]));
+		m_current += byteCount;
+	}
+
+	return S_OK;
+}
+
+HRESULT BinarySnapshotReader::ReadString(DecodedObject *decoded, const wchar_t **value)
+{
+	ULONGLONG reference;
+
+	IfComFailRet(ReadVarint(&reference));
+
+	//
+	// Strings live in deques, which never move their elements, so the pointers handed out
+	// stay valid as more strings are added.
+	//
+
+	if (reference == StringNew)
+	{
+		m_strings.push_back(wstring());
+		IfComFailRet(ReadUtf8(&m_strings.back()));
+		*value = m_strings.back().c_str();
+	}
+	else if (reference == StringInline)
+	{
+		decoded->strings.push_back(wstring());
+		IfComFailRet(ReadUtf8(&decoded->strings.back()));
+		*value = decoded->strings.back().c_str();
+	}
+	else
+	{
+		if (reference - StringReferenceBase >= m_strings.size())
+		{
+			return InvalidSnapshot;
+		}
+
+		*value = m_strings[(size_t) (reference - StringReferenceBase)].c_str();
+	}
+
+	return S_OK;
+}
+
+HRESULT BinarySnapshotReader::ReadRelationship(DecodedObject *decoded, ULONG_PTR objectId, PROFILER_HEAP_OBJECT_RELATIONSHIP *relationship)
+{
+	UINT relationshipId;
+	UINT relationshipInfo;
+
+	ZeroMemory(relationship, sizeof(*relationship));
+	IfComFailRet(ReadVarint(&relationshipId));
+	IfComFailRet(ReadVarint(&relationshipInfo));
+
+	relationship->relationshipId = relationshipId - 1;
+	relationship->relationshipInfo = (PROFILER_RELATIONSHIP_INFO) relationshipInfo;
+
+	switch (relationship->relationshipInfo)
+	{
+	case PROFILER_PROPERTY_TYPE_NUMBER:
+		return ReadBytes(&relationship->numberValue, sizeof(relationship->numberValue));
+
+	case PROFILER_PROPERTY_TYPE_STRING:
+		return ReadString(decoded, &relationship->stringValue);
+
+	case PROFILER_PROPERTY_TYPE_HEAP_OBJECT:
+		{
+			ULONG_PTR id;
+			IfComFailRet(ReadId(objectId, &id));
+			relationship->objectId = id;
+			return S_OK;
+		}
+
+	case PROFILER_PROPERTY_TYPE_EXTERNAL_OBJECT:
+		{
+			ULONGLONG address;
+			IfComFailRet(ReadVarint(&address));
+			relationship->externalObjectAddress = (void *) (ULONG_PTR) address;
+			return S_OK;
+		}
+
+	case PROFILER_PROPERTY_TYPE_BSTR:
+		{
+			const wchar_t *value;
+			IfComFailRet(ReadString(decoded, &value));
+			relationship->bstrValue = (BSTR) value;
+			return S_OK;
+		}
+
+	default:
+		return S_OK;
+	}
+}
+
+HRESULT BinarySnapshotReader::ReadRelationshipList(DecodedObject *decoded, ULONG_PTR objectId, PROFILER_HEAP_OBJECT_RELATIONSHIP_LIST **list)
+{
+	UINT count;
+
+	IfComFailRet(ReadVarint(&count));
+
+	//
+	// Every relationship takes at least two bytes, so a count larger than what's left is
+	// corrupt, and isn't used to size the allocation.
+	//
+
+	if ((size_t) (m_end - m_current) / 2 < count)
+	{
+		return InvalidSnapshot;
+	}
+
+	size_t size = offsetof(PROFILER_HEAP_OBJECT_RELATIONSHIP_LIST, elements) + count * sizeof(PROFILER_HEAP_OBJECT_RELATIONSHIP);
+	if (size < sizeof(PROFILER_HEAP_OBJECT_RELATIONSHIP_LIST))
+	{
+		size = sizeof(PROFILER_HEAP_OBJECT_RELATIONSHIP_LIST);
+	}
+
+	decoded->blocks.push_back(unique_ptr<uint8_t[]>(new uint8_t[size]));
+	*list = (PROFILER_HEAP_OBJECT_RELATIONSHIP_LIST *) decoded->blocks.back().get();
+	(*list)->count = count;
+
+	for (UINT index = 0; index < count; index++)
+	{
+		IfComFailRet(ReadRelationship(decoded, objectId, &(*list)->elements[index]));
+	}
+
+	return S_OK;
+}
+
+HRESULT BinarySnapshotReader::ReadOptionalInfo(DecodedObject *decoded, ULONG_PTR objectId, PROFILER_HEAP_OBJECT_OPTIONAL_INFO *optionalInfo)
+{
+	UINT infoType;
+
+	ZeroMemory(optionalInfo, sizeof(*optionalInfo));
+	IfComFailRet(ReadVarint(&infoType));
+
+	optionalInfo->infoType = (PROFILER_HEAP_OBJECT_OPTIONAL_INFO_TYPE) infoType;
+
+	switch (optionalInfo->infoType)
+	{
+	case PROFILER_HEAP_OBJECT_OPTIONAL_INFO_PROTOTYPE:
+		{
+			ULONG_PTR prototype;
+			IfComFailRet(ReadId(objectId, &prototype));
+			optionalInfo->prototype = prototype;
+			return S_OK;
+		}
+
+	case PROFILER_HEAP_OBJECT_OPTIONAL_INFO_FUNCTION_NAME:
+		return ReadString(decoded, &optionalInfo->functionName);
+
+	case PROFILER_HEAP_OBJECT_OPTIONAL_INFO_ELEMENT_ATTRIBUTES_SIZE:
+		{
+			UINT size;
+			IfComFailRet(ReadVarint(&size));
+			optionalInfo->elementAttributesSize = size;
+			return S_OK;
+		}
+
+	case PROFILER_HEAP_OBJECT_OPTIONAL_INFO_ELEMENT_TEXT_CHILDREN_SIZE:
+		{
+			UINT size;
+			IfComFailRet(ReadVarint(&size));
+			optionalInfo->elementTextChildrenSize = size;
+			return S_OK;
+		}
+
+	case PROFILER_HEAP_OBJECT_OPTIONAL_INFO_SCOPE_LIST:
+		{
+			UINT count;
+			IfComFailRet(ReadVarint(&count));
+
+			if ((size_t) (m_end - m_current) < count)
+			{
+				return InvalidSnapshot;
+			}
+
+			size_t size = offsetof(PROFILER_HEAP_OBJECT_SCOPE_LIST, scopes) + count * sizeof(PROFILER_HEAP_OBJECT_ID);
+			if (size < sizeof(PROFILER_HEAP_OBJECT_SCOPE_LIST))
+			{
+				size = sizeof(PROFILER_HEAP_OBJECT_SCOPE_LIST);
+			}
+
+			decoded->blocks.push_back(unique_ptr<uint8_t[]>(new uint8_t[size]));
+			optionalInfo->scopeList = (PROFILER_HEAP_OBJECT_SCOPE_LIST *) decoded->blocks.back().get();
+			optionalInfo->scopeList->count = count;
+
+			for (UINT index = 0; index < count; index++)
+			{
+				ULONG_PTR scope;
+				IfComFailRet(ReadId(objectId, &scope));
+				optionalInfo->scopeList->scopes[index] = scope;
+			}
+
+			return S_OK;
+		}
+
+	case PROFILER_HEAP_OBJECT_OPTIONAL_INFO_INTERNAL_PROPERTY:
+		decoded->blocks.push_back(unique_ptr<uint8_t[]>(new uint8_t[sizeof(PROFILER_HEAP_OBJECT_RELATIONSHIP)]));
+		optionalInfo->internalProperty = (PROFILER_HEAP_OBJECT_RELATIONSHIP *) decoded->blocks.back().get();
+		return ReadRelationship(decoded, objectId, optionalInfo->internalProperty);
+
+	case PROFILER_HEAP_OBJECT_OPTIONAL_INFO_NAME_PROPERTIES:
+		return ReadRelationshipList(decoded, objectId, &optionalInfo->namePropertyList);
+
+	case PROFILER_HEAP_OBJECT_OPTIONAL_INFO_INDEX_PROPERTIES:
+		return ReadRelationshipList(decoded, objectId, &optionalInfo->indexPropertyList);
+
+	case PROFILER_HEAP_OBJECT_OPTIONAL_INFO_RELATIONSHIPS:
+		return ReadRelationshipList(decoded, objectId, &optionalInfo->relationshipList);
+
+	case PROFILER_HEAP_OBJECT_OPTIONAL_INFO_WINRTEVENTS:
+		return ReadRelationshipList(decoded, objectId, &optionalInfo->eventList);
+
+	case PROFILER_HEAP_OBJECT_OPTIONAL_INFO_WEAKMAP_COLLECTION_LIST:
+		return ReadRelationshipList(decoded, objectId, &optionalInfo->weakMapCollectionList);
+
+	case PROFILER_HEAP_OBJECT_OPTIONAL_INFO_MAP_COLLECTION_LIST:
+		return ReadRelationshipList(decoded, objectId, &optionalInfo->mapCollectionList);
+
+	case PROFILER_HEAP_OBJECT_OPTIONAL_INFO_SET_COLLECTION_LIST:
+		return ReadRelationshipList(decoded, objectId, &optionalInfo->setCollectionList);
+
+	default:
+		return S_OK;
+	}
+}
+
+HRESULT BinarySnapshotReader::ReadRemovedObjects(void)
+{
+	ULONGLONG count;
+	ULONG_PTR objectId = 0;
+
+	IfComFailRet(ReadVarint(&count));
+
+	//
+	// Every id takes at least a byte, which stops a corrupt count from reserving more memory
+	// than the snapshot could need.
+	//
+
+	if (m_delta || count > (ULONGLONG) (m_end - m_current))
+	{
+		return InvalidSnapshot;
+	}
+
+	m_delta = true;
+	m_removedObjectIds.reserve((size_t) count);
+
+	for (ULONGLONG index = 0; index < count; index++)
+	{
+		IfComFailRet(ReadId(objectId, &objectId));
+		m_removedObjectIds.push_back(objectId);
+	}
+
+	return S_OK;
+}
+
+HRESULT BinarySnapshotReader::ReadObject(DecodedObject **decoded)
+{
+	ULONGLONG tag;
+
+	*decoded = nullptr;
+	IfComFailRet(ReadVarint(&tag));
+
+	if (tag == TagRemovedObjects)
+	{
+		IfComFailRet(ReadRemovedObjects());
+		IfComFailRet(ReadVarint(&tag));
+
+		if (tag != TagEnd)
+		{
+			return InvalidSnapshot;
+		}
+	}
+
+	if (tag == TagEnd)
+	{
+		m_finished = true;
+		return S_OK;
+	}
+
+	if (tag != TagObject)
+	{
+		return InvalidSnapshot;
+	}
+
+	unique_ptr<DecodedObject> object(new DecodedObject());
+	PROFILER_HEAP_OBJECT &heapObject = object->object;
+	UINT flags;
+	ULONG_PTR objectId;
+	UINT typeNameId;
+	UINT size;
+	UINT optionalInfoCount;
+
+	IfComFailRet(ReadVarint(&flags));
+	IfComFailRet(ReadId(m_previousId, &objectId));
+	IfComFailRet(ReadVarint(&typeNameId));
+	IfComFailRet(ReadVarint(&size));
+	IfComFailRet(ReadVarint(&optionalInfoCount));
+
+	if (optionalInfoCount > USHRT_MAX)
+	{
+		return InvalidSnapshot;
+	}
+
+	m_previousId = objectId;
+
+	ZeroMemory(&heapObject, sizeof(heapObject));
+	heapObject.flags = flags;
+	heapObject.size = size;
+	heapObject.objectId = objectId;
+	heapObject.typeNameId = typeNameId - 1;
+	heapObject.optionalInfoCount = (USHORT) optionalInfoCount;
+
+	object->optionalInfo.resize(optionalInfoCount);
+
+	for (UINT index = 0; index < optionalInfoCount; index++)
+	{
+		IfComFailRet(ReadOptionalInfo(object.get(), objectId, &object->optionalInfo[index]));
+	}
+
+	*decoded = object.release();
+	return S_OK;
+}
+
+HRESULT BinarySnapshotReader::Open(void)
+{
+	UINT32 magic;
+	UINT32 version;
+	UINT32 pointerSize;
+	UINT nameCount;
+
+	IfComFailRet(ReadUInt32(&magic));
+	IfComFailRet(ReadUInt32(&version));
+	IfComFailRet(ReadUInt32(&pointerSize));
+
+	if (magic != BinarySnapshotMagic || version != BinarySnapshotVersion)
+	{
+		return InvalidSnapshot;
+	}
+
+	//
+	// Ids from a 64-bit process won't fit in a 32-bit one's.
+	//
+
+	if (pointerSize > sizeof(ULONG_PTR))
+	{
+		return HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+	}
+
+	IfComFailRet(ReadVarint(&nameCount));
+
+	if ((size_t) (m_end - m_current) < nameCount)
+	{
+		return InvalidSnapshot;
+	}
+
+	for (UINT index = 0; index < nameCount; index++)
+	{
+		ULONGLONG present;
+
+		IfComFailRet(ReadVarint(&present));
+		m_strings.push_back(wstring());
+
+		if (present)
+		{
+			IfComFailRet(ReadUtf8(&m_strings.back()));
+			m_nameIdMap.push_back(m_strings.back().c_str());
+		}
+		else
+		{
+			m_nameIdMap.push_back(nullptr);
+		}
+	}
+
+	return S_OK;
+}
+
+HRESULT BinarySnapshotReader::QueryInterface(REFIID riid, void **ppvObj)
+{
+	if (riid == IID_IUnknown)
+	{
+		*ppvObj = (IUnknown *) this;
+	}
+	else if (riid == __uuidof(IActiveScriptProfilerHeapEnum))
+	{
+		*ppvObj = (IActiveScriptProfilerHeapEnum *) this;
+	}
+	else
+	{
+		*ppvObj = NULL;
+		return E_NOINTERFACE;
+	}
+
+	AddRef();
+	return NOERROR;
+}
+
+ULONG BinarySnapshotReader::AddRef()
+{
+	return InterlockedIncrement(&m_refCount);
+}
+
+ULONG BinarySnapshotReader::Release()
+{
+	long lw;
+
+	if (0 == (lw = InterlockedDecrement(&m_refCount)))
+	{
+		delete this;
+	}
+	return lw;
+}
+
+HRESULT BinarySnapshotReader::Next(ULONG celt, PROFILER_HEAP_OBJECT **heapObjects, ULONG *pceltFetched)
+{
+	ULONG fetched = 0;
+	HRESULT hr = S_OK;
+
+	while (fetched < celt && !m_finished)
+	{
+		DecodedObject *decoded;
+
+		hr = ReadObject(&decoded);
+		if (FAILED(hr))
+		{
+			FreeObjectAndOptionalInfo(fetched, heapObjects);
+			fetched = 0;
+			break;
+		}
+
+		if (decoded != nullptr)
+		{
+			heapObjects[fetched++] = &decoded->object;
+		}
+	}
+
+	if (pceltFetched != nullptr)
+	{
+		*pceltFetched = fetched;
+	}
+
+	if (FAILED(hr))
+	{
+		return hr;
+	}
+
+	return fetched < celt ? S_FALSE : S_OK;
+}
+
+HRESULT BinarySnapshotReader::GetOptionalInfo(PROFILER_HEAP_OBJECT *heapObject, ULONG celt, PROFILER_HEAP_OBJECT_OPTIONAL_INFO *optionalInfo)
+{
+	DecodedObject *decoded = CONTAINING_RECORD(heapObject, DecodedObject, object);
+
+	if (celt != decoded->optionalInfo.size())
+	{
+		return E_INVALIDARG;
+	}
+
+	for (ULONG index = 0; index < celt; index++)
+	{
+		optionalInfo[index] = decoded->optionalInfo[index];
+	}
+
+	return S_OK;
+}
+
+HRESULT BinarySnapshotReader::FreeObjectAndOptionalInfo(ULONG celt, PROFILER_HEAP_OBJECT **heapObjects)
+{
+	for (ULONG index = 0; index < celt; index++)
+	{
+		delete CONTAINING_RECORD(heapObjects[index], DecodedObject, object);
+	}
+
+	return S_OK;
+}
+
+HRESULT BinarySnapshotReader::GetNameIdMap(LPCWSTR **pNameList, UINT *pcelt)
+{
+	//
+	// Callers free the list with CoTaskMemFree, as they do the engine's. The names themselves
+	// belong to the reader.
+	//
+
+	size_t count = m_nameIdMap.size();
+	LPCWSTR *nameList = (LPCWSTR *) CoTaskMemAlloc((count > 0 ? count : 1) * sizeof(LPCWSTR));
+
+	if (nameList == nullptr)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	for (size_t index = 0; index < count; index++)
+	{
+		nameList[index] = m_nameIdMap[index];
+	}
+
+	*pNameList = nameList;
+	*pcelt = (UINT) count;
+	return S_OK;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include "SnapshotStream.h"
+
+//
+// The raw deflate decompressor matching Deflater, for the offline tools reading profiles
+// back. All of the compressed input has to be in memory, but output goes to a stream a
+// megabyte at a time, so only the last 32K of it, which matches can copy from, is held
+// onto.
+//
+// Huffman codes are decoded with a table for codes of up to nine bits, which is nearly
+// all of them, and bit by bit for the rest.
+//
+
+class Inflater sealed
+{
+private:
+	static const unsigned WindowSize = 32768;
+	static const unsigned OutputSize = 1024 * 1024;
+	static const unsigned MaximumMatch = 258;
+	static const unsigned FastBits = 9;
+	static const unsigned MaximumCodeLength = 15;
+	static const unsigned LiteralLengthCodes = 286;
+	static const unsigned FixedLiteralLengthCodes = 288;
+	static const unsigned DistanceCodes = 30;
+	static const unsigned CodeLengthCodes = 19;
+	static const unsigned EndOfBlock = 256;
+
+	//
+	// A code's fast table holds the symbol and length of each code short enough, indexed by
+	// its bits as they come out of the stream, and zero where there's no such code. Longer
+	// codes are found from the number of codes of each length and the symbols in code order.
+	//
+
+	struct HuffmanCode
+	{
+		uint16_t fast[1 << FastBits];
+		uint16_t counts[MaximumCodeLength + 1];
+		uint16_t symbols[FixedLiteralLengthCodes];
+	};
+
+	const uint8_t *m_input;
+	const uint8_t *m_inputEnd;
+	uint64_t m_bits;
+	unsigned m_bitCount;
+	std::vector<uint8_t> m_output;
+	size_t m_outputEnd;
+	size_t m_flushed;
+	ULONGLONG m_produced;
+	SnapshotStream *m_stream;
+	HuffmanCode m_fixedLiteralLengthCode;
+	HuffmanCode m_fixedDistanceCode;
+	HuffmanCode m_literalLengthCode;
+	HuffmanCode m_distanceCode;
+
+	Inflater(const Inflater &);
+	Inflater &operator=(const Inflater &);
+
+	static bool BuildCode(const uint8_t *lengths, unsigned count, HuffmanCode *code);
+	void Refill(void);
+	bool NeedBits(unsigned count);
+	unsigned TakeBits(unsigned count);
+	bool Decode(const HuffmanCode &code, unsigned *symbol);
+	HRESULT MakeRoom(void);
+	HRESULT Flush(void);
+	HRESULT InflateStoredBlock(void);
+	HRESULT ReadDynamicCodes(void);
+	HRESULT InflateBlock(const HuffmanCode &literalLengthCode, const HuffmanCode &distanceCode);
+
+public:
+	Inflater(void);
+
+	//
+	// Decompresses a whole deflate stream, giving the number of bytes it decompressed to.
+	//
+
+	HRESULT Inflate(const uint8_t *input, size_t length, SnapshotStream *output, ULONGLONG *outputLength);
+};
@@ -0,0 +1,918 @@
+#include "stdafx.h"
+#include <algorithm>
+#include "SnapshotDelta.h"
+
+using namespace std;
+
+static const HRESULT InvalidSnapshot = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+
+//
+// What the snapshot JSON writer starts an object's line, and a delta's list of removed
+// objects, with.
+//
+
+static const char ObjectLinePrefix[] = "{\"version\":\"1.0\",\"data\":[{\"objectId\":";
+static const char RemovedObjectsLinePrefix[] = "{\"version\":\"1.0\",\"removedObjectIds\":[";
+static const char NewObjectProperty[] = "\"isNew\":true";
+static const char OldObjectProperty[] = "\"isNew\":false";
+
+//
+// How snapshots with interned names list them in their first line, and refer to them in
+// objects and relationships, along with what the references are expanded to.
+//
+
+static const char NamesProperty[] = ",\"names\":[";
+static const char KindIdProperty[] = "\"kindId\":";
+static const char NameIdProperty[] = "\"nameId\":";
+static const char KindProperty[] = "\"kind\":\"";
+static const char NameProperty[] = "\"name\":\"";
+static const char TypeNameNotFound[] = "<Type Name Not Found>";
+
+static const size_t MergeBufferCapacity = 1024 * 1024;
+
+//
+// A 64-bit hash that's fed one word at a time. Fingerprints only need to tell objects
+// apart, not resist attack, so this favors speed.
+//
+
+class Fingerprint sealed
+{
+private:
+	ULONGLONG m_hash;
+
+public:
+	Fingerprint(void) :
+		m_hash(0x9E3779B97F4A7C15ULL)
+	{
+	}
+
+	void Add(ULONGLONG value)
+	{
+		m_hash ^= value * 0x87C37B91114253D5ULL;
+		m_hash = ((m_hash << 27) | (m_hash >> 37)) * 5 + 0x52DCE729;
+	}
+
+	//
+	// Strings are hashed four code units at a time, followed by their length, so that a
+	// null string and an empty one hash differently.
+	//
+
+	void AddString(const wchar_t *value)
+	{
+		if (value == nullptr)
+		{
+			Add(0);
+			return;
+		}
+
+		ULONGLONG packed = 0;
+		size_t length = 0;
+
+		for (; value[length] != L'\0'; length++)
+		{
+			packed = (packed << 16) | (uint16_t) value[length];
+
+			if ((length & 3) == 3)
+			{
+				Add(packed);
+				packed = 0;
+			}
+		}
+
+		Add(packed);
+		Add(length + 1);
+	}
+
+	void AddRelationship(const PROFILER_HEAP_OBJECT_RELATIONSHIP *relationship)
+	{
+		Add(relationship->relationshipId);
+		Add(relationship->relationshipInfo);
+
+		switch (relationship->relationshipInfo)
+		{
+		case PROFILER_PROPERTY_TYPE_NUMBER:
+		{
+			ULONGLONG bits;
+			memcpy(&bits, &relationship->numberValue, sizeof(bits));
+			Add(bits);
+			break;
+		}
+		case PROFILER_PROPERTY_TYPE_STRING:
+			AddString(relationship->stringValue);
+			break;
+		case PROFILER_PROPERTY_TYPE_BSTR:
+			AddString(relationship->bstrValue);
+			break;
+		case PROFILER_PROPERTY_TYPE_HEAP_OBJECT:
+			Add(relationship->objectId);
+			break;
+		case PROFILER_PROPERTY_TYPE_EXTERNAL_OBJECT:
+			Add((ULONG_PTR) relationship->externalObjectAddress);
+			break;
+		}
+	}
+
+	void AddRelationshipList(const PROFILER_HEAP_OBJECT_RELATIONSHIP_LIST *list)
+	{
+		Add(list->count);
+
+		for (unsigned index = 0; index < list->count; index++)
+		{
+			AddRelationship(&list->elements[index]);
+		}
+	}
+
+	ULONGLONG Finish(void)
+	{
+		ULONGLONG hash = m_hash;
+
+		hash ^= hash >> 33;
+		hash *= 0xFF51AFD7ED558CCDULL;
+		hash ^= hash >> 33;
+		hash *= 0xC4CEB9FE1A85EC53ULL;
+		hash ^= hash >> 33;
+		return hash;
+	}
+};
+
+ULONGLONG FingerprintHeapObject(const PROFILER_HEAP_OBJECT *object, const PROFILER_HEAP_OBJECT_OPTIONAL_INFO *optionalInfo)
+{
+	Fingerprint fingerprint;
+
+	fingerprint.Add(object->flags & ~(PROFILER_HEAP_OBJECT_FLAGS_NEW_OBJECT | PROFILER_HEAP_OBJECT_FLAGS_NEW_STATE_UNAVAILABLE));
+	fingerprint.Add(object->typeNameId);
+	fingerprint.Add(object->size);
+	fingerprint.Add(object->optionalInfoCount);
+
+	for (unsigned index = 0; index < object->optionalInfoCount; index++)
+	{
+		const PROFILER_HEAP_OBJECT_OPTIONAL_INFO &info = optionalInfo[index];
+
+		fingerprint.Add(info.infoType);
+
+		switch (info.infoType)
+		{
+		case PROFILER_HEAP_OBJECT_OPTIONAL_INFO_PROTOTYPE:
+			fingerprint.Add(info.prototype);
+			break;
+		case PROFILER_HEAP_OBJECT_OPTIONAL_INFO_FUNCTION_NAME:
+			fingerprint.AddString(info.functionName);
+			break;
+		case PROFILER_HEAP_OBJECT_OPTIONAL_INFO_ELEMENT_ATTRIBUTES_SIZE:
+			fingerprint.Add(info.elementAttributesSize);
+			break;
+		case PROFILER_HEAP_OBJECT_OPTIONAL_INFO_ELEMENT_TEXT_CHILDREN_SIZE:
+			fingerprint.Add(info.elementTextChildrenSize);
+			break;
+		case PROFILER_HEAP_OBJECT_OPTIONAL_INFO_SCOPE_LIST:
+			fingerprint.Add(info.scopeList->count);
+			for (unsigned scopeIndex = 0; scopeIndex < info.scopeList->count; scopeIndex++)
+			{
+				fingerprint.Add(info.scopeList->scopes[scopeIndex]);
+			}
+			break;
+		case PROFILER_HEAP_OBJECT_OPTIONAL_INFO_INTERNAL_PROPERTY:
+			fingerprint.AddRelationship(info.internalProperty);
+			break;
+		case PROFILER_HEAP_OBJECT_OPTIONAL_INFO_NAME_PROPERTIES:
+		case PROFILER_HEAP_OBJECT_OPTIONAL_INFO_INDEX_PROPERTIES:
+		case PROFILER_HEAP_OBJECT_OPTIONAL_INFO_RELATIONSHIPS:
+		case PROFILER_HEAP_OBJECT_OPTIONAL_INFO_WINRTEVENTS:
+		case PROFILER_HEAP_OBJECT_OPTIONAL_INFO_WEAKMAP_COLLECTION_LIST:
+		case PROFILER_HEAP_OBJECT_OPTIONAL_INFO_MAP_COLLECTION_LIST:
+		case PROFILER_HEAP_OBJECT_OPTIONAL_INFO_SET_COLLECTION_LIST:
+			fingerprint.AddRelationshipList(info.relationshipList);
+			break;
+		}
+	}
+
+	return fingerprint.Finish();
+}
+
+static bool CompareFingerprints(const ObjectFingerprint &left, const ObjectFingerprint &right)
+{
+	return left.objectId < right.objectId;
+}
+
+HRESULT SnapshotFingerprints::Build(vector<ObjectFingerprint> *fingerprints)
+{
+	try
+	{
+		sort(fingerprints->begin(), fingerprints->end(), CompareFingerprints);
+	}
+	catch (...)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	m_fingerprints.swap(*fingerprints);
+	fingerprints->clear();
+	return S_OK;
+}
+
+void SnapshotFingerprints::Clear(void)
+{
+	vector<ObjectFingerprint>().swap(m_fingerprints);
+}
+
+bool SnapshotFingerprints::Find(ULONG_PTR objectId, ULONGLONG *hash) const
+{
+	ObjectFingerprint key;
+	key.objectId = objectId;
+	key.hash = 0;
+
+	vector<ObjectFingerprint>::const_iterator found = lower_bound(m_fingerprints.begin(), m_fingerprints.end(), key, CompareFingerprints);
+
+	if (found == m_fingerprints.end() || found->objectId != objectId)
+	{
+		return false;
+	}
+
+	*hash = found->hash;
+	return true;
+}
+
+HRESULT SnapshotFingerprints::GetRemovedObjects(const SnapshotFingerprints &later, vector<ULONG_PTR> *objectIds) const
+{
+	size_t laterIndex = 0;
+
+	try
+	{
+		for (size_t index = 0; index < m_fingerprints.size(); index++)
+		{
+			ULONG_PTR objectId = m_fingerprints[index].objectId;
+
+			while (laterIndex < later.m_fingerprints.size() && later.m_fingerprints[laterIndex].objectId < objectId)
+			{
+				laterIndex++;
+			}
+
+			if (laterIndex == later.m_fingerprints.size() || later.m_fingerprints[laterIndex].objectId != objectId)
+			{
+				objectIds->push_back(objectId);
+			}
+		}
+	}
+	catch (...)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	return S_OK;
+}
+
+DeltaFilter::DeltaFilter(const SnapshotFingerprints *base) :
+	m_base(base),
+	m_includedCount(0)
+{
+}
+
+HRESULT DeltaFilter::Filter(const PROFILER_HEAP_OBJECT *object, const PROFILER_HEAP_OBJECT_OPTIONAL_INFO *optionalInfo, bool *include)
+{
+	ObjectFingerprint fingerprint;
+	ULONGLONG baseHash;
+
+	fingerprint.objectId = object->objectId;
+	fingerprint.hash = FingerprintHeapObject(object, optionalInfo);
+
+	try
+	{
+		m_fingerprints.push_back(fingerprint);
+	}
+	catch (...)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	//
+	// An object the engine says is new may have been given the id of one that's gone, so
+	// it's included even if nothing else about it differs.
+	//
+
+	*include =
+		m_base == nullptr ||
+		(object->flags & PROFILER_HEAP_OBJECT_FLAGS_NEW_OBJECT) != 0 ||
+		!m_base->Find(object->objectId, &baseHash) ||
+		baseHash != fingerprint.hash;
+
+	if (*include)
+	{
+		m_includedCount++;
+	}
+
+	return S_OK;
+}
+
+DeltaSnapshotReader::DeltaSnapshotReader(void) :
+	m_current(0),
+	m_refCount(1)
+{
+}
+
+DeltaSnapshotReader::~DeltaSnapshotReader(void)
+{
+	for (size_t index = 0; index < m_snapshots.size(); index++)
+	{
+		m_snapshots[index]->Release();
+	}
+}
+
+HRESULT DeltaSnapshotReader::Add(BinarySnapshotReader *snapshot)
+{
+	try
+	{
+		m_snapshots.push_back(snapshot);
+	}
+	catch (...)
+	{
+		return E_OUTOFMEMORY;
+	}
+
+	snapshot->AddRef();
+	return S_OK;
+}
+
+//
+// Moves on from a snapshot that's been read to the end. Once its objects have been passed
+// on, the ones it removed are treated the same way, so older snapshots' copies of either
+// are skipped.
+//
+
+void DeltaSnapshotReader::FinishSnapshot(void)
+{
+	BinarySnapshotReader *snapshot = m_snapshots[m_current++];
+
+	if (!snapshot->IsDelta())
+	{
+		m_current = m_snapshots.size();
+		return;
+	}
+
+	if (m_current < m_snapshots.size())
+	{
+		const vector<ULONG_PTR> &removedObjectIds = snapshot->RemovedObjectIds();
+		m_seen.insert(removedObjectIds.begin(), removedObjectIds.end());
+	}
+}
+
+HRESULT DeltaSnapshotReader::QueryInterface(REFIID riid, void **ppvObj)
+{
+	if (riid == IID_IUnknown)
+	{
+		*ppvObj = (IUnknown *) this;
+	}
+	else if (riid == __uuidof(IActiveScriptProfilerHeapEnum))
+	{
+		*ppvObj = (IActiveScriptProfilerHeapEnum *) this;
+	}
+	else
+	{
+		*ppvObj = NULL;
+		return E_NOINTERFACE;
+	}
+
+	AddRef();
+	return NOERROR;
+}
+
+ULONG DeltaSnapshotReader::AddRef()
+{
+	return InterlockedIncrement(&m_refCount);
+}
+
+ULONG DeltaSnapshotReader::Release()
+{
+	long lw;
+
+	if (0 == (lw = InterlockedDecrement(&m_refCount)))
+	{
+		delete this;
+	}
+	return lw;
+}
+
+HRESULT DeltaSnapshotReader::Next(ULONG celt, PROFILER_HEAP_OBJECT **heapObjects, ULONG *pceltFetched)
+{
+	ULONG fetched = 0;
+	HRESULT hr = S_OK;
+
+	try
+	{
+		while (fetched < celt && m_current < m_snapshots.size())
+		{
+			BinarySnapshotReader *snapshot = m_snapshots[m_current];
+			PROFILER_HEAP_OBJECT **snapshotObjects = heapObjects + fetched;
+			ULONG requested = celt - fetched;
+			ULONG snapshotFetched = 0;
+
+			//
+			// Nothing is read after the oldest snapshot, so its ids needn't be remembered.
+			//
+
+			bool oldest = m_current + 1 == m_snapshots.size();
+
+			hr = snapshot->Next(requested, snapshotObjects, &snapshotFetched);
+			if (FAILED(hr))
+			{
+				break;
+			}
+
+			hr = S_OK;
+
+			for (ULONG index = 0; index < snapshotFetched; index++)
+			{
+				PROFILER_HEAP_OBJECT *object = snapshotObjects[index];
+				bool include;
+
+				try
+				{
+					include = oldest ? m_seen.find(object->objectId) == m_seen.end() : m_seen.insert(object->objectId).second;
+				}
+				catch (...)
+				{
+					snapshot->FreeObjectAndOptionalInfo(snapshotFetched - index, snapshotObjects + index);
+					throw;
+				}
+
+				if (include)
+				{
+					//
+					// Anything the engine thought was new when the newest snapshot was taken is
+					// in that snapshot, so objects from older ones aren't new.
+					//
+
+					if (m_current > 0)
+					{
+						object->flags &= ~PROFILER_HEAP_OBJECT_FLAGS_NEW_OBJECT;
+					}
+
+					heapObjects[fetched++] = object;
+				}
+				else
+				{
+					snapshot->FreeObjectAndOptionalInfo(1, &object);
+				}
+			}
+
+			if (snapshotFetched < requested)
+			{
+				FinishSnapshot();
+			}
+		}
+	}
+	catch (...)
+	{
+		hr = E_OUTOFMEMORY;
+	}
+
+	if (FAILED(hr))
+	{
+		FreeObjectAndOptionalInfo(fetched, heapObjects);
+		fetched = 0;
+	}
+
+	if (pceltFetched != nullptr)
+	{
+		*pceltFetched = fetched;
+	}
+
+	if (FAILED(hr))
+	{
+		return hr;
+	}
+
+	return fetched < celt ? S_FALSE : S_OK;
+}
+
+//
+// Every binary snapshot reader frees and fills in optional info for the objects it hands
+// out the same way, so any of them can do it for objects from the others.
+//
+
+HRESULT DeltaSnapshotReader::GetOptionalInfo(PROFILER_HEAP_OBJECT *heapObject, ULONG celt, PROFILER_HEAP_OBJECT_OPTIONAL_INFO *optionalInfo)
+{
+	if (m_snapshots.empty())
+	{
+		return E_UNEXPECTED;
+	}
+
+	return m_snapshots[0]->GetOptionalInfo(heapObject, celt, optionalInfo);
+}
+
+HRESULT DeltaSnapshotReader::FreeObjectAndOptionalInfo(ULONG celt, PROFILER_HEAP_OBJECT **heapObjects)
+{
+	if (m_snapshots.empty())
+	{
+		return celt == 0 ? S_OK : E_UNEXPECTED;
+	}
+
+	return m_snapshots[0]->FreeObjectAndOptionalInfo(celt, heapObjects);
+}
+
+//
+// The engine only ever adds names, so the newest snapshot's names cover the older ones'.
+//
+
+HRESULT DeltaSnapshotReader::GetNameIdMap(LPCWSTR **pNameList, UINT *pcelt)
+{
+	if (m_snapshots.empty())
+	{
+		return E_UNEXPECTED;
+	}
+
+	return m_snapshots[0]->GetNameIdMap(pNameList, pcelt);
+}
+
+//
+// Ids are written as unsigned numbers. Older snapshots wrote ids that don't fit in an int
+// as strings of digits, or from a 32-bit process as negative numbers.
+//
+
+static bool ParseId(const char **current, const char *end, ULONG_PTR *id)
+{
+	const char *position = *current;
+	bool quoted = position < end && *position == '"';
+	bool negative;
+	ULONGLONG value = 0;
+
+	if (quoted)
+	{
+		position++;
+	}
+
+	negative = position < end && *position == '-';
+	if (negative)
+	{
+		position++;
+	}
+
+	const char *digits = position;
+
+	while (position < end && *position >= '0' && *position <= '9')
+	{
+		value = value * 10 + (*position - '0');
+		position++;
+	}
+
+	if (position == digits)
+	{
+		return false;
+	}
+
+	if (quoted)
+	{
+		if (position == end || *position != '"')
+		{
+			return false;
+		}
+
+		position++;
+	}
+
+	*id = (ULONG_PTR) (negative ? 0 - value : value);
+	*current = position;
+	return true;
+}
+
+template <size_t length>
+static bool StartsWith(const char *line, const char *lineEnd, const char (&prefix)[length])
+{
+	return (size_t) (lineEnd - line) >= length - 1 && memcmp(line, prefix, length - 1) == 0;
+}
+
+//
+// A name from the first line's list, still escaped.
+//
+
+struct InternedName
+{
+	const char *text;
+	size_t length;
+};
+
+//
+// Finds the list of interned names in a snapshot's first line, if it has one, giving where
+// the property starts so the line can be written without it.
+//
+
+static HRESULT ParseInternedNames(const char *line, const char *lineEnd, vector<InternedName> *names, const char **namesStart)
+{
+	const char *current = search(line, lineEnd, NamesProperty, NamesProperty + ARRAYSIZE(NamesProperty) - 1);
+
+	*namesStart = current;
+	if (current == lineEnd)
+	{
+		return S_OK;
+	}
+
+	current += ARRAYSIZE(NamesProperty) - 1;
+
+	if (current < lineEnd && *current == ']')
+	{
+		return S_OK;
+	}
+
+	for (;;)
+	{
+		if (current == lineEnd || *current != '"')
+		{
+			return InvalidSnapshot;
+		}
+
+		InternedName name = { ++current, 0 };
+
+		while (current < lineEnd && *current != '"')
+		{
+			current += *current == '\\' ? 2 : 1;
+		}
+
+		if (current >= lineEnd)
+		{
+			return InvalidSnapshot;
+		}
+
+		name.length = current - name.text;
+		names->push_back(name);
+		current++;
+
+		if (current == lineEnd)
+		{
+			return InvalidSnapshot;
+		}
+
+		if (*current++ == ']')
+		{
+			return S_OK;
+		}
+
+		if (current[-1] != ',')
+		{
+			return InvalidSnapshot;
+		}
+	}
+}
+
+//
+// Appends an object's line with the names its name ids refer to written in their place,
+// the way the line is written without interned names. Quotes in strings are escaped, so
+// neither property can be mistaken for part of one.
+//
+
+static HRESULT AppendExpandedNames(const char *line, const char *lineEnd, const vector<InternedName> &names, vector<char> *output)
+{
+	const char *current = line;
+
+	for (;;)
+	{
+		const char *quote = (const char *) memchr(current, '"', lineEnd - current);
+		const char *id;
+		bool kind;
+
+		if (quote == nullptr)
+		{
+			break;
+		}
+
+		if (StartsWith(quote, lineEnd, KindIdProperty))
+		{
+			id = quote + ARRAYSIZE(KindIdProperty) - 1;
+			kind = true;
+		}
+		else if (StartsWith(quote, lineEnd, NameIdProperty))
+		{
+			id = quote + ARRAYSIZE(NameIdProperty) - 1;
+			kind = false;
+		}
+		else
+		{
+			output->insert(output->end(), current, quote + 1);
+			current = quote + 1;
+			continue;
+		}
+
+		ULONGLONG nameId = 0;
+		const char *digits = id;
+
+		while (id < lineEnd && *id >= '0' && *id <= '9')
+		{
+			nameId = nameId * 10 + (*id++ - '0');
+		}
+
+		if (id == digits)
+		{
+			return InvalidSnapshot;
+		}
+
+		output->insert(output->end(), current, quote);
+
+		if (kind)
+		{
+			output->insert(output->end(), KindProperty, KindProperty + ARRAYSIZE(KindProperty) - 1);
+		}
+		else
+		{
+			output->insert(output->end(), NameProperty, NameProperty + ARRAYSIZE(NameProperty) - 1);
+		}
+
+		if (nameId < names.size())
+		{
+			output->insert(output->end(), names[(size_t) nameId].text, names[(size_t) nameId].text + names[(size_t) nameId].length);
+		}
+		else
+		{
+			output->insert(output->end(), TypeNameNotFound, TypeNameNotFound + ARRAYSIZE(TypeNameNotFound) - 1);
+		}
+
+		output->push_back('"');
+		current = id;
+	}
+
+	output->insert(output->end(), current, lineEnd);
+	return S_OK;
+}
+
+static HRESULT ParseRemovedObjects(const char *current, const char *end, unordered_set<ULONG_PTR> *seen, bool remember)
+{
+	current += ARRAYSIZE(RemovedObjectsLinePrefix) - 1;
+
+	if (current < end && *current == ']')
+	{
+		return S_OK;
+	}
+
+	for (;;)
+	{
+		ULONG_PTR objectId;
+
+		if (!ParseId(&current, end, &objectId) || current == end)
+		{
+			return InvalidSnapshot;
+		}
+
+		if (remember)
+		{
+			seen->insert(objectId);
+		}
+
+		if (*current++ == ']')
+		{
+			return S_OK;
+		}
+
+		if (current[-1] != ',')
+		{
+			return InvalidSnapshot;
+		}
+	}
+}
+
+HRESULT MergeJsonSnapshots(const vector<const MappedFile *> &snapshots, SnapshotStream *output)
+{
+	unordered_set<ULONG_PTR> seen;
+	vector<uint8_t> buffer;
+	vector<InternedName> names;
+	vector<char> expanded;
+	HRESULT hr = S_OK;
+
+	try
+	{
+		buffer.reserve(MergeBufferCapacity);
+
+		for (size_t index = 0; index < snapshots.size(); index++)
+		{
+			const char *current = (const char *) snapshots[index]->Data();
+			const char *end = current + snapshots[index]->Size();
+			bool oldest = index + 1 == snapshots.size();
+			bool delta = false;
+
+			if (current == end)
+			{
+				return InvalidSnapshot;
+			}
+
+			//
+			// The first line holds the profile's version and timestamp. The newest snapshot's
+			// goes at the top of the merged one. If it lists interned names, they're written
+			// back into the objects instead, so the merged snapshot is like any other.
+			//
+
+			const char *lineEnd = (const char *) memchr(current, '\r', end - current);
+			if (lineEnd == nullptr)
+			{
+				lineEnd = end;
+			}
+
+			if (index == 0)
+			{
+				const char *namesStart;
+
+				IfComFailRet(ParseInternedNames(current, lineEnd, &names, &namesStart));
+				buffer.insert(buffer.end(), current, namesStart);
+
+				if (namesStart != lineEnd)
+				{
+					buffer.push_back('}');
+				}
+			}
+
+			current = lineEnd;
+
+			while (current < end)
+			{
+				if (end - current < 2 || current[0] != '\r' || current[1] != '\n')
+				{
+					return InvalidSnapshot;
+				}
+
+				const char *line = current + 2;
+
+				lineEnd = (const char *) memchr(line, '\r', end - line);
+				if (lineEnd == nullptr)
+				{
+					lineEnd = end;
+				}
+
+				if (delta)
+				{
+					return InvalidSnapshot;
+				}
+
+				if (StartsWith(line, lineEnd, ObjectLinePrefix))
+				{
+					const char *idStart = line + ARRAYSIZE(ObjectLinePrefix) - 1;
+					ULONG_PTR objectId;
+
+					if (!ParseId(&idStart, lineEnd, &objectId))
+					{
+						return InvalidSnapshot;
+					}
+
+					bool include = oldest ? seen.find(objectId) == seen.end() : seen.insert(objectId).second;
+					const char *copyStart = current;
+					const char *copyEnd = lineEnd;
+
+					if (include && !names.empty())
+					{
+						expanded.assign(current, line);
+						IfComFailRet(AppendExpandedNames(line, lineEnd, names, &expanded));
+						copyStart = expanded.data();
+						copyEnd = copyStart + expanded.size();
+					}
+
+					//
+					// As with binary snapshots, objects from older snapshots aren't new. Quotes in
+					// strings are escaped, so the property can't be mistaken for part of one.
+					//
+
+					const char *newProperty = nullptr;
+
+					if (include && index > 0)
+					{
+						newProperty = search(copyStart, copyEnd, NewObjectProperty, NewObjectProperty + ARRAYSIZE(NewObjectProperty) - 1);
+					}
+
+					if (newProperty != nullptr && newProperty != copyEnd)
+					{
+						buffer.insert(buffer.end(), copyStart, newProperty);
+						buffer.insert(buffer.end(), OldObjectProperty, OldObjectProperty + ARRAYSIZE(OldObjectProperty) - 1);
+						buffer.insert(buffer.end(), newProperty + ARRAYSIZE(NewObjectProperty) - 1, copyEnd);
+					}
+					else if (include)
+					{
+						buffer.insert(buffer.end(), copyStart, copyEnd);
+					}
+				}
+				else if (StartsWith(line, lineEnd, RemovedObjectsLinePrefix))
+				{
+					IfComFailRet(ParseRemovedObjects(line, lineEnd, &seen, !oldest));
+					delta = true;
+				}
+				else
+				{
+					return InvalidSnapshot;
+				}
+
+				if (buffer.size() >= MergeBufferCapacity)
+				{
+					IfComFailRet(WriteToStream(output, buffer.data(), buffer.size()));
+					buffer.clear();
+				}
+
+				current = lineEnd;
+			}
+
+			if (!delta)
+			{
+				break;
+			}
+		}
+
+		hr = WriteToStream(output, buffer.data(), buffer.size());
+	}
+	catch (...)
+	{
+		hr = E_OUTOFMEMORY;
+	}
+
+	return hr;
+}
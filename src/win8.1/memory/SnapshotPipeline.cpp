@@ -0,0 +1,230 @@
+#include "stdafx.h"
+#include "SnapshotPipeline.h"
+
+using namespace std;
+
+SnapshotPipeline::SnapshotPipeline(SnapshotStream *stream) :
+	m_stream(stream),
+	m_nextSequence(0),
+	m_nextWrite(0),
+	m_finishing(false),
+	m_status(S_OK)
+{
+}
+
+SnapshotPipeline::~SnapshotPipeline(void)
+{
+	Finish();
+
+	for (size_t index = 0; index < m_batches.size(); index++)
+	{
+		delete m_batches[index];
+	}
+}
+
+//
+// Records the first error and wakes everything up, so every stage stops.
+//
+
+void SnapshotPipeline::Fail(HRESULT hr)
+{
+	{
+		lock_guard<mutex> lock(m_lock);
+
+		if (SUCCEEDED(m_status))
+		{
+			m_status = hr;
+		}
+	}
+
+	m_batchQueued.notify_all();
+	m_batchSerialized.notify_all();
+	m_batchFree.notify_all();
+}
+
+HRESULT SnapshotPipeline::Start(const vector<BatchSerializer *> &serializers, unsigned batchCount)
+{
+	if (serializers.empty() || batchCount == 0 || !m_batches.empty())
+	{
+		return E_INVALIDARG;
+	}
+
+	try
+	{
+		for (unsigned index = 0; index < batchCount; index++)
+		{
+			m_batches.push_back(new Batch());
+			m_free.push_back(m_batches.back());
+		}
+
+		m_writer = thread(&SnapshotPipeline::RunWriter, this);
+
+		for (size_t index = 0; index < serializers.size(); index++)
+		{
+			m_workers.push_back(thread(&SnapshotPipeline::RunWorker, this, serializers[index]));
+		}
+	}
+	catch (...)
+	{
+		Fail(E_OUTOFMEMORY);
+		return E_OUTOFMEMORY;
+	}
+
+	return S_OK;
+}
+
+HeapObjectBatch *SnapshotPipeline::Acquire(void)
+{
+	unique_lock<mutex> lock(m_lock);
+
+	while (m_free.empty() && SUCCEEDED(m_status))
+	{
+		m_batchFree.wait(lock);
+	}
+
+	if (FAILED(m_status))
+	{
+		return nullptr;
+	}
+
+	Batch *batch = m_free.front();
+	m_free.pop_front();
+	return &batch->objects;
+}
+
+void SnapshotPipeline::Submit(HeapObjectBatch *objects)
+{
+	Batch *batch = CONTAINING_RECORD(objects, Batch, objects);
+
+	{
+		lock_guard<mutex> lock(m_lock);
+		batch->sequence = m_nextSequence++;
+		m_queued.push_back(batch);
+	}
+
+	m_batchQueued.notify_one();
+}
+
+void SnapshotPipeline::RunWorker(BatchSerializer *serializer)
+{
+	for (;;)
+	{
+		Batch *batch = nullptr;
+
+		{
+			unique_lock<mutex> lock(m_lock);
+
+			while (m_queued.empty() && !m_finishing && SUCCEEDED(m_status))
+			{
+				m_batchQueued.wait(lock);
+			}
+
+			if (m_queued.empty() || FAILED(m_status))
+			{
+				return;
+			}
+
+			batch = m_queued.front();
+			m_queued.pop_front();
+		}
+
+		HRESULT hr = S_OK;
+
+		batch->output.clear();
+
+		try
+		{
+			hr = serializer->Serialize(&batch->objects, &batch->output);
+		}
+		catch (...)
+		{
+			hr = E_OUTOFMEMORY;
+		}
+
+		if (FAILED(hr))
+		{
+			Fail(hr);
+			return;
+		}
+
+		{
+			lock_guard<mutex> lock(m_lock);
+			m_serialized[batch->sequence] = batch;
+		}
+
+		m_batchSerialized.notify_one();
+	}
+}
+
+void SnapshotPipeline::RunWriter(void)
+{
+	for (;;)
+	{
+		Batch *batch = nullptr;
+
+		{
+			unique_lock<mutex> lock(m_lock);
+			map<ULONGLONG, Batch *>::iterator next;
+
+			while ((next = m_serialized.find(m_nextWrite)) == m_serialized.end() && SUCCEEDED(m_status) && !(m_finishing && m_nextWrite == m_nextSequence))
+			{
+				m_batchSerialized.wait(lock);
+			}
+
+			if (next == m_serialized.end() || FAILED(m_status))
+			{
+				return;
+			}
+
+			batch = next->second;
+			m_serialized.erase(next);
+		}
+
+		HRESULT hr = WriteToStream(m_stream, batch->output.data(), batch->output.size());
+
+		if (FAILED(hr))
+		{
+			Fail(hr);
+			return;
+		}
+
+		batch->objects.Clear();
+
+		{
+			lock_guard<mutex> lock(m_lock);
+			m_nextWrite++;
+			m_free.push_back(batch);
+		}
+
+		m_batchFree.notify_one();
+	}
+}
+
+HRESULT SnapshotPipeline::Finish(void)
+{
+	{
+		lock_guard<mutex> lock(m_lock);
+		m_finishing = true;
+	}
+
+	m_batchQueued.notify_all();
+	m_batchSerialized.notify_all();
+
+	for (size_t index = 0; index < m_workers.size(); index++)
+	{
+		m_workers[index].join();
+	}
+
+	m_workers.clear();
+
+	//
+	// The writer carries on until it has written every batch that was submitted.
+	//
+
+	if (m_writer.joinable())
+	{
+		m_writer.join();
+	}
+
+	return m_status;
+}
@@ -0,0 +1,990 @@
+#include "stdafx.h"
+#include <algorithm>
+#include <activprof.h>
+#include "BinarySnapshot.h"
+#include "SnapshotScanner.h"
+#include "Transcode.h"
+
+using namespace std;
+
+static const HRESULT InvalidSnapshot = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+
+//
+// What the snapshot JSON writer starts an object's line, and a delta's list of removed
+// objects, with.
+//
+
+static const char ObjectLinePrefix[] = "{\"version\":\"1.0\",\"data\":[";
+static const char RemovedObjectsLinePrefix[] = "{\"version\":\"1.0\",\"removedObjectIds\":";
+
+//
+// How the first line lists the names that objects refer to by index, when it does.
+//
+
+static const char NamesProperty[] = ",\"names\":";
+
+//
+// What references that aren't properties are called.
+//
+
+static const char PrototypeName[] = "prototype";
+static const char ScopesName[] = "scopes";
+static const char TypeNameNotFound[] = "<Type Name Not Found>";
+
+template <size_t length>
+static ScannedString MakeString(const char (&text)[length])
+{
+	ScannedString value = { text, length - 1 };
+	return value;
+}
+
+template <size_t length>
+static bool Equals(const ScannedString &value, const char (&text)[length])
+{
+	return value.length == length - 1 && memcmp(value.text, text, length - 1) == 0;
+}
+
+template <size_t length>
+static bool StartsWith(const char *line, const char *lineEnd, const char (&prefix)[length])
+{
+	return (size_t) (lineEnd - line) >= length - 1 && memcmp(line, prefix, length - 1) == 0;
+}
+
+//
+// Scans snapshot JSON, which has one heap object to a line. Each line is parsed in place,
+// and only the properties that are needed are looked at; the rest are skipped over.
+//
+
+class JsonSnapshotScanner sealed : public SnapshotScanner
+{
+private:
+	const char *m_start;
+	const char *m_end;
+	const char *m_next;
+	const char *m_current;
+	const char *m_lineEnd;
+	vector<ScannedString> m_names;
+	bool m_readHeader;
+
+	JsonSnapshotScanner(const JsonSnapshotScanner &);
+	JsonSnapshotScanner &operator=(const JsonSnapshotScanner &);
+
+	void SkipWhitespace(void)
+	{
+		while (m_current < m_lineEnd && (*m_current == ' ' || *m_current == '\t' || *m_current == '\n'))
+		{
+			m_current++;
+		}
+	}
+
+	bool Consume(char character)
+	{
+		SkipWhitespace();
+
+		if (m_current < m_lineEnd && *m_current == character)
+		{
+			m_current++;
+			return true;
+		}
+
+		return false;
+	}
+
+	HRESULT Expect(char character)
+	{
+		return Consume(character) ? S_OK : InvalidSnapshot;
+	}
+
+	HRESULT ReadString(ScannedString *value)
+	{
+		IfComFailRet(Expect('"'));
+
+		const char *start = m_current;
+
+		while (m_current < m_lineEnd && *m_current != '"')
+		{
+			m_current += *m_current == '\\' ? 2 : 1;
+		}
+
+		if (m_current >= m_lineEnd)
+		{
+			return InvalidSnapshot;
+		}
+
+		value->text = start;
+		value->length = m_current - start;
+		m_current++;
+		return S_OK;
+	}
+
+	HRESULT ReadUnsigned(ULONGLONG *value)
+	{
+		const char *digits;
+
+		SkipWhitespace();
+		digits = m_current;
+		*value = 0;
+
+		while (m_current < m_lineEnd && *m_current >= '0' && *m_current <= '9')
+		{
+			*value = *value * 10 + (*m_current - '0');
+			m_current++;
+		}
+
+		return m_current == digits ? InvalidSnapshot : S_OK;
+	}
+
+	//
+	// Ids are written as unsigned numbers. Older snapshots wrote ids that don't fit in an int
+	// as strings of digits, or from a 32-bit process as negative numbers.
+	//
+
+	HRESULT ReadId(ULONGLONG *id)
+	{
+		bool quoted = Consume('"');
+		bool negative = !quoted && Consume('-');
+
+		IfComFailRet(ReadUnsigned(id));
+
+		if (quoted)
+		{
+			IfComFailRet(Expect('"'));
+		}
+
+		if (negative)
+		{
+			*id = (UINT32) (0 - *id);
+		}
+
+		return S_OK;
+	}
+
+	HRESULT ReadBool(bool *value)
+	{
+		SkipWhitespace();
+
+		if (m_lineEnd - m_current >= 4 && memcmp(m_current, "true", 4) == 0)
+		{
+			*value = true;
+			m_current += 4;
+			return S_OK;
+		}
+
+		if (m_lineEnd - m_current >= 5 && memcmp(m_current, "false", 5) == 0)
+		{
+			*value = false;
+			m_current += 5;
+			return S_OK;
+		}
+
+		return InvalidSnapshot;
+	}
+
+	HRESULT SkipValue(void)
+	{
+		SkipWhitespace();
+
+		if (m_current >= m_lineEnd)
+		{
+			return InvalidSnapshot;
+		}
+
+		if (*m_current == '"')
+		{
+			ScannedString value;
+			return ReadString(&value);
+		}
+
+		if (*m_current != '{' && *m_current != '[')
+		{
+			const char *start = m_current;
+
+			while (m_current < m_lineEnd && *m_current != ',' && *m_current != '}' && *m_current != ']')
+			{
+				m_current++;
+			}
+
+			return m_current == start ? InvalidSnapshot : S_OK;
+		}
+
+		//
+		// Objects and arrays are skipped by counting brackets, stepping over strings since
+		// they can hold brackets of their own.
+		//
+
+		size_t depth = 0;
+
+		do
+		{
+			if (m_current >= m_lineEnd)
+			{
+				return InvalidSnapshot;
+			}
+
+			switch (*m_current)
+			{
+			case '"':
+				{
+					ScannedString value;
+					IfComFailRet(ReadString(&value));
+				}
+				continue;
+
+			case '{':
+			case '[':
+				depth++;
+				break;
+
+			case '}':
+			case ']':
+				depth--;
+				break;
+			}
+
+			m_current++;
+		}
+		while (depth > 0);
+
+		return S_OK;
+	}
+
+	//
+	// Looks a name up by its index in the first line's list.
+	//
+
+	HRESULT ReadNameId(ScannedString *name)
+	{
+		ULONGLONG nameId;
+
+		IfComFailRet(ReadUnsigned(&nameId));
+
+		if (nameId >= m_names.size())
+		{
+			*name = MakeString(TypeNameNotFound);
+		}
+		else
+		{
+			*name = m_names[(size_t) nameId];
+		}
+
+		return S_OK;
+	}
+
+	//
+	// The first line holds the profile's version and timestamp, and the list of names if
+	// they're interned. The names are left in place, still escaped, like any other string.
+	//
+
+	HRESULT ReadHeader(const char *line)
+	{
+		const char *names = search(line, m_lineEnd, NamesProperty, NamesProperty + ARRAYSIZE(NamesProperty) - 1);
+
+		if (names == m_lineEnd)
+		{
+			return S_OK;
+		}
+
+		m_current = names + ARRAYSIZE(NamesProperty) - 1;
+		IfComFailRet(Expect('['));
+
+		if (Consume(']'))
+		{
+			return S_OK;
+		}
+
+		do
+		{
+			ScannedString name;
+
+			IfComFailRet(ReadString(&name));
+			m_names.push_back(name);
+		}
+		while (Consume(','));
+
+		return Expect(']');
+	}
+
+	//
+	// A property, relationship or collection entry, which references an object if it has
+	// an id.
+	//
+
+	HRESULT ReadRelationship(ScannedObject *object)
+	{
+		ScannedReference reference = { 0, { nullptr, 0 } };
+		bool hasId = false;
+
+		IfComFailRet(Expect('{'));
+
+		if (Consume('}'))
+		{
+			return S_OK;
+		}
+
+		do
+		{
+			ScannedString key;
+
+			IfComFailRet(ReadString(&key));
+			IfComFailRet(Expect(':'));
+
+			if (Equals(key, "name"))
+			{
+				IfComFailRet(ReadString(&reference.name));
+			}
+			else if (Equals(key, "nameId"))
+			{
+				IfComFailRet(ReadNameId(&reference.name));
+			}
+			else if (Equals(key, "objectId"))
+			{
+				IfComFailRet(ReadId(&reference.objectId));
+				hasId = true;
+			}
+			else
+			{
+				IfComFailRet(SkipValue());
+			}
+		}
+		while (Consume(','));
+
+		IfComFailRet(Expect('}'));
+
+		if (hasId)
+		{
+			object->references.push_back(reference);
+		}
+
+		return S_OK;
+	}
+
+	HRESULT ReadRelationshipList(ScannedObject *object)
+	{
+		IfComFailRet(Expect('['));
+
+		if (Consume(']'))
+		{
+			return S_OK;
+		}
+
+		do
+		{
+			IfComFailRet(ReadRelationship(object));
+		}
+		while (Consume(','));
+
+		return Expect(']');
+	}
+
+	//
+	// Map entries are a key and a value, each written as a relationship.
+	//
+
+	HRESULT ReadMap(ScannedObject *object)
+	{
+		IfComFailRet(Expect('['));
+
+		if (Consume(']'))
+		{
+			return S_OK;
+		}
+
+		do
+		{
+			IfComFailRet(Expect('{'));
+
+			if (!Consume('}'))
+			{
+				do
+				{
+					ScannedString key;
+
+					IfComFailRet(ReadString(&key));
+					IfComFailRet(Expect(':'));
+
+					if (Equals(key, "key") || Equals(key, "value"))
+					{
+						IfComFailRet(ReadRelationship(object));
+					}
+					else
+					{
+						IfComFailRet(SkipValue());
+					}
+				}
+				while (Consume(','));
+
+				IfComFailRet(Expect('}'));
+			}
+		}
+		while (Consume(','));
+
+		return Expect(']');
+	}
+
+	HRESULT ReadScopes(ScannedObject *object)
+	{
+		IfComFailRet(Expect('['));
+
+		if (Consume(']'))
+		{
+			return S_OK;
+		}
+
+		do
+		{
+			ScannedReference reference = { 0, MakeString(ScopesName) };
+			IfComFailRet(ReadId(&reference.objectId));
+			object->references.push_back(reference);
+		}
+		while (Consume(','));
+
+		return Expect(']');
+	}
+
+	HRESULT ReadObject(ScannedObject *object)
+	{
+		bool hasId = false;
+
+		IfComFailRet(Expect('{'));
+
+		do
+		{
+			ScannedString key;
+
+			IfComFailRet(ReadString(&key));
+			IfComFailRet(Expect(':'));
+
+			if (Equals(key, "objectId"))
+			{
+				IfComFailRet(ReadId(&object->objectId));
+				hasId = true;
+			}
+			else if (Equals(key, "kind"))
+			{
+				IfComFailRet(ReadString(&object->kind));
+			}
+			else if (Equals(key, "kindId"))
+			{
+				IfComFailRet(ReadNameId(&object->kind));
+			}
+			else if (Equals(key, "functionName"))
+			{
+				IfComFailRet(ReadString(&object->functionName));
+			}
+			else if (Equals(key, "isRoot"))
+			{
+				IfComFailRet(ReadBool(&object->isRoot));
+			}
+			else if (Equals(key, "size"))
+			{
+				IfComFailRet(ReadUnsigned(&object->size));
+			}
+			else if (Equals(key, "prototype"))
+			{
+				ScannedReference reference = { 0, MakeString(PrototypeName) };
+				IfComFailRet(ReadId(&reference.objectId));
+				object->references.push_back(reference);
+			}
+			else if (Equals(key, "scopes"))
+			{
+				IfComFailRet(ReadScopes(object));
+			}
+			else if (Equals(key, "map"))
+			{
+				IfComFailRet(ReadMap(object));
+			}
+			else if (Equals(key, "properties") || Equals(key, "indices") || Equals(key, "relationships") ||
+				Equals(key, "events") || Equals(key, "set") || Equals(key, "internalProperties"))
+			{
+				IfComFailRet(ReadRelationshipList(object));
+			}
+			else
+			{
+				IfComFailRet(SkipValue());
+			}
+		}
+		while (Consume(','));
+
+		IfComFailRet(Expect('}'));
+		return hasId ? S_OK : InvalidSnapshot;
+	}
+
+public:
+	JsonSnapshotScanner(const uint8_t *snapshot, size_t length) :
+		m_start((const char *) snapshot),
+		m_end((const char *) snapshot + length),
+		m_next((const char *) snapshot),
+		m_current(nullptr),
+		m_lineEnd(nullptr),
+		m_readHeader(false)
+	{
+	}
+
+	HRESULT Next(ScannedObject *object)
+	{
+		object->objectId = 0;
+		object->size = 0;
+		object->kind.text = nullptr;
+		object->kind.length = 0;
+		object->functionName.text = nullptr;
+		object->functionName.length = 0;
+		object->isRoot = false;
+		object->references.clear();
+
+		while (m_next < m_end)
+		{
+			const char *line = m_next;
+
+			m_lineEnd = (const char *) memchr(line, '\r', m_end - line);
+			if (m_lineEnd == nullptr)
+			{
+				m_lineEnd = m_end;
+			}
+
+			m_next = m_lineEnd;
+			while (m_next < m_end && (*m_next == '\r' || *m_next == '\n'))
+			{
+				m_next++;
+			}
+
+			if (line == m_start)
+			{
+				if (!m_readHeader)
+				{
+					try
+					{
+						IfComFailRet(ReadHeader(line));
+					}
+					catch (...)
+					{
+						return E_OUTOFMEMORY;
+					}
+
+					m_readHeader = true;
+				}
+
+				continue;
+			}
+
+			if (StartsWith(line, m_lineEnd, ObjectLinePrefix))
+			{
+				m_current = line + ARRAYSIZE(ObjectLinePrefix) - 1;
+
+				try
+				{
+					return ReadObject(object);
+				}
+				catch (...)
+				{
+					return E_OUTOFMEMORY;
+				}
+			}
+
+			if (StartsWith(line, m_lineEnd, RemovedObjectsLinePrefix))
+			{
+				return DeltaSnapshotError;
+			}
+
+			return InvalidSnapshot;
+		}
+
+		return S_FALSE;
+	}
+
+	HRESULT Rewind(void)
+	{
+		m_next = m_start;
+		return S_OK;
+	}
+};
+
+//
+// Scans a binary snapshot by replaying it with a snapshot reader. Strings are escaped to
+// match the JSON, and an object's size takes in its slots the way the JSON writer's
+// does, with the pointer size of the process that wrote the snapshot.
+//
+
+class BinarySnapshotScanner sealed : public SnapshotScanner
+{
+private:
+	//
+	// A reference whose name was written into the text buffer. The name's pointer is set
+	// once the object is done, since the buffer can move until then.
+	//
+
+	struct PendingName
+	{
+		size_t reference;
+		size_t offset;
+		size_t length;
+	};
+
+	const uint8_t *m_snapshot;
+	size_t m_length;
+	BinarySnapshotReader *m_reader;
+	ULONGLONG m_pointerSize;
+	vector<string> m_names;
+	vector<bool> m_hasNames;
+	PROFILER_HEAP_OBJECT *m_object;
+	vector<PROFILER_HEAP_OBJECT_OPTIONAL_INFO> m_optionalInfo;
+	string m_text;
+	vector<PendingName> m_pendingNames;
+
+	BinarySnapshotScanner(const BinarySnapshotScanner &);
+	BinarySnapshotScanner &operator=(const BinarySnapshotScanner &);
+
+	static void AppendEscaped(string *text, const wchar_t *value)
+	{
+		size_t length = wcslen(value);
+		size_t offset = text->length();
+
+		text->resize(offset + JSON_ESCAPED_LENGTH_FOR_UTF16(length));
+		text->resize(offset + EscapeJsonString((const uint16_t *) value, length, (uint8_t *) &(*text)[offset]));
+	}
+
+	void FreeObject(void)
+	{
+		if (m_object != nullptr)
+		{
+			m_reader->FreeObjectAndOptionalInfo(1, &m_object);
+			m_object = nullptr;
+		}
+	}
+
+	void Close(void)
+	{
+		FreeObject();
+
+		if (m_reader != nullptr)
+		{
+			m_reader->Release();
+			m_reader = nullptr;
+		}
+	}
+
+	//
+	// Names are looked up the way the JSON writer looks them up, and as it does, an empty
+	// name is left out.
+	//
+
+	bool GetName(UINT nameId, ScannedString *name)
+	{
+		if (nameId == PROFILER_HEAP_OBJECT_NAME_ID_UNAVAILABLE)
+		{
+			return false;
+		}
+
+		if (nameId >= m_names.size() || !m_hasNames[nameId])
+		{
+			*name = MakeString(TypeNameNotFound);
+			return true;
+		}
+
+		name->text = m_names[nameId].c_str();
+		name->length = m_names[nameId].length();
+		return name->length > 0;
+	}
+
+	void AddRelationship(ScannedObject *object, const PROFILER_HEAP_OBJECT_RELATIONSHIP *relationship, bool index)
+	{
+		ScannedReference reference = { 0, { nullptr, 0 } };
+
+		switch (relationship->relationshipInfo)
+		{
+		case PROFILER_PROPERTY_TYPE_HEAP_OBJECT:
+			reference.objectId = relationship->objectId;
+			break;
+
+		case PROFILER_PROPERTY_TYPE_EXTERNAL_OBJECT:
+			reference.objectId = (ULONG_PTR) relationship->externalObjectAddress;
+			break;
+
+		default:
+			return;
+		}
+
+		if (index && relationship->relationshipId != PROFILER_HEAP_OBJECT_NAME_ID_UNAVAILABLE)
+		{
+			char name[16];
+			int length = _snprintf_s(name, ARRAYSIZE(name), _TRUNCATE, "[%u]", relationship->relationshipId);
+			PendingName pending = { object->references.size(), m_text.length(), (size_t) length };
+
+			m_text.append(name, length);
+			m_pendingNames.push_back(pending);
+		}
+		else
+		{
+			GetName(relationship->relationshipId, &reference.name);
+		}
+
+		object->references.push_back(reference);
+	}
+
+	void AddRelationshipList(ScannedObject *object, const PROFILER_HEAP_OBJECT_RELATIONSHIP_LIST *list, bool index)
+	{
+		for (ULONG element = 0; element < list->count; element++)
+		{
+			AddRelationship(object, &list->elements[element], index);
+		}
+	}
+
+	//
+	// Key/value lists only count whole pairs, as the JSON writer does.
+	//
+
+	void AddKeyValueList(ScannedObject *object, const PROFILER_HEAP_OBJECT_RELATIONSHIP_LIST *list, ULONGLONG *size)
+	{
+		for (ULONG element = 0; element + 1 < list->count; element += 2)
+		{
+			AddRelationship(object, &list->elements[element], false);
+			AddRelationship(object, &list->elements[element + 1], false);
+		}
+
+		*size += list->count * m_pointerSize;
+	}
+
+	void AddOptionalInfo(ScannedObject *object, const PROFILER_HEAP_OBJECT_OPTIONAL_INFO *optionalInfo, size_t *functionNameOffset)
+	{
+		switch (optionalInfo->infoType)
+		{
+		case PROFILER_HEAP_OBJECT_OPTIONAL_INFO_NAME_PROPERTIES:
+			AddRelationshipList(object, optionalInfo->namePropertyList, false);
+			object->size += optionalInfo->namePropertyList->count * m_pointerSize;
+			break;
+
+		case PROFILER_HEAP_OBJECT_OPTIONAL_INFO_INDEX_PROPERTIES:
+			AddRelationshipList(object, optionalInfo->indexPropertyList, true);
+			object->size += optionalInfo->indexPropertyList->count * m_pointerSize;
+			break;
+
+		case PROFILER_HEAP_OBJECT_OPTIONAL_INFO_RELATIONSHIPS:
+			AddRelationshipList(object, optionalInfo->relationshipList, false);
+			break;
+
+		case PROFILER_HEAP_OBJECT_OPTIONAL_INFO_WINRTEVENTS:
+			AddRelationshipList(object, optionalInfo->eventList, false);
+			break;
+
+		case PROFILER_HEAP_OBJECT_OPTIONAL_INFO_INTERNAL_PROPERTY:
+			AddRelationship(object, optionalInfo->internalProperty, false);
+			break;
+
+		case PROFILER_HEAP_OBJECT_OPTIONAL_INFO_PROTOTYPE:
+			{
+				ScannedReference reference = { optionalInfo->prototype, MakeString(PrototypeName) };
+				object->references.push_back(reference);
+			}
+			break;
+
+		case PROFILER_HEAP_OBJECT_OPTIONAL_INFO_FUNCTION_NAME:
+			*functionNameOffset = m_text.length();
+			AppendEscaped(&m_text, optionalInfo->functionName);
+			object->functionName.length = m_text.length() - *functionNameOffset;
+			break;
+
+		case PROFILER_HEAP_OBJECT_OPTIONAL_INFO_SCOPE_LIST:
+			for (ULONG scope = 0; scope < optionalInfo->scopeList->count; scope++)
+			{
+				ScannedReference reference = { optionalInfo->scopeList->scopes[scope], MakeString(ScopesName) };
+				object->references.push_back(reference);
+			}
+			break;
+
+		case PROFILER_HEAP_OBJECT_OPTIONAL_INFO_ELEMENT_ATTRIBUTES_SIZE:
+			object->size += optionalInfo->elementAttributesSize;
+			break;
+
+		case PROFILER_HEAP_OBJECT_OPTIONAL_INFO_ELEMENT_TEXT_CHILDREN_SIZE:
+			object->size += optionalInfo->elementTextChildrenSize;
+			break;
+
+		case PROFILER_HEAP_OBJECT_OPTIONAL_INFO_WEAKMAP_COLLECTION_LIST:
+			AddKeyValueList(object, optionalInfo->weakMapCollectionList, &object->size);
+			break;
+
+		case PROFILER_HEAP_OBJECT_OPTIONAL_INFO_MAP_COLLECTION_LIST:
+			AddKeyValueList(object, optionalInfo->mapCollectionList, &object->size);
+			break;
+
+		case PROFILER_HEAP_OBJECT_OPTIONAL_INFO_SET_COLLECTION_LIST:
+			AddRelationshipList(object, optionalInfo->setCollectionList, false);
+			object->size += optionalInfo->setCollectionList->count * m_pointerSize;
+			break;
+		}
+	}
+
+public:
+	BinarySnapshotScanner(const uint8_t *snapshot, size_t length) :
+		m_snapshot(snapshot),
+		m_length(length),
+		m_reader(nullptr),
+		m_pointerSize(sizeof(void *)),
+		m_object(nullptr)
+	{
+	}
+
+	~BinarySnapshotScanner(void)
+	{
+		Close();
+	}
+
+	HRESULT Open(void)
+	{
+		HRESULT hr = S_OK;
+		const wchar_t **nameIdMap = nullptr;
+		UINT nameCount = 0;
+
+		Close();
+
+		//
+		// The header's third word is the pointer size.
+		//
+
+		if (m_length < 3 * sizeof(UINT32))
+		{
+			return InvalidSnapshot;
+		}
+
+		m_pointerSize = ((const UINT32 *) m_snapshot)[2];
+
+		m_reader = new BinarySnapshotReader(m_snapshot, m_length);
+		if (m_reader == nullptr)
+		{
+			return E_OUTOFMEMORY;
+		}
+
+		IfComFailError(m_reader->Open());
+		IfComFailError(m_reader->GetNameIdMap(&nameIdMap, &nameCount));
+
+		try
+		{
+			m_names.assign(nameCount, string());
+			m_hasNames.assign(nameCount, false);
+
+			for (UINT index = 0; index < nameCount; index++)
+			{
+				if (nameIdMap[index] != nullptr)
+				{
+					AppendEscaped(&m_names[index], nameIdMap[index]);
+					m_hasNames[index] = true;
+				}
+			}
+		}
+		catch (...)
+		{
+			hr = E_OUTOFMEMORY;
+		}
+
+	error:
+		CoTaskMemFree(nameIdMap);
+
+		if (FAILED(hr))
+		{
+			Close();
+		}
+
+		return hr;
+	}
+
+	HRESULT Next(ScannedObject *object)
+	{
+		ULONG fetched = 0;
+		size_t functionNameOffset = 0;
+
+		if (m_reader == nullptr)
+		{
+			return E_UNEXPECTED;
+		}
+
+		FreeObject();
+
+		object->references.clear();
+		m_text.clear();
+		m_pendingNames.clear();
+
+		IfComFailRet(m_reader->Next(1, &m_object, &fetched));
+
+		if (fetched == 0)
+		{
+			m_object = nullptr;
+			return m_reader->IsDelta() ? DeltaSnapshotError : S_FALSE;
+		}
+
+		object->objectId = m_object->objectId;
+		object->size = m_object->size;
+		object->isRoot = (m_object->flags & PROFILER_HEAP_OBJECT_FLAGS_IS_ROOT) != 0;
+		object->kind.text = nullptr;
+		object->kind.length = 0;
+		object->functionName.text = nullptr;
+		object->functionName.length = 0;
+
+		GetName(m_object->typeNameId, &object->kind);
+
+		try
+		{
+			m_optionalInfo.resize(m_object->optionalInfoCount);
+
+			if (m_object->optionalInfoCount > 0)
+			{
+				IfComFailRet(m_reader->GetOptionalInfo(m_object, m_object->optionalInfoCount, m_optionalInfo.data()));
+			}
+
+			for (ULONG index = 0; index < m_object->optionalInfoCount; index++)
+			{
+				AddOptionalInfo(object, &m_optionalInfo[index], &functionNameOffset);
+			}
+		}
+		catch (...)
+		{
+			return E_OUTOFMEMORY;
+		}
+
+		if (object->functionName.length > 0)
+		{
+			object->functionName.text = m_text.c_str() + functionNameOffset;
+		}
+
+		for (size_t index = 0; index < m_pendingNames.size(); index++)
+		{
+			ScannedString &name = object->references[m_pendingNames[index].reference].name;
+
+			name.text = m_text.c_str() + m_pendingNames[index].offset;
+			name.length = m_pendingNames[index].length;
+		}
+
+		return S_OK;
+	}
+
+	HRESULT Rewind(void)
+	{
+		return Open();
+	}
+};
+
+HRESULT CreateSnapshotScanner(const uint8_t *snapshot, size_t length, SnapshotScanner **scanner)
+{
+	*scanner = nullptr;
+
+	if (length >= sizeof(UINT32) && *(const UINT32 *) snapshot == BinarySnapshotMagic)
+	{
+		BinarySnapshotScanner *binaryScanner = new BinarySnapshotScanner(snapshot, length);
+
+		if (binaryScanner == nullptr)
+		{
+			return E_OUTOFMEMORY;
+		}
+
+		HRESULT hr = binaryScanner->Open();
+		if (FAILED(hr))
+		{
+			delete binaryScanner;
+			return hr;
+		}
+
+		*scanner = binaryScanner;
+		return S_OK;
+	}
+
+	*scanner = new JsonSnapshotScanner(snapshot, length);
+	return *scanner == nullptr ? E_OUTOFMEMORY : S_OK;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+//
+// Reads the heap objects in a snapshot, JSON or binary, for the offline tools. Only what
+// they need is decoded: each object's id, size, kind and function name, whether it's a
+// root, and the objects it references along with the name of each reference.
+//
+// Strings are UTF-8, escaped the way the snapshot JSON escapes them, so they can be
+// printed or put in JSON as they are. They point into the snapshot or the scanner, and
+// are only good until the next object is read.
+//
+
+struct ScannedString
+{
+	const char *text;
+	size_t length;
+};
+
+struct ScannedReference
+{
+	ULONGLONG objectId;
+	ScannedString name;
+};
+
+struct ScannedObject
+{
+	ULONGLONG objectId;
+	ULONGLONG size;
+	ScannedString kind;
+	ScannedString functionName;
+	bool isRoot;
+	std::vector<ScannedReference> references;
+};
+
+class SnapshotScanner
+{
+public:
+	virtual ~SnapshotScanner(void) {}
+
+	//
+	// Reads the next object, returning S_FALSE when there are no more. A delta snapshot
+	// doesn't hold the whole heap, so scanning one fails once that's discovered.
+	//
+
+	virtual HRESULT Next(ScannedObject *object) = 0;
+
+	//
+	// Goes back to the first object.
+	//
+
+	virtual HRESULT Rewind(void) = 0;
+};
+
+//
+// Creates a scanner over a snapshot in memory, which must stay there as long as the
+// scanner is in use. The format is worked out from the snapshot's first bytes.
+//
+
+HRESULT CreateSnapshotScanner(const uint8_t *snapshot, size_t length, SnapshotScanner **scanner);
+
+//
+// The error a scanner fails with when given a delta snapshot.
+//
+
+const HRESULT DeltaSnapshotError = HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
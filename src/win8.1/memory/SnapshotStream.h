@@ -0,0 +1,103 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+//
+// Where snapshot output goes. The snapshot writers only ever append, a large chunk at a
+// time, so that's all a stream has to do.
+//
+
+class SnapshotStream
+{
+public:
+	virtual ~SnapshotStream(void) {}
+	virtual HRESULT Write(const void *bytes, ULONG length, ULONG *written) = 0;
+};
+
+//
+// Writes all of the given bytes, however many writes that takes.
+//
+
+HRESULT WriteToStream(SnapshotStream *stream, const void *bytes, size_t length);
+
+//
+// A stream over a new file, replacing any file already there.
+//
+
+class FileStream sealed : public SnapshotStream
+{
+private:
+	HANDLE m_file;
+
+	FileStream(const FileStream &);
+	FileStream &operator=(const FileStream &);
+
+public:
+	FileStream(void);
+	~FileStream(void);
+
+	HRESULT Create(const wchar_t *fileName);
+	HRESULT Write(const void *bytes, ULONG length, ULONG *written);
+
+	//
+	// Overwrites bytes that have already been written. Later writes still go to the end of
+	// the file.
+	//
+
+	HRESULT Patch(ULONGLONG offset, const void *bytes, ULONG length);
+	HRESULT Close(void);
+};
+
+//
+// A stream that appends to a buffer in memory. It must be given a buffer before it's
+// written to.
+//
+
+class MemoryStream sealed : public SnapshotStream
+{
+private:
+	std::vector<uint8_t> *m_buffer;
+
+	MemoryStream(const MemoryStream &);
+	MemoryStream &operator=(const MemoryStream &);
+
+public:
+	MemoryStream(void);
+
+	void SetBuffer(std::vector<uint8_t> *buffer) { m_buffer = buffer; }
+	HRESULT Write(const void *bytes, ULONG length, ULONG *written);
+};
+
+//
+// Makes an empty file in the temporary directory, giving its name.
+//
+
+HRESULT CreateTemporaryFile(std::wstring *fileName);
+
+//
+// A whole file mapped into memory for reading.
+//
+
+class MappedFile sealed
+{
+private:
+	HANDLE m_file;
+	HANDLE m_mapping;
+	const uint8_t *m_data;
+	size_t m_size;
+
+	MappedFile(const MappedFile &);
+	MappedFile &operator=(const MappedFile &);
+
+public:
+	MappedFile(void);
+	~MappedFile(void);
+
+	HRESULT Open(const wchar_t *fileName);
+	void Close(void);
+
+	const uint8_t *Data(void) const { return m_data; }
+	size_t Size(void) const { return m_size; }
+};
@@ -0,0 +1,449 @@
+#include "Transcode.h"
+#include <string.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define TRANSCODE_AVX2
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TRANSCODE_SSE2
+#endif
+
+#define REPLACEMENT_CHARACTER 0xFFFD
+
+//
+// How each ASCII character is written in a JSON string: 0 when it's written as is, 'u'
+// when it's written as \uXXXX, and otherwise the character that follows the backslash.
+// Characters outside ASCII are all written as \uXXXX too. JSON doesn't require that, but
+// it keeps the output ASCII, and some parsers choke on characters like U+FFFF.
+//
+
+static const char jsonEscapes[0x80] =
+{
+	'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'b', 't', 'n', 'u', 'f', 'r', 'u', 'u',
+	'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+	0, 0, '"', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, '/',
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, '\\', 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+};
+
+//
+// Two hex digits for every byte, so a \uXXXX escape takes two lookups.
+//
+
+static const char hexPairs[] =
+	"000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f202122232425262728292a2b2c2d2e2f303132333435363738393a3b3c3d3e3f404142434445464748494a4b4c4d4e4f505152535455565758595a5b5c5d5e5f606162636465666768696a6b6c6d6e6f707172737475767778797a7b7c7d7e7f"
+	"808182838485868788898a8b8c8d8e8f909192939495969798999a9b9c9d9e9fa0a1a2a3a4a5a6a7a8a9aaabacadaeafb0b1b2b3b4b5b6b7b8b9babbbcbdbebfc0c1c2c3c4c5c6c7c8c9cacbcccdcecfd0d1d2d3d4d5d6d7d8d9dadbdcdddedfe0e1e2e3e4e5e6e7e8e9eaebecedeeeff0f1f2f3f4f5f6f7f8f9fafbfcfdfeff";
+
+static inline bool IsContinuation(uint8_t byte)
+{
+	return (byte & 0xC0) == 0x80;
+}
+
+//
+// Widen ASCII bytes to UTF-16 for as long as the input stays ASCII. Returns the number of
+// bytes consumed (and code units written).
+//
+
+static inline size_t WidenAscii(const uint8_t *source, size_t sourceLength, uint16_t *destination)
+{
+	size_t index = 0;
+
+#ifdef TRANSCODE_AVX2
+	while (sourceLength - index >= 32)
+	{
+		__m256i bytes = _mm256_loadu_si256((const __m256i *) (source + index));
+		if (_mm256_movemask_epi8(bytes) != 0)
+		{
+			break;
+		}
+
+		_mm256_storeu_si256((__m256i *) (destination + index), _mm256_cvtepu8_epi16(_mm256_castsi256_si128(bytes)));
+		_mm256_storeu_si256((__m256i *) (destination + index + 16), _mm256_cvtepu8_epi16(_mm256_extracti128_si256(bytes, 1)));
+		index += 32;
+	}
+#endif
+
+#ifdef TRANSCODE_SSE2
+	const __m128i zero = _mm_setzero_si128();
+
+	while (sourceLength - index >= 16)
+	{
+		__m128i bytes = _mm_loadu_si128((const __m128i *) (source + index));
+		if (_mm_movemask_epi8(bytes) != 0)
+		{
+			break;
+		}
+
+		_mm_storeu_si128((__m128i *) (destination + index), _mm_unpacklo_epi8(bytes, zero));
+		_mm_storeu_si128((__m128i *) (destination + index + 8), _mm_unpackhi_epi8(bytes, zero));
+		index += 16;
+	}
+#endif
+
+	while (sourceLength - index >= 8)
+	{
+		uint64_t word;
+		memcpy(&word, source + index, sizeof(word));
+		if ((word & 0x8080808080808080ULL) != 0)
+		{
+			break;
+		}
+
+		for (size_t offset = 0; offset < 8; offset++)
+		{
+			destination[index + offset] = source[index + offset];
+		}
+
+		index += 8;
+	}
+
+	while (index < sourceLength && source[index] < 0x80)
+	{
+		destination[index] = source[index];
+		index++;
+	}
+
+	return index;
+}
+
+//
+// Narrow ASCII code units to UTF-8 for as long as the input stays ASCII. Returns the number
+// of code units consumed (and bytes written).
+//
+
+static inline size_t NarrowAscii(const uint16_t *source, size_t sourceLength, uint8_t *destination)
+{
+	size_t index = 0;
+
+#ifdef TRANSCODE_AVX2
+	const __m256i nonAsciiMask256 = _mm256_set1_epi16((short) 0xFF80);
+
+	while (sourceLength - index >= 32)
+	{
+		__m256i low = _mm256_loadu_si256((const __m256i *) (source + index));
+		__m256i high = _mm256_loadu_si256((const __m256i *) (source + index + 16));
+		if (!_mm256_testz_si256(_mm256_or_si256(low, high), nonAsciiMask256))
+		{
+			break;
+		}
+
+		//
+		// The pack works within 128-bit lanes, so the quadwords have to be put back in order.
+		//
+
+		__m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(low, high), 0xD8);
+		_mm256_storeu_si256((__m256i *) (destination + index), packed);
+		index += 32;
+	}
+#endif
+
+#ifdef TRANSCODE_SSE2
+	const __m128i nonAsciiMask = _mm_set1_epi16((short) 0xFF80);
+	const __m128i zero = _mm_setzero_si128();
+
+	while (sourceLength - index >= 16)
+	{
+		__m128i low = _mm_loadu_si128((const __m128i *) (source + index));
+		__m128i high = _mm_loadu_si128((const __m128i *) (source + index + 8));
+		__m128i nonAscii = _mm_and_si128(_mm_or_si128(low, high), nonAsciiMask);
+		if (_mm_movemask_epi8(_mm_cmpeq_epi16(nonAscii, zero)) != 0xFFFF)
+		{
+			break;
+		}
+
+		_mm_storeu_si128((__m128i *) (destination + index), _mm_packus_epi16(low, high));
+		index += 16;
+	}
+#endif
+
+	while (sourceLength - index >= 4)
+	{
+		uint64_t word;
+		memcpy(&word, source + index, sizeof(word));
+		if ((word & 0xFF80FF80FF80FF80ULL) != 0)
+		{
+			break;
+		}
+
+		destination[index] = (uint8_t) source[index];
+		destination[index + 1] = (uint8_t) source[index + 1];
+		destination[index + 2] = (uint8_t) source[index + 2];
+		destination[index + 3] = (uint8_t) source[index + 3];
+		index += 4;
+	}
+
+	while (index < sourceLength && source[index] < 0x80)
+	{
+		destination[index] = (uint8_t) source[index];
+		index++;
+	}
+
+	return index;
+}
+
+size_t Utf8ToUtf16(const uint8_t *source, size_t sourceLength, uint16_t *destination)
+{
+	const uint8_t *end = source + sourceLength;
+	uint16_t *current = destination;
+
+	while (source < end)
+	{
+		size_t ascii = WidenAscii(source, end - source, current);
+		source += ascii;
+		current += ascii;
+
+		//
+		// Decode non-ASCII characters one at a time until we get back to ASCII. Invalid
+		// sequences are replaced by one U+FFFD for each maximal subpart, as the Unicode
+		// standard recommends.
+		//
+
+		while (source < end && *source >= 0x80)
+		{
+			uint8_t lead = *source;
+			size_t available = end - source;
+
+			if (lead >= 0xC2 && lead <= 0xDF)
+			{
+				if (available >= 2 && IsContinuation(source[1]))
+				{
+					*current++ = (uint16_t) (((lead & 0x1F) << 6) | (source[1] & 0x3F));
+					source += 2;
+				}
+				else
+				{
+					*current++ = REPLACEMENT_CHARACTER;
+					source += 1;
+				}
+			}
+			else if (lead >= 0xE0 && lead <= 0xEF)
+			{
+				uint8_t lower = lead == 0xE0 ? 0xA0 : 0x80;
+				uint8_t upper = lead == 0xED ? 0x9F : 0xBF;
+
+				if (available < 2 || source[1] < lower || source[1] > upper)
+				{
+					*current++ = REPLACEMENT_CHARACTER;
+					source += 1;
+				}
+				else if (available < 3 || !IsContinuation(source[2]))
+				{
+					*current++ = REPLACEMENT_CHARACTER;
+					source += 2;
+				}
+				else
+				{
+					*current++ = (uint16_t) (((lead & 0x0F) << 12) | ((source[1] & 0x3F) << 6) | (source[2] & 0x3F));
+					source += 3;
+				}
+			}
+			else if (lead >= 0xF0 && lead <= 0xF4)
+			{
+				uint8_t lower = lead == 0xF0 ? 0x90 : 0x80;
+				uint8_t upper = lead == 0xF4 ? 0x8F : 0xBF;
+
+				if (available < 2 || source[1] < lower || source[1] > upper)
+				{
+					*current++ = REPLACEMENT_CHARACTER;
+					source += 1;
+				}
+				else if (available < 3 || !IsContinuation(source[2]))
+				{
+					*current++ = REPLACEMENT_CHARACTER;
+					source += 2;
+				}
+				else if (available < 4 || !IsContinuation(source[3]))
+				{
+					*current++ = REPLACEMENT_CHARACTER;
+					source += 3;
+				}
+				else
+				{
+					uint32_t codePoint = ((lead & 0x07) << 18) | ((source[1] & 0x3F) << 12) | ((source[2] & 0x3F) << 6) | (source[3] & 0x3F);
+					codePoint -= 0x10000;
+					*current++ = (uint16_t) (0xD800 | (codePoint >> 10));
+					*current++ = (uint16_t) (0xDC00 | (codePoint & 0x3FF));
+					source += 4;
+				}
+			}
+			else
+			{
+				*current++ = REPLACEMENT_CHARACTER;
+				source += 1;
+			}
+		}
+	}
+
+	return current - destination;
+}
+
+size_t Utf16ToUtf8(const uint16_t *source, size_t sourceLength, uint8_t *destination)
+{
+	const uint16_t *end = source + sourceLength;
+	uint8_t *current = destination;
+
+	while (source < end)
+	{
+		size_t ascii = NarrowAscii(source, end - source, current);
+		source += ascii;
+		current += ascii;
+
+		while (source < end && *source >= 0x80)
+		{
+			uint32_t codePoint = *source++;
+
+			if (codePoint >= 0xD800 && codePoint <= 0xDFFF)
+			{
+				//
+				// Only a high surrogate followed by a low surrogate is valid; anything else
+				// is an unpaired surrogate and gets replaced.
+				//
+
+				if (codePoint <= 0xDBFF && source < end && *source >= 0xDC00 && *source <= 0xDFFF)
+				{
+					codePoint = 0x10000 + ((codePoint - 0xD800) << 10) + (*source++ - 0xDC00);
+				}
+				else
+				{
+					codePoint = REPLACEMENT_CHARACTER;
+				}
+			}
+
+			if (codePoint < 0x800)
+			{
+				*current++ = (uint8_t) (0xC0 | (codePoint >> 6));
+				*current++ = (uint8_t) (0x80 | (codePoint & 0x3F));
+			}
+			else if (codePoint < 0x10000)
+			{
+				*current++ = (uint8_t) (0xE0 | (codePoint >> 12));
+				*current++ = (uint8_t) (0x80 | ((codePoint >> 6) & 0x3F));
+				*current++ = (uint8_t) (0x80 | (codePoint & 0x3F));
+			}
+			else
+			{
+				*current++ = (uint8_t) (0xF0 | (codePoint >> 18));
+				*current++ = (uint8_t) (0x80 | ((codePoint >> 12) & 0x3F));
+				*current++ = (uint8_t) (0x80 | ((codePoint >> 6) & 0x3F));
+				*current++ = (uint8_t) (0x80 | (codePoint & 0x3F));
+			}
+		}
+	}
+
+	return current - destination;
+}
+
+static inline bool IsUnescaped(uint16_t character)
+{
+	return character < 0x80 && jsonEscapes[character] == 0;
+}
+
+//
+// Copy code units that don't need escaping, narrowed to ASCII, for as long as there are
+// any. Returns the number of code units consumed (and bytes written).
+//
+
+static inline size_t CopyUnescaped(const uint16_t *source, size_t sourceLength, uint8_t *destination)
+{
+	size_t index = 0;
+
+#ifdef TRANSCODE_SSE2
+	//
+	// Signed comparisons catch everything from 0x8000 up along with the control characters,
+	// so two comparisons cover everything outside of ASCII.
+	//
+
+	const __m128i space = _mm_set1_epi16(0x20);
+	const __m128i ascii = _mm_set1_epi16(0x7F);
+	const __m128i quote = _mm_set1_epi16('"');
+	const __m128i backslash = _mm_set1_epi16('\\');
+	const __m128i slash = _mm_set1_epi16('/');
+
+	while (sourceLength - index >= 16)
+	{
+		__m128i low = _mm_loadu_si128((const __m128i *) (source + index));
+		__m128i high = _mm_loadu_si128((const __m128i *) (source + index + 8));
+		__m128i escaped = _mm_or_si128(
+			_mm_or_si128(_mm_cmplt_epi16(low, space), _mm_cmpgt_epi16(low, ascii)),
+			_mm_or_si128(_mm_cmplt_epi16(high, space), _mm_cmpgt_epi16(high, ascii)));
+
+		escaped = _mm_or_si128(escaped, _mm_or_si128(_mm_cmpeq_epi16(low, quote), _mm_cmpeq_epi16(high, quote)));
+		escaped = _mm_or_si128(escaped, _mm_or_si128(_mm_cmpeq_epi16(low, backslash), _mm_cmpeq_epi16(high, backslash)));
+		escaped = _mm_or_si128(escaped, _mm_or_si128(_mm_cmpeq_epi16(low, slash), _mm_cmpeq_epi16(high, slash)));
+
+		if (_mm_movemask_epi8(escaped) != 0)
+		{
+			break;
+		}
+
+		_mm_storeu_si128((__m128i *) (destination + index), _mm_packus_epi16(low, high));
+		index += 16;
+	}
+
+	//
+	// Names and short strings are most of what gets escaped, so the rest of a string gets
+	// one more try at eight code units.
+	//
+
+	if (sourceLength - index >= 8)
+	{
+		__m128i units = _mm_loadu_si128((const __m128i *) (source + index));
+		__m128i escaped = _mm_or_si128(_mm_cmplt_epi16(units, space), _mm_cmpgt_epi16(units, ascii));
+
+		escaped = _mm_or_si128(escaped, _mm_cmpeq_epi16(units, quote));
+		escaped = _mm_or_si128(escaped, _mm_cmpeq_epi16(units, backslash));
+		escaped = _mm_or_si128(escaped, _mm_cmpeq_epi16(units, slash));
+
+		if (_mm_movemask_epi8(escaped) == 0)
+		{
+			_mm_storel_epi64((__m128i *) (destination + index), _mm_packus_epi16(units, units));
+			index += 8;
+		}
+	}
+#endif
+
+	while (index < sourceLength && IsUnescaped(source[index]))
+	{
+		destination[index] = (uint8_t) source[index];
+		index++;
+	}
+
+	return index;
+}
+
+size_t EscapeJsonString(const uint16_t *source, size_t sourceLength, uint8_t *destination)
+{
+	const uint16_t *end = source + sourceLength;
+	uint8_t *current = destination;
+
+	while (source < end)
+	{
+		size_t unescaped = CopyUnescaped(source, end - source, current);
+		source += unescaped;
+		current += unescaped;
+
+		while (source < end && !IsUnescaped(*source))
+		{
+			uint16_t character = *source++;
+			char escape = character < 0x80 ? jsonEscapes[character] : 'u';
+
+			*current++ = '\\';
+			*current++ = (uint8_t) escape;
+
+			if (escape == 'u')
+			{
+				memcpy(current, hexPairs + (character >> 8) * 2, 2);
+				memcpy(current + 2, hexPairs + (character & 0xFF) * 2, 2);
+				current += 4;
+			}
+		}
+	}
+
+	return current - destination;
+}
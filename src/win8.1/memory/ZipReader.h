@@ -0,0 +1,54 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "Inflate.h"
+#include "SnapshotStream.h"
+
+//
+// Reads the parts of an OPC package, such as a memory profile, for the offline tools. The
+// package is mapped into memory, and a part is decompressed straight to a stream, so no
+// part is ever held in memory whole. Zip64 packages are read, and each part's CRC is
+// checked as it's extracted.
+//
+
+class ZipReader sealed
+{
+private:
+	struct Entry
+	{
+		std::string name;
+		UINT16 method;
+		UINT32 crc;
+		ULONGLONG compressedSize;
+		ULONGLONG size;
+		ULONGLONG offset;
+	};
+
+	MappedFile m_file;
+	std::vector<Entry> m_entries;
+	Inflater m_inflater;
+	UINT32 m_crcTable[256];
+
+	ZipReader(const ZipReader &);
+	ZipReader &operator=(const ZipReader &);
+
+	HRESULT FindCentralDirectory(ULONGLONG *offset, ULONGLONG *size, ULONGLONG *entryCount) const;
+	HRESULT ReadCentralDirectory(void);
+
+public:
+	ZipReader(void);
+
+	HRESULT Open(const wchar_t *fileName);
+
+	//
+	// Parts are listed in the order they're in the package. Part names are as the package
+	// has them, without the leading slash of the part URI.
+	//
+
+	size_t PartCount(void) const { return m_entries.size(); }
+	const std::string &PartName(size_t index) const { return m_entries[index].name; }
+	ULONGLONG PartSize(size_t index) const { return m_entries[index].size; }
+
+	HRESULT ExtractPart(size_t index, SnapshotStream *output);
+};
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <windows.h>
+
+//
+// Benchmarks of the host's and the memory tools' hot paths, each next to what it replaced
+// or the settings it was chosen from. Only Release builds give meaningful numbers.
+//
+// An operation is timed over a number of iterations, several times over, and the fastest
+// run is the one reported, being the one the rest of the machine disturbed least.
+//
+
+double GetSeconds(void);
+
+template <typename Operation>
+double TimeBest(unsigned runs, unsigned iterations, Operation operation)
+{
+	double best = 0;
+
+	for (unsigned run = 0; run < runs; run++)
+	{
+		double start = GetSeconds();
+
+		for (unsigned iteration = 0; iteration < iterations; iteration++)
+		{
+			operation();
+		}
+
+		double seconds = (GetSeconds() - start) / iterations;
+
+		if (run == 0 || seconds < best)
+		{
+			best = seconds;
+		}
+	}
+
+	return best;
+}
+
+//
+// Prints a result as a row of the benchmark's table.
+//
+
+void Report(const char *benchmark, const char *variant, double value, const char *unit);
+
+//
+// Results are added into this, so the compiler can't drop work whose result is unused.
+//
+
+extern volatile size_t benchmarkSink;
+
+void BenchmarkGcPolicy(void);
+void BenchmarkHeapEnumeration(void);
+void BenchmarkScriptLoad(void);
+void BenchmarkTranscode(void);
@@ -0,0 +1,72 @@
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "Benchmark.h"
+
+struct BenchmarkCase
+{
+	const wchar_t *name;
+	void (*run)(void);
+};
+
+static const BenchmarkCase benchmarks[] =
+{
+	{ L"GcPolicy", BenchmarkGcPolicy },
+	{ L"HeapEnumeration", BenchmarkHeapEnumeration },
+	{ L"ScriptLoad", BenchmarkScriptLoad },
+	{ L"Transcode", BenchmarkTranscode },
+};
+
+volatile size_t benchmarkSink = 0;
+
+double GetSeconds(void)
+{
+	static LARGE_INTEGER frequency = {};
+	LARGE_INTEGER now;
+
+	if (frequency.QuadPart == 0)
+	{
+		QueryPerformanceFrequency(&frequency);
+	}
+
+	QueryPerformanceCounter(&now);
+	return (double) now.QuadPart / frequency.QuadPart;
+}
+
+void Report(const char *benchmark, const char *variant, double value, const char *unit)
+{
+	printf("%-24s %-36s %12.2f %s\n", benchmark, variant, value, unit);
+}
+
+//
+// Runs every benchmark, or just those named on the command line.
+//
+
+int _cdecl wmain(int argc, wchar_t *argv[])
+{
+	int run = 0;
+
+	for (size_t index = 0; index < ARRAYSIZE(benchmarks); index++)
+	{
+		bool selected = argc <= 1;
+
+		for (int arg = 1; arg < argc && !selected; arg++)
+		{
+			selected = _wcsicmp(argv[arg], benchmarks[index].name) == 0;
+		}
+
+		if (selected)
+		{
+			benchmarks[index].run();
+			run++;
+		}
+	}
+
+	if (run == 0)
+	{
+		fwprintf(stderr, L"usage: chakrabenchmarks [benchmark]...\n");
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <string>
+
+//
+// A small harness for the host's and the memory tools' building blocks. Each test is a
+// function returning whether it passed. Check fails the running test with the condition
+// that didn't hold, and where.
+//
+
+#define Check(condition) \
+	{ \
+		if (!(condition)) \
+		{ \
+			fwprintf(stderr, L"%S(%d): check failed: %S\n", __FILE__, __LINE__, #condition); \
+			return false; \
+		} \
+	}
+
+//
+// Data files the tests compare against are in a directory given on the command line, the
+// data directory next to the tests by default.
+//
+
+std::wstring GetDataPath(const wchar_t *fileName);
+bool ReadWholeFile(const wchar_t *fileName, std::string *contents);
+
+bool TestPprofWriterMatchesGolden(void);
+bool TestEscapeJsonStringEveryCodeUnit(void);
+bool TestEscapeJsonStringMatchesReference(void);
+bool TestTranscodeRoundTripsAscii(void);
+bool TestTranscodeRoundTripsEveryCodePoint(void);
+bool TestTranscodeRoundTripsMixedText(void);
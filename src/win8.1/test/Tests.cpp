@@ -0,0 +1,98 @@
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include "Test.h"
+
+using namespace std;
+
+struct TestCase
+{
+	const wchar_t *name;
+	bool (*run)(void);
+};
+
+static const TestCase tests[] =
+{
+	{ L"PprofWriterMatchesGolden", TestPprofWriterMatchesGolden },
+	{ L"EscapeJsonStringEveryCodeUnit", TestEscapeJsonStringEveryCodeUnit },
+	{ L"EscapeJsonStringMatchesReference", TestEscapeJsonStringMatchesReference },
+	{ L"TranscodeRoundTripsAscii", TestTranscodeRoundTripsAscii },
+	{ L"TranscodeRoundTripsEveryCodePoint", TestTranscodeRoundTripsEveryCodePoint },
+	{ L"TranscodeRoundTripsMixedText", TestTranscodeRoundTripsMixedText },
+};
+
+static wstring dataDirectory = L"data";
+
+wstring GetDataPath(const wchar_t *fileName)
+{
+	return dataDirectory + L"\\" + fileName;
+}
+
+bool ReadWholeFile(const wchar_t *fileName, string *contents)
+{
+	HANDLE file = CreateFileW(fileName, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+
+	LARGE_INTEGER size;
+	bool succeeded = GetFileSizeEx(file, &size) && size.HighPart == 0;
+
+	if (succeeded)
+	{
+		DWORD read = 0;
+
+		contents->resize(size.LowPart);
+		succeeded = size.LowPart == 0 || (ReadFile(file, &(*contents)[0], size.LowPart, &read, nullptr) && read == size.LowPart);
+	}
+
+	CloseHandle(file);
+	return succeeded;
+}
+
+//
+// Runs every test, or just those whose names are given after the data directory.
+//
+
+int _cdecl wmain(int argc, wchar_t *argv[])
+{
+	if (argc > 1)
+	{
+		dataDirectory = argv[1];
+	}
+
+	int failed = 0;
+	int run = 0;
+
+	for (size_t index = 0; index < ARRAYSIZE(tests); index++)
+	{
+		bool selected = argc <= 2;
+
+		for (int arg = 2; arg < argc && !selected; arg++)
+		{
+			selected = wcscmp(argv[arg], tests[index].name) == 0;
+		}
+
+		if (!selected)
+		{
+			continue;
+		}
+
+		run++;
+
+		if (tests[index].run())
+		{
+			fwprintf(stdout, L"passed: %s\n", tests[index].name);
+		}
+		else
+		{
+			fwprintf(stdout, L"FAILED: %s\n", tests[index].name);
+			failed++;
+		}
+	}
+
+	fwprintf(stdout, L"%d of %d tests passed.\n", run - failed, run);
+	return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}